@@ -4,7 +4,7 @@ import { Runtime, generateUUID } from "./runtime";
 
 export type EmbeddingModelName = "BAAI/bge-m3";
 
-export type VectorStoreName = "faiss" | "chromadb";
+export type VectorStoreName = "faiss" | "simd" | "chromadb";
 
 interface EmbeddingModelDescription {
   modelId: string;
@@ -37,7 +37,7 @@ export interface VectorStoreRetrieveItem extends VectorStoreInsertItem {
  * The `VectorStore` class provides a high-level abstraction for storing and retrieving documents.
  * It mainly consists of two modules - embedding model and vector store.
  *
- * It supports embedding text using AI and interfacing with pluggable vector store backends such as FAISS or ChromaDB.
+ * It supports embedding text using AI and interfacing with pluggable vector store backends such as FAISS, the built-in SIMD store or ChromaDB.
  * This class handles initialization, insertion, similarity-based retrieval, and cleanup.
  *
  * Typical usage involves:
@@ -102,6 +102,7 @@ export class VectorStore {
     // Initialize vector store
     const vsComponentType = {
       faiss: "faiss_vector_store",
+      simd: "simd_vector_store",
       chromadb: "chromadb_vector_store",
     }[vectorStoreName];
     const result2 = await this.runtime.define(
@@ -135,6 +136,53 @@ export class VectorStore {
     });
   }
 
+  /**
+   * Splits texts into chunks, and embeds and inserts the chunks without
+   * leaving the runtime. Returns ids of the inserted chunks.
+   */
+  async ingest(
+    /** The raw texts to insert */
+    texts: Array<string>,
+    options?: {
+      /** Metadata of each text, which is stored with each of its chunks */
+      metadatas?: Array<Record<string, any> | null>;
+      /** Chunk size to split texts into */
+      chunkSize?: number;
+      /** Overlap size between chunks */
+      chunkOverlap?: number;
+      /** Number of chunks embedded and inserted at once */
+      batchSize?: number;
+    }
+  ): Promise<Array<string>> {
+    let ids: Array<string> = [];
+    for await (const resp of this.runtime.callIter("ingest_documents", {
+      embedding_model: this.componentState.embeddingName,
+      vector_store: this.componentState.vecstoreName,
+      texts: texts,
+      metadatas: options?.metadatas,
+      chunk_size: options?.chunkSize ?? 4000,
+      chunk_overlap: options?.chunkOverlap ?? 200,
+      batch_size: options?.batchSize ?? 32,
+    })) {
+      if (resp.ids) ids = resp.ids;
+    }
+    return ids;
+  }
+
+  /**
+   * Inserts a document under an external key, replacing the document
+   * previously stored under the key (FAISS store only)
+   */
+  async upsert(key: string, item: VectorStoreInsertItem): Promise<void> {
+    const embedding = await this.embedding(item.document);
+    await this.runtime.callMethod(this.componentState.vecstoreName, "upsert", {
+      key: key,
+      embedding: embedding,
+      document: item.document,
+      metadata: item.metadata,
+    });
+  }
+
   /** Retrieves the top-K most similar documents to the given query */
   async retrieve(
     /** The input query string to search for similar content */
@@ -155,6 +203,40 @@ export class VectorStore {
     return resp.results;
   }
 
+  /**
+   * Retrieves the top-K documents by both embedding similarity and BM25
+   * keyword search, fusing the two rankings (FAISS and SIMD stores only)
+   */
+  async hybridRetrieve(
+    /** The input query string to search for similar content */
+    query: string,
+    /** Number of top documents to retrieve */
+    topK: number = 5,
+    options?: {
+      /** "rrf" (reciprocal rank fusion) or "weighted" */
+      fusion?: "rrf" | "weighted";
+      /** Weight of embedding similarities in weighted fusion */
+      vectorWeight?: number;
+    }
+  ): Promise<Array<VectorStoreRetrieveItem>> {
+    const embedding = await this.embedding(query);
+    const inputs: Record<string, any> = {
+      query_embedding: embedding,
+      query_text: query,
+      top_k: topK,
+    };
+    if (options?.fusion !== undefined) inputs["fusion"] = options.fusion;
+    if (options?.vectorWeight !== undefined)
+      inputs["vector_weight"] = options.vectorWeight;
+    const resp: { results: Array<VectorStoreRetrieveItem> } =
+      await this.runtime.callMethod(
+        this.componentState.vecstoreName,
+        "hybrid_retrieve",
+        inputs
+      );
+    return resp.results;
+  }
+
   async clear(): Promise<void> {
     await this.runtime.callMethod(this.componentState.vecstoreName, "clear");
   }
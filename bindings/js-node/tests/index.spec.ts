@@ -262,6 +262,8 @@ describe("JSVM", () => {
         api_key: process.env.OPENAI_API_KEY,
         model: "gpt-4o",
       });
+      let content = "";
+      let finishReason = null;
       for await (const resp of rt.callIterMethod("oai", "infer", {
         messages: [
           {
@@ -271,10 +273,12 @@ describe("JSVM", () => {
           },
         ],
       })) {
-        expect(resp.finish_reason).to.be.equal("stop");
         expect(resp.message.role).to.be.equal("assistant");
-        expect(resp.message.content).to.contain("Joe Biden");
+        content += resp.message.content;
+        finishReason = resp.finish_reason;
       }
+      expect(finishReason).to.be.equal("stop");
+      expect(content).to.contain("Joe Biden");
       await rt.stop();
     });
   }
@@ -281,9 +281,15 @@ class Tool:
         self,
         desc: ToolDescription,
         call_fn: Callable[..., Any],
+        http_request_fn: Optional[Callable[..., dict[str, Any]]] = None,
+        http_response_fn: Optional[Callable[[dict[str, Any]], Any]] = None,
     ):
         self.desc = desc
         self.call = call_fn
+        # Tools calling HTTP APIs may split a call into building the request and
+        # parsing its response, so that calls of several of them are sent at once
+        self.http_request = http_request_fn
+        self.http_response = http_response_fn
 
 
 class ToolAuthenticator(ABC):
@@ -516,22 +522,39 @@ class Agent:
                         prev_resp_type = resp.type
                         yield resp
 
-                    def run_tool(tool_call: ToolCall):
+                    def find_tool(tool_call: ToolCall) -> Tool:
                         tool_ = next(
                             (t for t in self._tools if t.desc.name == tool_call.function.name),
                             None,
                         )
                         if not tool_:
                             raise RuntimeError("Tool not found")
-                        resp = tool_.call(**tool_call.function.arguments)
-                        return ToolCallResultMessage(
+                        return tool_
+
+                    tool_calls = tool_call_message.tool_calls
+                    tools_ = [find_tool(tc) for tc in tool_calls]
+                    outputs: dict[int, Any] = {}
+
+                    # Requests of HTTP tools are sent concurrently, and the rest are run in order
+                    http_indices = [i for i, t in enumerate(tools_) if t.http_request is not None]
+                    if len(http_indices) > 1:
+                        requests = [tools_[i].http_request(**tool_calls[i].function.arguments) for i in http_indices]
+                        for http_resp in self._runtime.call_iter("http_request_many", {"requests": requests}):
+                            i = http_indices[http_resp["index"]]
+                            outputs[i] = tools_[i].http_response(http_resp)
+                    for i, tool_call in enumerate(tool_calls):
+                        if i not in outputs:
+                            outputs[i] = tools_[i].call(**tool_call.function.arguments)
+
+                    tool_call_results = [
+                        ToolCallResultMessage(
                             role="tool",
                             name=tool_call.function.name,
                             tool_call_id=tool_call.id,
-                            content=json.dumps(resp),
+                            content=json.dumps(outputs[i]),
                         )
-
-                    tool_call_results = [run_tool(tc) for tc in tool_call_message.tool_calls]
+                        for i, tool_call in enumerate(tool_calls)
+                    ]
 
                     for result_msg in tool_call_results:
                         self._messages.append(result_msg)
@@ -655,7 +678,7 @@ class Agent:
 
         behavior = tool_def.behavior
 
-        def call(**inputs: dict[str, Any]) -> Any:
+        def build_request(**inputs: dict[str, Any]) -> dict[str, Any]:
             def render_template(template: str, context: dict[str, Any]) -> tuple[str, list[str]]:
                 import re
 
@@ -697,9 +720,9 @@ class Agent:
             if callable(authenticator):
                 request = authenticator(request)
 
-            # Call HTTP request
-            output = None
-            resp = self._runtime.call("http_request", request)
+            return request
+
+        def parse_response(resp: dict[str, Any]) -> Any:
             output = json.loads(resp["body"])
 
             # Parse output path if defined
@@ -708,7 +731,19 @@ class Agent:
 
             return output
 
-        return self.add_tool(Tool(desc=tool_def.description, call_fn=call))
+        def call(**inputs: dict[str, Any]) -> Any:
+            # Call HTTP request
+            resp = self._runtime.call("http_request", build_request(**inputs))
+            return parse_response(resp)
+
+        return self.add_tool(
+            Tool(
+                desc=tool_def.description,
+                call_fn=call,
+                http_request_fn=build_request,
+                http_response_fn=parse_response,
+            )
+        )
 
     def add_tools_from_preset(
         self, preset_name: str, authenticator: Optional[Callable[[dict[str, Any]], dict[str, Any]]] = None
@@ -26,4 +26,6 @@ class BrokerClient:
         status: bool,
         *args,
     ) -> bool: ...
-    def listen() -> Optional[Packet]: ...
+    def listen(self) -> Optional[Packet]: ...
+    def listen_many(self, timeout: float = 1.0) -> list[Packet]: ...
+    def readiness_fd(self) -> int: ...
@@ -1,4 +1,4 @@
-from asyncio import Event, to_thread
+from asyncio import Event, get_running_loop, to_thread
 from collections import defaultdict
 from typing import Any, AsyncGenerator, Generator, Literal, Optional, TypedDict
 
@@ -83,15 +83,17 @@ class RuntimeBase:
             return txid
         raise RuntimeError("Failed to send packet")
 
+    def _store_packet(self, packet: Packet) -> None:
+        txid = packet["headers"][0]
+        if packet["packet_type"] == "respond_execute":
+            idx = packet["headers"][1]
+            self._exec_responses[txid][idx] = packet
+        else:
+            self._responses[txid] = packet
+
     def _sync_listen(self) -> None:
-        packet = self._client.listen()
-        if packet is not None:
-            txid = packet["headers"][0]
-            if packet["packet_type"] == "respond_execute":
-                idx = packet["headers"][1]
-                self._exec_responses[txid][idx] = packet
-            else:
-                self._responses[txid] = packet
+        for packet in self._client.listen_many():
+            self._store_packet(packet)
 
     async def _listen(self) -> None:
         # If listen lock exists -> wait
@@ -100,18 +102,32 @@ class RuntimeBase:
         else:
             # Create a new event
             self._listen_lock = Event()
-            # Listen packet
-            packet = await to_thread(self._client.listen)
-            if packet is not None:
-                txid = packet["headers"][0]
-                if packet["packet_type"] == "respond_execute":
-                    idx = packet["headers"][1]
-                    self._exec_responses[txid][idx] = packet
-                else:
-                    self._responses[txid] = packet
-            # Emit event
-            self._listen_lock.set()
-            self._listen_lock = None
+            try:
+                for packet in await self._wait_packets():
+                    self._store_packet(packet)
+            finally:
+                # Emit event
+                self._listen_lock.set()
+                self._listen_lock = None
+
+    async def _wait_packets(self) -> list[Packet]:
+        # Wait in the event loop for the client to signal packets, or else in a
+        # thread, which does not block the loop as the client releases the GIL
+        fd = self._client.readiness_fd()
+        if fd >= 0:
+            loop = get_running_loop()
+            ready = loop.create_future()
+            try:
+                loop.add_reader(fd, lambda: ready.done() or ready.set_result(None))
+            except NotImplementedError:
+                pass
+            else:
+                try:
+                    await ready
+                finally:
+                    loop.remove_reader(fd)
+                return self._client.listen_many(0)
+        return await to_thread(self._client.listen_many)
 
 
 class Runtime(RuntimeBase):
@@ -28,7 +28,7 @@ class VectorStore:
     The `VectorStore` class provides a high-level abstraction for storing and retrieving documents.
     It mainly consists of two modules - embedding model and vector store.
 
-    It supports embedding text using AI and interfacing with pluggable vector store backends such as FAISS or ChromaDB.
+    It supports embedding text using AI and interfacing with pluggable vector store backends such as FAISS, the built-in SIMD store or ChromaDB.
     This class handles initialization, insertion, similarity-based retrieval, and cleanup.
 
     Typical usage involves:
@@ -43,7 +43,7 @@ class VectorStore:
         self,
         runtime: Runtime,
         embedding_model_name: Literal["BAAI/bge-m3"],
-        vector_store_name: Literal["faiss", "chromadb"],
+        vector_store_name: Literal["faiss", "simd", "chromadb"],
         url: Optional[str] = None,
         collection: Optional[str] = None,
         embedding_model_attrs: Optional[dict[str, Any]] = None,
@@ -56,7 +56,7 @@ class VectorStore:
         :param embedding_model_name: The name of the embedding model to use. Currently it only supports `BAAI/bge-m3`.
         :param url: (ChromaDB only) URL of the database.
         :param collection: (ChromaDB only) The collection name of the database.
-        :param vector_store_name: The name of the vector store provider (One of faiss or chromaDB).
+        :param vector_store_name: The name of the vector store provider (One of faiss, simd or chromaDB).
         :param embedding_model_attrs: Additional initialization parameters (for `define_component` runtime call).
         :param vector_store_attrs: Additional initialization parameters (for `define_component` runtime call).
         """
@@ -87,7 +87,7 @@ class VectorStore:
     def define(
         self,
         embedding_model_name: Literal["BAAI/bge-m3"],
-        vector_store_name: Literal["faiss", "chromadb"],
+        vector_store_name: Literal["faiss", "simd", "chromadb"],
         url: Optional[str] = None,
         collection: Optional[str] = None,
         embedding_model_attrs: Optional[dict[str, Any]] = None,
@@ -119,10 +119,12 @@ class VectorStore:
 
         # Initialize vector store
         vector_store_attrs = vector_store_attrs or {}
-        if vector_store_name == "faiss":
+        if vector_store_name in ("faiss", "simd"):
             if "dimension" not in vector_store_attrs:
                 vector_store_attrs["dimension"] = dimension
-            self._runtime.define("faiss_vector_store", self._component_state.vector_store_name, vector_store_attrs)
+            self._runtime.define(
+                f"{vector_store_name}_vector_store", self._component_state.vector_store_name, vector_store_attrs
+            )
         elif vector_store_name == "chromadb":
             if "url" not in vector_store_attrs:
                 vector_store_attrs["url"] = url
@@ -181,6 +183,60 @@ class VectorStore:
             },
         )
 
+    def ingest(
+        self,
+        texts: List[str],
+        metadatas: Optional[List[Optional[Dict[str, Any]]]] = None,
+        chunk_size: int = 4000,
+        chunk_overlap: int = 200,
+        batch_size: int = 32,
+    ) -> List[str]:
+        """
+        Splits texts into chunks, and embeds and inserts the chunks without leaving the runtime.
+
+        :param texts: The raw texts to insert.
+        :param metadatas: Metadata of each text, which is stored with each of its chunks.
+        :param chunk_size: Chunk size to split texts into.
+        :param chunk_overlap: Overlap size between chunks.
+        :param batch_size: Number of chunks embedded and inserted at once.
+        :returns: Ids of the inserted chunks.
+        """
+        inputs = {
+            "embedding_model": self._component_state.embedding_model_name,
+            "vector_store": self._component_state.vector_store_name,
+            "texts": texts,
+            "chunk_size": chunk_size,
+            "chunk_overlap": chunk_overlap,
+            "batch_size": batch_size,
+        }
+        if metadatas is not None:
+            inputs["metadatas"] = metadatas
+        ids = []
+        for resp in self._runtime.call_iter("ingest_documents", inputs):
+            ids = resp.get("ids", ids)
+        return ids
+
+    def upsert(self, key: str, document: str, metadata: Optional[Dict[str, Any]] = None):
+        """
+        Inserts a document under an external key, replacing the document previously stored under the key.
+        Only FAISS vector stores support it.
+
+        :param key: External key of the document, such as the path of its source file.
+        :param document: The raw text document to insert.
+        :param metadata: Metadata records additional information about the document.
+        """
+        embedding = self.embedding(document)
+        self._runtime.call_method(
+            self._component_state.vector_store_name,
+            "upsert",
+            {
+                "key": key,
+                "embedding": embedding,
+                "document": document,
+                "metadata": metadata,
+            },
+        )
+
     def retrieve(self, query: str, top_k: int = 5) -> List[VectorStoreRetrieveItem]:
         """
         Retrieves the top-K most similar documents to the given query.
@@ -201,6 +257,38 @@ class VectorStore:
         results = TypeAdapter(List[VectorStoreRetrieveItem]).validate_python(resp["results"])
         return results
 
+    def hybrid_retrieve(
+        self,
+        query: str,
+        top_k: int = 5,
+        fusion: Literal["rrf", "weighted"] = "rrf",
+        vector_weight: float = 0.5,
+    ) -> List[VectorStoreRetrieveItem]:
+        """
+        Retrieves the top-K documents by both embedding similarity and BM25 keyword search, fusing the two rankings.
+        Only FAISS and SIMD vector stores support it.
+
+        :param query: The input query string to search for.
+        :param top_k: Number of top documents to retrieve.
+        :param fusion: `rrf` (reciprocal rank fusion) or `weighted` (weighted sum of normalized scores).
+        :param vector_weight: Weight of embedding similarities in weighted fusion.
+        :returns: A list of retrieved items.
+        """
+        embedding = self.embedding(query)
+        resp = self._runtime.call_method(
+            self._component_state.vector_store_name,
+            "hybrid_retrieve",
+            {
+                "query_embedding": embedding,
+                "query_text": query,
+                "top_k": top_k,
+                "fusion": fusion,
+                "vector_weight": vector_weight,
+            },
+        )
+        results = TypeAdapter(List[VectorStoreRetrieveItem]).validate_python(resp["results"])
+        return results
+
     def clean(self):
         """
         Removes all entries from the vector store.
@@ -13,6 +13,7 @@
 #include "vm.hpp"
 
 #include "py_value_converters.hpp"
+#include "readiness_fd.hpp"
 
 static std::optional<std::thread> broker_thread;
 static std::optional<std::thread> vm_thread;
@@ -52,6 +53,61 @@ std::string instruction_type_to_string(const ailoy::instruction_type &itype) {
     throw ailoy::exception("invalid instruction type");
 }
 
+std::shared_ptr<ailoy::value_t>
+packet_to_value(std::shared_ptr<ailoy::packet_t> packet) {
+  auto ret = ailoy::create<ailoy::map_t>();
+  ret->insert_or_assign(
+      "packet_type",
+      ailoy::create<ailoy::string_t>(packet_type_to_string(packet->ptype)));
+
+  if (packet->itype.has_value()) {
+    ret->insert_or_assign(
+        "instruction_type",
+        ailoy::create<ailoy::string_t>(
+            instruction_type_to_string(packet->itype.value())));
+  } else {
+    ret->insert_or_assign("instruction_type", ailoy::create<ailoy::null_t>());
+  }
+  ret->insert_or_assign("headers", packet->headers);
+  ret->insert_or_assign("body", packet->body);
+  return ret;
+}
+
+/**
+ * @brief Broker client of Python, which also signals arriving packets through
+ * a file descriptor that asyncio can wait on
+ */
+class py_broker_client_t : public ailoy::broker_client_t {
+public:
+  py_broker_client_t(const std::string &url)
+      : ailoy::broker_client_t(url),
+        readiness_(std::make_shared<readiness_fd_t>()) {
+    set_on_recv([readiness = readiness_]() { readiness->set(); });
+  }
+
+  int readiness_fd() const { return readiness_->fileno(); }
+
+  /**
+   * @brief Wait up to `timeout` for a packet, then take every packet arrived
+   * @details The readiness descriptor is cleared first, so that it is set
+   * again by any packet not taken here.
+   */
+  std::vector<std::shared_ptr<ailoy::packet_t>>
+  listen_many(ailoy::duration_t timeout) {
+    readiness_->clear();
+    std::vector<std::shared_ptr<ailoy::packet_t>> packets;
+    auto packet = listen(timeout);
+    while (packet) {
+      packets.push_back(packet);
+      packet = listen(ailoy::now());
+    }
+    return packets;
+  }
+
+private:
+  std::shared_ptr<readiness_fd_t> readiness_;
+};
+
 void start_threads(const std::string &url) {
   broker_thread = std::thread{[&]() { ailoy::broker_start(url); }};
   std::shared_ptr<const ailoy::module_t> mods[] = {ailoy::get_default_module(),
@@ -79,11 +135,11 @@ PYBIND11_MODULE(ailoy_py, m) {
   m.def("stop_threads", &stop_threads);
   m.def("generate_uuid", &generate_uuid);
 
-  py::class_<ailoy::broker_client_t, std::shared_ptr<ailoy::broker_client_t>>(
+  py::class_<py_broker_client_t, std::shared_ptr<py_broker_client_t>>(
       m, "BrokerClient")
       .def(py::init<const std::string &>())
       .def("send_type1",
-           [](std::shared_ptr<ailoy::broker_client_t> self,
+           [](std::shared_ptr<py_broker_client_t> self,
               py::args args) -> bool {
              if (args.size() != 2) {
                throw std::runtime_error("Expected 2 arguments");
@@ -96,7 +152,7 @@ PYBIND11_MODULE(ailoy_py, m) {
                return self->send<ailoy::packet_type::disconnect>(txid);
            })
       .def("send_type2",
-           [](std::shared_ptr<ailoy::broker_client_t> self,
+           [](std::shared_ptr<py_broker_client_t> self,
               py::args args) -> bool {
              std::string txid = py::cast<std::string>(args[0]);
              std::string ptype = py::cast<std::string>(args[1]);
@@ -171,7 +227,7 @@ PYBIND11_MODULE(ailoy_py, m) {
              }
            })
       .def("send_type3",
-           [](std::shared_ptr<ailoy::broker_client_t> self,
+           [](std::shared_ptr<py_broker_client_t> self,
               py::args args) -> bool {
              auto txid = py::cast<std::string>(args[0]);
              auto ptype = py::cast<std::string>(args[1]);
@@ -190,28 +246,34 @@ PYBIND11_MODULE(ailoy_py, m) {
              return false;
            })
       .def("listen",
-           [](std::shared_ptr<ailoy::broker_client_t> self)
+           [](std::shared_ptr<py_broker_client_t> self)
                -> std::shared_ptr<ailoy::value_t> {
-             auto resp = self->listen(ailoy::timeout_default);
-             if (resp == nullptr)
-               return ailoy::create<ailoy::null_t>();
-
-             auto ret = ailoy::create<ailoy::map_t>();
-             ret->insert_or_assign("packet_type",
-                                   ailoy::create<ailoy::string_t>(
-                                       packet_type_to_string(resp->ptype)));
-
-             if (resp->itype.has_value()) {
-               ret->insert_or_assign(
-                   "instruction_type",
-                   ailoy::create<ailoy::string_t>(
-                       instruction_type_to_string(resp->itype.value())));
-             } else {
-               ret->insert_or_assign("instruction_type",
-                                     ailoy::create<ailoy::null_t>());
+             std::shared_ptr<ailoy::packet_t> packet;
+             {
+               // other Python threads run while waiting
+               py::gil_scoped_release release;
+               packet = self->listen(ailoy::timeout_default);
              }
-             ret->insert_or_assign("headers", resp->headers);
-             ret->insert_or_assign("body", resp->body);
-             return ret;
-           });
+             if (packet == nullptr)
+               return ailoy::create<ailoy::null_t>();
+             return packet_to_value(packet);
+           })
+      .def(
+          "listen_many",
+          [](std::shared_ptr<py_broker_client_t> self,
+             double timeout) -> std::shared_ptr<ailoy::value_t> {
+            std::vector<std::shared_ptr<ailoy::packet_t>> packets;
+            {
+              py::gil_scoped_release release;
+              packets = self->listen_many(
+                  std::chrono::duration_cast<ailoy::duration_t>(
+                      std::chrono::duration<double>(timeout)));
+            }
+            auto ret = ailoy::create<ailoy::array_t>();
+            for (const auto &packet : packets)
+              ret->push_back(packet_to_value(packet));
+            return ret;
+          },
+          py::arg("timeout") = 1.0)
+      .def("readiness_fd", &py_broker_client_t::readiness_fd);
 }
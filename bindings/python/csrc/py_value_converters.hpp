@@ -34,9 +34,29 @@ public:
       value = ailoy::create<ailoy::bytes_t>(src.cast<std::string>());
       return true;
     } else if (isinstance<py::list>(src)) {
+      auto list = reinterpret_borrow<py::list>(src);
       auto arr = ailoy::create<ailoy::array_t>();
-      for (auto item : src.cast<py::list>())
+      arr->reserve(list.size());
+      for (auto item : list) {
+        // numbers are converted in place rather than through py::cast, which
+        // looks up this caster again for each of them
+        PyObject *obj = item.ptr();
+        if (PyFloat_CheckExact(obj)) {
+          arr->push_back(
+              ailoy::create<ailoy::double_t>(PyFloat_AS_DOUBLE(obj)));
+          continue;
+        }
+        if (PyLong_CheckExact(obj)) {
+          int overflow;
+          long long v = PyLong_AsLongLongAndOverflow(obj, &overflow);
+          if (overflow == 0 && !(v == -1 && PyErr_Occurred())) {
+            arr->push_back(ailoy::create<ailoy::int_t>(v));
+            continue;
+          }
+          PyErr_Clear();
+        }
         arr->push_back(py::cast<std::shared_ptr<ailoy::value_t>>(item));
+      }
       value = arr;
       return true;
     } else if (isinstance<py::dict>(src)) {
@@ -48,34 +68,27 @@ public:
       value = map;
       return true;
     } else if (py::isinstance<py::array>(src)) {
-      py::array arr = py::cast<py::array>(src);
-      py::buffer_info info = arr.request();
+      // copied only if not C-contiguous, e.g. a transposed or sliced view
+      auto arr = py::array::ensure(src, py::array::c_style);
+      if (!arr)
+        return false;
       auto ndarray = ailoy::create<ailoy::ndarray_t>();
-      ndarray->shape.assign(info.shape.begin(), info.shape.end());
-      if (info.format == py::format_descriptor<int8_t>::format())
-        ndarray->dtype = {kDLInt, 8, 1};
-      else if (info.format == py::format_descriptor<int16_t>::format())
-        ndarray->dtype = {kDLInt, 16, 1};
-      else if (info.format == py::format_descriptor<int32_t>::format())
-        ndarray->dtype = {kDLInt, 32, 1};
-      else if (info.format == py::format_descriptor<int64_t>::format())
-        ndarray->dtype = {kDLInt, 64, 1};
-      else if (info.format == py::format_descriptor<uint8_t>::format())
-        ndarray->dtype = {kDLUInt, 8, 1};
-      else if (info.format == py::format_descriptor<uint16_t>::format())
-        ndarray->dtype = {kDLUInt, 16, 1};
-      else if (info.format == py::format_descriptor<uint32_t>::format())
-        ndarray->dtype = {kDLUInt, 32, 1};
-      else if (info.format == py::format_descriptor<uint64_t>::format())
-        ndarray->dtype = {kDLUInt, 64, 1};
-      else if (info.format == py::format_descriptor<float>::format())
-        ndarray->dtype = {kDLFloat, 32, 1};
-      else if (info.format == py::format_descriptor<double>::format())
-        ndarray->dtype = {kDLFloat, 64, 1};
+      ndarray->shape.assign(arr.shape(), arr.shape() + arr.ndim());
+      // by kind and size, since the format of a dtype varies by platform,
+      // e.g. "l" or "q" for int64
+      char kind = arr.dtype().kind();
+      auto bits = static_cast<uint8_t>(arr.itemsize() * 8);
+      if (kind == 'i' && (bits == 8 || bits == 16 || bits == 32 || bits == 64))
+        ndarray->dtype = {kDLInt, bits, 1};
+      else if (kind == 'u' &&
+               (bits == 8 || bits == 16 || bits == 32 || bits == 64))
+        ndarray->dtype = {kDLUInt, bits, 1};
+      else if (kind == 'f' && (bits == 32 || bits == 64))
+        ndarray->dtype = {kDLFloat, bits, 1};
       else
         throw ailoy::exception("Unsupported numpy dtype for ndarray_t");
-      ndarray->data.resize(info.size * info.itemsize);
-      std::memcpy(ndarray->data.data(), info.ptr, info.size * info.itemsize);
+      auto begin = static_cast<const uint8_t *>(arr.data());
+      ndarray->data.assign(begin, begin + arr.nbytes());
       value = ndarray;
       return true;
     } else {
@@ -84,8 +97,8 @@ public:
   }
 
   // C++ → Python
-  static handle cast(std::shared_ptr<ailoy::value_t> val, return_value_policy,
-                     handle) {
+  static handle cast(std::shared_ptr<ailoy::value_t> val,
+                     return_value_policy policy, handle parent) {
     if (val->is_type_of<ailoy::null_t>()) {
       return py::none().release();
     } else if (val->is_type_of<ailoy::bool_t>()) {
@@ -105,9 +118,10 @@ public:
       return py::bytes(reinterpret_cast<const char *>(b.data()), b.size())
           .release();
     } else if (val->is_type_of<ailoy::array_t>()) {
-      py::list rv;
-      for (auto &item : *val->as<ailoy::array_t>())
-        rv.append(py::cast(item));
+      const auto &items = *val->as<ailoy::array_t>();
+      py::list rv(items.size());
+      for (size_t i = 0; i < items.size(); i++)
+        PyList_SET_ITEM(rv.ptr(), i, cast(items[i], policy, parent).ptr());
       return rv.release();
     } else if (val->is_type_of<ailoy::map_t>()) {
       py::dict rv;
@@ -176,14 +190,12 @@ public:
         strides[i] = stride;
         stride *= shape[i];
       }
-      return py::array(
-                 py::buffer_info(static_cast<void *>(arr->data.data()), // ptr
-                                 arr->itemsize(), // itemsize
-                                 format,          // format
-                                 shape.size(),    // ndim
-                                 shape,           // shape
-                                 strides          // strides
-                                 ))
+      // a view of the data, which the base keeps alive
+      using owner_t = std::shared_ptr<ailoy::ndarray_t>;
+      py::capsule base(new owner_t(arr),
+                       [](void *p) { delete static_cast<owner_t *>(p); });
+      return py::array(py::dtype(format), shape, strides, arr->data.data(),
+                       base)
           .release();
     } else {
       return py::none().release();
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief File descriptor which is readable while set, for an event loop to
+ * wait on
+ * @details An eventfd on Linux, and a pipe on the other POSIX systems.
+ * Windows has no such descriptor that asyncio can wait on, so `fileno()` is -1
+ * there.
+ */
+class readiness_fd_t {
+public:
+  readiness_fd_t() {
+#if defined(__linux__)
+    read_fd_ = write_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(_WIN32)
+    int fds[2];
+    if (pipe(fds) == 0) {
+      for (int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+      }
+      read_fd_ = fds[0];
+      write_fd_ = fds[1];
+    }
+#endif
+  }
+
+  readiness_fd_t(const readiness_fd_t &) = delete;
+
+  readiness_fd_t &operator=(const readiness_fd_t &) = delete;
+
+  ~readiness_fd_t() {
+#if !defined(_WIN32)
+    if (read_fd_ >= 0)
+      close(read_fd_);
+    if (write_fd_ >= 0 && write_fd_ != read_fd_)
+      close(write_fd_);
+#endif
+  }
+
+  int fileno() const { return read_fd_; }
+
+  /**
+   * @brief Make the descriptor readable, from any thread
+   */
+  void set() {
+#if defined(__linux__)
+    uint64_t one = 1;
+    [[maybe_unused]] auto n = write(write_fd_, &one, sizeof(one));
+#elif !defined(_WIN32)
+    // a full pipe is readable already
+    char one = 1;
+    [[maybe_unused]] auto n = write(write_fd_, &one, sizeof(one));
+#endif
+  }
+
+  /**
+   * @brief Make the descriptor unreadable until it is set again
+   */
+  void clear() {
+#if defined(__linux__)
+    uint64_t count;
+    [[maybe_unused]] auto n = read(read_fd_, &count, sizeof(count));
+#elif !defined(_WIN32)
+    char buf[64];
+    while (read(read_fd_, buf, sizeof(buf)) > 0)
+      ;
+#endif
+  }
+
+private:
+  int read_fd_ = -1;
+
+  int write_fd_ = -1;
+};
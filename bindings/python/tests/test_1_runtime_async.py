@@ -1,3 +1,4 @@
+import asyncio
 import time
 
 import pytest
@@ -29,6 +30,13 @@ async def test_async_spell(runtime: AsyncRuntime):
         i += 1
 
 
+async def test_async_concurrent_calls(runtime: AsyncRuntime):
+    # packets of all calls are taken by whichever call listens
+    texts = [f"hello {i}" for i in range(8)]
+    resps = await asyncio.gather(*(runtime.call("echo", {"text": text}) for text in texts))
+    assert [resp["text"] for resp in resps] == texts
+
+
 async def test_async_infer_language_model(runtime: AsyncRuntime):
     await runtime.define("tvm_language_model", "lm0", {"model": "Qwen/Qwen3-0.6B"})
     input = {"messages": [{"role": "user", "content": "Who are you?"}]}
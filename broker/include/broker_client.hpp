@@ -118,6 +118,16 @@ public:
    */
   std::shared_ptr<packet_t> listen(duration_t due, bool skip_body = false);
 
+  /**
+   * @brief Calls `f` whenever a packet arrives
+   * @details This lets an event loop wait for packets along with its other
+   * events, and then take them with `listen` without blocking. `f` is called
+   * on the sending thread, so it should be quick.
+   */
+  void set_on_recv(std::function<void()> f) {
+    monitor_->set_on_signal(std::move(f));
+  }
+
 private:
   std::shared_ptr<inproc::socket_t> socket_;
 
@@ -31,6 +31,7 @@
 #include <chrono>
 #include <condition_variable>
 #include <deque>
+#include <functional>
 #include <shared_mutex>
 
 #include "exception.hpp"
@@ -124,6 +125,15 @@ public:
     return monitor(now() + due);
   }
 
+  /**
+   * @brief Calls `f` whenever a signal is queued
+   * @details This lets a thread wait for signals along with other events,
+   * e.g. in an event loop, instead of blocking in `monitor()`. `f` is called
+   * by the notifying thread while the queue is locked, so it should be quick
+   * and must not use this monitor.
+   */
+  void set_on_signal(std::function<void()> f);
+
 private:
   friend class notify_t;
 
@@ -132,6 +142,8 @@ private:
   std::unique_ptr<condition_variable_t> cv_;
 
   std::deque<signal_t> q_;
+
+  std::function<void()> on_signal_;
 };
 
 /**
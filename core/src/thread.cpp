@@ -14,6 +14,11 @@ std::optional<signal_t> monitor_t::monitor(const time_point_t &due) {
     return std::nullopt;
 }
 
+void monitor_t::set_on_signal(std::function<void()> f) {
+  wlock_t lk{*m_};
+  on_signal_ = std::move(f);
+}
+
 size_t notify_t::next_id = 0;
 
 void notify_t::notify(const std::string &what) {
@@ -24,6 +29,8 @@ void notify_t::notify(const std::string &what) {
   wlock_t lk{*monitor->m_, std::defer_lock};
   lk.lock();
   monitor->q_.push_back(signal_t(myname, what));
+  if (monitor->on_signal_)
+    monitor->on_signal_();
   lk.unlock();
   monitor->cv_->notify_all();
 }
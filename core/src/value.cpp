@@ -64,8 +64,8 @@ nlohmann::json ndarray_t::to_nlohmann_json() const {
   // Write data
   std::copy(data.begin(), data.end(), it);
 
-  // Return nlohmann::json obj
-  return nlohmann::json::binary(rv, 1801);
+  // Return nlohmann::json obj, which takes the vector over without a copy
+  return nlohmann::json::binary(std::move(rv), 1801);
 }
 
 std::shared_ptr<ndarray_t>
@@ -88,11 +88,11 @@ ndarray_t::from_nlohmann_json(const nlohmann::json::binary_t &j) {
   it += sizeof(DLDataType);
 
   // Parse ndatalen
-  rv->data.resize(reinterpret_cast<const uint64_t &>(*it));
+  size_t ndatalen = reinterpret_cast<const uint64_t &>(*it);
   it += sizeof(uint64_t);
 
   // Parse data
-  std::copy(it, it + rv->data.size(), rv->data.data());
+  rv->data.assign(it, it + ndatalen);
 
   return rv;
 }
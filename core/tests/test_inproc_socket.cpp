@@ -1,3 +1,4 @@
+#include <atomic>
 #include <thread>
 
 #include <gtest/gtest.h>
@@ -103,6 +104,23 @@ TEST(AiloyInprocSocketTest, SimpleSendReceive) {
   ASSERT_EQ(r2->operator std::string(), "World hello");
 }
 
+TEST(AiloyInprocSocketTest, MonitorOnSignal) {
+  auto [socket1, socket2] = connect("inproc://MonitorOnSignal");
+  auto monitor = ailoy::create<ailoy::monitor_t>();
+  socket2->set_monitor(monitor);
+  std::atomic<int> num_signals = 0;
+  monitor->set_on_signal([&]() { num_signals++; });
+
+  ASSERT_TRUE(socket1->send(ailoy::create<ailoy::bytes_t>("Hello")));
+  ASSERT_TRUE(socket1->send(ailoy::create<ailoy::bytes_t>("World")));
+  ASSERT_EQ(num_signals, 2);
+
+  // the signals are still queued for `monitor()`
+  ASSERT_TRUE(monitor->monitor(0s).has_value());
+  ASSERT_TRUE(monitor->monitor(0s).has_value());
+  ASSERT_FALSE(monitor->monitor(0s).has_value());
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
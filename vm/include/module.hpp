@@ -99,6 +99,13 @@ using value_or_error_t = std::variant<std::shared_ptr<value_t>, error_output_t>;
 using component_or_error_t =
     std::variant<std::shared_ptr<component_t>, error_output_t>;
 
+/**
+ * @brief Function that finds a component defined in the VM by its name
+ * @return The component, or nullptr if there is no such component
+ */
+using component_lookup_t =
+    std::function<std::shared_ptr<component_t>(const std::string &)>;
+
 /**
  * @brief Abstract base class for VM-running function object
  */
@@ -106,6 +113,15 @@ class operator_t : public object_t {
 public:
   operator_t() : in_(nullptr) {}
 
+  /**
+   * @brief Let the operator use components of the VM running it
+   * @details VM sets it before `initialize()`, so that an operator can
+   * combine several components in a single call.
+   */
+  void set_component_lookup(component_lookup_t lookup) {
+    lookup_ = std::move(lookup);
+  }
+
   virtual std::optional<error_output_t>
   initialize(std::shared_ptr<const value_t> in = nullptr) {
     in_ = in;
@@ -121,8 +137,14 @@ public:
 
   virtual output_t step() = 0;
 
+protected:
+  std::shared_ptr<component_t> find_component(const std::string &name) const {
+    return lookup_ ? lookup_(name) : nullptr;
+  }
+
 private:
   std::shared_ptr<const value_t> in_;
+  component_lookup_t lookup_;
 };
 
 /**
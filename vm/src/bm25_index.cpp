@@ -0,0 +1,341 @@
+#include "bm25_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <climits>
+
+namespace ailoy {
+
+constexpr float bm25_k1 = 1.2f;
+constexpr float bm25_b = 0.75f;
+constexpr size_t bm25_block_size = 128;
+
+static void write_varint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+static uint64_t read_varint(const std::string &in, size_t &pos) {
+  uint64_t value = 0;
+  for (int shift = 0;; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(in[pos++]);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+}
+
+std::vector<std::string> bm25_index_t::tokenize(std::string_view text) {
+  std::vector<std::string> terms;
+  std::string term;
+  bool non_ascii = false;
+  auto flush = [&]() {
+    if (!term.empty())
+      terms.push_back(std::move(term));
+    term.clear();
+  };
+  for (unsigned char c : text) {
+    if (c >= 0x80) {
+      if (!non_ascii)
+        flush();
+      non_ascii = true;
+      term.push_back(static_cast<char>(c));
+    } else if (std::isalnum(c)) {
+      if (non_ascii)
+        flush();
+      non_ascii = false;
+      term.push_back(static_cast<char>(std::tolower(c)));
+    } else
+      flush();
+  }
+  flush();
+  return terms;
+}
+
+bm25_index_t::document_t bm25_index_t::analyze(std::string_view text) {
+  document_t document;
+  for (auto &term : tokenize(text)) {
+    document.terms[std::move(term)]++;
+    document.length++;
+  }
+  return document;
+}
+
+void bm25_index_t::insert(int64_t id, const document_t &document) {
+  for (const auto &[term, tf] : document.terms)
+    add_posting(postings_[term], id, tf);
+  lengths_[id] = document.length;
+  total_length_ += document.length;
+}
+
+void bm25_index_t::erase(int64_t id, const document_t &document) {
+  auto length = lengths_.find(id);
+  if (length == lengths_.end())
+    return;
+  total_length_ -= length->second;
+  lengths_.erase(length);
+  for (const auto &[term, _] : document.terms) {
+    auto postings = postings_.find(term);
+    if (postings == postings_.end())
+      continue;
+    remove_posting(postings->second, id);
+    if (postings->second.count == 0)
+      postings_.erase(postings);
+  }
+}
+
+void bm25_index_t::clear() {
+  postings_.clear();
+  lengths_.clear();
+  total_length_ = 0;
+}
+
+void bm25_index_t::add_posting(postings_t &postings, int64_t id, uint32_t tf) {
+  postings.max_tf = std::max(postings.max_tf, tf);
+  auto &blocks = postings.blocks;
+
+  // ids mostly arrive in increasing order, so they are appended
+  if (blocks.empty() || id > blocks.back().last_id) {
+    if (blocks.empty() || blocks.back().count >= bm25_block_size)
+      blocks.push_back(block_t{.first_id = id, .last_id = id});
+    auto &block = blocks.back();
+    write_varint(block.data, id - block.last_id);
+    write_varint(block.data, tf);
+    block.last_id = id;
+    block.count++;
+    postings.count++;
+    return;
+  }
+
+  // otherwise the block covering the id is rewritten
+  auto block = std::lower_bound(
+      blocks.begin(), blocks.end(), id,
+      [](const block_t &b, int64_t id) { return b.last_id < id; });
+  auto entries = decode_block(*block);
+  auto entry = std::lower_bound(
+      entries.begin(), entries.end(), std::pair<int64_t, uint32_t>{id, 0});
+  if (entry != entries.end() && entry->first == id)
+    entry->second = tf;
+  else {
+    entries.insert(entry, {id, tf});
+    postings.count++;
+  }
+  *block = encode_block(entries);
+}
+
+void bm25_index_t::remove_posting(postings_t &postings, int64_t id) {
+  auto &blocks = postings.blocks;
+  auto block = std::lower_bound(
+      blocks.begin(), blocks.end(), id,
+      [](const block_t &b, int64_t id) { return b.last_id < id; });
+  if (block == blocks.end() || block->first_id > id)
+    return;
+  auto entries = decode_block(*block);
+  auto entry = std::lower_bound(
+      entries.begin(), entries.end(), std::pair<int64_t, uint32_t>{id, 0});
+  if (entry == entries.end() || entry->first != id)
+    return;
+  entries.erase(entry);
+  postings.count--;
+  if (entries.empty())
+    blocks.erase(block);
+  else
+    *block = encode_block(entries);
+}
+
+std::vector<std::pair<int64_t, uint32_t>>
+bm25_index_t::decode_block(const block_t &block) {
+  std::vector<std::pair<int64_t, uint32_t>> entries(block.count);
+  size_t pos = 0;
+  int64_t id = block.first_id;
+  for (auto &[entry_id, tf] : entries) {
+    id += read_varint(block.data, pos);
+    entry_id = id;
+    tf = read_varint(block.data, pos);
+  }
+  return entries;
+}
+
+bm25_index_t::block_t bm25_index_t::encode_block(
+    const std::vector<std::pair<int64_t, uint32_t>> &entries) {
+  block_t block{.first_id = entries.front().first,
+                .last_id = entries.front().first};
+  for (auto [id, tf] : entries) {
+    write_varint(block.data, id - block.last_id);
+    write_varint(block.data, tf);
+    block.last_id = id;
+    block.count++;
+  }
+  return block;
+}
+
+/**
+ * Iterates postings in id order, decoding a block only when it is entered
+ */
+class bm25_index_t::cursor_t {
+public:
+  cursor_t(const postings_t &postings) : postings_(postings) { load_block(); }
+
+  bool done() const { return block_ >= postings_.blocks.size(); }
+
+  int64_t id() const { return entries_[pos_].first; }
+
+  uint32_t tf() const { return entries_[pos_].second; }
+
+  void next() {
+    if (++pos_ >= entries_.size()) {
+      block_++;
+      load_block();
+    }
+  }
+
+  /**
+   * Move to the first posting whose id is not less than `target`
+   */
+  void advance(int64_t target) {
+    if (done() || id() >= target)
+      return;
+    if (postings_.blocks[block_].last_id < target) {
+      // skip whole blocks by their last id
+      while (block_ < postings_.blocks.size() &&
+             postings_.blocks[block_].last_id < target)
+        block_++;
+      load_block();
+    }
+    while (!done() && id() < target)
+      next();
+  }
+
+private:
+  void load_block() {
+    pos_ = 0;
+    entries_.clear();
+    if (!done())
+      entries_ = decode_block(postings_.blocks[block_]);
+  }
+
+  const postings_t &postings_;
+  size_t block_ = 0;
+  std::vector<std::pair<int64_t, uint32_t>> entries_;
+  size_t pos_ = 0;
+};
+
+std::vector<std::pair<int64_t, float>>
+bm25_index_t::search(std::string_view query, size_t top_k,
+                     const std::vector<int64_t> *selected) const {
+  if (top_k == 0 || lengths_.empty())
+    return {};
+
+  double num_documents = lengths_.size();
+  float avg_length = static_cast<float>(total_length_ / num_documents);
+
+  struct term_t {
+    const postings_t *postings;
+    float idf;
+    float upper_bound;
+  };
+  std::vector<term_t> terms;
+  for (const auto &[term, _] : analyze(query).terms) {
+    auto postings = postings_.find(term);
+    if (postings == postings_.end())
+      continue;
+    double df = postings->second.count;
+    float idf = std::log(1.0 + (num_documents - df + 0.5) / (df + 0.5));
+    // the score of a term is the largest for an empty document
+    float max_tf = postings->second.max_tf;
+    float upper_bound =
+        idf * max_tf * (bm25_k1 + 1) / (max_tf + bm25_k1 * (1 - bm25_b));
+    terms.push_back({&postings->second, idf, upper_bound});
+  }
+  if (terms.empty())
+    return {};
+
+  // terms in ascending order of upper bound, with cumulative upper bounds
+  std::sort(terms.begin(), terms.end(), [](const auto &a, const auto &b) {
+    return a.upper_bound < b.upper_bound;
+  });
+  std::vector<float> cumulative_bounds(terms.size());
+  std::vector<cursor_t> cursors;
+  for (size_t i = 0; i < terms.size(); i++) {
+    cumulative_bounds[i] =
+        terms[i].upper_bound + (i > 0 ? cumulative_bounds[i - 1] : 0.0f);
+    cursors.emplace_back(*terms[i].postings);
+  }
+
+  auto term_score = [&](size_t i, uint32_t tf, uint32_t length) {
+    float norm = bm25_k1 * (1 - bm25_b + bm25_b * length / avg_length);
+    return terms[i].idf * tf * (bm25_k1 + 1) / (tf + norm);
+  };
+
+  using candidate_t = std::pair<float, int64_t>;
+  auto greater = [](const candidate_t &a, const candidate_t &b) {
+    return a.first > b.first;
+  };
+  std::vector<candidate_t> heap;
+  float threshold = 0.0f;
+  // terms before `first_essential` cannot make a document enter the top-k
+  // by themselves
+  size_t first_essential = 0;
+
+  while (true) {
+    while (first_essential < terms.size() &&
+           cumulative_bounds[first_essential] <= threshold)
+      first_essential++;
+    if (first_essential == terms.size())
+      break;
+
+    int64_t id = INT64_MAX;
+    for (size_t i = first_essential; i < terms.size(); i++) {
+      if (!cursors[i].done())
+        id = std::min(id, cursors[i].id());
+    }
+    if (id == INT64_MAX)
+      break;
+
+    bool is_selected =
+        !selected || std::binary_search(selected->begin(), selected->end(), id);
+    uint32_t length = lengths_.at(id);
+    float score = 0.0f;
+    for (size_t i = first_essential; i < terms.size(); i++) {
+      if (!cursors[i].done() && cursors[i].id() == id) {
+        score += term_score(i, cursors[i].tf(), length);
+        cursors[i].next();
+      }
+    }
+    if (!is_selected)
+      continue;
+
+    // add non-essential terms while they can still make a difference
+    for (size_t i = first_essential; i-- > 0;) {
+      if (heap.size() == top_k && score + cumulative_bounds[i] <= threshold)
+        break;
+      cursors[i].advance(id);
+      if (!cursors[i].done() && cursors[i].id() == id)
+        score += term_score(i, cursors[i].tf(), length);
+    }
+
+    if (heap.size() < top_k) {
+      heap.emplace_back(score, id);
+      std::push_heap(heap.begin(), heap.end(), greater);
+    } else if (score > threshold) {
+      std::pop_heap(heap.begin(), heap.end(), greater);
+      heap.back() = {score, id};
+      std::push_heap(heap.begin(), heap.end(), greater);
+    }
+    if (heap.size() == top_k)
+      threshold = heap.front().first;
+  }
+
+  // sorting a min-heap leaves it in descending order
+  std::sort_heap(heap.begin(), heap.end(), greater);
+  std::vector<std::pair<int64_t, float>> results;
+  for (auto [score, id] : heap)
+    results.emplace_back(id, score);
+  return results;
+}
+
+} // namespace ailoy
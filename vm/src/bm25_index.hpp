@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ailoy {
+
+/**
+ * @brief In-memory BM25 inverted index over documents
+ * @details Postings of each term are sorted by id and split into blocks of
+ * varint-encoded id deltas and term frequencies. Each block keeps its id
+ * range, so cursors skip blocks without decoding them. Top-k queries are
+ * evaluated with MaxScore, which stops scoring terms whose upper bound
+ * cannot lift a document into the current top-k.
+ *
+ * Const member functions may be called concurrently, while the others need
+ * exclusive access.
+ */
+class bm25_index_t {
+public:
+  /**
+   * @brief Terms of a document with their frequencies
+   */
+  struct document_t {
+    std::unordered_map<std::string, uint32_t> terms;
+    uint32_t length = 0;
+  };
+
+  /**
+   * @brief Split text into lowercase terms
+   * @details Terms are runs of ASCII letters and digits, or of non-ASCII
+   * characters, so that words of other scripts are kept as a whole.
+   */
+  static std::vector<std::string> tokenize(std::string_view text);
+
+  static document_t analyze(std::string_view text);
+
+  void insert(int64_t id, const document_t &document);
+
+  /**
+   * @param document Terms the document was inserted with
+   */
+  void erase(int64_t id, const document_t &document);
+
+  void clear();
+
+  size_t size() const { return lengths_.size(); }
+
+  /**
+   * @brief Find the top-k documents by BM25 score
+   * @param selected If given, only these ids (sorted) are scored
+   * @return Pairs of id and score, in descending order of score
+   */
+  std::vector<std::pair<int64_t, float>>
+  search(std::string_view query, size_t top_k,
+         const std::vector<int64_t> *selected = nullptr) const;
+
+private:
+  struct block_t {
+    int64_t first_id;
+    int64_t last_id;
+    uint32_t count = 0;
+    std::string data;
+  };
+
+  struct postings_t {
+    std::vector<block_t> blocks;
+    uint64_t count = 0;
+    // Never decreases on erase, so it stays an upper bound
+    uint32_t max_tf = 0;
+  };
+
+  class cursor_t;
+
+  static void add_posting(postings_t &postings, int64_t id, uint32_t tf);
+
+  static void remove_posting(postings_t &postings, int64_t id);
+
+  static std::vector<std::pair<int64_t, uint32_t>>
+  decode_block(const block_t &block);
+
+  static block_t
+  encode_block(const std::vector<std::pair<int64_t, uint32_t>> &entries);
+
+  std::unordered_map<std::string, postings_t> postings_;
+  std::unordered_map<int64_t, uint32_t> lengths_;
+  uint64_t total_length_ = 0;
+};
+
+} // namespace ailoy
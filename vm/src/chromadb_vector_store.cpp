@@ -1,6 +1,16 @@
 #include "chromadb_vector_store.hpp"
 
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <format>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
 
 #include "exception.hpp"
 #include "uuid.hpp"
@@ -16,25 +26,153 @@ const std::string COLLECTIONS_BASE_URL =
     std::format("/api/v2/tenants/{}/databases/{}/collections", DEFAULT_TENANT,
                 DEFAULT_DATABASE);
 
+static const httplib::Response &check_result(const httplib::Result &result,
+                                             int status,
+                                             const std::string &message) {
+  if (!result)
+    throw ailoy::runtime_error("[Chromadb] Failed to request: " +
+                               httplib::to_string(result.error()));
+  if (result->status != status)
+    throw ailoy::runtime_error(
+        "[Chromadb] " + message + ": " +
+        std::string(httplib::status_message(result->status)));
+  return *result;
+}
+
+/**
+ * Appends floats as a JSON array in their shortest round-trip form, which is
+ * much faster than building a `nlohmann::json` array of them
+ */
+static void append_floats(std::string &out, const float *data, size_t size) {
+  char buf[32];
+  out.push_back('[');
+  for (size_t i = 0; i < size; i++) {
+    if (i > 0)
+      out.push_back(',');
+    // JSON has no representation of NaN and infinities
+    if (!std::isfinite(data[i])) {
+      out += "null";
+      continue;
+    }
+    auto [end, _] = std::to_chars(buf, buf + sizeof(buf), data[i]);
+    out.append(buf, end);
+  }
+  out.push_back(']');
+}
+
+/**
+ * Builds the body of an add request column by column
+ */
+class add_body_builder_t {
+public:
+  // Size of the body without items
+  static constexpr size_t envelope_size =
+      std::string_view(
+          R"({"ids":[],"embeddings":[],"documents":[],"metadatas":[]})")
+          .size();
+
+  size_t count() const { return count_; }
+
+  size_t size() const {
+    return envelope_size + ids_.size() + embeddings_.size() +
+           documents_.size() + metadatas_.size();
+  }
+
+  /**
+   * Whether appending the item would exceed the batch limits
+   */
+  bool would_overflow(const std::string &id,
+                      const vector_store_add_input_t &input,
+                      const chromadb_vector_store_config_t &config) {
+    if (count_ == 0)
+      return false;
+    if (count_ >= config.max_batch_size)
+      return true;
+    serialize(id, input);
+    return size() + item_size() > config.max_batch_bytes;
+  }
+
+  void append(const std::string &id, const vector_store_add_input_t &input) {
+    if (serialized_id_ != &id)
+      serialize(id, input);
+    serialized_id_ = nullptr;
+    if (count_ > 0) {
+      ids_.push_back(',');
+      embeddings_.push_back(',');
+      documents_.push_back(',');
+      metadatas_.push_back(',');
+    }
+    ids_ += item_id_;
+    embeddings_ += item_embedding_;
+    documents_ += item_document_;
+    metadatas_ += item_metadata_;
+    count_++;
+  }
+
+  std::string build() {
+    std::string body = std::format(
+        R"({{"ids":[{}],"embeddings":[{}],"documents":[{}],"metadatas":[{}]}})",
+        ids_, embeddings_, documents_, metadatas_);
+    ids_.clear();
+    embeddings_.clear();
+    documents_.clear();
+    metadatas_.clear();
+    count_ = 0;
+    return body;
+  }
+
+private:
+  void serialize(const std::string &id, const vector_store_add_input_t &input) {
+    item_id_ = nlohmann::json(id).dump();
+    auto embedding = input.embedding->operator std::vector<float>();
+    item_embedding_.clear();
+    append_floats(item_embedding_, embedding.data(), embedding.size());
+    item_document_ = nlohmann::json(input.document).dump();
+    item_metadata_ = input.metadata.value_or(nlohmann::json::object()).dump();
+    serialized_id_ = &id;
+  }
+
+  size_t item_size() const {
+    return item_id_.size() + item_embedding_.size() + item_document_.size() +
+           item_metadata_.size() + 4;
+  }
+
+  std::string ids_, embeddings_, documents_, metadatas_;
+  size_t count_ = 0;
+
+  // The last serialized item, kept between `would_overflow` and `append`
+  const std::string *serialized_id_ = nullptr;
+  std::string item_id_, item_embedding_, item_document_, item_metadata_;
+};
+
 chromadb_vector_store_t::chromadb_vector_store_t(
     const std::string &url, const std::string &collection,
     bool delete_collection_on_cleanup)
-    : cli_(std::make_shared<httplib::Client>(url)),
-      collection_name_(collection),
-      delete_collection_on_cleanup_(delete_collection_on_cleanup) {
+    : chromadb_vector_store_t(chromadb_vector_store_config_t{
+          .url = url,
+          .collection = collection,
+          .delete_collection_on_cleanup = delete_collection_on_cleanup}) {}
+
+chromadb_vector_store_t::chromadb_vector_store_t(
+    const chromadb_vector_store_config_t &config)
+    : config_(config) {
+  if (config_.max_connections == 0)
+    throw ailoy::runtime_error(
+        "[Chromadb] max_connections should be greater than 0");
+  if (config_.max_batch_size == 0)
+    throw ailoy::runtime_error(
+        "[Chromadb] max_batch_size should be greater than 0");
   _create_collection();
 }
 
 void chromadb_vector_store_t::_create_collection() {
   nlohmann::json params;
-  params["name"] = collection_name_;
+  params["name"] = config_.collection;
   // use cosine similarity as default
   params["configuration"] =
       nlohmann::json{{"hnsw", nlohmann::json{{"space", "cosine"}}}};
 
-  std::string body = params.dump();
-  httplib::Result create_result = cli_->Post(COLLECTIONS_BASE_URL, body.data(),
-                                             body.size(), "application/json");
+  httplib::Result create_result = post(COLLECTIONS_BASE_URL, params.dump());
 
   // Request has been failed
   if (!create_result)
@@ -44,21 +182,21 @@ void chromadb_vector_store_t::_create_collection() {
   // Created the collection successfully
   if (create_result->status == httplib::OK_200) {
     auto j = nlohmann::json::parse(create_result->body);
-    collection_id_ = j["id"];
+    set_collection_id(j["id"]);
     return;
   }
 
   // The collection is already created. Get existing collection's id.
   if (create_result->status == httplib::Conflict_409) {
-    httplib::Result get_result =
-        cli_->Get(std::format("{}/{}", COLLECTIONS_BASE_URL, collection_name_));
-    if (get_result->status != httplib::OK_200) {
-      throw ailoy::runtime_error(
-          "[Chromadb] Failed to get existing collection: " +
-          std::string(httplib::status_message(get_result->status)));
-    }
-    auto j = nlohmann::json::parse(get_result->body);
-    collection_id_ = j["id"];
+    httplib::Result get_result = send([&](httplib::Client &cli) {
+      return cli.Get(
+          std::format("{}/{}", COLLECTIONS_BASE_URL, config_.collection));
+    });
+    auto j = nlohmann::json::parse(
+        check_result(get_result, httplib::OK_200,
+                     "Failed to get existing collection")
+            .body);
+    set_collection_id(j["id"]);
     return;
   }
 
@@ -68,29 +206,26 @@ void chromadb_vector_store_t::_create_collection() {
 }
 
 void chromadb_vector_store_t::_delete_collection() {
-  httplib::Result result = cli_->Delete(
-      std::format("{}/{}", COLLECTIONS_BASE_URL, collection_name_));
-  if (result->status != httplib::OK_200) {
-    throw ailoy::runtime_error(
-        "[Chromadb] Failed to delete collection: " +
-        std::string(httplib::status_message(result->status)));
-  }
+  httplib::Result result = send([&](httplib::Client &cli) {
+    return cli.Delete(
+        std::format("{}/{}", COLLECTIONS_BASE_URL, config_.collection));
+  });
+  check_result(result, httplib::OK_200, "Failed to delete collection");
 }
 
-chromadb_vector_store_t::chromadb_vector_store_t(
-    std::shared_ptr<const value_t> attrs) {
+static chromadb_vector_store_config_t
+parse_chromadb_attrs(std::shared_ptr<const value_t> attrs) {
   if (!attrs->is_type_of<map_t>()) {
     throw ailoy::runtime_error("[Chromadb] component attrs should be map type");
   }
   auto attrs_map = attrs->as<map_t>();
-  std::string url = CHROMADB_DEFAULT_URL;
-  std::string collection = CHROMADB_DEFAULT_COLLECTION;
+  chromadb_vector_store_config_t config;
   if (attrs_map->contains("url")) {
     auto attr_url = attrs_map->at("url");
     if (!attr_url->is_type_of<string_t>()) {
       throw ailoy::runtime_error("[Chromadb] url should be a type of string");
     }
-    url = *attr_url->as<string_t>();
+    config.url = *attr_url->as<string_t>();
   }
   if (attrs_map->contains("collection")) {
     auto attr_collection = attrs_map->at("collection");
@@ -98,79 +233,198 @@ chromadb_vector_store_t::chromadb_vector_store_t(
       throw ailoy::runtime_error(
           "[Chromadb] collection should be a type of string");
     }
-    collection = *attr_collection->as<string_t>();
+    config.collection = *attr_collection->as<string_t>();
   }
-  cli_ = std::make_shared<httplib::Client>(url);
-  collection_name_ = collection;
-  delete_collection_on_cleanup_ = false;
-  _create_collection();
+  for (auto [key, field] :
+       {std::pair{"max_connections", &config.max_connections},
+        std::pair{"max_batch_size", &config.max_batch_size},
+        std::pair{"max_batch_bytes", &config.max_batch_bytes}}) {
+    if (!attrs_map->contains(key))
+      continue;
+    auto attr = attrs_map->at(key);
+    if (attr->is_type_of<uint_t>())
+      *field = *attr->as<uint_t>();
+    else if (attr->is_type_of<int_t>())
+      *field = *attr->as<int_t>();
+    else
+      throw ailoy::runtime_error(std::format(
+          "[Chromadb] {} should be a type of unsigned integer", key));
+  }
+  return config;
 }
 
+chromadb_vector_store_t::chromadb_vector_store_t(
+    std::shared_ptr<const value_t> attrs)
+    : chromadb_vector_store_t(parse_chromadb_attrs(attrs)) {}
+
 chromadb_vector_store_t::~chromadb_vector_store_t() {
-  if (delete_collection_on_cleanup_)
+  if (config_.delete_collection_on_cleanup)
     _delete_collection();
 }
 
-std::string
-chromadb_vector_store_t::add_vector(const vector_store_add_input_t &input) {
-  std::string id = generate_uuid();
-
-  nlohmann::json params;
-  params["ids"] = std::vector<std::string>{id};
-  params["embeddings"] = std::vector<std::vector<float>>{
-      input.embedding->operator std::vector<float>()};
-  params["documents"] = std::vector<std::string>{input.document};
-  params["metadatas"] = nlohmann::json::array();
-  if (input.metadata.has_value())
-    params["metadatas"].push_back(input.metadata.value());
-  else {
-    // metadata is null
-    params["metadatas"].push_back(nlohmann::json({}));
-  }
+httplib::Result chromadb_vector_store_t::send(
+    const std::function<httplib::Result(httplib::Client &)> &request) {
+  auto client = http_client_pool_t::global().acquire(config_.url);
+  httplib::Result result = request(*client);
+  if (!result)
+    client.discard();
+  return result;
+}
 
-  std::string body = params.dump();
-  httplib::Result result =
-      cli_->Post(std::format("{}/{}/add", COLLECTIONS_BASE_URL, collection_id_),
-                 body.data(), body.size(), "application/json");
-  if (result->status != httplib::Created_201) {
-    throw ailoy::runtime_error(
-        "[Chromadb] Failed to add vector to collection: " +
-        std::string(httplib::status_message(result->status)));
-  }
+httplib::Result chromadb_vector_store_t::post(const std::string &path,
+                                              const std::string &body) {
+  return send([&](httplib::Client &cli) {
+    return cli.Post(path, body, "application/json");
+  });
+}
 
-  return id;
+std::string
+chromadb_vector_store_t::add_vector(const vector_store_add_input_t &input) {
+  std::vector<std::string> ids{generate_uuid()};
+  add({&input, 1}, ids);
+  return ids[0];
 }
 
 std::vector<std::string> chromadb_vector_store_t::add_vectors(
     std::vector<vector_store_add_input_t> &inputs) {
-  nlohmann::json params;
-  params["ids"] = nlohmann::json::array();
-  params["embeddings"] = nlohmann::json::array();
-  params["documents"] = nlohmann::json::array();
-  params["metadatas"] = nlohmann::json::array();
-
-  for (const auto &input : inputs) {
-    params["ids"].push_back(generate_uuid());
-    params["embeddings"].push_back(
-        input.embedding->operator std::vector<float>());
-    params["documents"].push_back(input.document);
-    if (input.metadata.has_value())
-      params["metadatas"].push_back(input.metadata.value());
-    else
-      params["metadatas"].push_back(nlohmann::json({}));
+  std::vector<std::string> ids(inputs.size());
+  for (auto &id : ids)
+    id = generate_uuid();
+  add(inputs, ids);
+  return ids;
+}
+
+void chromadb_vector_store_t::add(
+    std::span<const vector_store_add_input_t> inputs,
+    const std::vector<std::string> &ids) {
+  const std::string path = collection_path("/add");
+
+  struct batch_t {
+    size_t begin;
+    size_t end;
+    std::string body;
+  };
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<batch_t> queue;
+  bool done = false;
+  // The first failure, which is thrown as ailoy::runtime_error once the
+  // workers are joined
+  std::optional<std::string> error;
+  std::vector<batch_t> added;
+
+  auto fail = [&](const std::string &reason) {
+    {
+      std::lock_guard lock(mutex);
+      if (!error)
+        error = reason;
+    }
+    cv.notify_all();
+  };
+
+  auto send_batch = [&](batch_t batch) {
+    try {
+      check_result(post(path, batch.body), httplib::Created_201,
+                   "Failed to add vectors to collection");
+      batch.body.clear();
+      std::lock_guard lock(mutex);
+      added.push_back(std::move(batch));
+    } catch (const ailoy::runtime_error &e) {
+      fail(e.what());
+    } catch (const std::exception &e) {
+      fail(std::string("[Chromadb] Failed to add vectors to collection: ") +
+           e.what());
+    }
+  };
+
+  auto worker = [&]() {
+    while (true) {
+      batch_t batch;
+      {
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [&]() { return !queue.empty() || done || error; });
+        if (error || queue.empty())
+          return;
+        batch = std::move(queue.front());
+        queue.pop_front();
+      }
+      // wake the producer waiting for room in the queue
+      cv.notify_all();
+      send_batch(std::move(batch));
+    }
+  };
+
+  // Batches are serialized here and sent by workers, which are started as
+  // batches come, up to the number of connections
+  std::vector<std::thread> workers;
+  auto submit = [&](batch_t batch) {
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [&]() {
+      return queue.size() < config_.max_connections || error;
+    });
+    if (error)
+      return false;
+    queue.push_back(std::move(batch));
+    lock.unlock();
+    cv.notify_all();
+    if (workers.size() < config_.max_connections)
+      workers.emplace_back(worker);
+    return true;
+  };
+
+  // Failures of the producer, such as starting a thread, must not leave the
+  // workers unjoined
+  try {
+    add_body_builder_t builder;
+    size_t begin = 0;
+    bool submitted = true;
+    for (size_t i = 0; i < inputs.size() && submitted; i++) {
+      if (builder.would_overflow(ids[i], inputs[i], config_)) {
+        submitted = submit({begin, i, builder.build()});
+        begin = i;
+      }
+      builder.append(ids[i], inputs[i]);
+    }
+    if (submitted && builder.count() > 0) {
+      // a single batch is sent without starting a worker
+      if (workers.empty())
+        send_batch({begin, inputs.size(), builder.build()});
+      else
+        submit({begin, inputs.size(), builder.build()});
+    }
+  } catch (const ailoy::runtime_error &e) {
+    fail(e.what());
+  } catch (const std::exception &e) {
+    fail(std::string("[Chromadb] Failed to add vectors to collection: ") +
+         e.what());
   }
 
-  std::string body = params.dump();
-  httplib::Result result =
-      cli_->Post(std::format("{}/{}/add", COLLECTIONS_BASE_URL, collection_id_),
-                 body.data(), body.size(), "application/json");
-  if (result->status != httplib::Created_201) {
-    throw ailoy::runtime_error(
-        "[Chromadb] Failed to add vectors to collection: " +
-        std::string(httplib::status_message(result->status)));
+  {
+    std::lock_guard lock(mutex);
+    done = true;
   }
+  cv.notify_all();
+  for (auto &worker : workers)
+    worker.join();
+
+  if (!error)
+    return;
 
-  return params["ids"].get<std::vector<std::string>>();
+  // Roll back the batches that were added, so that the insertion fails as a
+  // whole. This is best-effort, as the server may be unreachable.
+  if (!added.empty()) {
+    nlohmann::json params;
+    params["ids"] = nlohmann::json::array();
+    for (const auto &batch : added) {
+      for (size_t i = batch.begin; i < batch.end; i++)
+        params["ids"].push_back(ids[i]);
+    }
+    try {
+      post(collection_path("/delete"), params.dump());
+    } catch (...) {
+    }
+  }
+  throw ailoy::runtime_error(error.value());
 }
 
 std::optional<vector_store_get_result_t>
@@ -180,15 +434,14 @@ chromadb_vector_store_t::get_by_id(const std::string &id) {
   params["include"] =
       std::vector<std::string>{"embeddings", "documents", "metadatas"};
 
-  std::string body = params.dump();
-  httplib::Result result =
-      cli_->Post(std::format("{}/{}/get", COLLECTIONS_BASE_URL, collection_id_),
-                 body.data(), body.size(), "application/json");
-  if (result->status != httplib::OK_200) {
+  httplib::Result result = post(collection_path("/get"), params.dump());
+  if (!result || result->status != httplib::OK_200) {
     return std::nullopt;
   }
 
   auto j = nlohmann::json::parse(result->body);
+  if (j["ids"].empty())
+    return std::nullopt;
   auto document = j["documents"][0].get<std::string>();
   auto metadata = j["metadatas"][0];
   auto embedding = j["embeddings"][0].get<std::vector<float>>();
@@ -209,35 +462,65 @@ chromadb_vector_store_t::get_by_id(const std::string &id) {
 }
 
 std::vector<vector_store_retrieve_result_t>
-chromadb_vector_store_t::retrieve(embedding_t query_embedding, uint64_t top_k) {
-  nlohmann::json params;
-  params["query_embeddings"] = std::vector<std::vector<float>>{
-      query_embedding->operator std::vector<float>()};
-  params["include"] =
-      std::vector<std::string>{"documents", "metadatas", "distances"};
-  params["n_results"] = top_k;
-
-  std::string body = params.dump();
-  httplib::Result result = cli_->Post(
-      std::format("{}/{}/query", COLLECTIONS_BASE_URL, collection_id_),
-      body.data(), body.size(), "application/json");
-  if (result->status != httplib::OK_200) {
-    throw ailoy::runtime_error(
-        "[Chromadb] Failed to get query results: " +
-        std::string(httplib::status_message(result->status)));
-  }
+chromadb_vector_store_t::retrieve(
+    embedding_t query_embedding, uint64_t top_k,
+    const vector_store_retrieve_params_t &retrieve_params) {
+  return std::move(query(query_embedding->operator std::vector<float>(), 1,
+                         top_k, retrieve_params)[0]);
+}
+
+std::vector<std::vector<vector_store_retrieve_result_t>>
+chromadb_vector_store_t::retrieve_many(
+    embedding_t query_embeddings, uint64_t top_k,
+    const vector_store_retrieve_params_t &retrieve_params) {
+  if (query_embeddings->shape.size() != 2)
+    throw ailoy::runtime_error("[Chromadb] invalid query embeddings shape: " +
+                               query_embeddings->shape_str());
+
+  return query(query_embeddings->operator std::vector<float>(),
+               query_embeddings->shape[0], top_k, retrieve_params);
+}
 
-  std::vector<vector_store_retrieve_result_t> results;
+std::vector<std::vector<vector_store_retrieve_result_t>>
+chromadb_vector_store_t::query(
+    const std::vector<float> &query_embeddings, size_t num_queries,
+    uint64_t top_k, const vector_store_retrieve_params_t &retrieve_params) {
+  // HNSW search parameters of chromadb are fixed per collection, so only the
+  // filter is used here.
+  size_t dimension =
+      num_queries > 0 ? query_embeddings.size() / num_queries : 0;
+  std::string body = R"({"query_embeddings":[)";
+  for (size_t q = 0; q < num_queries; q++) {
+    if (q > 0)
+      body.push_back(',');
+    append_floats(body, query_embeddings.data() + q * dimension, dimension);
+  }
+  body += std::format(
+      R"(],"include":["documents","metadatas","distances"],"n_results":{})",
+      top_k);
+  if (retrieve_params.filter.has_value())
+    body += R"(,"where":)" +
+            to_chromadb_where(retrieve_params.filter.value()).dump();
+  body.push_back('}');
+
+  httplib::Result result = post(collection_path("/query"), body);
+  check_result(result, httplib::OK_200, "Failed to get query results");
+
+  // chromadb returns results of each query in the same order
   auto res_body = nlohmann::json::parse(result->body);
-  auto ids = res_body["ids"][0].get<std::vector<std::string>>();
-  auto documents = res_body["documents"][0].get<std::vector<std::string>>();
-  auto metadatas = res_body["metadatas"][0];
-  auto distances = res_body["distances"][0].get<std::vector<float>>();
-  for (int i = 0; i < ids.size(); i++) {
-    results.push_back({.id = ids[i],
-                       .document = documents[i],
-                       .metadata = metadatas[i],
-                       .similarity = 1 - distances[i]});
+  std::vector<std::vector<vector_store_retrieve_result_t>> results(
+      num_queries);
+  for (size_t q = 0; q < num_queries; q++) {
+    auto ids = res_body["ids"][q].get<std::vector<std::string>>();
+    auto documents = res_body["documents"][q].get<std::vector<std::string>>();
+    auto metadatas = res_body["metadatas"][q];
+    auto distances = res_body["distances"][q].get<std::vector<float>>();
+    for (int i = 0; i < ids.size(); i++) {
+      results[q].push_back({.id = ids[i],
+                            .document = documents[i],
+                            .metadata = metadatas[i],
+                            .similarity = 1 - distances[i]});
+    }
   }
   return results;
 }
@@ -246,20 +529,25 @@ void chromadb_vector_store_t::remove_vector(const std::string &id) {
   nlohmann::json params;
   params["ids"] = std::vector<std::string>{id};
 
-  std::string body = params.dump();
-  httplib::Result result = cli_->Post(
-      std::format("{}/{}/delete", COLLECTIONS_BASE_URL, collection_id_),
-      body.data(), body.size(), "application/json");
-  if (result->status != httplib::OK_200) {
-    throw ailoy::runtime_error(
-        "[Chromadb] Failed to delete embedding: " +
-        std::string(httplib::status_message(result->status)));
-  }
+  httplib::Result result = post(collection_path("/delete"), params.dump());
+  check_result(result, httplib::OK_200, "Failed to delete embedding");
 }
+
+std::string
+chromadb_vector_store_t::collection_path(const std::string &suffix) {
+  std::shared_lock lock(collection_id_mutex_);
+  return std::format("{}/{}{}", COLLECTIONS_BASE_URL, collection_id_, suffix);
+}
+
+void chromadb_vector_store_t::set_collection_id(const std::string &id) {
+  std::unique_lock lock(collection_id_mutex_);
+  collection_id_ = id;
+}
+
 void chromadb_vector_store_t::clear() {
   // delete and recreate collection
   _delete_collection();
   _create_collection();
 }
 
-} // namespace ailoy
\ No newline at end of file
+} // namespace ailoy
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <functional>
+#include <shared_mutex>
+#include <span>
+
 #include <httplib.h>
 
+#include "http_client_pool.hpp"
 #include "vector_store.hpp"
 
 namespace ailoy {
@@ -9,12 +14,32 @@ namespace ailoy {
 const std::string CHROMADB_DEFAULT_URL = "http://localhost:8000";
 const std::string CHROMADB_DEFAULT_COLLECTION = "default_collection";
 
+struct chromadb_vector_store_config_t {
+  std::string url = CHROMADB_DEFAULT_URL;
+  std::string collection = CHROMADB_DEFAULT_COLLECTION;
+  bool delete_collection_on_cleanup = false;
+  // Number of insert batches in flight, each over its own connection
+  size_t max_connections = 4;
+  // Inserts are split into batches of at most `max_batch_size` items and
+  // `max_batch_bytes` bytes of request body. A single item larger than
+  // `max_batch_bytes` is sent alone.
+  size_t max_batch_size = 1000;
+  size_t max_batch_bytes = 4 * 1024 * 1024;
+};
+
+/**
+ * @brief Vector store backed by a ChromaDB server
+ * @details Requests are sent over keep-alive connections of the pool shared
+ * by the process, so every member function may be called from multiple
+ * threads.
+ */
 class chromadb_vector_store_t : public vector_store_t {
 public:
   chromadb_vector_store_t(
       const std::string &url = CHROMADB_DEFAULT_URL,
       const std::string &collection = CHROMADB_DEFAULT_COLLECTION,
       bool delete_collection_on_cleanup = false);
+  chromadb_vector_store_t(const chromadb_vector_store_config_t &config);
   chromadb_vector_store_t(std::shared_ptr<const value_t> attrs);
   ~chromadb_vector_store_t();
 
@@ -24,6 +49,11 @@ public:
 
   std::string add_vector(const vector_store_add_input_t &input) override;
 
+  /**
+   * @details Batches are serialized while earlier ones are in flight, and
+   * sent in parallel over pooled connections. If any batch fails, the
+   * batches already added are deleted again before the error is thrown.
+   */
   std::vector<std::string>
   add_vectors(std::vector<vector_store_add_input_t> &inputs) override;
 
@@ -31,17 +61,44 @@ public:
   get_by_id(const std::string &id) override;
 
   std::vector<vector_store_retrieve_result_t>
-  retrieve(embedding_t query_embedding, uint64_t top_k) override;
+  retrieve(embedding_t query_embedding, uint64_t top_k,
+           const vector_store_retrieve_params_t &params = {}) override;
+
+  std::vector<std::vector<vector_store_retrieve_result_t>>
+  retrieve_many(embedding_t query_embeddings, uint64_t top_k,
+                const vector_store_retrieve_params_t &params = {}) override;
 
   void remove_vector(const std::string &id) override;
 
   void clear() override;
 
 private:
-  std::shared_ptr<httplib::Client> cli_;
+  void add(std::span<const vector_store_add_input_t> inputs,
+           const std::vector<std::string> &ids);
+
+  std::vector<std::vector<vector_store_retrieve_result_t>>
+  query(const std::vector<float> &query_embeddings, size_t num_queries,
+        uint64_t top_k, const vector_store_retrieve_params_t &retrieve_params);
+
+  /**
+   * @brief Run a request on a pooled connection
+   */
+  httplib::Result
+  send(const std::function<httplib::Result(httplib::Client &)> &request);
+
+  httplib::Result post(const std::string &path, const std::string &body);
+
+  /**
+   * @brief Path of the collection, followed by `suffix`
+   */
+  std::string collection_path(const std::string &suffix);
+
+  void set_collection_id(const std::string &id);
+
+  chromadb_vector_store_config_t config_;
+  // Replaced by `clear` while other requests may be building their paths
+  std::shared_mutex collection_id_mutex_;
   std::string collection_id_;
-  std::string collection_name_;
-  bool delete_collection_on_cleanup_;
 };
 
-} // namespace ailoy
\ No newline at end of file
+} // namespace ailoy
@@ -1,6 +1,7 @@
 #include "module.hpp"
 
 #include "calculator.hpp"
+#include "http_cache.hpp"
 #include "http_request.hpp"
 
 namespace ailoy {
@@ -14,7 +15,19 @@ std::shared_ptr<const module_t> get_default_module() {
   // Add Operator HTTP Request
   if (default_ops.find("http_request") == default_ops.end()) {
     default_ops.insert_or_assign("http_request",
-                                 create<instant_operator_t>(http_request_op));
+                                 create_http_request_operator());
+  }
+
+  // Add Operator HTTP Request Many
+  if (!default_ops.contains("http_request_many")) {
+    default_ops.insert_or_assign("http_request_many",
+                                 create_http_request_many_operator());
+  }
+
+  // Add Operator HTTP Cache Stats
+  if (!default_ops.contains("http_cache_stats")) {
+    default_ops.insert_or_assign(
+        "http_cache_stats", create<instant_operator_t>(http_cache_stats_op));
   }
 
   // Add Operator Calculator
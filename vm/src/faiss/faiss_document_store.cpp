@@ -0,0 +1,277 @@
+#include "faiss_document_store.hpp"
+
+#include <cstring>
+
+namespace ailoy {
+
+namespace fs = std::filesystem;
+
+static void write_u32(std::ostream &os, uint32_t v) {
+  os.write(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void write_record(std::ostream &os, std::string_view document,
+                         std::string_view metadata) {
+  write_u32(os, document.size());
+  os.write(document.data(), document.size());
+  write_u32(os, metadata.size());
+  os.write(metadata.data(), metadata.size());
+}
+
+static std::string encode_metadata(const metadata_t &metadata) {
+  if (!metadata.has_value())
+    return "";
+  std::string rv;
+  nlohmann::json::to_cbor(metadata.value(), rv);
+  return rv;
+}
+
+static metadata_t decode_metadata(std::string_view metadata) {
+  if (metadata.empty())
+    return std::nullopt;
+  return nlohmann::json::from_cbor(metadata.begin(), metadata.end());
+}
+
+void faiss_document_segment_t::add(int64_t id, std::string_view document,
+                                   const metadata_t &metadata) {
+  std::string encoded = encode_metadata(metadata);
+  items_.push_back(item_t{
+      .id = id,
+      .document_offset = documents_.size(),
+      .metadata_offset = metadatas_.size(),
+      .document_size = static_cast<uint32_t>(document.size()),
+      .metadata_size = static_cast<uint32_t>(encoded.size()),
+  });
+  documents_.append(document);
+  metadatas_.append(encoded);
+}
+
+void faiss_document_store_t::insert(int64_t id, std::string_view document,
+                                    const metadata_t &metadata) {
+  faiss_document_segment_t segment;
+  segment.add(id, document, metadata);
+  insert(std::move(segment));
+}
+
+void faiss_document_store_t::insert(faiss_document_segment_t &&segment) {
+  uint64_t document_base = documents_.size();
+  uint64_t metadata_base = metadatas_.size();
+  documents_.append(segment.documents_);
+  metadatas_.append(segment.metadatas_);
+  for (const auto &item : segment.items_) {
+    if (item.id >= entries_.size())
+      entries_.resize(item.id + 1);
+    else
+      release(item.id);
+    entries_[item.id] = entry_t{
+        .document_offset = document_base + item.document_offset,
+        .metadata_offset = metadata_base + item.metadata_offset,
+        .document_size = item.document_size,
+        .metadata_size = item.metadata_size,
+        .location = location_t::memory,
+    };
+  }
+  compact_if_needed();
+}
+
+void faiss_document_store_t::erase(int64_t id) {
+  release(id);
+  compact_if_needed();
+}
+
+void faiss_document_store_t::release(int64_t id) {
+  if (!contains(id))
+    return;
+  auto &entry = entries_[id];
+  if (entry.location == location_t::memory)
+    garbage_size_ += entry.document_size + entry.metadata_size;
+  else
+    file_garbage_size_ += record_size(entry.document_offset);
+  entry.location = location_t::none;
+}
+
+void faiss_document_store_t::clear() {
+  entries_.clear();
+  documents_.clear();
+  metadatas_.clear();
+  garbage_size_ = 0;
+  // the saved file is left as it is, but none of it is used anymore
+  file_garbage_size_ = file_.size();
+}
+
+std::string faiss_document_store_t::get_document(int64_t id) const {
+  if (!contains(id))
+    return "";
+  const auto &entry = entries_[id];
+  if (entry.location == location_t::file)
+    return read_record(entry.document_offset).document;
+  return documents_.substr(entry.document_offset, entry.document_size);
+}
+
+metadata_t faiss_document_store_t::get_metadata(int64_t id) const {
+  if (!contains(id))
+    return std::nullopt;
+  const auto &entry = entries_[id];
+  if (entry.location == location_t::file)
+    return decode_metadata(read_record(entry.document_offset).metadata);
+  return decode_metadata(std::string_view(metadatas_).substr(
+      entry.metadata_offset, entry.metadata_size));
+}
+
+void faiss_document_store_t::save(const fs::path &dir, bool append) {
+  fs::path documents_path = dir / "documents.bin";
+  std::vector<uint64_t> offsets(entries_.size());
+
+  auto write_memory_entries = [&](std::ostream &os) {
+    for (size_t id = 0; id < entries_.size(); id++) {
+      const auto &entry = entries_[id];
+      if (entry.location != location_t::memory)
+        continue;
+      offsets[id] = static_cast<uint64_t>(os.tellp());
+      write_record(os,
+                   std::string_view(documents_).substr(entry.document_offset,
+                                                       entry.document_size),
+                   std::string_view(metadatas_).substr(entry.metadata_offset,
+                                                       entry.metadata_size));
+    }
+  };
+
+  // erased records stay in the file until it is rewritten, once they take up
+  // a quarter of it
+  if (append && file_garbage_size_ * 4 >= file_.size())
+    append = false;
+
+  if (append) {
+    // the mapping is dropped first since Windows refuses to write to a mapped
+    // file
+    file_ = utils::mapped_file_t();
+    std::ofstream ofs(documents_path,
+                      std::ios::binary | std::ios::in | std::ios::out);
+    ofs.seekp(0, std::ios::end);
+    write_memory_entries(ofs);
+    ofs.close();
+    if (!ofs) {
+      file_ = utils::mapped_file_t(documents_path);
+      throw ailoy::runtime_error("[FAISS] failed to write " +
+                                 documents_path.string());
+    }
+    for (size_t id = 0; id < entries_.size(); id++) {
+      if (entries_[id].location == location_t::file)
+        offsets[id] = entries_[id].document_offset;
+    }
+  } else {
+    write_file_atomic(documents_path, [&](std::ostream &ofs) {
+      for (size_t id = 0; id < entries_.size(); id++) {
+        if (entries_[id].location != location_t::file)
+          continue;
+        auto record = read_record(entries_[id].document_offset);
+        offsets[id] = static_cast<uint64_t>(ofs.tellp());
+        write_record(ofs, record.document, record.metadata);
+      }
+      write_memory_entries(ofs);
+    });
+  }
+
+  write_file_atomic(dir / "documents.idx", [&](std::ostream &ofs) {
+    for (size_t i = 0; i < entries_.size(); i++) {
+      if (entries_[i].location == location_t::none)
+        continue;
+      int64_t id = i;
+      ofs.write(reinterpret_cast<const char *>(&id), sizeof(id));
+      ofs.write(reinterpret_cast<const char *>(&offsets[i]),
+                sizeof(offsets[i]));
+    }
+  });
+
+  // every entry is now served from the saved file
+  for (size_t id = 0; id < entries_.size(); id++) {
+    if (entries_[id].location == location_t::none)
+      continue;
+    entries_[id].document_offset = offsets[id];
+    entries_[id].location = location_t::file;
+  }
+  documents_.clear();
+  documents_.shrink_to_fit();
+  metadatas_.clear();
+  metadatas_.shrink_to_fit();
+  garbage_size_ = 0;
+  if (!append)
+    file_garbage_size_ = 0;
+  file_ = utils::mapped_file_t(documents_path);
+}
+
+void faiss_document_store_t::load(const fs::path &dir,
+                                  uint64_t file_garbage_size) {
+  clear();
+  std::ifstream idx_file(dir / "documents.idx", std::ios::binary);
+  int64_t id;
+  uint64_t offset;
+  while (idx_file.read(reinterpret_cast<char *>(&id), sizeof(id)) &&
+         idx_file.read(reinterpret_cast<char *>(&offset), sizeof(offset))) {
+    if (id >= entries_.size())
+      entries_.resize(id + 1);
+    entries_[id] = entry_t{.document_offset = offset,
+                           .location = location_t::file};
+  }
+  file_ = utils::mapped_file_t(dir / "documents.bin");
+  file_garbage_size_ = file_garbage_size;
+}
+
+faiss_document_store_t::record_t
+faiss_document_store_t::read_record(uint64_t offset) const {
+  // The mapping is read-only, so concurrent readers need no lock
+  std::string_view file(static_cast<const char *>(file_.data()), file_.size());
+  auto read_bytes = [&](std::string &out) {
+    uint32_t size;
+    if (offset > file.size() || file.size() - offset < sizeof(size))
+      throw ailoy::runtime_error("[FAISS] corrupted document file");
+    std::memcpy(&size, file.data() + offset, sizeof(size));
+    offset += sizeof(size);
+    if (file.size() - offset < size)
+      throw ailoy::runtime_error("[FAISS] corrupted document file");
+    out.assign(file.substr(offset, size));
+    offset += size;
+  };
+  record_t record;
+  read_bytes(record.document);
+  read_bytes(record.metadata);
+  return record;
+}
+
+uint64_t faiss_document_store_t::record_size(uint64_t offset) const {
+  // only the lengths are read, skipping the document between them
+  uint64_t begin = offset;
+  for (int i = 0; i < 2; i++) {
+    uint32_t size;
+    if (offset > file_.size() || file_.size() - offset < sizeof(size))
+      throw ailoy::runtime_error("[FAISS] corrupted document file");
+    std::memcpy(&size, static_cast<const char *>(file_.data()) + offset,
+                sizeof(size));
+    offset += sizeof(size) + size;
+  }
+  return offset - begin;
+}
+
+void faiss_document_store_t::compact_if_needed() {
+  if (garbage_size_ == 0 ||
+      garbage_size_ * 2 < documents_.size() + metadatas_.size())
+    return;
+
+  std::string documents;
+  std::string metadatas;
+  for (auto &entry : entries_) {
+    if (entry.location != location_t::memory)
+      continue;
+    auto document_offset = documents.size();
+    auto metadata_offset = metadatas.size();
+    documents.append(documents_, entry.document_offset, entry.document_size);
+    metadatas.append(metadatas_, entry.metadata_offset, entry.metadata_size);
+    entry.document_offset = document_offset;
+    entry.metadata_offset = metadata_offset;
+  }
+  documents_ = std::move(documents);
+  metadatas_ = std::move(metadatas);
+  garbage_size_ = 0;
+}
+
+} // namespace ailoy
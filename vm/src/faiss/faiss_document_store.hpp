@@ -0,0 +1,165 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../file_util.hpp"
+#include "../vector_store.hpp"
+
+namespace ailoy {
+
+/**
+ * Write a file next to its destination and move it into place, so that files
+ * currently mapped into memory are never truncated.
+ */
+template <typename writer_t>
+void write_file_atomic(const std::filesystem::path &path, writer_t writer) {
+  std::filesystem::path tmp_path = path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!ofs)
+      throw ailoy::runtime_error("[FAISS] failed to open " + tmp_path.string());
+    writer(ofs);
+    if (!ofs)
+      throw ailoy::runtime_error("[FAISS] failed to write " +
+                                 tmp_path.string());
+  }
+  std::filesystem::rename(tmp_path, path);
+}
+
+class faiss_document_store_t;
+
+/**
+ * @brief Documents and metadata encoded ahead of insertion
+ * @details A segment is built without touching the store, so bulk inserts
+ * can encode it outside of the store lock and publish it at once.
+ */
+class faiss_document_segment_t {
+public:
+  void add(int64_t id, std::string_view document, const metadata_t &metadata);
+
+private:
+  friend class faiss_document_store_t;
+
+  struct item_t {
+    int64_t id;
+    uint64_t document_offset;
+    uint64_t metadata_offset;
+    uint32_t document_size;
+    uint32_t metadata_size;
+  };
+
+  std::vector<item_t> items_;
+  std::string documents_;
+  std::string metadatas_;
+};
+
+/**
+ * @brief Columnar store of documents and metadata of the faiss vector store
+ * @details Ids are dense, so entries are addressed by id directly. Documents
+ * are kept in a contiguous arena and metadata in a CBOR column, and both are
+ * decoded only when requested. Saved entries stay on disk and are read on
+ * demand.
+ *
+ * The document file is a sequence of records of
+ * [u32 length][document][u32 length][CBOR metadata], where a zero-length
+ * metadata means no metadata. The index file is an array of (id, offset)
+ * pairs into the document file.
+ *
+ * Const member functions may be called concurrently, while the others need
+ * exclusive access.
+ */
+class faiss_document_store_t {
+public:
+  void insert(int64_t id, std::string_view document, const metadata_t &metadata);
+
+  /**
+   * @brief Insert every entry of the segment, replacing existing ones
+   */
+  void insert(faiss_document_segment_t &&segment);
+
+  void erase(int64_t id);
+
+  void clear();
+
+  bool contains(int64_t id) const {
+    return id >= 0 && id < entries_.size() &&
+           entries_[id].location != location_t::none;
+  }
+
+  std::string get_document(int64_t id) const;
+
+  metadata_t get_metadata(int64_t id) const;
+
+  template <typename callback_t> void for_each_id(callback_t callback) const {
+    for (size_t id = 0; id < entries_.size(); id++) {
+      if (entries_[id].location != location_t::none)
+        callback(static_cast<int64_t>(id));
+    }
+  }
+
+  /**
+   * @brief Save into `dir`. Entries read from `dir` are kept as they are
+   * when `append` is set, and only entries in memory are appended, unless
+   * erased records take up a quarter of the document file, which is then
+   * rewritten.
+   */
+  void save(const std::filesystem::path &dir, bool append);
+
+  /**
+   * @brief Replace the entries with the ones saved in `dir`
+   * @param file_garbage_size Bytes of erased records in the document file,
+   * as returned by `file_garbage_size` when it was saved
+   */
+  void load(const std::filesystem::path &dir, uint64_t file_garbage_size = 0);
+
+  /**
+   * @brief Bytes of erased records left in the document file
+   */
+  uint64_t file_garbage_size() const { return file_garbage_size_; }
+
+private:
+  enum class location_t : uint8_t { none, memory, file };
+
+  struct entry_t {
+    // Offset into the arenas, or offset of the record in the document file
+    uint64_t document_offset;
+    uint64_t metadata_offset;
+    uint32_t document_size;
+    uint32_t metadata_size;
+    location_t location = location_t::none;
+  };
+
+  struct record_t {
+    std::string document;
+    std::string metadata;
+  };
+
+  record_t read_record(uint64_t offset) const;
+
+  uint64_t record_size(uint64_t offset) const;
+
+  /**
+   * Mark the entry as erased without compacting the arenas
+   */
+  void release(int64_t id);
+
+  /**
+   * Drop the holes left by erased entries once they take up half the arena
+   */
+  void compact_if_needed();
+
+  std::vector<entry_t> entries_;
+  std::string documents_;
+  std::string metadatas_;
+  size_t garbage_size_ = 0;
+
+  // Mapping of the saved document file, read by entries in `location_t::file`
+  utils::mapped_file_t file_;
+  uint64_t file_garbage_size_ = 0;
+};
+
+} // namespace ailoy
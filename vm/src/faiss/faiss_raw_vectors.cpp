@@ -0,0 +1,117 @@
+#include "faiss_raw_vectors.hpp"
+
+#include <fstream>
+
+#include "faiss_document_store.hpp"
+
+namespace ailoy {
+
+namespace fs = std::filesystem;
+
+void faiss_raw_vectors_t::insert(size_t n, const float *vectors,
+                                 const int64_t *ids) {
+  for (size_t i = 0; i < n; i++) {
+    // ids are never reused, so rows are only appended
+    memory_rows_[ids[i]] = memory_vectors_.size() / dimension_;
+    memory_vectors_.insert(memory_vectors_.end(), vectors + i * dimension_,
+                           vectors + (i + 1) * dimension_);
+  }
+}
+
+void faiss_raw_vectors_t::erase(int64_t id) {
+  // rows stay until the vectors are saved again
+  memory_rows_.erase(id);
+  mapped_rows_.erase(id);
+}
+
+void faiss_raw_vectors_t::clear() {
+  memory_rows_.clear();
+  memory_vectors_.clear();
+  mapped_rows_.clear();
+  mapped_vectors_ = utils::mapped_file_t();
+}
+
+const float *faiss_raw_vectors_t::get(int64_t id) const {
+  if (auto it = memory_rows_.find(id); it != memory_rows_.end())
+    return memory_vectors_.data() + it->second * dimension_;
+  if (auto it = mapped_rows_.find(id); it != mapped_rows_.end())
+    return static_cast<const float *>(mapped_vectors_.data()) +
+           it->second * dimension_;
+  return nullptr;
+}
+
+void faiss_raw_vectors_t::save(const fs::path &dir, bool append) {
+  fs::path vectors_path = dir / "vectors.bin";
+  size_t row_size = dimension_ * sizeof(float);
+  std::vector<std::pair<int64_t, uint64_t>> rows;
+
+  auto write_memory_rows = [&](std::ostream &os, uint64_t num_rows) {
+    for (auto [id, row] : memory_rows_) {
+      os.write(reinterpret_cast<const char *>(memory_vectors_.data() +
+                                              row * dimension_),
+               row_size);
+      rows.emplace_back(id, num_rows++);
+    }
+  };
+
+  // rows of erased vectors stay in the file until it is rewritten, once they
+  // take up a quarter of it
+  uint64_t num_file_rows = append ? fs::file_size(vectors_path) / row_size : 0;
+  if (append && (num_file_rows - mapped_rows_.size()) * 4 >= num_file_rows)
+    append = false;
+
+  if (append) {
+    rows.assign(mapped_rows_.begin(), mapped_rows_.end());
+    std::ofstream ofs(vectors_path,
+                      std::ios::binary | std::ios::in | std::ios::out);
+    ofs.seekp(0, std::ios::end);
+    write_memory_rows(ofs, num_file_rows);
+    if (!ofs)
+      throw ailoy::runtime_error("[FAISS] failed to write " +
+                                 vectors_path.string());
+  } else {
+    write_file_atomic(vectors_path, [&](std::ostream &ofs) {
+      uint64_t num_rows = 0;
+      for (auto [id, row] : mapped_rows_) {
+        ofs.write(static_cast<const char *>(mapped_vectors_.data()) +
+                      row * row_size,
+                  row_size);
+        rows.emplace_back(id, num_rows++);
+      }
+      write_memory_rows(ofs, num_rows);
+    });
+  }
+
+  write_file_atomic(dir / "vectors.idx", [&](std::ostream &ofs) {
+    ofs.write(reinterpret_cast<const char *>(rows.data()),
+              rows.size() * sizeof(rows[0]));
+  });
+
+  // every vector is now served from the saved file
+  mapped_vectors_ = utils::mapped_file_t(vectors_path);
+  mapped_rows_ = std::unordered_map<int64_t, size_t>(rows.begin(), rows.end());
+  memory_rows_.clear();
+  memory_vectors_.clear();
+  memory_vectors_.shrink_to_fit();
+}
+
+void faiss_raw_vectors_t::load(const fs::path &dir) {
+  clear();
+  std::ifstream idx_file(dir / "vectors.idx", std::ios::binary);
+  if (!idx_file)
+    throw ailoy::runtime_error("[FAISS] no full-precision vectors found at " +
+                               dir.string());
+  int64_t id;
+  uint64_t row;
+  mapped_vectors_ = utils::mapped_file_t(dir / "vectors.bin");
+  uint64_t num_rows = mapped_vectors_.size() / (dimension_ * sizeof(float));
+  while (idx_file.read(reinterpret_cast<char *>(&id), sizeof(id)) &&
+         idx_file.read(reinterpret_cast<char *>(&row), sizeof(row))) {
+    if (row >= num_rows)
+      throw ailoy::runtime_error(
+          "[FAISS] corrupted full-precision vector file");
+    mapped_rows_[id] = row;
+  }
+}
+
+} // namespace ailoy
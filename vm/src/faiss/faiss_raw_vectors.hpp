@@ -0,0 +1,60 @@
+#pragma once
+
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+#include "../file_util.hpp"
+
+namespace ailoy {
+
+/**
+ * @brief Full-precision copies of vectors stored in a quantized index
+ * @details Vectors added since the last save are kept in memory, and saved
+ * vectors are mapped from the vector file. The vector file is an array of
+ * float32 rows, and the index file is an array of (id, row) pairs.
+ *
+ * Const member functions may be called concurrently, while the others need
+ * exclusive access.
+ */
+class faiss_raw_vectors_t {
+public:
+  explicit faiss_raw_vectors_t(size_t dimension) : dimension_(dimension) {}
+
+  void insert(size_t n, const float *vectors, const int64_t *ids);
+
+  void erase(int64_t id);
+
+  void clear();
+
+  /**
+   * @return Vector of `id`, or nullptr if not found
+   */
+  const float *get(int64_t id) const;
+
+  /**
+   * @brief Save into `dir`. Rows already saved in `dir` are kept as they are
+   * when `append` is set, and only vectors in memory are appended, unless
+   * rows of erased vectors take up a quarter of the vector file, which is
+   * then rewritten.
+   */
+  void save(const std::filesystem::path &dir, bool append);
+
+  /**
+   * @brief Replace the vectors with the ones saved in `dir`
+   */
+  void load(const std::filesystem::path &dir);
+
+private:
+  size_t dimension_;
+
+  // id -> row of `memory_vectors_`
+  std::unordered_map<int64_t, size_t> memory_rows_;
+  std::vector<float> memory_vectors_;
+
+  // id -> row of `mapped_vectors_`
+  std::unordered_map<int64_t, size_t> mapped_rows_;
+  utils::mapped_file_t mapped_vectors_;
+};
+
+} // namespace ailoy
@@ -1,28 +1,146 @@
 #include "faiss_vector_store.hpp"
 
+#include <algorithm>
 #include <atomic>
-#include <unordered_map>
+#include <bit>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <regex>
+#include <thread>
 
-#include <faiss/IndexFlat.h>
+#include <faiss/IVFlib.h>
+#include <faiss/IndexHNSW.h>
 #include <faiss/IndexIDMap.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/clone_index.h>
 #include <faiss/impl/FaissException.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/invlists/InvertedLists.h>
 #include <nlohmann/json.hpp>
 
+#include "../bm25_index.hpp"
+#include "faiss_document_store.hpp"
+#include "faiss_raw_vectors.hpp"
+
 namespace ailoy {
 
 static std::shared_ptr<module_t> faiss_vector_store_module =
     ailoy::create<module_t>();
 
-struct document_store_t {
-  std::string document;
-  std::optional<nlohmann::json> metadata = std::nullopt;
-};
+namespace fs = std::filesystem;
+
+/**
+ * Layout of a saved store directory:
+ *  - store.json: manifest with id counter and vectors waiting for training
+ *  - index.faiss: faiss index written by `faiss::write_index`
+ *  - pending.bin: raw vectors waiting for training
+ *  - documents.bin, documents.idx: documents and metadata (see
+ *    `faiss_document_store_t`)
+ *  - vectors.bin, vectors.idx: full-precision vectors for re-ranking (see
+ *    `faiss_raw_vectors_t`)
+ *  - tombstones.bin: bitmap of ids removed but not yet compacted out of the
+ *    index
+ *  - keys.bin: records of [u32 length][external key][i64 id]
+ */
+constexpr int faiss_vector_store_format_version = 3;
+
+// Stores of version 2 have no tombstones and keys, and are still readable
+constexpr int faiss_vector_store_min_format_version = 2;
+
+/**
+ * Replace the "Flat" encoding of the index factory string with the encoding
+ * of `storage`, e.g. "IVF1024,Flat" with "int8" becomes "IVF1024,SQ8".
+ */
+static std::string apply_storage(const std::string &index,
+                                 const std::string &storage) {
+  std::string encoding;
+  std::smatch match;
+  if (storage == "float32")
+    return index;
+  else if (storage == "float16")
+    encoding = "SQfp16";
+  else if (storage == "int8")
+    encoding = "SQ8";
+  else if (std::regex_match(storage, match, std::regex("pq([0-9]+)")))
+    encoding = "PQ" + match[1].str();
+  else
+    throw ailoy::runtime_error("[FAISS] unknown storage \"" + storage + "\"");
+
+  auto separator = index.rfind(',');
+  std::string last =
+      separator == std::string::npos ? index : index.substr(separator + 1);
+  if (last == "Flat")
+    return index.substr(0, index.size() - last.size()) + encoding;
+  // HNSW without an encoding stores flat vectors
+  if (std::regex_match(last, std::regex("HNSW[0-9]*")))
+    return index + "," + encoding;
+  throw ailoy::runtime_error("[FAISS] storage \"" + storage +
+                             "\" cannot be applied to index \"" + index +
+                             "\"");
+}
 
+/**
+ * Retrievals take the store lock shared and run concurrently, while
+ * modifications take it exclusively. Bulk inserts encode their documents into
+ * a side segment before taking the lock, so that readers are blocked only
+ * while the segment is published.
+ */
 class faiss_vector_store_impl_t {
 public:
-  faiss_vector_store_impl_t(const size_t dimension) {
-    index_flat_ = faiss::IndexFlatIP(dimension);
-    index_ = faiss::IndexIDMap2(&index_flat_);
+  faiss_vector_store_impl_t(const faiss_vector_store_config_t &config) {
+    std::string index_description =
+        config.storage.has_value()
+            ? apply_storage(config.index, config.storage.value())
+            : config.index;
+    faiss::Index *index;
+    try {
+      index = faiss::index_factory(config.dimension, index_description.c_str(),
+                                   faiss::METRIC_INNER_PRODUCT);
+    } catch (const faiss::FaissException &e) {
+      throw ailoy::runtime_error("[FAISS] invalid index \"" +
+                                 index_description + "\": " + e.what());
+    }
+
+    auto ivf = faiss::ivflib::try_extract_index_ivf(index);
+    if (ivf) {
+      // IVF indexes keep external ids by themselves. With a hashtable direct
+      // map, they can also reconstruct and remove vectors by id.
+      ivf->set_direct_map_type(faiss::DirectMap::Hashtable);
+      if (config.nprobe.has_value())
+        ivf->nprobe = config.nprobe.value();
+    } else {
+      auto id_map = new faiss::IndexIDMap2(index);
+      id_map->own_fields = true;
+      index = id_map;
+    }
+    set_index(index);
+
+    auto hnsw = dynamic_cast<faiss::IndexHNSW *>(base_index_);
+    if (hnsw && config.ef_search.has_value())
+      hnsw->hnsw.efSearch = config.ef_search.value();
+
+    // Faiss suggests at least 39 training points per centroid
+    if (config.train_size.has_value())
+      train_size_ = config.train_size.value();
+    else if (ivf)
+      train_size_ = std::max<size_t>(39 * ivf->nlist, 1000);
+    else
+      train_size_ = 10000;
+
+    if (config.rerank.has_value() && config.rerank.value() > 0) {
+      rerank_ = config.rerank.value();
+      raw_vectors_.emplace(config.dimension);
+    }
+    compaction_threshold_ = config.compaction_threshold.value_or(
+        compaction_threshold_);
+  }
+
+  ~faiss_vector_store_impl_t() {
+    if (compaction_thread_.joinable())
+      compaction_thread_.join();
   }
 
   std::string add_vector(const vector_store_add_input_t &input) {
@@ -33,14 +151,24 @@ public:
 
     int64_t id = id_counter_.fetch_add(1, std::memory_order_relaxed);
     auto vec = input.embedding->operator std::vector<float>();
-    index_.add_with_ids(1, vec.data(), &id);
-    document_store_[id] = document_store_t{.document = input.document,
-                                           .metadata = input.metadata};
+    wlock_t lk(mutex_);
+    add_embeddings(1, vec.data(), &id);
+    documents_.insert(id, input.document, input.metadata);
+    if (metadata_index_.has_value())
+      metadata_index_->insert(id, input.metadata);
+    if (bm25_index_.has_value())
+      bm25_index_->insert(id, bm25_index_t::analyze(input.document));
     return std::to_string(id);
   }
 
+  /**
+   * Add vectors, and replace the vectors stored under `keys` if given.
+   */
   std::vector<std::string>
-  add_vectors(std::vector<vector_store_add_input_t> inputs) {
+  add_vectors(std::vector<vector_store_add_input_t> inputs,
+              const std::vector<std::string> *keys = nullptr) {
+    if (keys && keys->size() != inputs.size())
+      throw ailoy::runtime_error("[FAISS] number of keys and items differ");
     // check shape of every embeddings first
     for (const auto &input : inputs) {
       if (!is_valid_embedding(input.embedding)) {
@@ -49,30 +177,43 @@ public:
       }
     }
 
-    // insert embeddings to index
-    std::vector<int64_t> ids;
-    std::vector<float> embeddings(index_.d * inputs.size());
-    size_t idx = 0;
-    for (const auto &input : inputs) {
-      int64_t id = id_counter_.fetch_add(1, std::memory_order_relaxed);
-      ids.push_back(id);
-
+    // build the segment of embeddings and documents without the lock
+    int64_t first_id =
+        id_counter_.fetch_add(inputs.size(), std::memory_order_relaxed);
+    std::vector<int64_t> ids(inputs.size());
+    std::iota(ids.begin(), ids.end(), first_id);
+    std::vector<float> embeddings(index_->d * inputs.size());
+    faiss_document_segment_t segment;
+    for (size_t i = 0; i < inputs.size(); i++) {
       // concatenate each embedding to embeddings
-      auto vec = input.embedding->operator std::vector<float>();
-      memcpy(embeddings.data() + (idx * index_.d), vec.data(),
-             index_.d * sizeof(float));
-
-      idx++;
+      auto vec = inputs[i].embedding->operator std::vector<float>();
+      memcpy(embeddings.data() + (i * index_->d), vec.data(),
+             index_->d * sizeof(float));
+      segment.add(ids[i], inputs[i].document, inputs[i].metadata);
     }
 
-    index_.add_with_ids(inputs.size(), embeddings.data(), ids.data());
-
-    // insert documents and metadatas
-    for (size_t i = 0; i < inputs.size(); i++) {
-      document_store_[ids[i]] = document_store_t{
-          .document = inputs[i].document,
-          .metadata = inputs[i].metadata,
-      };
+    // publish the segment
+    wlock_t lk(mutex_);
+    add_embeddings(inputs.size(), embeddings.data(), ids.data());
+    documents_.insert(std::move(segment));
+    if (metadata_index_.has_value()) {
+      for (size_t i = 0; i < inputs.size(); i++)
+        metadata_index_->insert(ids[i], inputs[i].metadata);
+    }
+    if (bm25_index_.has_value()) {
+      for (size_t i = 0; i < inputs.size(); i++)
+        bm25_index_->insert(ids[i], bm25_index_t::analyze(inputs[i].document));
+    }
+    if (keys) {
+      // a key repeated in the batch ends up with its last item
+      for (size_t i = 0; i < inputs.size(); i++) {
+        if (auto it = keys_.find(keys->at(i)); it != keys_.end())
+          remove_locked(it->second);
+        keys_[keys->at(i)] = ids[i];
+        id_keys_[ids[i]] = keys->at(i);
+      }
+      if (needs_compaction())
+        start_compaction();
     }
 
     std::vector<std::string> string_ids(ids.size());
@@ -83,123 +224,878 @@ public:
 
   std::optional<vector_store_get_result_t> get_by_id(const std::string &id) {
     int64_t _id = std::strtoll(id.c_str(), nullptr, 10);
-    std::vector<float> vec(index_.d);
-    try {
-      index_.reconstruct(_id, vec.data());
-    } catch (faiss::FaissException e) {
+    rlock_t lk(mutex_);
+    if (!documents_.contains(_id))
       return std::nullopt;
+
+    std::vector<float> vec(index_->d);
+    auto pending = std::find(pending_ids_.begin(), pending_ids_.end(), _id);
+    const float *raw_vec = raw_vectors_ ? raw_vectors_->get(_id) : nullptr;
+    if (raw_vec) {
+      // full-precision vector is preferred over the quantized one
+      std::copy_n(raw_vec, index_->d, vec.begin());
+    } else if (pending != pending_ids_.end()) {
+      size_t i = std::distance(pending_ids_.begin(), pending);
+      std::copy_n(pending_vectors_.begin() + i * index_->d, index_->d,
+                  vec.begin());
+    } else {
+      try {
+        index_->reconstruct(_id, vec.data());
+      } catch (const faiss::FaissException &e) {
+        return std::nullopt;
+      }
     }
 
     auto ndarray = ailoy::create<ailoy::ndarray_t>();
-    ndarray->shape.push_back(index_.d);
+    ndarray->shape.push_back(index_->d);
     ndarray->dtype = {.code = kDLFloat, .bits = 32, .lanes = 1};
     ndarray->data.resize(sizeof(float) * vec.size());
     memcpy(ndarray->data.data(), vec.data(), sizeof(float) * vec.size());
 
     return vector_store_get_result_t{
         .id = id,
-        .document = document_store_[_id].document,
-        .metadata = document_store_[_id].metadata,
+        .document = documents_.get_document(_id),
+        .metadata = documents_.get_metadata(_id),
         .embedding = std::move(ndarray),
     };
   }
 
   std::vector<vector_store_retrieve_result_t>
   retrieve(std::shared_ptr<const ailoy::ndarray_t> query_embedding,
-           uint64_t top_k) {
+           uint64_t top_k, const vector_store_retrieve_params_t &params) {
     if (!is_valid_embedding(query_embedding)) {
       throw ailoy::runtime_error("[FAISS] invalid query embedding shape: " +
                                  query_embedding->shape_str());
     }
+    auto vec = query_embedding->operator std::vector<float>();
+    rlock_t lk(mutex_);
+    return std::move(search(1, vec.data(), top_k, params)[0]);
+  }
 
-    faiss::idx_t min_k =
-        std::min(index_.ntotal, static_cast<faiss::idx_t>(top_k));
-    if (min_k == 0) {
-      return {};
+  std::vector<std::vector<vector_store_retrieve_result_t>>
+  retrieve_many(std::shared_ptr<const ailoy::ndarray_t> query_embeddings,
+                uint64_t top_k, const vector_store_retrieve_params_t &params) {
+    // should be 2-D array of (number of queries, dimension)
+    if (query_embeddings->shape.size() != 2 ||
+        query_embeddings->shape[1] != index_->d) {
+      throw ailoy::runtime_error("[FAISS] invalid query embeddings shape: " +
+                                 query_embeddings->shape_str());
     }
+    auto vecs = query_embeddings->operator std::vector<float>();
+    rlock_t lk(mutex_);
+    return search(query_embeddings->shape[0], vecs.data(), top_k, params);
+  }
 
-    std::vector<float> similarities(min_k);
-    std::vector<faiss::idx_t> ids(min_k);
+  std::vector<vector_store_retrieve_result_t>
+  hybrid_retrieve(std::shared_ptr<const ailoy::ndarray_t> query_embedding,
+                  const std::string &query_text, uint64_t top_k,
+                  const vector_store_retrieve_params_t &params,
+                  const vector_store_hybrid_params_t &hybrid_params) {
+    if (!is_valid_embedding(query_embedding)) {
+      throw ailoy::runtime_error("[FAISS] invalid query embedding shape: " +
+                                 query_embedding->shape_str());
+    }
     auto vec = query_embedding->operator std::vector<float>();
+    uint64_t num_candidates = hybrid_params.num_candidates.value_or(4 * top_k);
+    rlock_t lk(mutex_);
+    auto vector_results =
+        std::move(search(1, vec.data(), num_candidates, params)[0]);
 
-    index_.search(1, vec.data(), min_k, similarities.data(), ids.data());
-
-    std::vector<vector_store_retrieve_result_t> results(min_k);
-    for (int i = 0; i < min_k; i++) {
-      faiss::idx_t id = ids[i];
-      results[i] = {.id = std::to_string(id),
-                    .document = document_store_[id].document,
-                    .metadata = document_store_[id].metadata,
-                    .similarity = similarities[i]};
+    std::vector<int64_t> selected;
+    if (params.filter.has_value())
+      selected = get_metadata_index().select(params.filter.value());
+    std::vector<vector_store_retrieve_result_t> lexical_results;
+    for (auto [id, score] : get_bm25_index().search(
+             query_text, num_candidates,
+             params.filter.has_value() ? &selected : nullptr)) {
+      lexical_results.push_back({.id = std::to_string(id),
+                                 .document = documents_.get_document(id),
+                                 .metadata = documents_.get_metadata(id),
+                                 .similarity = score});
+    }
+    try {
+      return fuse_retrieve_results(std::move(vector_results),
+                                   std::move(lexical_results), top_k,
+                                   hybrid_params);
+    } catch (const ailoy::runtime_error &e) {
+      throw ailoy::runtime_error(std::string("[FAISS] ") + e.what());
     }
-
-    return results;
   }
 
   void remove_vector(const std::string &id) {
     int64_t _id = std::strtoll(id.c_str(), nullptr, 10);
-    index_.remove_ids(faiss::IDSelectorArray(1, &_id));
-    document_store_.erase(_id);
+    wlock_t lk(mutex_);
+    ensure_writable();
+    remove_locked(_id);
+    if (needs_compaction())
+      start_compaction();
+  }
+
+  /**
+   * Remove the vectors marked as removed from the index, and wait until it is
+   * done. Retrievals keep running on the current index in the meantime.
+   */
+  void compact() {
+    std::lock_guard<std::mutex> compaction_lk(compaction_mutex_);
+    {
+      // inverted lists mapped from disk cannot be cloned
+      wlock_t lk(mutex_);
+      ensure_writable();
+    }
+
+    // snapshot of the index and its tombstones
+    std::unique_ptr<faiss::Index> index;
+    std::vector<int64_t> removed;
+    uint64_t generation;
+    {
+      rlock_t lk(mutex_);
+      for (size_t byte = 0; byte < tombstones_.size(); byte++) {
+        for (int bit = 0; bit < 8; bit++) {
+          if ((tombstones_[byte] >> bit) & 1)
+            removed.push_back(byte * 8 + bit);
+        }
+      }
+      if (removed.empty())
+        return;
+      generation = generation_;
+      try {
+        index.reset(faiss::clone_index(index_.get()));
+      } catch (const faiss::FaissException &e) {
+        throw ailoy::runtime_error(
+            std::string("[FAISS] failed to compact index: ") + e.what());
+      }
+      // writers are excluded by the shared lock, and compactions by
+      // `compaction_mutex_`, so the log can be started here
+      compaction_log_.emplace();
+    }
+
+    // the slow part runs without the store lock
+    try {
+      remove_from_index(index.get(), removed);
+    } catch (const faiss::FaissException &e) {
+      wlock_t lk(mutex_);
+      compaction_log_.reset();
+      throw ailoy::runtime_error(
+          std::string("[FAISS] failed to compact index: ") + e.what());
+    }
+
+    // replay vectors added in the meantime and swap the index
+    wlock_t lk(mutex_);
+    auto log = std::move(compaction_log_);
+    compaction_log_.reset();
+    if (generation != generation_)
+      return;
+    if (!log->ids.empty())
+      index->add_with_ids(log->ids.size(), log->vectors.data(),
+                          log->ids.data());
+    set_index(index.release());
+    // ids removed after the snapshot stay marked
+    for (int64_t id : removed)
+      unset_removed(id);
+  }
+
+  /**
+   * Remove an item with the store lock held exclusively. Vectors in the index
+   * are only marked as removed, and skipped by searches until the index is
+   * compacted.
+   */
+  void remove_locked(int64_t id) {
+    if (!documents_.contains(id))
+      return;
+    auto pending = std::find(pending_ids_.begin(), pending_ids_.end(), id);
+    if (pending != pending_ids_.end()) {
+      size_t i = std::distance(pending_ids_.begin(), pending);
+      pending_ids_.erase(pending);
+      pending_vectors_.erase(pending_vectors_.begin() + i * index_->d,
+                             pending_vectors_.begin() + (i + 1) * index_->d);
+    } else
+      set_removed(id);
+    if (metadata_index_.has_value())
+      metadata_index_->erase(id, documents_.get_metadata(id));
+    if (bm25_index_.has_value())
+      bm25_index_->erase(id,
+                         bm25_index_t::analyze(documents_.get_document(id)));
+    documents_.erase(id);
+    if (raw_vectors_)
+      raw_vectors_->erase(id);
+    if (auto it = id_keys_.find(id); it != id_keys_.end()) {
+      keys_.erase(it->second);
+      id_keys_.erase(it);
+    }
   }
 
   void clear() {
-    index_.remove_ids(faiss::IDSelectorAll());
-    document_store_.clear();
+    wlock_t lk(mutex_);
+    ensure_writable();
+    index_->reset();
+    pending_ids_.clear();
+    pending_vectors_.clear();
+    documents_.clear();
+    metadata_index_.reset();
+    bm25_index_.reset();
+    if (raw_vectors_)
+      raw_vectors_->clear();
+    tombstones_.clear();
+    num_tombstones_ = 0;
+    keys_.clear();
+    id_keys_.clear();
+    // a compaction in progress is discarded
+    generation_++;
+  }
+
+  /**
+   * Save the store into the directory `path`. When saving into the directory
+   * the store was loaded from, only documents added since then are appended
+   * to the document file, until erased ones take up a quarter of it.
+   */
+  void save(const std::string &path) {
+    fs::path dir(path);
+    fs::create_directories(dir);
+    wlock_t lk(mutex_);
+    ensure_writable();
+
+    try {
+      fs::path index_path = dir / "index.faiss";
+      fs::path tmp_path = index_path;
+      tmp_path += ".tmp";
+      faiss::write_index(index_.get(), tmp_path.string().c_str());
+      fs::rename(tmp_path, index_path);
+    } catch (const faiss::FaissException &e) {
+      throw ailoy::runtime_error(std::string("[FAISS] failed to save index: ") +
+                                 e.what());
+    }
+
+    // only new documents are appended when saving into the same directory
+    bool append = !source_path_.empty() &&
+                  fs::exists(dir / "documents.bin") &&
+                  fs::equivalent(source_path_, dir);
+    documents_.save(dir, append);
+    if (raw_vectors_)
+      raw_vectors_->save(dir, append && fs::exists(dir / "vectors.bin"));
+    source_path_ = dir;
+
+    // vectors waiting for training
+    write_file_atomic(dir / "pending.bin", [&](std::ostream &ofs) {
+      ofs.write(reinterpret_cast<const char *>(pending_vectors_.data()),
+                pending_vectors_.size() * sizeof(float));
+    });
+    write_file_atomic(dir / "tombstones.bin", [&](std::ostream &ofs) {
+      ofs.write(reinterpret_cast<const char *>(tombstones_.data()),
+                tombstones_.size());
+    });
+    write_file_atomic(dir / "keys.bin", [&](std::ostream &ofs) {
+      for (const auto &[key, id] : keys_) {
+        uint32_t size = key.size();
+        ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        ofs.write(key.data(), size);
+        ofs.write(reinterpret_cast<const char *>(&id), sizeof(id));
+      }
+    });
+
+    nlohmann::json manifest = {
+        {"version", faiss_vector_store_format_version},
+        {"dimension", index_->d},
+        {"id_counter", id_counter_.load()},
+        {"train_size", train_size_},
+        {"pending_ids", pending_ids_},
+        {"rerank", rerank_},
+        {"compaction_threshold", compaction_threshold_},
+        {"document_garbage_size", documents_.file_garbage_size()},
+    };
+    write_file_atomic(dir / "store.json",
+                      [&](std::ostream &ofs) { ofs << manifest.dump(); });
+  }
+
+  /**
+   * Load a store saved by `save`. Inverted lists of IVF indexes are mapped
+   * into memory instead of being read, and documents are read from the
+   * document file on demand.
+   */
+  static std::unique_ptr<faiss_vector_store_impl_t>
+  load(const std::string &path) {
+    fs::path dir(path);
+    std::ifstream manifest_file(dir / "store.json");
+    if (!manifest_file)
+      throw ailoy::runtime_error("[FAISS] no vector store found at " + path);
+    nlohmann::json manifest;
+    try {
+      manifest = nlohmann::json::parse(manifest_file);
+    } catch (const nlohmann::json::exception &e) {
+      throw ailoy::runtime_error(
+          std::string("[FAISS] corrupted vector store manifest: ") + e.what());
+    }
+    int version = manifest.value("version", 0);
+    if (version < faiss_vector_store_min_format_version ||
+        version > faiss_vector_store_format_version)
+      throw ailoy::runtime_error("[FAISS] unsupported vector store version");
+
+    std::unique_ptr<faiss_vector_store_impl_t> rv(
+        new faiss_vector_store_impl_t());
+    try {
+      rv->set_index(faiss::read_index((dir / "index.faiss").string().c_str(),
+                                      faiss::IO_FLAG_MMAP));
+    } catch (const faiss::FaissException &e) {
+      throw ailoy::runtime_error(std::string("[FAISS] failed to load index: ") +
+                                 e.what());
+    }
+    rv->mapped_ = true;
+    rv->id_counter_ = manifest["id_counter"].get<int64_t>();
+    rv->train_size_ = manifest["train_size"].get<size_t>();
+    rv->pending_ids_ = manifest["pending_ids"].get<std::vector<int64_t>>();
+    rv->pending_vectors_.resize(rv->pending_ids_.size() * rv->index_->d);
+    if (!rv->pending_vectors_.empty()) {
+      std::ifstream ifs(dir / "pending.bin", std::ios::binary);
+      ifs.read(reinterpret_cast<char *>(rv->pending_vectors_.data()),
+               rv->pending_vectors_.size() * sizeof(float));
+      if (!ifs)
+        throw ailoy::runtime_error("[FAISS] corrupted pending vector file");
+    }
+
+    rv->documents_.load(
+        dir, manifest.value("document_garbage_size", uint64_t{0}));
+    rv->rerank_ = manifest.value("rerank", 0);
+    if (rv->rerank_ > 0) {
+      rv->raw_vectors_.emplace(rv->index_->d);
+      rv->raw_vectors_->load(dir);
+    }
+    rv->compaction_threshold_ =
+        manifest.value("compaction_threshold", rv->compaction_threshold_);
+
+    if (std::ifstream ifs(dir / "tombstones.bin", std::ios::binary); ifs) {
+      rv->tombstones_.assign(std::istreambuf_iterator<char>(ifs),
+                             std::istreambuf_iterator<char>());
+      for (uint8_t byte : rv->tombstones_)
+        rv->num_tombstones_ += std::popcount(byte);
+    }
+    if (std::ifstream ifs(dir / "keys.bin", std::ios::binary); ifs) {
+      uint32_t size;
+      int64_t id;
+      while (ifs.read(reinterpret_cast<char *>(&size), sizeof(size))) {
+        std::string key(size, '\0');
+        if (!ifs.read(key.data(), size) ||
+            !ifs.read(reinterpret_cast<char *>(&id), sizeof(id)))
+          throw ailoy::runtime_error("[FAISS] corrupted key file");
+        rv->id_keys_[id] = key;
+        rv->keys_[std::move(key)] = id;
+      }
+    }
+    rv->source_path_ = dir;
+    return rv;
   }
 
+  size_t dimension() const { return index_->d; }
+
 private:
+  faiss_vector_store_impl_t() = default;
+
+  void set_index(faiss::Index *index) {
+    index_.reset(index);
+    auto id_map = dynamic_cast<faiss::IndexIDMap2 *>(index);
+    base_index_ = id_map ? id_map->index : index;
+  }
+
+  /**
+   * Inverted lists mapped by `load` are read-only, so copy them into memory
+   * before the first modification.
+   */
+  void ensure_writable() {
+    if (!mapped_)
+      return;
+    if (auto ivf = faiss::ivflib::try_extract_index_ivf(base_index_)) {
+      auto src = ivf->invlists;
+      auto dst = new faiss::ArrayInvertedLists(src->nlist, src->code_size);
+      for (size_t l = 0; l < src->nlist; l++) {
+        faiss::InvertedLists::ScopedIds ids(src, l);
+        faiss::InvertedLists::ScopedCodes codes(src, l);
+        dst->add_entries(l, src->list_size(l), ids.get(), codes.get());
+      }
+      ivf->replace_invlists(dst, true);
+    }
+    mapped_ = false;
+  }
+
+  bool is_removed(int64_t id) const {
+    size_t byte = id >> 3;
+    return byte < tombstones_.size() && ((tombstones_[byte] >> (id & 7)) & 1);
+  }
+
+  void set_removed(int64_t id) {
+    size_t byte = id >> 3;
+    if (byte >= tombstones_.size())
+      tombstones_.resize(byte + 1);
+    tombstones_[byte] |= 1 << (id & 7);
+    num_tombstones_++;
+  }
+
+  void unset_removed(int64_t id) {
+    if (!is_removed(id))
+      return;
+    tombstones_[id >> 3] &= ~(1 << (id & 7));
+    num_tombstones_--;
+  }
+
+  bool needs_compaction() const {
+    return num_tombstones_ > 0 &&
+           num_tombstones_ >= compaction_threshold_ * index_->ntotal;
+  }
+
+  /**
+   * Start compacting in the background, with the store lock held
+   * exclusively
+   */
+  void start_compaction() {
+    if (compacting_)
+      return;
+    // the previous compaction is done with the lock, so it ends shortly
+    if (compaction_thread_.joinable())
+      compaction_thread_.join();
+    compacting_ = true;
+    compaction_thread_ = std::thread([this] {
+      try {
+        compact();
+      } catch (...) {
+        // retried on a later removal
+      }
+      wlock_t lk(mutex_);
+      compacting_ = false;
+    });
+  }
+
+  /**
+   * Remove `removed` from an index that is not shared yet. Vectors are
+   * removed in a single pass over the index, except for HNSW indexes which
+   * cannot remove vectors and are rebuilt instead.
+   */
+  static void remove_from_index(faiss::Index *index,
+                                std::vector<int64_t> &removed) {
+    // IVF indexes with a hashtable direct map remove ids of an array only
+    if (faiss::ivflib::try_extract_index_ivf(index)) {
+      index->remove_ids(faiss::IDSelectorArray(removed.size(), removed.data()));
+      return;
+    }
+
+    auto id_map = dynamic_cast<faiss::IndexIDMap2 *>(index);
+    if (!id_map || !dynamic_cast<faiss::IndexHNSW *>(id_map->index)) {
+      index->remove_ids(faiss::IDSelectorBatch(removed.size(), removed.data()));
+      return;
+    }
+
+    std::sort(removed.begin(), removed.end());
+    std::vector<float> vectors;
+    std::vector<faiss::idx_t> ids;
+    std::vector<float> vec(index->d);
+    for (faiss::idx_t i = 0; i < id_map->ntotal; i++) {
+      if (std::binary_search(removed.begin(), removed.end(), id_map->id_map[i]))
+        continue;
+      id_map->index->reconstruct(i, vec.data());
+      vectors.insert(vectors.end(), vec.begin(), vec.end());
+      ids.push_back(id_map->id_map[i]);
+    }
+    index->reset();
+    index->add_with_ids(ids.size(), vectors.data(), ids.data());
+  }
+
+  /**
+   * The metadata index is built on the first filtered query, so that loading
+   * a saved store does not read every document. Concurrent readers may race
+   * to build it, so building is serialized.
+   */
+  const metadata_index_t &get_metadata_index() {
+    wlock_t lk(metadata_index_mutex_);
+    if (!metadata_index_.has_value()) {
+      metadata_index_.emplace();
+      documents_.for_each_id([&](int64_t id) {
+        metadata_index_->insert(id, documents_.get_metadata(id));
+      });
+    }
+    return metadata_index_.value();
+  }
+
+  /**
+   * The BM25 index is built on the first hybrid query, in the same way as the
+   * metadata index. It is kept only in memory and rebuilt after loading.
+   */
+  const bm25_index_t &get_bm25_index() {
+    wlock_t lk(bm25_index_mutex_);
+    if (!bm25_index_.has_value()) {
+      bm25_index_.emplace();
+      documents_.for_each_id([&](int64_t id) {
+        bm25_index_->insert(id,
+                            bm25_index_t::analyze(documents_.get_document(id)));
+      });
+    }
+    return bm25_index_.value();
+  }
+
   bool is_valid_embedding(std::shared_ptr<const ailoy::ndarray_t> embedding) {
     // should be 1-D array with length same as dimension
-    return embedding->shape.size() == 1 && embedding->shape[0] == index_.d;
+    return embedding->shape.size() == 1 && embedding->shape[0] == index_->d;
+  }
+
+  /**
+   * Add embeddings to the index, or buffer them until there are enough
+   * vectors to train the index.
+   */
+  void add_embeddings(size_t n, const float *embeddings, const int64_t *ids) {
+    ensure_writable();
+    if (raw_vectors_)
+      raw_vectors_->insert(n, embeddings, ids);
+    if (index_->is_trained) {
+      index_->add_with_ids(n, embeddings, ids);
+      if (compaction_log_.has_value()) {
+        compaction_log_->vectors.insert(compaction_log_->vectors.end(),
+                                        embeddings, embeddings + n * index_->d);
+        compaction_log_->ids.insert(compaction_log_->ids.end(), ids, ids + n);
+      }
+      return;
+    }
+
+    pending_vectors_.insert(pending_vectors_.end(), embeddings,
+                            embeddings + n * index_->d);
+    pending_ids_.insert(pending_ids_.end(), ids, ids + n);
+    if (pending_ids_.size() < train_size_)
+      return;
+
+    try {
+      index_->train(pending_ids_.size(), pending_vectors_.data());
+    } catch (const faiss::FaissException &e) {
+      // drop the vectors being added, which have no documents yet, so that
+      // the store is left as it was
+      pending_ids_.resize(pending_ids_.size() - n);
+      pending_vectors_.resize(pending_vectors_.size() - n * index_->d);
+      if (raw_vectors_) {
+        for (size_t i = 0; i < n; i++)
+          raw_vectors_->erase(ids[i]);
+      }
+      throw ailoy::runtime_error(std::string("[FAISS] failed to train index: ") +
+                                 e.what());
+    }
+    index_->add_with_ids(pending_ids_.size(), pending_vectors_.data(),
+                         pending_ids_.data());
+    pending_ids_.clear();
+    pending_vectors_.clear();
   }
 
-  faiss::IndexFlatIP index_flat_;
-  faiss::IndexIDMap2 index_;
+  /**
+   * Search `n` queries at once, so that faiss can parallelize over queries.
+   * Called with the store lock held at least shared.
+   */
+  std::vector<std::vector<vector_store_retrieve_result_t>>
+  search(size_t n, const float *queries, uint64_t top_k,
+         const vector_store_retrieve_params_t &params) {
+    std::vector<std::vector<std::pair<float, faiss::idx_t>>> candidates(n);
+
+    // Pre-filter with metadata, so that only matching ids are scored
+    std::vector<int64_t> selected;
+    std::unique_ptr<faiss::IDSelector> selector;
+    std::unique_ptr<faiss::IDSelectorBitmap> tombstone_selector;
+    faiss::idx_t num_candidates = index_->ntotal - num_tombstones_;
+    if (params.filter.has_value()) {
+      selected = get_metadata_index().select(params.filter.value());
+      if (selected.empty())
+        return std::vector<std::vector<vector_store_retrieve_result_t>>(n);
+      selector = std::make_unique<faiss::IDSelectorBatch>(selected.size(),
+                                                          selected.data());
+      num_candidates = std::min<faiss::idx_t>(num_candidates, selected.size());
+    } else if (num_tombstones_ > 0) {
+      // removed ids are never selected by filters, so they are skipped
+      // explicitly only without one
+      tombstone_selector = std::make_unique<faiss::IDSelectorBitmap>(
+          tombstones_.size(), tombstones_.data());
+      selector =
+          std::make_unique<faiss::IDSelectorNot>(tombstone_selector.get());
+    }
+
+    // fetch more candidates from the index when they are re-ranked
+    uint64_t num_fetched = raw_vectors_ ? top_k * rerank_ : top_k;
+    faiss::idx_t min_k =
+        std::min(num_candidates, static_cast<faiss::idx_t>(num_fetched));
+    if (min_k > 0) {
+      std::vector<float> similarities(n * min_k);
+      std::vector<faiss::idx_t> ids(n * min_k);
+      auto search_params = get_search_params(params);
+      if (selector) {
+        if (!search_params)
+          search_params = std::make_unique<faiss::SearchParameters>();
+        search_params->sel = selector.get();
+      }
+      index_->search(n, queries, min_k, similarities.data(), ids.data(),
+                     search_params.get());
+      for (size_t q = 0; q < n; q++) {
+        for (faiss::idx_t i = q * min_k; i < (q + 1) * min_k; i++) {
+          // approximate indexes return -1 when fewer than k results are found
+          if (ids[i] >= 0)
+            candidates[q].emplace_back(similarities[i], ids[i]);
+        }
+      }
+    }
+
+    // vectors waiting for index training are scanned exhaustively
+    for (size_t i = 0; i < pending_ids_.size(); i++) {
+      if (params.filter.has_value() &&
+          !std::binary_search(selected.begin(), selected.end(),
+                              pending_ids_[i]))
+        continue;
+      auto pending_vec = pending_vectors_.begin() + i * index_->d;
+      for (size_t q = 0; q < n; q++) {
+        const float *query = queries + q * index_->d;
+        float similarity = std::inner_product(query, query + index_->d,
+                                              pending_vec, 0.0f);
+        candidates[q].emplace_back(similarity, pending_ids_[i]);
+      }
+    }
+
+    // exact similarities from the full-precision vectors
+    if (raw_vectors_) {
+      for (size_t q = 0; q < n; q++) {
+        const float *query = queries + q * index_->d;
+        for (auto &[similarity, id] : candidates[q]) {
+          if (const float *raw_vec = raw_vectors_->get(id))
+            similarity = std::inner_product(query, query + index_->d,
+                                            raw_vec, 0.0f);
+        }
+      }
+    }
+
+    std::vector<std::vector<vector_store_retrieve_result_t>> results(n);
+    for (size_t q = 0; q < n; q++) {
+      size_t num_results = std::min<size_t>(candidates[q].size(), top_k);
+      std::partial_sort(
+          candidates[q].begin(), candidates[q].begin() + num_results,
+          candidates[q].end(),
+          [](const auto &a, const auto &b) { return a.first > b.first; });
+
+      results[q].resize(num_results);
+      for (size_t i = 0; i < num_results; i++) {
+        auto [similarity, id] = candidates[q][i];
+        // documents and metadata are decoded only for the top-k
+        results[q][i] = {.id = std::to_string(id),
+                         .document = documents_.get_document(id),
+                         .metadata = documents_.get_metadata(id),
+                         .similarity = similarity};
+      }
+    }
+    return results;
+  }
+
+  std::unique_ptr<faiss::SearchParameters>
+  get_search_params(const vector_store_retrieve_params_t &params) {
+    if (params.ef_search.has_value() &&
+        dynamic_cast<faiss::IndexHNSW *>(base_index_)) {
+      auto rv = std::make_unique<faiss::SearchParametersHNSW>();
+      rv->efSearch = params.ef_search.value();
+      return rv;
+    }
+    if (params.nprobe.has_value() &&
+        faiss::ivflib::try_extract_index_ivf(base_index_)) {
+      auto rv = std::make_unique<faiss::SearchParametersIVF>();
+      rv->nprobe = params.nprobe.value();
+      return rv;
+    }
+    return nullptr;
+  }
+
+  // Index holding external ids (either an IVF index or an id map wrapping
+  // `base_index_`)
+  std::unique_ptr<faiss::Index> index_;
+  faiss::Index *base_index_;
+  size_t train_size_;
+  std::vector<float> pending_vectors_;
+  std::vector<int64_t> pending_ids_;
   std::atomic<int64_t> id_counter_{0};
-  std::unordered_map<int64_t, document_store_t> document_store_;
+  faiss_document_store_t documents_;
+  // Directory the store was loaded from or saved into
+  fs::path source_path_;
+  std::optional<metadata_index_t> metadata_index_;
+  mutex_t metadata_index_mutex_;
+  std::optional<bm25_index_t> bm25_index_;
+  mutex_t bm25_index_mutex_;
+  // Re-ranking factor, where 0 disables re-ranking
+  size_t rerank_ = 0;
+  std::optional<faiss_raw_vectors_t> raw_vectors_;
+  // Whether the inverted lists are still mapped from the saved index
+  bool mapped_ = false;
+
+  // Bitmap of ids removed from documents but still in the index
+  std::vector<uint8_t> tombstones_;
+  size_t num_tombstones_ = 0;
+  // Fraction of removed vectors in the index that starts a compaction
+  double compaction_threshold_ = 0.2;
+  // Vectors added while a compaction is in progress, replayed onto the
+  // compacted index
+  struct compaction_log_t {
+    std::vector<float> vectors;
+    std::vector<int64_t> ids;
+  };
+  std::optional<compaction_log_t> compaction_log_;
+  // Incremented by `clear`, so that compactions started before are discarded
+  uint64_t generation_ = 0;
+  bool compacting_ = false;
+  std::thread compaction_thread_;
+  std::mutex compaction_mutex_;
+
+  // External key -> id, and its reverse
+  std::unordered_map<std::string, int64_t> keys_;
+  std::unordered_map<int64_t, std::string> id_keys_;
+
+  mutex_t mutex_;
 };
 
-faiss_vector_store_t::faiss_vector_store_t(const size_t dimension) {
-  impl_ = new faiss_vector_store_impl_t(dimension);
+faiss_vector_store_t::faiss_vector_store_t(const size_t dimension)
+    : faiss_vector_store_t(faiss_vector_store_config_t{.dimension = dimension}) {
+}
+
+faiss_vector_store_t::faiss_vector_store_t(
+    const faiss_vector_store_config_t &config) {
+  init(config, true);
 }
 
 faiss_vector_store_t::faiss_vector_store_t(
     std::shared_ptr<const value_t> attrs) {
-  auto dimension = attrs->as<map_t>()->at<uint_t>("dimension");
-  impl_ = new faiss_vector_store_impl_t(*dimension);
+  if (!attrs->is_type_of<map_t>())
+    throw ailoy::runtime_error("[FAISS] component attrs should be map type");
+  auto attrs_map = attrs->as<map_t>();
+
+  auto get_uint_attr = [&](const std::string &key) -> std::optional<size_t> {
+    if (!attrs_map->contains(key))
+      return std::nullopt;
+    auto attr = attrs_map->at(key);
+    if (attr->is_type_of<uint_t>())
+      return *attr->as<uint_t>();
+    else if (attr->is_type_of<int_t>())
+      return *attr->as<int_t>();
+    throw ailoy::runtime_error("[FAISS] " + key +
+                               " should be a type of unsigned integer");
+  };
+
+  faiss_vector_store_config_t config;
+  auto dimension = get_uint_attr("dimension");
+  config.dimension = dimension.value_or(0);
+  if (attrs_map->contains("index")) {
+    if (!attrs_map->at("index")->is_type_of<string_t>())
+      throw ailoy::runtime_error("[FAISS] index should be a type of string");
+    config.index = *attrs_map->at<string_t>("index");
+  }
+  config.ef_search = get_uint_attr("ef_search");
+  config.nprobe = get_uint_attr("nprobe");
+  config.train_size = get_uint_attr("train_size");
+  if (attrs_map->contains("storage")) {
+    if (!attrs_map->at("storage")->is_type_of<string_t>())
+      throw ailoy::runtime_error("[FAISS] storage should be a type of string");
+    config.storage = *attrs_map->at<string_t>("storage");
+  }
+  config.rerank = get_uint_attr("rerank");
+  if (attrs_map->contains("compaction_threshold")) {
+    auto threshold = attrs_map->at("compaction_threshold");
+    if (threshold->is_type_of<float_t>())
+      config.compaction_threshold = *threshold->as<float_t>();
+    else if (threshold->is_type_of<double_t>())
+      config.compaction_threshold = *threshold->as<double_t>();
+    else
+      throw ailoy::runtime_error(
+          "[FAISS] compaction_threshold should be a type of float");
+  }
+  if (attrs_map->contains("path")) {
+    if (!attrs_map->at("path")->is_type_of<string_t>())
+      throw ailoy::runtime_error("[FAISS] path should be a type of string");
+    config.path = *attrs_map->at<string_t>("path");
+  }
+
+  init(config, dimension.has_value());
 }
 
-faiss_vector_store_t::~faiss_vector_store_t() {
-  if (impl_) {
-    delete impl_;
-    impl_ = nullptr;
+void faiss_vector_store_t::init(const faiss_vector_store_config_t &config,
+                                bool check_dimension) {
+  path_ = config.path;
+  if (path_.has_value() && fs::exists(fs::path(path_.value()) / "store.json")) {
+    auto loaded = faiss_vector_store_impl_t::load(path_.value());
+    if (check_dimension && loaded->dimension() != config.dimension)
+      throw ailoy::runtime_error(
+          "[FAISS] dimension of the saved store is " +
+          std::to_string(loaded->dimension()) + ", not " +
+          std::to_string(config.dimension));
+    impl_ = std::move(loaded);
+    return;
   }
+
+  // dimension can be omitted only when opening a saved store
+  if (!check_dimension)
+    throw ailoy::runtime_error("[FAISS] dimension should be specified");
+  impl_ = std::make_shared<faiss_vector_store_impl_t>(config);
+}
+
+faiss_vector_store_t::~faiss_vector_store_t() = default;
+
+std::shared_ptr<faiss_vector_store_impl_t>
+faiss_vector_store_t::get_impl() const {
+  rlock_t lk(impl_mutex_);
+  return impl_;
 }
 
 std::string
 faiss_vector_store_t::add_vector(const vector_store_add_input_t &input) {
-  return impl_->add_vector(input);
+  return get_impl()->add_vector(input);
 }
 
 std::vector<std::string> faiss_vector_store_t::add_vectors(
     std::vector<vector_store_add_input_t> &inputs) {
-  return impl_->add_vectors(inputs);
+  return get_impl()->add_vectors(inputs);
 }
 
 std::optional<vector_store_get_result_t>
 faiss_vector_store_t::get_by_id(const std::string &id) {
-  return impl_->get_by_id(id);
+  return get_impl()->get_by_id(id);
 }
 
 std::vector<vector_store_retrieve_result_t> faiss_vector_store_t::retrieve(
-    std::shared_ptr<const ailoy::ndarray_t> query_embedding, uint64_t k) {
-  return impl_->retrieve(query_embedding, k);
+    std::shared_ptr<const ailoy::ndarray_t> query_embedding, uint64_t k,
+    const vector_store_retrieve_params_t &params) {
+  return get_impl()->retrieve(query_embedding, k, params);
+}
+
+std::vector<std::vector<vector_store_retrieve_result_t>>
+faiss_vector_store_t::retrieve_many(
+    std::shared_ptr<const ailoy::ndarray_t> query_embeddings, uint64_t k,
+    const vector_store_retrieve_params_t &params) {
+  return get_impl()->retrieve_many(query_embeddings, k, params);
+}
+
+std::vector<vector_store_retrieve_result_t>
+faiss_vector_store_t::hybrid_retrieve(
+    std::shared_ptr<const ailoy::ndarray_t> query_embedding,
+    const std::string &query_text, uint64_t k,
+    const vector_store_retrieve_params_t &params,
+    const vector_store_hybrid_params_t &hybrid_params) {
+  return get_impl()->hybrid_retrieve(query_embedding, query_text, k, params,
+                                     hybrid_params);
+}
+
+std::vector<std::string> faiss_vector_store_t::upsert_vectors(
+    const std::vector<std::string> &keys,
+    std::vector<vector_store_add_input_t> &inputs) {
+  return get_impl()->add_vectors(inputs, &keys);
 }
 
 void faiss_vector_store_t::remove_vector(const std::string &id) {
-  impl_->remove_vector(id);
+  get_impl()->remove_vector(id);
 }
 
-void faiss_vector_store_t::clear() { impl_->clear(); }
+void faiss_vector_store_t::clear() { get_impl()->clear(); }
+
+void faiss_vector_store_t::compact() { get_impl()->compact(); }
+
+void faiss_vector_store_t::save(const std::optional<std::string> &path) {
+  if (!path.has_value() && !path_.has_value())
+    throw ailoy::runtime_error("[FAISS] path to save should be specified");
+  get_impl()->save(path.value_or(path_.value_or("")));
+}
+
+void faiss_vector_store_t::load(const std::string &path) {
+  // calls still holding the previous store finish on it
+  std::shared_ptr<faiss_vector_store_impl_t> loaded =
+      faiss_vector_store_impl_t::load(path);
+  wlock_t lk(impl_mutex_);
+  impl_ = std::move(loaded);
+}
 
 } // namespace ailoy
@@ -1,14 +1,49 @@
 #pragma once
 
 #include "../vector_store.hpp"
+#include "thread.hpp"
 
 namespace ailoy {
 
 class faiss_vector_store_impl_t;
 
+struct faiss_vector_store_config_t {
+  size_t dimension;
+  // Faiss index factory string, e.g. "Flat", "HNSW32", "IVF1024,Flat",
+  // "IVF1024,PQ16" or "SQ8"
+  std::string index = "Flat";
+  // Default efSearch of HNSW indexes
+  std::optional<size_t> ef_search = std::nullopt;
+  // Default nprobe of IVF indexes
+  std::optional<size_t> nprobe = std::nullopt;
+  // Number of vectors buffered before training indexes that need it
+  std::optional<size_t> train_size = std::nullopt;
+  // Encoding of stored vectors, replacing the "Flat" encoding of `index`:
+  // "float32", "float16", "int8" (8 bits per dimension, scaled by the range
+  // of each dimension) or "pq<M>" (product quantization into M bytes)
+  std::optional<std::string> storage = std::nullopt;
+  // Keep full-precision vectors next to the quantized index, and re-rank
+  // `rerank * top_k` candidates of the index with exact similarities
+  std::optional<size_t> rerank = std::nullopt;
+  // Removed vectors are skipped by searches until the index is compacted in
+  // the background, which starts once this fraction of the index is removed.
+  // Defaults to 0.2.
+  std::optional<double> compaction_threshold = std::nullopt;
+  // Directory to save the store into. The store is loaded from it if a store
+  // was already saved there.
+  std::optional<std::string> path = std::nullopt;
+};
+
+/**
+ * @brief Vector store on a faiss index
+ * @details Every member function may be called from multiple threads.
+ * Retrievals run concurrently with each other, and `load` replaces the store
+ * without waiting for calls in progress.
+ */
 class faiss_vector_store_t : public vector_store_t {
 public:
   faiss_vector_store_t(const size_t dimension);
+  faiss_vector_store_t(const faiss_vector_store_config_t &config);
   faiss_vector_store_t(std::shared_ptr<const value_t> attrs);
   ~faiss_vector_store_t();
 
@@ -21,14 +56,65 @@ public:
   get_by_id(const std::string &id) override;
 
   std::vector<vector_store_retrieve_result_t>
-  retrieve(embedding_t query_embedding, uint64_t top_k) override;
+  retrieve(embedding_t query_embedding, uint64_t top_k,
+           const vector_store_retrieve_params_t &params = {}) override;
+
+  std::vector<std::vector<vector_store_retrieve_result_t>>
+  retrieve_many(embedding_t query_embeddings, uint64_t top_k,
+                const vector_store_retrieve_params_t &params = {}) override;
+
+  /**
+   * @brief Retrieve with both the query embedding and BM25 keyword search
+   * over documents, and fuse the two rankings.
+   * @details The BM25 index is built on the first call and maintained from
+   * then on.
+   */
+  std::vector<vector_store_retrieve_result_t>
+  hybrid_retrieve(embedding_t query_embedding, const std::string &query_text,
+                  uint64_t top_k,
+                  const vector_store_retrieve_params_t &params = {},
+                  const vector_store_hybrid_params_t &hybrid_params = {});
+
+  /**
+   * @brief Add vectors under external keys. Vectors already stored under the
+   * same keys are removed.
+   * @return Unique identifiers of the added vectors
+   */
+  std::vector<std::string>
+  upsert_vectors(const std::vector<std::string> &keys,
+                 std::vector<vector_store_add_input_t> &inputs);
 
   void remove_vector(const std::string &id) override;
 
   void clear() override;
 
+  /**
+   * @brief Drop removed vectors from the index now, instead of waiting for
+   * the background compaction.
+   */
+  void compact();
+
+  /**
+   * @brief Save the index, documents and metadata into a directory.
+   * @param path Directory to save into. Defaults to the `path` of the config.
+   */
+  void save(const std::optional<std::string> &path = std::nullopt);
+
+  /**
+   * @brief Replace the contents of the store with a store saved by `save`.
+   * @param path Directory to load from
+   */
+  void load(const std::string &path);
+
 private:
-  faiss_vector_store_impl_t *impl_;
+  void init(const faiss_vector_store_config_t &config, bool check_dimension);
+
+  std::shared_ptr<faiss_vector_store_impl_t> get_impl() const;
+
+  std::shared_ptr<faiss_vector_store_impl_t> impl_;
+  mutable mutex_t impl_mutex_;
+
+  std::optional<std::string> path_;
 };
 
 } // namespace ailoy
@@ -1,6 +1,19 @@
 #include "file_util.hpp"
 
+#include <algorithm>
 #include <fstream>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "exception.hpp"
 
 namespace ailoy {
 namespace utils {
@@ -19,5 +32,117 @@ std::string LoadBytesFromFile(const std::filesystem::path &path) {
   return data;
 }
 
+mapped_file_t::mapped_file_t(const std::filesystem::path &path) {
+  size_ = std::filesystem::file_size(path);
+  // empty files cannot be mapped
+  if (size_ == 0)
+    return;
+#ifdef _WIN32
+  file_ = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ,
+                      nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    file_ = nullptr;
+    throw ailoy::runtime_error("Cannot open " + path.string());
+  }
+  mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_)
+    data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+  if (!data_) {
+    unmap();
+    throw ailoy::runtime_error("Cannot map " + path.string());
+  }
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw ailoy::runtime_error("Cannot open " + path.string());
+  void *data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping stays valid after closing the file
+  close(fd);
+  if (data == MAP_FAILED)
+    throw ailoy::runtime_error("Cannot map " + path.string());
+  data_ = data;
+#endif
+}
+
+mapped_file_t::mapped_file_t(mapped_file_t &&other) noexcept {
+  *this = std::move(other);
+}
+
+mapped_file_t &mapped_file_t::operator=(mapped_file_t &&other) noexcept {
+  if (this != &other) {
+    unmap();
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+#ifdef _WIN32
+    std::swap(file_, other.file_);
+    std::swap(mapping_, other.mapping_);
+#endif
+  }
+  return *this;
+}
+
+mapped_file_t::~mapped_file_t() { unmap(); }
+
+void mapped_file_t::release(size_t offset, size_t size) {
+#ifndef _WIN32
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t begin = (offset + page_size - 1) / page_size * page_size;
+  size_t end = std::min(offset + size, size_) / page_size * page_size;
+  if (data_ && begin < end)
+    madvise(static_cast<char *>(data_) + begin, end - begin, MADV_DONTNEED);
+#endif
+}
+
+void mapped_file_t::unmap() {
+#ifdef _WIN32
+  if (data_)
+    UnmapViewOfFile(data_);
+  if (mapping_)
+    CloseHandle(mapping_);
+  if (file_)
+    CloseHandle(file_);
+  file_ = nullptr;
+  mapping_ = nullptr;
+#else
+  if (data_)
+    munmap(data_, size_);
+#endif
+  data_ = nullptr;
+  size_ = 0;
+}
+
 } // namespace utils
+
+std::filesystem::path get_cache_root() {
+  std::filesystem::path cache_root;
+  if (std::getenv("AILOY_CACHE_ROOT")) {
+    // Check environment variable
+    cache_root = std::filesystem::path(std::getenv("AILOY_CACHE_ROOT"));
+  } else {
+    // Set to default cache root
+#if defined(_WIN32)
+    if (std::getenv("LOCALAPPDATA"))
+      cache_root =
+          std::filesystem::path(std::getenv("LOCALAPPDATA")) / "ailoy";
+#else
+    if (std::getenv("HOME"))
+      cache_root =
+          std::filesystem::path(std::getenv("HOME")) / ".cache" / "ailoy";
+#endif
+  }
+  if (cache_root.empty()) {
+    throw exception("Cannot get cache root");
+  }
+
+  try {
+    // Create a directory
+    // It returns false if already exists
+    std::filesystem::create_directories(cache_root);
+  } catch (const std::filesystem::filesystem_error &e) {
+    throw exception("cache root directory creation failed");
+  }
+
+  return cache_root;
+}
+
 } // namespace ailoy
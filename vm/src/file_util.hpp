@@ -1,3 +1,5 @@
+#pragma once
+
 #include <filesystem>
 
 namespace ailoy {
@@ -5,5 +7,53 @@ namespace utils {
 
 std::string LoadBytesFromFile(const std::filesystem::path &path);
 
+/**
+ * @brief Read-only memory mapping of a whole file
+ */
+class mapped_file_t {
+public:
+  mapped_file_t() = default;
+
+  /**
+   * @throw ailoy::runtime_error if the file cannot be mapped
+   */
+  explicit mapped_file_t(const std::filesystem::path &path);
+
+  mapped_file_t(const mapped_file_t &) = delete;
+  mapped_file_t &operator=(const mapped_file_t &) = delete;
+  mapped_file_t(mapped_file_t &&other) noexcept;
+  mapped_file_t &operator=(mapped_file_t &&other) noexcept;
+
+  ~mapped_file_t();
+
+  const void *data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+  /**
+   * @brief Drop the pages in a range of the mapping from memory, which are
+   * read from the file again when accessed
+   * @details Pages partially in the range are kept. Does nothing on Windows.
+   */
+  void release(size_t offset, size_t size);
+
+private:
+  void unmap();
+
+  void *data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void *file_ = nullptr;
+  void *mapping_ = nullptr;
+#endif
+};
+
 } // namespace utils
+
+/**
+ * @brief Get the cache root directory. If the AILOY_CACHE_ROOT environment
+ * variable is set, it will be used; otherwise, the default path will be used.
+ */
+std::filesystem::path get_cache_root();
+
 } // namespace ailoy
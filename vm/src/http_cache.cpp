@@ -0,0 +1,486 @@
+#include "http_cache.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <ctime>
+#include <format>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <nlohmann/json.hpp>
+
+#include "exception.hpp"
+#include "file_util.hpp"
+
+namespace ailoy {
+
+namespace fs = std::filesystem;
+using std::chrono::system_clock;
+
+static std::string to_lower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return s;
+}
+
+static std::string_view trim(std::string_view s) {
+  size_t begin = s.find_first_not_of(" \t");
+  if (begin == std::string_view::npos)
+    return {};
+  size_t end = s.find_last_not_of(" \t");
+  return s.substr(begin, end - begin + 1);
+}
+
+/**
+ * Header names are case-insensitive, while the maps keep them as sent
+ */
+static std::optional<std::string>
+find_header(const std::unordered_map<std::string, std::string> &headers,
+            const std::string &name) {
+  auto lower_name = to_lower(name);
+  for (const auto &[key, value] : headers) {
+    if (to_lower(key) == lower_name)
+      return value;
+  }
+  return std::nullopt;
+}
+
+static void set_header(std::unordered_map<std::string, std::string> &headers,
+                       const std::string &name, const std::string &value) {
+  auto lower_name = to_lower(name);
+  std::erase_if(headers, [&](const auto &header) {
+    return to_lower(header.first) == lower_name;
+  });
+  headers.insert_or_assign(name, value);
+}
+
+/**
+ * Split a comma separated header value, like that of `Cache-Control` or
+ * `Vary`, into lowercase names and their values if any
+ */
+static std::unordered_map<std::string, std::optional<std::string>>
+parse_directives(const std::optional<std::string> &value) {
+  std::unordered_map<std::string, std::optional<std::string>> directives;
+  if (!value.has_value())
+    return directives;
+  std::string_view rest = value.value();
+  while (!rest.empty()) {
+    size_t comma = rest.find(',');
+    auto item = trim(rest.substr(0, comma));
+    rest = comma == std::string_view::npos ? "" : rest.substr(comma + 1);
+    if (item.empty())
+      continue;
+    size_t eq = item.find('=');
+    auto name = to_lower(std::string(trim(item.substr(0, eq))));
+    if (eq == std::string_view::npos)
+      directives.insert_or_assign(name, std::nullopt);
+    else {
+      auto arg = trim(item.substr(eq + 1));
+      if (arg.size() >= 2 && arg.front() == '"' && arg.back() == '"')
+        arg = arg.substr(1, arg.size() - 2);
+      directives.insert_or_assign(name, std::string(arg));
+    }
+  }
+  return directives;
+}
+
+static std::optional<int64_t>
+parse_seconds(const std::optional<std::string> &s) {
+  if (!s.has_value())
+    return std::nullopt;
+  int64_t seconds;
+  auto [ptr, ec] = std::from_chars(s->data(), s->data() + s->size(), seconds);
+  if (ec != std::errc() || ptr != s->data() + s->size() || seconds < 0)
+    return std::nullopt;
+  return seconds;
+}
+
+/**
+ * Parse dates like `Sun, 06 Nov 1994 08:49:37 GMT`
+ */
+static std::optional<system_clock::time_point>
+parse_http_date(const std::optional<std::string> &s) {
+  if (!s.has_value())
+    return std::nullopt;
+  std::tm tm = {};
+  std::istringstream ss(s.value());
+  ss.imbue(std::locale::classic());
+  ss >> std::get_time(&tm, "%a, %d %b %Y %H:%M:%S");
+  if (ss.fail())
+    return std::nullopt;
+#ifdef _WIN32
+  time_t t = _mkgmtime(&tm);
+#else
+  time_t t = timegm(&tm);
+#endif
+  return system_clock::from_time_t(t);
+}
+
+static std::vector<std::string> vary_names(const http_response_t &resp) {
+  std::vector<std::string> names;
+  for (const auto &[name, _] :
+       parse_directives(find_header(resp.headers, "Vary")))
+    names.push_back(name);
+  return names;
+}
+
+/**
+ * How long a response stays fresh from when it was generated
+ */
+static system_clock::duration
+freshness_lifetime(const http_response_t &resp,
+                   system_clock::time_point stored_at) {
+  auto directives =
+      parse_directives(find_header(resp.headers, "Cache-Control"));
+  if (directives.contains("no-cache"))
+    return system_clock::duration::zero();
+  if (directives.contains("max-age")) {
+    auto max_age = parse_seconds(directives.at("max-age"));
+    return std::chrono::seconds(max_age.value_or(0));
+  }
+  // an invalid `Expires`, like 0, means already expired
+  if (find_header(resp.headers, "Expires").has_value()) {
+    auto expires = parse_http_date(find_header(resp.headers, "Expires"));
+    auto date = parse_http_date(find_header(resp.headers, "Date"));
+    if (!expires.has_value())
+      return system_clock::duration::zero();
+    return std::max(system_clock::duration::zero(),
+                    expires.value() - date.value_or(stored_at));
+  }
+  return system_clock::duration::zero();
+}
+
+static bool is_cacheable(const http_request_t &req,
+                         const http_response_t &resp) {
+  if (resp.status_code != 200)
+    return false;
+  auto directives =
+      parse_directives(find_header(resp.headers, "Cache-Control"));
+  if (directives.contains("no-store") || directives.contains("private"))
+    return false;
+  // the cache is shared, so a response to credentials would be served to
+  // whoever asks next, unless the server says it is for everyone
+  if ((find_header(req.headers, "Authorization").has_value() ||
+       find_header(req.headers, "Cookie").has_value()) &&
+      !directives.contains("public"))
+    return false;
+  auto names = vary_names(resp);
+  if (std::find(names.begin(), names.end(), "*") != names.end())
+    return false;
+  // a response which is never fresh is still useful with a validator
+  return freshness_lifetime(resp, system_clock::now()) >
+             system_clock::duration::zero() ||
+         find_header(resp.headers, "ETag").has_value() ||
+         find_header(resp.headers, "Last-Modified").has_value();
+}
+
+size_t http_cache_t::entry_t::size() const {
+  size_t size = key.size() + response.body.size();
+  for (const auto &[name, value] : response.headers)
+    size += name.size() + value.size();
+  for (const auto &[name, value] : vary)
+    size += name.size() + value.size();
+  return size;
+}
+
+http_cache_t::http_cache_t(const http_cache_config_t &config)
+    : config_(config) {}
+
+http_cache_t &http_cache_t::global() {
+  static http_cache_t cache;
+  return cache;
+}
+
+http_response_t http_cache_t::fetch(const http_request_t &req,
+                                    const send_t &send) {
+  bool use_disk = req.cache == http_cache_mode_t::disk;
+  auto req_directives =
+      parse_directives(find_header(req.headers, "Cache-Control"));
+  if (req.method != "GET" || req_directives.contains("no-store"))
+    return send(req);
+
+  std::string key = req.method + " " + req.url;
+  auto entry = lookup(key, use_disk);
+  if (entry.has_value()) {
+    for (const auto &[name, value] : entry->vary) {
+      if (find_header(req.headers, name).value_or("") != value) {
+        entry.reset();
+        break;
+      }
+    }
+  }
+
+  auto now = system_clock::now();
+  std::optional<http_response_t> resp;
+  if (entry.has_value()) {
+    auto age = std::chrono::seconds(
+                   parse_seconds(find_header(entry->response.headers, "Age"))
+                       .value_or(0)) +
+               (now - entry->stored_at);
+    if (!req_directives.contains("no-cache") &&
+        freshness_lifetime(entry->response, entry->stored_at) > age) {
+      std::lock_guard lock(mutex_);
+      stats_.hits++;
+      return entry->response;
+    }
+
+    auto etag = find_header(entry->response.headers, "ETag");
+    auto last_modified = find_header(entry->response.headers, "Last-Modified");
+    if (etag.has_value() || last_modified.has_value()) {
+      http_request_t conditional = req;
+      if (etag.has_value())
+        set_header(conditional.headers, "If-None-Match", etag.value());
+      if (last_modified.has_value())
+        set_header(conditional.headers, "If-Modified-Since",
+                   last_modified.value());
+      resp = send(conditional);
+      if (resp->status_code == 304) {
+        // the headers of 304 replace the stored ones, except those about
+        // the body which is not sent
+        for (const auto &[name, value] : resp->headers) {
+          auto lower_name = to_lower(name);
+          if (lower_name != "content-length" &&
+              lower_name != "transfer-encoding")
+            set_header(entry->response.headers, name, value);
+        }
+        entry->stored_at = now;
+        auto revalidated = entry->response;
+        store(std::move(entry.value()), use_disk);
+        std::lock_guard lock(mutex_);
+        stats_.revalidations++;
+        return revalidated;
+      }
+    }
+  }
+
+  if (!resp.has_value())
+    resp = send(req);
+  {
+    std::lock_guard lock(mutex_);
+    stats_.misses++;
+  }
+  if (is_cacheable(req, resp.value())) {
+    entry_t new_entry{.key = key, .response = resp.value(), .stored_at = now};
+    for (const auto &name : vary_names(resp.value()))
+      new_entry.vary.emplace_back(name,
+                                  find_header(req.headers, name).value_or(""));
+    store(std::move(new_entry), use_disk);
+  } else if (entry.has_value())
+    remove(key, use_disk);
+  return resp.value();
+}
+
+http_cache_stats_t http_cache_t::stats() {
+  std::lock_guard lock(mutex_);
+  auto stats = stats_;
+  stats.memory_entries = entries_.size();
+  stats.memory_bytes = memory_bytes_;
+  return stats;
+}
+
+void http_cache_t::clear() {
+  {
+    std::lock_guard lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    memory_bytes_ = 0;
+    stats_ = {};
+  }
+  std::lock_guard lock(disk_mutex_);
+  disk_size_.reset();
+  try {
+    auto dir = disk_file("").parent_path();
+    fs::remove_all(dir);
+  } catch (...) {
+    // nothing on disk to clear
+  }
+}
+
+std::optional<http_cache_t::entry_t>
+http_cache_t::lookup(const std::string &key, bool use_disk) {
+  {
+    std::lock_guard lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return *it->second;
+    }
+  }
+  if (!use_disk)
+    return std::nullopt;
+  auto entry = read_disk(key);
+  if (entry.has_value())
+    store(entry.value(), false);
+  return entry;
+}
+
+void http_cache_t::store(entry_t entry, bool use_disk) {
+  if (use_disk)
+    write_disk(entry);
+
+  std::lock_guard lock(mutex_);
+  auto it = index_.find(entry.key);
+  if (it != index_.end()) {
+    memory_bytes_ -= it->second->size();
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+  size_t size = entry.size();
+  if (size > config_.memory_capacity)
+    return;
+  entries_.push_front(std::move(entry));
+  index_.insert_or_assign(entries_.front().key, entries_.begin());
+  memory_bytes_ += size;
+  while (memory_bytes_ > config_.memory_capacity) {
+    memory_bytes_ -= entries_.back().size();
+    index_.erase(entries_.back().key);
+    entries_.pop_back();
+  }
+}
+
+void http_cache_t::remove(const std::string &key, bool use_disk) {
+  {
+    std::lock_guard lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      memory_bytes_ -= it->second->size();
+      entries_.erase(it->second);
+      index_.erase(it);
+    }
+  }
+  if (!use_disk)
+    return;
+  std::lock_guard lock(disk_mutex_);
+  try {
+    auto path = disk_file(key);
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (fs::remove(path) && !ec && disk_size_.has_value())
+      *disk_size_ -= std::min<uint64_t>(size, *disk_size_);
+  } catch (...) {
+  }
+}
+
+/**
+ * An entry on disk is a line of JSON about the response, followed by its
+ * body as is
+ */
+std::optional<http_cache_t::entry_t>
+http_cache_t::read_disk(const std::string &key) {
+  std::lock_guard lock(disk_mutex_);
+  try {
+    std::ifstream ifs(disk_file(key), std::ios::binary);
+    if (!ifs)
+      return std::nullopt;
+    std::string meta_line;
+    std::getline(ifs, meta_line);
+    auto meta = nlohmann::json::parse(meta_line);
+    // files are named by the hash of keys, which may collide
+    if (meta["key"] != key)
+      return std::nullopt;
+
+    entry_t entry{.key = key};
+    entry.response.status_code = meta["status_code"];
+    entry.response.headers = meta["headers"];
+    entry.vary = meta["vary"];
+    entry.stored_at = system_clock::time_point(
+        std::chrono::seconds(meta["stored_at"].get<int64_t>()));
+    entry.response.body.assign(std::istreambuf_iterator<char>(ifs), {});
+    return entry;
+  } catch (...) {
+    // a broken entry is as good as none
+    return std::nullopt;
+  }
+}
+
+void http_cache_t::write_disk(const entry_t &entry) {
+  if (entry.size() > config_.disk_capacity)
+    return;
+  std::lock_guard lock(disk_mutex_);
+  try {
+    auto path = disk_file(entry.key);
+    nlohmann::json meta = {
+        {"key", entry.key},
+        {"status_code", entry.response.status_code},
+        {"headers", entry.response.headers},
+        {"vary", entry.vary},
+        {"stored_at", std::chrono::duration_cast<std::chrono::seconds>(
+                          entry.stored_at.time_since_epoch())
+                          .count()},
+    };
+    // the directory is scanned once, and the size is kept up to date after
+    if (!disk_size_.has_value())
+      disk_size_ = prune_disk(path.parent_path(), config_.disk_capacity, {});
+
+    // written aside and renamed, so that readers never see a partial file
+    auto tmp_path = path;
+    tmp_path += ".tmp";
+    {
+      std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+      ofs << meta.dump() << '\n';
+      ofs.write(entry.response.body.data(), entry.response.body.size());
+      if (!ofs)
+        return;
+    }
+    std::error_code ec;
+    auto old_size = fs::file_size(path, ec);
+    if (!ec)
+      *disk_size_ -= std::min<uint64_t>(old_size, *disk_size_);
+    *disk_size_ += fs::file_size(tmp_path);
+    fs::rename(tmp_path, path);
+
+    // pruned below the capacity, so that it is not scanned on every write
+    if (*disk_size_ > config_.disk_capacity)
+      disk_size_ =
+          prune_disk(path.parent_path(), config_.disk_capacity / 4 * 3, path);
+  } catch (...) {
+    // the disk tier is best effort, and is scanned again after a failure
+    disk_size_.reset();
+  }
+}
+
+uint64_t http_cache_t::prune_disk(const fs::path &dir, uint64_t target,
+                                  const fs::path &keep) {
+  std::vector<std::pair<fs::file_time_type, fs::path>> files;
+  uint64_t total_size = 0;
+  for (const auto &file : fs::directory_iterator(dir)) {
+    if (!file.is_regular_file())
+      continue;
+    total_size += file.file_size();
+    files.emplace_back(file.last_write_time(), file.path());
+  }
+  std::sort(files.begin(), files.end());
+  for (const auto &[_, file] : files) {
+    if (total_size <= target)
+      break;
+    if (file == keep)
+      continue;
+    total_size -= fs::file_size(file);
+    fs::remove(file);
+  }
+  return total_size;
+}
+
+std::filesystem::path http_cache_t::disk_file(const std::string &key) {
+  auto dir = config_.disk_path.empty() ? get_cache_root() / "http"
+                                       : config_.disk_path;
+  fs::create_directories(dir);
+  return dir / std::format("{:016x}", std::hash<std::string>{}(key));
+}
+
+value_or_error_t http_cache_stats_op(std::shared_ptr<const value_t> inputs) {
+  auto stats = http_cache_t::global().stats();
+  auto outputs = create<map_t>();
+  outputs->insert_or_assign("hits", create<uint_t>(stats.hits));
+  outputs->insert_or_assign("revalidations",
+                            create<uint_t>(stats.revalidations));
+  outputs->insert_or_assign("misses", create<uint_t>(stats.misses));
+  outputs->insert_or_assign("memory_entries",
+                            create<uint_t>(stats.memory_entries));
+  outputs->insert_or_assign("memory_bytes",
+                            create<uint_t>(stats.memory_bytes));
+  return outputs;
+}
+
+} // namespace ailoy
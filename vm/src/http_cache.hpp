@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "http_request.hpp"
+
+namespace ailoy {
+
+struct http_cache_config_t {
+  // Bytes of responses kept in memory, evicting the least recently used ones
+  size_t memory_capacity = 64 * 1024 * 1024;
+  // Bytes of responses kept on disk, evicting the least recently written ones
+  size_t disk_capacity = 256 * 1024 * 1024;
+  // Directory of the disk tier, `<cache root>/http` if empty
+  std::filesystem::path disk_path;
+};
+
+struct http_cache_stats_t {
+  // Served from the cache without contacting the server
+  uint64_t hits = 0;
+  // Served from the cache after the server answered 304 Not Modified
+  uint64_t revalidations = 0;
+  // Sent to the server, either uncached or modified since
+  uint64_t misses = 0;
+  size_t memory_entries = 0;
+  size_t memory_bytes = 0;
+};
+
+/**
+ * @brief Cache of GET responses, following the freshness and validators the
+ * server sends
+ * @details Responses are keyed by method, URL and the request headers named
+ * by `Vary`. A response is fresh for `Cache-Control: max-age`, or else until
+ * `Expires`. Stale responses with an `ETag` or a `Last-Modified` are
+ * revalidated with `If-None-Match` or `If-Modified-Since`. `no-store` in the
+ * request or the response bypasses the cache, and `no-cache` always
+ * revalidates. As the cache is shared, responses marked `private`, and those
+ * to requests with `Authorization` or `Cookie` unless marked `public`, are
+ * not stored. All member functions may be called from multiple threads.
+ */
+class http_cache_t {
+public:
+  using send_t = std::function<http_response_t(const http_request_t &)>;
+
+  http_cache_t(const http_cache_config_t &config = {});
+
+  /**
+   * @brief The cache shared by the whole process
+   */
+  static http_cache_t &global();
+
+  /**
+   * @brief Answer a request from the cache, sending it with `send` when
+   * needed
+   * @details The disk tier is looked up and written only if `req.cache` is
+   * `http_cache_mode_t::disk`.
+   */
+  http_response_t fetch(const http_request_t &req, const send_t &send);
+
+  http_cache_stats_t stats();
+
+  /**
+   * @brief Drop every entry in memory and on disk, and reset the stats
+   */
+  void clear();
+
+private:
+  struct entry_t {
+    std::string key;
+    http_response_t response;
+    // Request headers named by `Vary`, with the values they had
+    std::vector<std::pair<std::string, std::string>> vary;
+    std::chrono::system_clock::time_point stored_at;
+
+    size_t size() const;
+  };
+
+  std::optional<entry_t> lookup(const std::string &key, bool use_disk);
+
+  void store(entry_t entry, bool use_disk);
+
+  void remove(const std::string &key, bool use_disk);
+
+  std::optional<entry_t> read_disk(const std::string &key);
+
+  void write_disk(const entry_t &entry);
+
+  /**
+   * @brief Remove the least recently written files of `dir` but `keep`,
+   * until their total size is at most `target`
+   * @return The total size left
+   */
+  uint64_t prune_disk(const std::filesystem::path &dir, uint64_t target,
+                      const std::filesystem::path &keep);
+
+  std::filesystem::path disk_file(const std::string &key);
+
+  http_cache_config_t config_;
+
+  std::mutex mutex_;
+  // Most recently used at the front
+  std::list<entry_t> entries_;
+  std::unordered_map<std::string, std::list<entry_t>::iterator> index_;
+  size_t memory_bytes_ = 0;
+  http_cache_stats_t stats_;
+
+  std::mutex disk_mutex_;
+  // Bytes of files in the disk tier, unknown until the first write
+  std::optional<uint64_t> disk_size_;
+};
+
+value_or_error_t http_cache_stats_op(std::shared_ptr<const value_t> inputs);
+
+} // namespace ailoy
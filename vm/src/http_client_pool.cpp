@@ -0,0 +1,203 @@
+#include "http_client_pool.hpp"
+
+#include <httplib.h>
+
+#include "exception.hpp"
+
+namespace ailoy {
+
+/**
+ * Host of an origin, without the brackets of an IPv6 address
+ */
+static std::string host_of(const std::string &origin) {
+  size_t begin = origin.find("://");
+  begin = begin == std::string::npos ? 0 : begin + 3;
+  if (begin < origin.size() && origin[begin] == '[') {
+    size_t end = origin.find(']', begin);
+    return origin.substr(begin + 1, end == std::string::npos
+                                        ? std::string::npos
+                                        : end - begin - 1);
+  }
+  size_t end = origin.find_first_of(":/", begin);
+  return origin.substr(begin, end == std::string::npos ? std::string::npos
+                                                       : end - begin);
+}
+
+static bool is_ip_address(const std::string &host) {
+  return host.find(':') != std::string::npos ||
+         host.find_first_not_of("0123456789.") == std::string::npos;
+}
+
+http_client_lease_t &
+http_client_lease_t::operator=(http_client_lease_t &&other) noexcept {
+  if (this != &other) {
+    release();
+    pool_ = other.pool_;
+    origin_ = std::move(other.origin_);
+    client_ = std::move(other.client_);
+  }
+  return *this;
+}
+
+http_client_lease_t::~http_client_lease_t() { release(); }
+
+void http_client_lease_t::discard() {
+  if (!client_)
+    return;
+  pool_->forget_address(host_of(origin_));
+  pool_->release(origin_, std::move(client_), false);
+}
+
+void http_client_lease_t::release() {
+  if (!client_)
+    return;
+  pool_->release(origin_, std::move(client_), true);
+}
+
+http_client_pool_t::http_client_pool_t(const http_client_pool_config_t &config)
+    : config_(config) {
+  if (config_.max_connections_per_origin == 0)
+    throw ailoy::runtime_error(
+        "[HTTP] max_connections_per_origin should be greater than 0");
+}
+
+http_client_pool_t::~http_client_pool_t() = default;
+
+http_client_pool_t &http_client_pool_t::global() {
+  static http_client_pool_t pool;
+  return pool;
+}
+
+http_client_lease_t http_client_pool_t::acquire(const std::string &origin) {
+  http_client_lease_t lease;
+  lease.pool_ = this;
+  lease.origin_ = origin;
+
+  std::vector<std::unique_ptr<httplib::Client>> evicted;
+  {
+    std::unique_lock lock(mutex_);
+    evicted = evict_idle_clients();
+    // looked up again after waiting, since an origin without connections
+    // may be erased meanwhile
+    cv_.wait(lock, [&]() {
+      auto &entry = origins_[origin];
+      return !entry.idle_clients.empty() ||
+             entry.num_clients < config_.max_connections_per_origin;
+    });
+    auto &entry = origins_[origin];
+    if (!entry.idle_clients.empty()) {
+      // the most recently used one, which is the least likely to have been
+      // closed by the server
+      lease.client_ = std::move(entry.idle_clients.back().client);
+      entry.idle_clients.pop_back();
+    } else
+      entry.num_clients++;
+  }
+
+  if (!lease.client_) {
+    std::unique_ptr<httplib::Client> client;
+    try {
+      client = std::make_unique<httplib::Client>(origin);
+    } catch (const std::exception &) {
+      // unsupported schemes are thrown
+    }
+    if (!client || !client->is_valid()) {
+      // not leased yet, so it is given back by hand
+      release(origin, nullptr, false);
+      throw ailoy::runtime_error("[HTTP] Invalid origin: " + origin);
+    }
+    std::string host = host_of(origin);
+    if (!is_ip_address(host)) {
+      std::string address = resolve(host);
+      if (!address.empty())
+        client->set_hostname_addr_map({{host, address}});
+    }
+    client->set_keep_alive(true);
+    lease.client_ = std::move(client);
+  }
+
+  lease.client_->set_connection_timeout(CPPHTTPLIB_CONNECTION_TIMEOUT_SECOND,
+                                        CPPHTTPLIB_CONNECTION_TIMEOUT_USECOND);
+  lease.client_->set_read_timeout(CPPHTTPLIB_READ_TIMEOUT_SECOND,
+                                  CPPHTTPLIB_READ_TIMEOUT_USECOND);
+  lease.client_->set_write_timeout(CPPHTTPLIB_WRITE_TIMEOUT_SECOND,
+                                   CPPHTTPLIB_WRITE_TIMEOUT_USECOND);
+  lease.client_->set_follow_location(false);
+  return lease;
+}
+
+size_t http_client_pool_t::num_connections(const std::string &origin) {
+  std::vector<std::unique_ptr<httplib::Client>> evicted;
+  std::lock_guard lock(mutex_);
+  evicted = evict_idle_clients();
+  auto it = origins_.find(origin);
+  return it == origins_.end() ? 0 : it->second.num_clients;
+}
+
+void http_client_pool_t::release(const std::string &origin,
+                                 std::unique_ptr<httplib::Client> client,
+                                 bool reusable) {
+  {
+    std::lock_guard lock(mutex_);
+    auto &entry = origins_[origin];
+    if (reusable && client)
+      entry.idle_clients.push_back(
+          {std::move(client), std::chrono::steady_clock::now()});
+    else
+      entry.num_clients--;
+  }
+  cv_.notify_all();
+  // a discarded client is closed here, outside of the lock
+}
+
+std::vector<std::unique_ptr<httplib::Client>>
+http_client_pool_t::evict_idle_clients() {
+  std::vector<std::unique_ptr<httplib::Client>> evicted;
+  auto now = std::chrono::steady_clock::now();
+  for (auto it = origins_.begin(); it != origins_.end();) {
+    auto &entry = it->second;
+    // idle clients are in the order of release, so the expired ones are
+    // at the front
+    auto expired = entry.idle_clients.begin();
+    while (expired != entry.idle_clients.end() &&
+           now - expired->since > config_.idle_timeout) {
+      evicted.push_back(std::move(expired->client));
+      expired++;
+    }
+    entry.num_clients -= expired - entry.idle_clients.begin();
+    entry.idle_clients.erase(entry.idle_clients.begin(), expired);
+    if (entry.num_clients == 0)
+      it = origins_.erase(it);
+    else
+      it++;
+  }
+  return evicted;
+}
+
+std::string http_client_pool_t::resolve(const std::string &host) {
+  auto now = std::chrono::steady_clock::now();
+  {
+    std::lock_guard lock(dns_mutex_);
+    auto it = dns_cache_.find(host);
+    if (it != dns_cache_.end() && it->second.expires > now)
+      return it->second.address;
+  }
+
+  // resolved outside of the lock, which may take long
+  std::vector<std::string> addresses;
+  httplib::hosted_at(host, addresses);
+  if (addresses.empty())
+    return "";
+
+  std::lock_guard lock(dns_mutex_);
+  dns_cache_.insert_or_assign(host,
+                              dns_entry_t{addresses[0], now + config_.dns_ttl});
+  return addresses[0];
+}
+
+void http_client_pool_t::forget_address(const std::string &host) {
+  std::lock_guard lock(dns_mutex_);
+  dns_cache_.erase(host);
+}
+
+} // namespace ailoy
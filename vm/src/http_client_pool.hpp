@@ -0,0 +1,139 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace httplib {
+class Client;
+}
+
+namespace ailoy {
+
+class http_client_pool_t;
+
+struct http_client_pool_config_t {
+  // Number of connections to an origin, idle or in use, beyond which
+  // `acquire` blocks
+  size_t max_connections_per_origin = 8;
+  // Idle connections unused for longer than this are closed
+  std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(30);
+  // Addresses of hosts are resolved again after this
+  std::chrono::steady_clock::duration dns_ttl = std::chrono::minutes(5);
+};
+
+/**
+ * @brief Exclusive use of a pooled client, which is returned to the pool on
+ * destruction
+ */
+class http_client_lease_t {
+public:
+  http_client_lease_t() = default;
+  http_client_lease_t(const http_client_lease_t &) = delete;
+  http_client_lease_t &operator=(const http_client_lease_t &) = delete;
+  http_client_lease_t(http_client_lease_t &&other) noexcept = default;
+  http_client_lease_t &operator=(http_client_lease_t &&other) noexcept;
+
+  ~http_client_lease_t();
+
+  httplib::Client &operator*() const { return *client_; }
+
+  httplib::Client *operator->() const { return client_.get(); }
+
+  /**
+   * @brief Close the connection instead of returning it to the pool
+   * @details To be called when the connection is left in an unknown state,
+   * e.g. after a failed or interrupted request. The cached address of the
+   * host is forgotten too, in case it was the cause of the failure.
+   */
+  void discard();
+
+private:
+  friend class http_client_pool_t;
+
+  void release();
+
+  http_client_pool_t *pool_ = nullptr;
+  std::string origin_;
+  std::unique_ptr<httplib::Client> client_;
+};
+
+/**
+ * @brief Keep-alive HTTP clients pooled by origin
+ * @details Requests to the same origin, e.g. each completion of an agent
+ * loop, reuse warm connections instead of paying for TCP and TLS setup every
+ * time. Idle connections are closed lazily on later calls, and the
+ * addresses of hosts are cached for new connections. All member functions
+ * may be called from multiple threads.
+ */
+class http_client_pool_t {
+public:
+  http_client_pool_t(const http_client_pool_config_t &config = {});
+
+  ~http_client_pool_t();
+
+  /**
+   * @brief The pool shared by the whole process
+   */
+  static http_client_pool_t &global();
+
+  /**
+   * @brief Lease a client to an origin, like `https://api.openai.com`
+   * @details Blocks while `max_connections_per_origin` connections to the
+   * origin are in use. The client starts from the default settings of
+   * httplib, whatever the previous lease has set.
+   * @throw ailoy::runtime_error if the origin is invalid
+   */
+  http_client_lease_t acquire(const std::string &origin);
+
+  /**
+   * @brief Number of connections to an origin, idle or in use
+   */
+  size_t num_connections(const std::string &origin);
+
+private:
+  friend class http_client_lease_t;
+
+  struct idle_client_t {
+    std::unique_ptr<httplib::Client> client;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  struct origin_t {
+    std::vector<idle_client_t> idle_clients;
+    size_t num_clients = 0;
+  };
+
+  struct dns_entry_t {
+    std::string address;
+    std::chrono::steady_clock::time_point expires;
+  };
+
+  void release(const std::string &origin,
+               std::unique_ptr<httplib::Client> client, bool reusable);
+
+  /**
+   * @brief Move out idle clients past `idle_timeout`, to be closed outside
+   * of the lock
+   */
+  std::vector<std::unique_ptr<httplib::Client>> evict_idle_clients();
+
+  std::string resolve(const std::string &host);
+
+  void forget_address(const std::string &host);
+
+  http_client_pool_config_t config_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::unordered_map<std::string, origin_t> origins_;
+
+  std::mutex dns_mutex_;
+  std::unordered_map<std::string, dns_entry_t> dns_cache_;
+};
+
+} // namespace ailoy
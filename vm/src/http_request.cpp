@@ -1,27 +1,41 @@
 #include "http_request.hpp"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
 #include <httplib.h>
 
 #include "exception.hpp"
+#include "http_cache.hpp"
+#include "http_client_pool.hpp"
 
 namespace ailoy {
 
-http_response_t run_http_request(const http_request_t &req) {
+static http_response_t
+send_http_request(const http_request_t &req,
+                  const http_body_receiver_t &receiver) {
   auto url = req.url;
   auto method = req.method;
   auto headers = req.headers;
   auto body = req.body;
 
-  std::string host, path;
+  std::string origin, path;
   size_t pos = url.find("://");
-  if (pos != std::string::npos) {
+  if (pos != std::string::npos &&
+      (url.starts_with("http://") || url.starts_with("https://"))) {
     pos += 3;
     size_t slash_pos = url.find("/", pos);
     if (slash_pos == std::string::npos) {
-      host = url.substr(pos);
+      origin = url;
       path = "/";
     } else {
-      host = url.substr(pos, slash_pos - pos);
+      origin = url.substr(0, slash_pos);
       path = url.substr(slash_pos);
     }
   } else {
@@ -32,10 +46,22 @@ http_response_t run_http_request(const http_request_t &req) {
     };
   }
 
-  httplib::Client client(host);
-  client.set_follow_location(true);
-  client.set_read_timeout(5, 0);
-  client.set_connection_timeout(5, 0);
+  http_client_lease_t client;
+  try {
+    client = http_client_pool_t::global().acquire(origin);
+  } catch (const ailoy::runtime_error &) {
+    return http_response_t{
+        .status_code = 400,
+        .headers = {},
+        .body = "Invalid URL format",
+    };
+  }
+  // httplib takes any 3xx for a redirect, so 304 Not Modified to a
+  // conditional request has to be returned as is
+  client->set_follow_location(!req.headers.contains("If-None-Match") &&
+                              !req.headers.contains("If-Modified-Since"));
+  client->set_read_timeout(req.timeout);
+  client->set_connection_timeout(req.timeout);
 
   httplib::Headers httplib_headers;
   for (const auto &[key, value] : req.headers) {
@@ -53,14 +79,55 @@ http_response_t run_http_request(const http_request_t &req) {
     content_type = "text/plain";
   }
 
+  if (receiver) {
+    // Sent as is so that the body is handed over as it arrives, which the
+    // method-specific functions of httplib keep instead
+    httplib::Request http_req;
+    http_req.method = req.method;
+    http_req.path = path;
+    http_req.headers = httplib_headers;
+    if (req.method == "POST" || req.method == "PUT") {
+      http_req.body = body_str;
+      if (!http_req.headers.contains("Content-Type"))
+        http_req.headers.emplace("Content-Type", content_type);
+    }
+    http_req.response_handler = [&](const httplib::Response &res) {
+      response.status_code = res.status;
+      for (const auto &[key, value] : res.headers)
+        response.headers[key] = value;
+      return true;
+    };
+    http_req.content_receiver = [&](const char *data, size_t data_length,
+                                    uint64_t, uint64_t) {
+      return receiver(response, std::string_view(data, data_length));
+    };
+
+    httplib::Response http_res;
+    httplib::Error error;
+    if (!client->send(http_req, http_res, error)) {
+      client.discard();
+      return http_response_t{
+          .status_code = 500,
+          .headers = {},
+          .body = "Request Failed",
+      };
+    }
+    // the response handler is skipped for responses without a body
+    response.status_code = http_res.status;
+    response.headers.clear();
+    for (const auto &[key, value] : http_res.headers)
+      response.headers[key] = value;
+    return response;
+  }
+
   if (req.method == "GET") {
-    result = client.Get(path, httplib_headers);
+    result = client->Get(path, httplib_headers);
   } else if (req.method == "POST") {
-    result = client.Post(path, httplib_headers, body_str, content_type);
+    result = client->Post(path, httplib_headers, body_str, content_type);
   } else if (req.method == "PUT") {
-    result = client.Put(path, httplib_headers, body_str, content_type);
+    result = client->Put(path, httplib_headers, body_str, content_type);
   } else if (req.method == "DELETE") {
-    result = client.Delete(path, httplib_headers);
+    result = client->Delete(path, httplib_headers);
   } else {
     return http_response_t{
         .status_code = 400,
@@ -77,6 +144,7 @@ http_response_t run_http_request(const http_request_t &req) {
       response.headers[key] = value;
     }
   } else {
+    client.discard();
     response.status_code = 500;
     response.body = "Request Failed";
   }
@@ -84,44 +152,103 @@ http_response_t run_http_request(const http_request_t &req) {
   return response;
 }
 
-value_or_error_t http_request_op(std::shared_ptr<const value_t> inputs) {
+http_response_t run_http_request(const http_request_t &req) {
+  if (req.cache != http_cache_mode_t::off)
+    return http_cache_t::global().fetch(req, [](const http_request_t &req) {
+      return send_http_request(req, nullptr);
+    });
+  return send_http_request(req, nullptr);
+}
+
+http_response_t run_http_request(const http_request_t &req,
+                                 const http_body_receiver_t &receiver) {
+  return send_http_request(req, receiver);
+}
+
+/**
+ * Parse the inputs of a request, where `name` prefixes the names of the
+ * fields in errors
+ */
+static std::variant<http_request_t, error_output_t>
+parse_http_request(const std::string &context, const std::string &name,
+                   std::shared_ptr<const value_t> inputs) {
   if (!inputs->is_type_of<map_t>())
     return error_output_t(
-        type_error("http_request", "inputs", "map_t", inputs->get_type()));
+        type_error(context, name + "inputs", "map_t", inputs->get_type()));
 
   auto input_map = inputs->as<map_t>();
   if (!input_map->contains("url"))
-    return error_output_t(range_error("http_request", "url"));
+    return error_output_t(range_error(context, name + "url"));
   if (!input_map->at("url")->is_type_of<string_t>())
-    return error_output_t(type_error("http_request", "url", "string_t",
+    return error_output_t(type_error(context, name + "url", "string_t",
                                      input_map->at("url")->get_type()));
   auto url = input_map->at<string_t>("url");
 
   if (!input_map->contains("method"))
-    return error_output_t(range_error("http_request", "method"));
+    return error_output_t(range_error(context, name + "method"));
   if (!input_map->at("method")->is_type_of<string_t>())
-    return error_output_t(type_error("http_request", "method", "string_t",
+    return error_output_t(type_error(context, name + "method", "string_t",
                                      input_map->at("method")->get_type()));
   auto method = input_map->at<string_t>("method");
   if (!(*method == "GET" || *method == "POST" || *method == "PUT" ||
         *method == "DELETE")) {
-    return error_output_t(value_error("HTTP Request", "method",
+    return error_output_t(value_error(context, name + "method",
                                       "GET | POST | PUT | DELETE", *method));
   }
   std::shared_ptr<const map_t> headers = create<map_t>();
   if (input_map->contains("headers")) {
     if (!input_map->at("headers")->is_type_of<map_t>())
-      return error_output_t(type_error("http_request", "headers", "map_t",
+      return error_output_t(type_error(context, name + "headers", "map_t",
                                        input_map->at("headers")->get_type()));
     headers = input_map->at<map_t>("headers");
   }
   std::shared_ptr<const string_t> body = create<string_t>();
   if (input_map->contains("body")) {
     if (!input_map->at("body")->is_type_of<string_t>())
-      return error_output_t(type_error("http_request", "body", "string_t",
+      return error_output_t(type_error(context, name + "body", "string_t",
                                        input_map->at("body")->get_type()));
     body = input_map->at<string_t>("body");
   }
+  double timeout = 5.0;
+  if (input_map->contains("timeout")) {
+    auto timeout_val = input_map->at("timeout");
+    if (timeout_val->is_type_of<double_t>())
+      timeout = *timeout_val->as<double_t>();
+    else if (timeout_val->is_type_of<float_t>())
+      timeout = *timeout_val->as<float_t>();
+    else if (timeout_val->is_type_of<uint_t>())
+      timeout = *timeout_val->as<uint_t>();
+    else if (timeout_val->is_type_of<int_t>())
+      timeout = *timeout_val->as<int_t>();
+    else
+      return error_output_t(type_error(context, name + "timeout",
+                                       "double_t | float_t | uint_t | int_t",
+                                       timeout_val->get_type()));
+    if (!(timeout > 0))
+      return error_output_t(value_error(context, name + "timeout",
+                                        "positive", std::to_string(timeout)));
+  }
+
+  auto cache = http_cache_mode_t::off;
+  if (input_map->contains("cache")) {
+    auto cache_val = input_map->at("cache");
+    if (cache_val->is_type_of<bool_t>()) {
+      if (*cache_val->as<bool_t>())
+        cache = http_cache_mode_t::memory;
+    } else if (cache_val->is_type_of<string_t>()) {
+      const std::string &mode = *cache_val->as<string_t>();
+      if (mode == "memory")
+        cache = http_cache_mode_t::memory;
+      else if (mode == "disk")
+        cache = http_cache_mode_t::disk;
+      else
+        return error_output_t(
+            value_error(context, name + "cache", "memory | disk", mode));
+    } else
+      return error_output_t(type_error(context, name + "cache",
+                                       "bool_t | string_t",
+                                       cache_val->get_type()));
+  }
 
   std::unordered_map<std::string, std::string> req_headers_map;
   for (auto it = headers->begin(); it != headers->end(); it++) {
@@ -130,14 +257,19 @@ value_or_error_t http_request_op(std::shared_ptr<const value_t> inputs) {
     req_headers_map.emplace(key, value);
   }
 
-  ailoy::http_request_t req = {
+  return http_request_t{
       .url = *url,
       .method = *method,
       .headers = req_headers_map,
       .body = body->data(),
+      .timeout = std::chrono::milliseconds(
+          static_cast<std::chrono::milliseconds::rep>(timeout * 1000)),
+      .cache = cache,
   };
-  auto resp = ailoy::run_http_request(req);
+}
 
+static std::shared_ptr<map_t>
+http_response_to_value(const http_response_t &resp) {
   auto resp_headers_map = create<map_t>();
   for (const auto &[key, value] : resp.headers) {
     resp_headers_map->insert_or_assign(key, create<string_t>(value));
@@ -150,4 +282,415 @@ value_or_error_t http_request_op(std::shared_ptr<const value_t> inputs) {
   return outputs;
 }
 
-} // namespace ailoy
\ No newline at end of file
+value_or_error_t http_request_op(std::shared_ptr<const value_t> inputs) {
+  auto req = parse_http_request("http_request", "", inputs);
+  if (std::holds_alternative<error_output_t>(req))
+    return std::get<error_output_t>(req);
+  auto resp = ailoy::run_http_request(std::get<http_request_t>(req));
+  return http_response_to_value(resp);
+}
+
+// Chunks of a streamed body received ahead of the ones taken, which bounds
+// the memory used to a few chunks however large the body is
+constexpr size_t http_stream_queue_capacity = 4;
+
+class http_request_operator_t : public operator_t {
+public:
+  ~http_request_operator_t() { stop(); }
+
+  std::optional<error_output_t>
+  initialize(std::shared_ptr<const value_t> in) override {
+    stop();
+    auto error = parse_inputs(in);
+    if (error.has_value())
+      return error;
+    operator_t::initialize(in);
+    if (chunk_size_ > 0)
+      start();
+    return std::nullopt;
+  }
+
+  output_t step() override {
+    if (chunk_size_ > 0)
+      return step_chunk();
+    if (output_path_.has_value()) {
+      auto out = download();
+      reset_input();
+      return out;
+    }
+    auto resp = run_http_request(req_);
+    reset_input();
+    return ok_output_t(http_response_to_value(resp), true);
+  }
+
+  void reset_input() override {
+    stop();
+    operator_t::reset_input();
+  }
+
+private:
+  std::optional<error_output_t>
+  parse_inputs(std::shared_ptr<const value_t> in) {
+    const std::string context = "http_request";
+    auto req = parse_http_request(context, "", in);
+    if (std::holds_alternative<error_output_t>(req))
+      return std::get<error_output_t>(req);
+    req_ = std::move(std::get<http_request_t>(req));
+    auto input_map = in->as<map_t>();
+
+    chunk_size_ = 0;
+    if (input_map->contains("chunk_size")) {
+      auto val = input_map->at("chunk_size");
+      if (val->is_type_of<uint_t>())
+        chunk_size_ = *val->as<uint_t>();
+      else if (val->is_type_of<int_t>() && *val->as<int_t>() >= 0)
+        chunk_size_ = *val->as<int_t>();
+      else
+        return error_output_t(type_error(context, "chunk_size",
+                                         "uint_t | int_t", val->get_type()));
+      if (chunk_size_ == 0)
+        return error_output_t(
+            value_error(context, "chunk_size", "positive", "0"));
+    }
+
+    output_path_.reset();
+    if (input_map->contains("output_path")) {
+      if (!input_map->at("output_path")->is_type_of<string_t>())
+        return error_output_t(
+            type_error(context, "output_path", "string_t",
+                       input_map->at("output_path")->get_type()));
+      output_path_ = *input_map->at<string_t>("output_path");
+      if (chunk_size_ > 0)
+        return error_output_t(value_error(context, "output_path",
+                                          "absent with chunk_size",
+                                          *output_path_));
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * Receive the body on another thread, cutting it into chunks queued for
+   * `step_chunk`
+   */
+  void start() {
+    cancelled_ = false;
+    done_ = false;
+    error_.reset();
+    head_.reset();
+    offset_ = 0;
+    thread_ = std::thread([this]() {
+      std::string chunk;
+      size_t num_chunks = 0;
+      auto push = [&](bool last) {
+        std::unique_lock lock(mutex_);
+        if (!last)
+          cv_.wait(lock, [&]() {
+            return chunks_.size() < http_stream_queue_capacity || cancelled_;
+          });
+        if (cancelled_)
+          return false;
+        chunks_.push_back(std::move(chunk));
+        chunk.clear();
+        num_chunks++;
+        lock.unlock();
+        cv_.notify_all();
+        return true;
+      };
+
+      auto resp = run_http_request(
+          req_, [&](const http_response_t &head, std::string_view data) {
+            {
+              std::lock_guard lock(mutex_);
+              if (!head_.has_value())
+                head_ = head;
+            }
+            while (!data.empty()) {
+              size_t n = std::min(chunk_size_ - chunk.size(), data.size());
+              chunk.append(data.substr(0, n));
+              data.remove_prefix(n);
+              if (chunk.size() == chunk_size_ && !push(false))
+                return false;
+            }
+            return !cancelled_.load();
+          });
+      if (cancelled_)
+        return;
+
+      if (!resp.body.empty()) {
+        std::lock_guard lock(mutex_);
+        error_ = "[HTTP] " + resp.body;
+      } else {
+        {
+          std::lock_guard lock(mutex_);
+          if (!head_.has_value())
+            head_ = resp;
+        }
+        // the rest, or an empty body as a chunk of its own
+        if (!chunk.empty() || num_chunks == 0)
+          push(true);
+        std::lock_guard lock(mutex_);
+        done_ = true;
+      }
+      cv_.notify_all();
+    });
+  }
+
+  output_t step_chunk() {
+    std::string chunk;
+    bool finish;
+    auto outputs = create<map_t>();
+    {
+      std::unique_lock lock(mutex_);
+      cv_.wait(lock, [&]() {
+        return !chunks_.empty() || done_ || error_.has_value();
+      });
+      if (chunks_.empty()) {
+        auto error = error_.value_or("[HTTP] Response ended unexpectedly");
+        lock.unlock();
+        reset_input();
+        return error_output_t(error);
+      }
+      chunk = std::move(chunks_.front());
+      chunks_.pop_front();
+      finish = done_ && chunks_.empty();
+      // the status and the headers come with the first chunk only
+      if (offset_ == 0)
+        outputs = http_response_to_value(*head_);
+    }
+    cv_.notify_all();
+
+    outputs->insert_or_assign("body", create<bytes_t>(chunk));
+    outputs->insert_or_assign("offset", create<uint_t>(offset_));
+    offset_ += chunk.size();
+    if (finish)
+      reset_input();
+    return ok_output_t(outputs, finish);
+  }
+
+  /**
+   * Write the body to a temporary file next to `output_path_`, which is
+   * moved into place once the whole body is received. The body of a response
+   * other than 2xx, like an error page, is output instead and the file is
+   * left untouched.
+   */
+  output_t download() {
+    auto path = std::filesystem::path(*output_path_);
+    auto temp_path = path;
+    temp_path += ".part";
+    std::ofstream ofs(temp_path, std::ios::binary | std::ios::trunc);
+    if (!ofs)
+      return error_output_t(
+          std::format("[HTTP] Failed to open {}", temp_path.string()));
+
+    size_t size = 0;
+    std::string error_body;
+    auto resp = run_http_request(
+        req_, [&](const http_response_t &head, std::string_view data) {
+          if (head.status_code / 100 != 2) {
+            error_body.append(data);
+            return true;
+          }
+          ofs.write(data.data(), data.size());
+          size += data.size();
+          return ofs.good();
+        });
+    ofs.close();
+
+    std::error_code ec;
+    if (!resp.body.empty() || ofs.fail()) {
+      std::filesystem::remove(temp_path, ec);
+      return error_output_t(
+          resp.body.empty()
+              ? std::format("[HTTP] Failed to write {}", temp_path.string())
+              : "[HTTP] " + resp.body);
+    }
+    if (resp.status_code / 100 != 2) {
+      std::filesystem::remove(temp_path, ec);
+      auto outputs = http_response_to_value(resp);
+      outputs->insert_or_assign("body", create<bytes_t>(error_body));
+      return ok_output_t(outputs, true);
+    }
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+      std::filesystem::remove(temp_path, ec);
+      return error_output_t(
+          std::format("[HTTP] Failed to write {}", path.string()));
+    }
+
+    auto outputs = http_response_to_value(resp);
+    outputs->erase("body");
+    outputs->insert_or_assign("path", create<string_t>(path.string()));
+    outputs->insert_or_assign("size", create<uint_t>(size));
+    return ok_output_t(outputs, true);
+  }
+
+  /**
+   * Abort the body being received, if any, after the read in progress which
+   * is bounded by the timeout
+   */
+  void stop() {
+    {
+      std::lock_guard lock(mutex_);
+      cancelled_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable())
+      thread_.join();
+    chunks_.clear();
+  }
+
+  http_request_t req_;
+  size_t chunk_size_ = 0;
+  std::optional<std::string> output_path_;
+
+  std::thread thread_;
+  std::atomic<bool> cancelled_ = false;
+  size_t offset_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::string> chunks_;
+  std::optional<http_response_t> head_;
+  bool done_ = false;
+  std::optional<std::string> error_;
+};
+
+std::shared_ptr<operator_t> create_http_request_operator() {
+  return create<http_request_operator_t>();
+}
+
+class http_request_many_operator_t : public operator_t {
+public:
+  ~http_request_many_operator_t() { stop(); }
+
+  std::optional<error_output_t>
+  initialize(std::shared_ptr<const value_t> in) override {
+    stop();
+    auto error = parse_inputs(in);
+    if (error.has_value())
+      return error;
+    operator_t::initialize(in);
+    start();
+    return std::nullopt;
+  }
+
+  output_t step() override {
+    std::pair<size_t, http_response_t> completed;
+    {
+      std::unique_lock lock(mutex_);
+      cv_.wait(lock, [&]() { return !completed_.empty(); });
+      completed = std::move(completed_.front());
+      completed_.pop_front();
+    }
+    num_outputs_++;
+    bool finish = num_outputs_ == requests_.size();
+
+    auto outputs = http_response_to_value(completed.second);
+    outputs->insert_or_assign("index", create<uint_t>(completed.first));
+    if (finish)
+      reset_input();
+    return ok_output_t(outputs, finish);
+  }
+
+  void reset_input() override {
+    stop();
+    operator_t::reset_input();
+  }
+
+private:
+  std::optional<error_output_t>
+  parse_inputs(std::shared_ptr<const value_t> in) {
+    const std::string context = "http_request_many";
+    if (!in->is_type_of<map_t>())
+      return error_output_t(
+          type_error(context, "inputs", "map_t", in->get_type()));
+    auto input_map = in->as<map_t>();
+    if (!input_map->contains("requests"))
+      return error_output_t(range_error(context, "requests"));
+    if (!input_map->at("requests")->is_type_of<array_t>())
+      return error_output_t(type_error(context, "requests", "array_t",
+                                       input_map->at("requests")->get_type()));
+    auto requests = input_map->at<array_t>("requests");
+    if (requests->empty())
+      return error_output_t(value_error(context, "requests", "non-empty array",
+                                        "empty array"));
+
+    max_concurrency_ = 16;
+    if (input_map->contains("max_concurrency")) {
+      auto val = input_map->at("max_concurrency");
+      if (val->is_type_of<uint_t>())
+        max_concurrency_ = *val->as<uint_t>();
+      else if (val->is_type_of<int_t>() && *val->as<int_t>() >= 0)
+        max_concurrency_ = *val->as<int_t>();
+      else
+        return error_output_t(type_error(context, "max_concurrency",
+                                         "uint_t | int_t", val->get_type()));
+      if (max_concurrency_ == 0)
+        return error_output_t(
+            value_error(context, "max_concurrency", "positive", "0"));
+    }
+
+    requests_.clear();
+    for (size_t i = 0; i < requests->size(); i++) {
+      auto req = parse_http_request(context, std::format("requests[{}].", i),
+                                    requests->at(i));
+      if (std::holds_alternative<error_output_t>(req))
+        return std::get<error_output_t>(req);
+      requests_.push_back(std::move(std::get<http_request_t>(req)));
+    }
+    return std::nullopt;
+  }
+
+  void start() {
+    cancelled_ = false;
+    next_ = 0;
+    num_outputs_ = 0;
+    // Requests are taken in order by the workers, and their responses are
+    // queued as they complete
+    auto worker = [this]() {
+      while (!cancelled_) {
+        size_t i = next_++;
+        if (i >= requests_.size())
+          return;
+        auto resp = run_http_request(requests_[i]);
+        {
+          std::lock_guard lock(mutex_);
+          completed_.emplace_back(i, std::move(resp));
+        }
+        cv_.notify_one();
+      }
+    };
+    size_t num_workers = std::min(max_concurrency_, requests_.size());
+    for (size_t i = 0; i < num_workers; i++)
+      workers_.emplace_back(worker);
+  }
+
+  /**
+   * Let the workers finish the requests in flight, which are bounded by
+   * their timeouts, and drop the responses not taken
+   */
+  void stop() {
+    cancelled_ = true;
+    for (auto &worker : workers_)
+      worker.join();
+    workers_.clear();
+    completed_.clear();
+  }
+
+  std::vector<http_request_t> requests_;
+  size_t max_concurrency_;
+  std::vector<std::thread> workers_;
+  std::atomic<bool> cancelled_ = false;
+  std::atomic<size_t> next_ = 0;
+  size_t num_outputs_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::pair<size_t, http_response_t>> completed_;
+};
+
+std::shared_ptr<operator_t> create_http_request_many_operator() {
+  return create<http_request_many_operator_t>();
+}
+
+} // namespace ailoy
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <optional>
+#include <string_view>
 #include <unordered_map>
 
 #include "module.hpp"
@@ -8,11 +11,23 @@
 
 namespace ailoy {
 
+enum class http_cache_mode_t {
+  // Always sent to the server
+  off,
+  // Answered from responses cached in memory when possible
+  memory,
+  // Same as `memory`, with responses also kept on disk across processes
+  disk,
+};
+
 struct http_request_t {
   std::string url;
   std::string method;
   std::unordered_map<std::string, std::string> headers;
   std::optional<std::string> body = std::nullopt;
+  // Applies to connecting and to each read of the response
+  std::chrono::milliseconds timeout = std::chrono::seconds(5);
+  http_cache_mode_t cache = http_cache_mode_t::off;
 };
 
 struct http_response_t {
@@ -21,8 +36,43 @@ struct http_response_t {
   std::string body;
 };
 
+/**
+ * @brief Send a request, or answer it from `http_cache_t::global()` if
+ * `req.cache` allows
+ */
 http_response_t run_http_request(const http_request_t &req);
 
+/**
+ * @brief Receives the body of a response piece by piece, along with its status
+ * and headers in `head`, and returns false to abort the request
+ */
+using http_body_receiver_t =
+    std::function<bool(const http_response_t &head, std::string_view data)>;
+
+/**
+ * @brief Send a request, handing the body of its response over to `receiver`
+ * as it arrives instead of keeping it
+ * @details The cache is bypassed. The returned response has an empty body,
+ * unless the request failed, in which case the body tells why.
+ */
+http_response_t run_http_request(const http_request_t &req,
+                                 const http_body_receiver_t &receiver);
+
 value_or_error_t http_request_op(std::shared_ptr<const value_t> inputs);
 
+/**
+ * @brief Operator sending a request, which outputs the whole response by
+ * default
+ * @details With `chunk_size`, the body is output in chunks of that many bytes
+ * as it arrives. With `output_path`, the body is written to that file instead.
+ * Either way, only a few chunks are held in memory at a time.
+ */
+std::shared_ptr<operator_t> create_http_request_operator();
+
+/**
+ * @brief Operator sending many requests concurrently, which outputs each
+ * response with the index of its request as it completes
+ */
+std::shared_ptr<operator_t> create_http_request_many_operator();
+
 } // namespace ailoy
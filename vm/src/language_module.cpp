@@ -1,13 +1,17 @@
 #include "language.hpp"
 
 #include "chromadb_vector_store.hpp"
-#include "faiss/faiss_vector_store.hpp"
 #include "mlc_llm/embedding_model.hpp"
 #include "mlc_llm/language_model.hpp"
 #include "mlc_llm/mlc_llm_engine.hpp"
 #include "mlc_llm/model_cache.hpp"
 #include "openai.hpp"
+#include "rag.hpp"
+#include "simd_vector_store.hpp"
 #include "split_text.hpp"
+#ifdef AILOY_WITH_FAISS
+#include "faiss/faiss_vector_store.hpp"
+#endif
 
 namespace ailoy {
 
@@ -46,31 +50,54 @@ std::shared_ptr<const module_t> get_language_module() {
   // Add Operators: Split Text
   if (!language_module->ops.contains("split_text_by_separator")) {
     language_module->ops.insert_or_assign(
-        "split_text_by_separator",
-        create<instant_operator_t>(split_text_by_separator_op));
+        "split_text_by_separator", create_split_text_by_separator_operator());
   }
   if (!language_module->ops.contains("split_text") ||
       !language_module->ops.contains("split_text_separators_recursively")) {
     language_module->ops.insert_or_assign(
         "split_text_separators_recursively",
-        create<instant_operator_t>(split_text_by_separators_recursively_op));
+        create_split_text_by_separators_recursively_operator());
     language_module->ops.insert_or_assign(
-        "split_text",
-        create<instant_operator_t>(split_text_by_separators_recursively_op));
+        "split_text", create_split_text_by_separators_recursively_operator());
+  }
+  if (!language_module->ops.contains("split_texts")) {
+    language_module->ops.insert_or_assign("split_texts",
+                                          create_split_texts_operator());
+  }
+  if (!language_module->ops.contains("split_file")) {
+    language_module->ops.insert_or_assign("split_file",
+                                          create_split_file_operator());
   }
 
   // Add Components: Vectorstores
+#ifdef AILOY_WITH_FAISS
   if (!language_module->factories.contains("faiss_vector_store")) {
     language_module->factories.insert_or_assign(
         "faiss_vector_store",
         create_vector_store_component<faiss_vector_store_t>);
   }
+#endif
+  if (!language_module->factories.contains("simd_vector_store")) {
+    language_module->factories.insert_or_assign(
+        "simd_vector_store",
+        create_vector_store_component<simd_vector_store_t>);
+  }
   if (!language_module->factories.contains("chromadb_vector_store")) {
     language_module->factories.insert_or_assign(
         "chromadb_vector_store",
         create_vector_store_component<chromadb_vector_store_t>);
   }
 
+  // Add Operators: RAG
+  if (!language_module->ops.contains("ingest_documents")) {
+    language_module->ops.insert_or_assign("ingest_documents",
+                                          create_ingest_documents_operator());
+  }
+  if (!language_module->ops.contains("rag_query")) {
+    language_module->ops.insert_or_assign("rag_query",
+                                          create_rag_query_operator());
+  }
+
   // Add Component: OpenAI
   if (!language_module->factories.contains("openai")) {
     language_module->factories.insert_or_assign("openai",
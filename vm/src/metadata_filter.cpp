@@ -0,0 +1,310 @@
+#include "metadata_filter.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#include "exception.hpp"
+
+namespace ailoy {
+
+static bool is_scalar(const nlohmann::json &value) {
+  return value.is_string() || value.is_number() || value.is_boolean();
+}
+
+static bool is_logical_operator(const std::string &key) {
+  return key == "$and" || key == "$or";
+}
+
+static bool is_range_operator(const std::string &op) {
+  return op == "$gt" || op == "$gte" || op == "$lt" || op == "$lte";
+}
+
+/**
+ * Conditions on a field are either a bare value (equality) or a map of
+ * operators to operands.
+ */
+static nlohmann::json normalize_condition(const nlohmann::json &condition) {
+  if (condition.is_object())
+    return condition;
+  return nlohmann::json{{"$eq", condition}};
+}
+
+/**
+ * Numbers of different types (e.g. 1 and 1.0) should have the same key
+ */
+static std::string value_key(const nlohmann::json &value) {
+  if (value.is_number())
+    return nlohmann::json(value.get<double>()).dump();
+  return value.dump();
+}
+
+void validate_metadata_filter(const metadata_filter_t &filter) {
+  if (!filter.is_object())
+    throw ailoy::runtime_error("[Filter] filter should be a map");
+  if (filter.empty())
+    throw ailoy::runtime_error("[Filter] filter should not be empty");
+
+  for (const auto &[key, value] : filter.items()) {
+    if (is_logical_operator(key)) {
+      if (!value.is_array() || value.empty())
+        throw ailoy::runtime_error("[Filter] " + key +
+                                   " should be a non-empty array of filters");
+      for (const auto &sub_filter : value)
+        validate_metadata_filter(sub_filter);
+      continue;
+    }
+    if (key.starts_with("$"))
+      throw ailoy::runtime_error("[Filter] unknown operator " + key);
+
+    auto condition = normalize_condition(value);
+    if (condition.empty())
+      throw ailoy::runtime_error("[Filter] condition of " + key +
+                                 " should not be empty");
+    for (const auto &[op, operand] : condition.items()) {
+      if (op == "$eq" || op == "$ne") {
+        if (!is_scalar(operand))
+          throw ailoy::runtime_error("[Filter] operand of " + op +
+                                     " should be a string, number or bool");
+      } else if (is_range_operator(op)) {
+        if (!operand.is_number())
+          throw ailoy::runtime_error("[Filter] operand of " + op +
+                                     " should be a number");
+      } else if (op == "$in" || op == "$nin") {
+        if (!operand.is_array() ||
+            !std::all_of(operand.begin(), operand.end(), is_scalar))
+          throw ailoy::runtime_error("[Filter] operand of " + op +
+                                     " should be an array of values");
+      } else
+        throw ailoy::runtime_error("[Filter] unknown operator " + op);
+    }
+  }
+}
+
+static bool match_condition(const nlohmann::json &value, const std::string &op,
+                            const nlohmann::json &operand) {
+  if (op == "$eq")
+    return value == operand;
+  if (op == "$ne")
+    return value != operand;
+  if (op == "$in")
+    return std::find(operand.begin(), operand.end(), value) != operand.end();
+  if (op == "$nin")
+    return std::find(operand.begin(), operand.end(), value) == operand.end();
+  if (!value.is_number())
+    return false;
+  double lhs = value.get<double>();
+  double rhs = operand.get<double>();
+  if (op == "$gt")
+    return lhs > rhs;
+  if (op == "$gte")
+    return lhs >= rhs;
+  if (op == "$lt")
+    return lhs < rhs;
+  if (op == "$lte")
+    return lhs <= rhs;
+  return false;
+}
+
+bool match_metadata_filter(const metadata_filter_t &filter,
+                           const std::optional<nlohmann::json> &metadata) {
+  for (const auto &[key, value] : filter.items()) {
+    bool matched;
+    if (key == "$and")
+      matched = std::all_of(value.begin(), value.end(), [&](const auto &f) {
+        return match_metadata_filter(f, metadata);
+      });
+    else if (key == "$or")
+      matched = std::any_of(value.begin(), value.end(), [&](const auto &f) {
+        return match_metadata_filter(f, metadata);
+      });
+    else if (!metadata.has_value() || !metadata->is_object() ||
+             !metadata->contains(key))
+      // conditions never match missing fields, including $ne and $nin
+      matched = false;
+    else {
+      const auto &field_value = metadata->at(key);
+      auto condition = normalize_condition(value);
+      matched = true;
+      for (const auto &[op, operand] : condition.items())
+        matched = matched && match_condition(field_value, op, operand);
+    }
+    if (!matched)
+      return false;
+  }
+  return true;
+}
+
+nlohmann::json to_chromadb_where(const metadata_filter_t &filter) {
+  std::vector<nlohmann::json> clauses;
+  for (const auto &[key, value] : filter.items()) {
+    if (is_logical_operator(key)) {
+      auto sub_filters = nlohmann::json::array();
+      for (const auto &sub_filter : value)
+        sub_filters.push_back(to_chromadb_where(sub_filter));
+      clauses.push_back({{key, sub_filters}});
+      continue;
+    }
+    auto condition = normalize_condition(value);
+    for (const auto &[op, operand] : condition.items())
+      clauses.push_back({{key, {{op, operand}}}});
+  }
+  if (clauses.size() == 1)
+    return clauses[0];
+  return nlohmann::json{{"$and", clauses}};
+}
+
+void metadata_index_t::insert(int64_t id,
+                              const std::optional<nlohmann::json> &metadata) {
+  if (!metadata.has_value() || !metadata->is_object())
+    return;
+  for (const auto &[field, value] : metadata->items()) {
+    if (!is_scalar(value))
+      continue;
+    values_[field][value_key(value)].insert(id);
+    if (value.is_number())
+      numbers_[field].emplace(value.get<double>(), id);
+  }
+}
+
+void metadata_index_t::erase(int64_t id,
+                             const std::optional<nlohmann::json> &metadata) {
+  if (!metadata.has_value() || !metadata->is_object())
+    return;
+  for (const auto &[field, value] : metadata->items()) {
+    if (!is_scalar(value))
+      continue;
+    auto &ids = values_[field][value_key(value)];
+    ids.erase(id);
+    if (ids.empty())
+      values_[field].erase(value_key(value));
+    if (value.is_number()) {
+      auto &numbers = numbers_[field];
+      auto [begin, end] = numbers.equal_range(value.get<double>());
+      for (auto it = begin; it != end; it++) {
+        if (it->second == id) {
+          numbers.erase(it);
+          break;
+        }
+      }
+    }
+  }
+}
+
+void metadata_index_t::clear() {
+  values_.clear();
+  numbers_.clear();
+}
+
+static std::set<int64_t> set_intersection(const std::set<int64_t> &a,
+                                          const std::set<int64_t> &b) {
+  std::set<int64_t> rv;
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                        std::inserter(rv, rv.end()));
+  return rv;
+}
+
+static std::set<int64_t> set_difference(const std::set<int64_t> &a,
+                                        const std::set<int64_t> &b) {
+  std::set<int64_t> rv;
+  std::set_difference(a.begin(), a.end(), b.begin(), b.end(),
+                      std::inserter(rv, rv.end()));
+  return rv;
+}
+
+std::vector<int64_t>
+metadata_index_t::select(const metadata_filter_t &filter) const {
+  std::optional<id_set_t> selected;
+  auto intersect = [&](id_set_t ids) {
+    selected = selected.has_value() ? set_intersection(*selected, ids)
+                                    : std::move(ids);
+  };
+
+  for (const auto &[key, value] : filter.items()) {
+    if (key == "$and") {
+      for (const auto &sub_filter : value) {
+        auto ids = select(sub_filter);
+        intersect(id_set_t(ids.begin(), ids.end()));
+      }
+    } else if (key == "$or") {
+      id_set_t ids;
+      for (const auto &sub_filter : value) {
+        auto sub_ids = select(sub_filter);
+        ids.insert(sub_ids.begin(), sub_ids.end());
+      }
+      intersect(std::move(ids));
+    } else
+      intersect(select_field(key, value));
+    if (selected->empty())
+      break;
+  }
+
+  if (!selected.has_value())
+    return {};
+  return std::vector<int64_t>(selected->begin(), selected->end());
+}
+
+metadata_index_t::id_set_t
+metadata_index_t::select_field(const std::string &field,
+                               const nlohmann::json &condition) const {
+  std::optional<id_set_t> selected;
+  auto normalized = normalize_condition(condition);
+  for (const auto &[op, operand] : normalized.items()) {
+    id_set_t ids;
+    if (op == "$eq")
+      ids = select_equal(field, operand);
+    else if (op == "$ne")
+      ids = set_difference(select_field_present(field),
+                           select_equal(field, operand));
+    else if (op == "$in" || op == "$nin") {
+      for (const auto &value : operand) {
+        auto value_ids = select_equal(field, value);
+        ids.insert(value_ids.begin(), value_ids.end());
+      }
+      if (op == "$nin")
+        ids = set_difference(select_field_present(field), ids);
+    } else if (numbers_.contains(field)) {
+      const auto &numbers = numbers_.at(field);
+      double bound = operand.get<double>();
+      auto begin = numbers.begin();
+      auto end = numbers.end();
+      if (op == "$gt")
+        begin = numbers.upper_bound(bound);
+      else if (op == "$gte")
+        begin = numbers.lower_bound(bound);
+      else if (op == "$lt")
+        end = numbers.lower_bound(bound);
+      else if (op == "$lte")
+        end = numbers.upper_bound(bound);
+      for (auto it = begin; it != end; it++)
+        ids.insert(it->second);
+    }
+    selected = selected.has_value() ? set_intersection(*selected, ids)
+                                    : std::move(ids);
+  }
+  return selected.value_or(id_set_t{});
+}
+
+metadata_index_t::id_set_t
+metadata_index_t::select_equal(const std::string &field,
+                               const nlohmann::json &value) const {
+  auto field_values = values_.find(field);
+  if (field_values == values_.end())
+    return {};
+  auto ids = field_values->second.find(value_key(value));
+  if (ids == field_values->second.end())
+    return {};
+  return ids->second;
+}
+
+metadata_index_t::id_set_t
+metadata_index_t::select_field_present(const std::string &field) const {
+  id_set_t rv;
+  auto field_values = values_.find(field);
+  if (field_values == values_.end())
+    return rv;
+  for (const auto &[_, ids] : field_values->second)
+    rv.insert(ids.begin(), ids.end());
+  return rv;
+}
+
+} // namespace ailoy
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace ailoy {
+
+/**
+ * Metadata filters follow the `where` clause of ChromaDB.
+ *  - `{"field": value}` or `{"field": {"$eq": value}}`: equality
+ *  - `{"field": {"$ne": value}}`: inequality
+ *  - `{"field": {"$gt" | "$gte" | "$lt" | "$lte": number}}`: range
+ *  - `{"field": {"$in" | "$nin": [values...]}}`: membership
+ *  - `{"$and" | "$or": [filters...]}`: boolean combination
+ * A map with multiple fields is the conjunction of each field.
+ */
+using metadata_filter_t = nlohmann::json;
+
+/**
+ * @brief Check that the filter is well-formed
+ * @throw ailoy::runtime_error if the filter is invalid
+ */
+void validate_metadata_filter(const metadata_filter_t &filter);
+
+/**
+ * @brief Evaluate the filter against a single metadata
+ */
+bool match_metadata_filter(const metadata_filter_t &filter,
+                           const std::optional<nlohmann::json> &metadata);
+
+/**
+ * @brief Convert the filter into a `where` clause that ChromaDB accepts
+ * @details ChromaDB requires a single field per map, so maps with multiple
+ * fields are rewritten into `$and`.
+ */
+nlohmann::json to_chromadb_where(const metadata_filter_t &filter);
+
+/**
+ * @brief Inverted index from top-level metadata fields to ids
+ */
+class metadata_index_t {
+public:
+  void insert(int64_t id, const std::optional<nlohmann::json> &metadata);
+
+  void erase(int64_t id, const std::optional<nlohmann::json> &metadata);
+
+  void clear();
+
+  /**
+   * @brief Select ids whose metadata matches the filter
+   * @return Sorted ids
+   */
+  std::vector<int64_t> select(const metadata_filter_t &filter) const;
+
+private:
+  using id_set_t = std::set<int64_t>;
+
+  id_set_t select_field(const std::string &field,
+                        const nlohmann::json &condition) const;
+
+  id_set_t select_equal(const std::string &field,
+                        const nlohmann::json &value) const;
+
+  id_set_t select_field_present(const std::string &field) const;
+
+  // field -> value key -> ids
+  std::unordered_map<std::string, std::unordered_map<std::string, id_set_t>>
+      values_;
+  // field -> numeric value -> ids, for range conditions
+  std::unordered_map<std::string, std::multimap<double, int64_t>> numbers_;
+};
+
+} // namespace ailoy
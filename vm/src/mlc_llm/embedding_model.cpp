@@ -1,6 +1,9 @@
 #include "embedding_model.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
+#include <numeric>
 
 #include <tokenizers_c.h>
 #include <tvm/runtime/ndarray.h>
@@ -36,6 +39,47 @@ std::vector<tokenizer_t::token_t> tokenizer_t::encode(const std::string &text,
   // return tokenizer_->Encode(text);
 }
 
+tokenizer_t::batch_encoding_t
+tokenizer_t::encode_batch(const std::vector<std::string> &texts,
+                          bool add_special_token) {
+  std::vector<std::string_view> views(texts.begin(), texts.end());
+  return encode_batch(views, add_special_token);
+}
+
+tokenizer_t::batch_encoding_t
+tokenizer_t::encode_batch(std::span<const std::string_view> texts,
+                          bool add_special_token) {
+  batch_encoding_t rv;
+  rv.offsets.reserve(texts.size() + 1);
+  rv.offsets.push_back(0);
+  if (texts.empty())
+    return rv;
+
+  std::vector<const char *> data(texts.size());
+  std::vector<size_t> lengths(texts.size());
+  for (size_t i = 0; i < texts.size(); i++) {
+    data[i] = texts[i].data();
+    lengths[i] = texts[i].length();
+  }
+
+  std::vector<TokenizerEncodeResult> results(texts.size());
+  tokenizers_encode_batch(handle_, data.data(), lengths.data(), texts.size(),
+                          static_cast<int>(add_special_token), results.data());
+
+  size_t total_len = 0;
+  for (const auto &result : results)
+    total_len += result.len;
+  rv.ids.resize(total_len);
+  for (const auto &result : results) {
+    size_t begin = rv.offsets.back();
+    std::memcpy(rv.ids.data() + begin, result.token_ids,
+                result.len * sizeof(token_t));
+    rv.offsets.push_back(begin + result.len);
+  }
+  tokenizers_free_encode_results(results.data(), results.size());
+  return rv;
+}
+
 std::string tokenizer_t::decode(const std::vector<tokenizer_t::token_t> &ids,
                                 bool skip_special_tokens) {
   size_t ids_size = ids.size();
@@ -143,6 +187,88 @@ tvm_embedding_model_t::infer(std::vector<int> tokens) {
   return processed_embedding;
 }
 
+const tvm::runtime::NDArray
+tvm_embedding_model_t::infer_batch(const tokenizer_t::batch_encoding_t &encoded,
+                                   size_t max_batch_tokens) {
+  Device cpu = Device{kDLCPU, 0};
+  DLDataType I32 = DLDataType{.code = kDLInt, .bits = 32, .lanes = 1};
+  DLDataType F32 = DLDataType{.code = kDLFloat, .bits = 32, .lanes = 1};
+
+  size_t num_texts = encoded.offsets.size() - 1;
+  auto length = [&](size_t i) {
+    return encoded.offsets[i + 1] - encoded.offsets[i];
+  };
+  // texts of similar lengths go together, to keep the padding small
+  std::vector<size_t> order(num_texts);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return length(a) < length(b); });
+
+  NDArray embeddings;
+  size_t begin = 0;
+  while (begin < num_texts) {
+    // the longest text of a pass is the last one
+    size_t end = begin + 1;
+    while (end < num_texts &&
+           (end - begin + 1) * length(order[end]) <= max_batch_tokens)
+      end++;
+    int64_t batch_size = end - begin;
+    int64_t seq_len = std::max<int64_t>(length(order[end - 1]), 1);
+
+    NDArray inputNDArrayCPU = NDArray::Empty({batch_size, seq_len}, I32, cpu);
+    NDArray maskNDArrayCPU = NDArray::Empty({batch_size, seq_len}, I32, cpu);
+    auto input_nd_array = static_cast<int32_t *>(inputNDArrayCPU->data);
+    auto mask_nd_array = static_cast<int32_t *>(maskNDArrayCPU->data);
+    std::fill_n(input_nd_array, batch_size * seq_len, 0);
+    std::fill_n(mask_nd_array, batch_size * seq_len, 0);
+    for (int64_t b = 0; b < batch_size; b++) {
+      size_t i = order[begin + b];
+      std::copy(encoded.ids.begin() + encoded.offsets[i],
+                encoded.ids.begin() + encoded.offsets[i + 1],
+                input_nd_array + b * seq_len);
+      std::fill_n(mask_nd_array + b * seq_len, length(i), 1);
+    }
+
+    NDArray inputNDArrayGPU =
+        NDArray::Empty({batch_size, seq_len}, I32, engine_->get_device());
+    inputNDArrayGPU.CopyFrom(inputNDArrayCPU);
+    NDArray maskNDArrayGPU =
+        NDArray::Empty({batch_size, seq_len}, I32, engine_->get_device());
+    maskNDArrayGPU.CopyFrom(maskNDArrayCPU);
+
+    NDArray logitsCurBatchOnGPU =
+        fprefill_(inputNDArrayGPU, maskNDArrayGPU, engine_->get_params());
+    NDArray logitsCurBatchOnCPU = NDArray::Empty(
+        logitsCurBatchOnGPU.Shape(), logitsCurBatchOnGPU.DataType(), cpu);
+    logitsCurBatchOnCPU.CopyFrom(logitsCurBatchOnGPU);
+
+    // the embedding of a text is the output of its first token, like infer
+    int64_t dim = logitsCurBatchOnCPU.Shape().back();
+    int64_t row_stride = 1;
+    for (size_t d = 1; d < logitsCurBatchOnCPU.Shape().size(); d++)
+      row_stride *= logitsCurBatchOnCPU.Shape()[d];
+    if (!embeddings.defined())
+      embeddings = NDArray::Empty({static_cast<int64_t>(num_texts), dim}, F32,
+                                  cpu);
+    auto to_data = static_cast<float *>(embeddings->data);
+    for (int64_t b = 0; b < batch_size; b++) {
+      float *to = to_data + order[begin + b] * dim;
+      if (logitsCurBatchOnCPU.DataType().bits() == 16) {
+        auto from = static_cast<uint16_t *>(logitsCurBatchOnCPU->data) +
+                    b * row_stride;
+        for (int64_t d = 0; d < dim; d++)
+          to[d] = float16_to_float32(from[d]);
+      } else {
+        auto from =
+            static_cast<float *>(logitsCurBatchOnCPU->data) + b * row_stride;
+        std::copy_n(from, dim, to);
+      }
+    }
+    begin = end;
+  }
+  return embeddings;
+}
+
 component_or_error_t
 create_tvm_embedding_model_component(std::shared_ptr<const value_t> inputs) {
   if (!inputs->is_type_of<map_t>())
@@ -204,6 +330,39 @@ create_tvm_embedding_model_component(std::shared_ptr<const value_t> inputs) {
                                        "map_t", inputs->get_type()));
 
     auto input_map = inputs->as<map_t>();
+    auto tokenizer = component->get_obj("tokenizer")->as<tokenizer_t>();
+    auto model =
+        component->get_obj("embedding_model")->as<tvm_embedding_model_t>();
+
+    // Batched input: embeddings of every prompt are stacked into a 2-d array
+    if (input_map->contains("prompts")) {
+      if (!input_map->at("prompts")->is_type_of<array_t>())
+        return error_output_t(
+            type_error("TVM Embedding Model: infer", "prompts", "array_t",
+                       input_map->at("prompts")->get_type()));
+      std::vector<std::string> prompts;
+      for (const auto &prompt_val : *input_map->at<array_t>("prompts")) {
+        if (!prompt_val->is_type_of<string_t>())
+          return error_output_t(type_error("TVM Embedding Model: infer",
+                                           "prompts.*", "string_t",
+                                           prompt_val->get_type()));
+        prompts.push_back(*prompt_val->as<string_t>());
+      }
+
+      std::shared_ptr<ndarray_t> embeddings;
+      if (prompts.empty()) {
+        embeddings = create<ndarray_t>();
+        embeddings->dtype = {.code = kDLFloat, .bits = 32, .lanes = 1};
+        embeddings->shape = {0, 0};
+      } else {
+        auto encoded = tokenizer->encode_batch(prompts);
+        embeddings = ndarray_from_tvm(model->infer_batch(encoded));
+      }
+
+      auto outputs = create<map_t>();
+      outputs->insert_or_assign("embeddings", embeddings);
+      return outputs;
+    }
 
     // Get input prompt
     if (!input_map->contains("prompt"))
@@ -215,13 +374,10 @@ create_tvm_embedding_model_component(std::shared_ptr<const value_t> inputs) {
                                        input_map->at("prompt")->get_type()));
     auto prompt = input_map->at<string_t>("prompt");
 
-    auto tokens =
-        component->get_obj("tokenizer")->as<tokenizer_t>()->encode(*prompt);
+    auto tokens = tokenizer->encode(*prompt);
 
     // Run inference with embedding model
-    auto embedding = component->get_obj("embedding_model")
-                         ->as<tvm_embedding_model_t>()
-                         ->infer(tokens);
+    auto embedding = model->infer(tokens);
 
     auto outputs = create<map_t>();
     outputs->insert_or_assign("embedding", ndarray_from_tvm(embedding));
@@ -232,27 +388,66 @@ create_tvm_embedding_model_component(std::shared_ptr<const value_t> inputs) {
       [](std::shared_ptr<component_t> component,
          std::shared_ptr<const value_t> inputs) -> value_or_error_t {
     if (!inputs->is_type_of<map_t>())
-      return error_output_t(type_error("TVM Embedding Model: infer", "inputs",
-                                       "map_t", inputs->get_type()));
+      return error_output_t(type_error("TVM Embedding Model: tokenize",
+                                       "inputs", "map_t", inputs->get_type()));
 
     auto input_map = inputs->as<map_t>();
+    auto tokenizer = component->get_obj("tokenizer")->as<tokenizer_t>();
+    const DLDataType I32 = {.code = kDLInt, .bits = 32, .lanes = 1};
+    const DLDataType I64 = {.code = kDLInt, .bits = 64, .lanes = 1};
+
+    // Batched input: tokens of every prompt are packed into one buffer and
+    // `offsets` marks the boundaries
+    if (input_map->contains("prompts")) {
+      if (!input_map->at("prompts")->is_type_of<array_t>())
+        return error_output_t(type_error(
+            "TVM Embedding Model: tokenize", "prompts", "array_t",
+            input_map->at("prompts")->get_type()));
+      std::vector<std::string> prompts;
+      for (const auto &prompt_val : *input_map->at<array_t>("prompts")) {
+        if (!prompt_val->is_type_of<string_t>())
+          return error_output_t(type_error("TVM Embedding Model: tokenize",
+                                           "prompts.*", "string_t",
+                                           prompt_val->get_type()));
+        prompts.push_back(*prompt_val->as<string_t>());
+      }
+
+      auto encoded = tokenizer->encode_batch(prompts);
+      std::vector<int64_t> offsets(encoded.offsets.begin(),
+                                   encoded.offsets.end());
+
+      auto outputs = create<map_t>();
+      outputs->insert_or_assign(
+          "tokens", create<ndarray_t>(
+                        std::vector<size_t>{encoded.ids.size()}, I32,
+                        reinterpret_cast<const uint8_t *>(encoded.ids.data()),
+                        encoded.ids.size() * sizeof(int32_t)));
+      outputs->insert_or_assign(
+          "offsets",
+          create<ndarray_t>(std::vector<size_t>{offsets.size()}, I64,
+                            reinterpret_cast<const uint8_t *>(offsets.data()),
+                            offsets.size() * sizeof(int64_t)));
+      return outputs;
+    }
 
     // Get input prompt
     if (!input_map->contains("prompt"))
-      return error_output_t("Input prompt not specified");
+      return error_output_t(
+          range_error("TVM Embedding Model: tokenize", "prompt"));
     if (!input_map->at("prompt")->is_type_of<string_t>())
-      return error_output_t(type_error("TVM Embedding Model: infer", "prompt",
-                                       "string_t",
-                                       input_map->at("prmopt")->get_type()));
+      return error_output_t(type_error("TVM Embedding Model: tokenize",
+                                       "prompt", "string_t",
+                                       input_map->at("prompt")->get_type()));
     auto prompt = input_map->at<string_t>("prompt");
 
-    auto tokens = create<array_t>();
-    for (auto id :
-         component->get_obj("tokenizer")->as<tokenizer_t>()->encode(*prompt))
-      tokens->push_back(create<int_t>(id));
+    auto ids = tokenizer->encode(*prompt);
 
     auto outputs = create<map_t>();
-    outputs->insert_or_assign("tokens", tokens);
+    outputs->insert_or_assign(
+        "tokens",
+        create<ndarray_t>(std::vector<size_t>{ids.size()}, I32,
+                          reinterpret_cast<const uint8_t *>(ids.data()),
+                          ids.size() * sizeof(int32_t)));
     return outputs;
   };
 
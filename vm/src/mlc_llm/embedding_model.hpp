@@ -1,5 +1,8 @@
 #pragma once
 
+#include <span>
+#include <string_view>
+
 #include <tvm/runtime/packed_func.h>
 
 #include "module.hpp"
@@ -12,11 +15,31 @@ class tokenizer_t : public object_t {
   using token_t = int32_t;
 
 public:
+  /**
+   * @brief Token ids of several texts packed into one contiguous buffer
+   * @details Tokens of the i-th text are `ids[offsets[i]:offsets[i+1]]`.
+   */
+  struct batch_encoding_t {
+    std::vector<token_t> ids;
+    std::vector<size_t> offsets;
+  };
+
   tokenizer_t(const std::filesystem::path &json_file_path);
 
   std::vector<token_t> encode(const std::string &text,
                               bool add_special_token = true);
 
+  /**
+   * @brief Encode many texts at once
+   * @details The batch is handed over to the tokenizer library in a single
+   * call, which tokenizes the texts in parallel.
+   */
+  batch_encoding_t encode_batch(const std::vector<std::string> &texts,
+                                bool add_special_token = true);
+
+  batch_encoding_t encode_batch(std::span<const std::string_view> texts,
+                                bool add_special_token = true);
+
   std::string decode(const std::vector<token_t> &ids,
                      bool skip_special_tokens = true);
 
@@ -38,6 +61,16 @@ public:
 
   const tvm::runtime::NDArray infer(std::vector<int> tokens);
 
+  /**
+   * @brief Embed every text of a batch encoding
+   * @details Texts are sorted by length and run through the model in padded
+   * forward passes of up to `max_batch_tokens` tokens, including padding.
+   * @return 2-D F32 NDArray of (texts, dim), in the order of the texts
+   */
+  const tvm::runtime::NDArray
+  infer_batch(const tokenizer_t::batch_encoding_t &encoded,
+              size_t max_batch_tokens = 8192);
+
   std::filesystem::path get_model_path() const {
     return engine_->get_model_path();
   }
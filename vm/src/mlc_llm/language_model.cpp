@@ -1,5 +1,8 @@
 #include "language_model.hpp"
 
+#include <filesystem>
+
+#include "embedding_model.hpp"
 #include "mlc_llm_engine.hpp"
 #include "module.hpp"
 #include "tvm_model.hpp"
@@ -320,6 +323,10 @@ create_tvm_language_model_component(std::shared_ptr<const value_t> inputs) {
   auto rv = create<component_t>(ops);
   rv->set_obj("engine", engine);
   rv->set_obj("template_engine", template_engine);
+  // Tokenizer for other operators, such as measuring texts in tokens
+  if (std::filesystem::exists(engine->get_model_path() / "tokenizer.json"))
+    rv->set_obj("tokenizer", create<tokenizer_t>(engine->get_model_path() /
+                                                 "tokenizer.json"));
   return rv;
 };
 
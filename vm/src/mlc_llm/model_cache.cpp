@@ -220,36 +220,6 @@ std::atomic<bool> SigintGuard::g_sigint{false};
 namespace fs = std::filesystem;
 using json = nlohmann::json;
 
-std::filesystem::path get_cache_root() {
-  fs::path cache_root;
-  if (std::getenv("AILOY_CACHE_ROOT")) {
-    // Check environment variable
-    cache_root = fs::path(std::getenv("AILOY_CACHE_ROOT"));
-  } else {
-    // Set to default cache root
-#if defined(_WIN32)
-    if (std::getenv("LOCALAPPDATA"))
-      cache_root = fs::path(std::getenv("LOCALAPPDATA")) / "ailoy";
-#else
-    if (std::getenv("HOME"))
-      cache_root = fs::path(std::getenv("HOME")) / ".cache" / "ailoy";
-#endif
-  }
-  if (cache_root.empty()) {
-    throw exception("Cannot get cache root");
-  }
-
-  try {
-    // Create a directory
-    // It returns false if already exists
-    fs::create_directories(cache_root);
-  } catch (const fs::filesystem_error &e) {
-    throw exception("cache root directory creation failed");
-  }
-
-  return cache_root;
-}
-
 std::string get_models_url() {
   if (std::getenv("AILOY_MODELS_URL"))
     return std::getenv("AILOY_MODELS_URL");
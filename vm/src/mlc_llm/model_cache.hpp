@@ -6,6 +6,7 @@
 
 #include <nlohmann/json.hpp>
 
+#include "../file_util.hpp"
 #include "module.hpp"
 
 namespace ailoy {
@@ -39,12 +40,6 @@ struct model_cache_remove_result_t {
   std::optional<std::string> error_message = std::nullopt;
 };
 
-/**
- * @brief Get the cache root directory. If the AILOY_CACHE_ROOT environment
- * variable is set, it will be used; otherwise, the default path will be used.
- */
-std::filesystem::path get_cache_root();
-
 std::vector<model_cache_list_result_t> list_local_models();
 
 model_cache_download_result_t
@@ -119,12 +119,14 @@ void from_json(const json &j, ailoy::openai_chat_completion_request_t &obj) {
 }
 
 void to_json(json &j, const ailoy::openai_response_delta_t &obj) {
-  j = json{{"message", obj.message}, {"finish_reason", obj.finish_reason}};
+  j = json{{"message", obj.message}};
+  j["finish_reason"] = obj.finish_reason;
 }
 
 void from_json(const json &j, ailoy::openai_response_delta_t &obj) {
   j.at("message").get_to(obj.message);
-  j.at("finish_reason").get_to(obj.finish_reason);
+  if (j.contains("finish_reason") && !j["finish_reason"].is_null())
+    obj.finish_reason = j.at("finish_reason");
 }
 
 } // namespace nlohmann
@@ -166,148 +168,332 @@ convert_request_input(std::shared_ptr<const value_t> inputs) {
   return request;
 }
 
-openai_llm_engine_t::openai_llm_engine_t(const std::string &api_key,
-                                         const std::string &model)
-    : api_key_(api_key), model_(model) {}
+// Tool call indices are capped, since each one takes a slot in a vector
+constexpr size_t openai_max_tool_calls = 128;
+
+openai_chat_completion_stream_t::openai_chat_completion_stream_t(
+    const std::string &base_url, const std::string &api_key,
+    const std::string &body)
+    : client_(http_client_pool_t::global().acquire(base_url)) {
+  thread_ = std::thread([this, api_key, body]() {
+    try {
+      run(api_key, body);
+    } catch (const std::exception &e) {
+      done_ = true;
+      fail(std::string("[OpenAI] Stream failed: ") + e.what());
+    } catch (...) {
+      done_ = true;
+      fail("[OpenAI] Stream failed");
+    }
+  });
+}
 
-openai_response_delta_t openai_llm_engine_t::infer(
-    std::unique_ptr<openai_chat_completion_request_t> request) {
-  httplib::Client client("https://api.openai.com");
-  std::unordered_map<std::string, std::string> headers = {
-      {"Authorization", "Bearer " + api_key_},
+void openai_chat_completion_stream_t::run(const std::string &api_key,
+                                          const std::string &body) {
+  httplib::Request http_req;
+  http_req.method = "POST";
+  http_req.path = "/v1/chat/completions";
+  http_req.headers = {
+      {"Authorization", "Bearer " + api_key},
       {"Content-Type", "application/json"},
+      {"Accept", "text/event-stream"},
       {"Cache-Control", "no-cache"},
   };
-  httplib::Headers httplib_headers;
-  for (const auto &[key, value] : headers) {
-    httplib_headers.emplace(key, value);
+  http_req.body = body;
+
+  // errors are not streamed, so their bodies are kept to be reported
+  int status = 0;
+  std::string error_body;
+  http_req.response_handler = [&](const httplib::Response &res) {
+    status = res.status;
+    return !cancelled_;
+  };
+  http_req.content_receiver = [&](const char *data, size_t data_length,
+                                  uint64_t, uint64_t) {
+    if (status != httplib::OK_200) {
+      error_body.append(data, data_length);
+      return !cancelled_;
+    }
+    // exceptions must not unwind through the client
+    try {
+      receive({data, data_length});
+    } catch (const std::exception &e) {
+      fail(std::string("[OpenAI] Invalid event: ") + e.what());
+    } catch (...) {
+      fail("[OpenAI] Invalid event");
+    }
+    return !cancelled_ && !failed();
+  };
+
+  httplib::Response res;
+  httplib::Error err;
+  bool request_succeeded = client_->send(http_req, res, err);
+  reusable_ = request_succeeded;
+  done_ = true;
+  if (cancelled_)
+    return;
+  if (!request_succeeded)
+    fail("[OpenAI] Request failed: " + httplib::to_string(err));
+  else if (status != httplib::OK_200)
+    fail(std::format("[OpenAI] Request failed: [{}] {}", status, error_body));
+  else
+    fail("[OpenAI] Stream ended without finish reason");
+}
+
+openai_chat_completion_stream_t::~openai_chat_completion_stream_t() {
+  cancel();
+}
+
+openai_response_delta_t openai_chat_completion_stream_t::next() {
+  std::unique_lock lock(mutex_);
+  cv_.wait(lock, [&]() {
+    return !deltas_.empty() || error_.has_value() || finished_;
+  });
+  if (!deltas_.empty()) {
+    auto delta = std::move(deltas_.front());
+    deltas_.pop_front();
+    return delta;
+  }
+  if (error_.has_value())
+    throw ailoy::runtime_error(error_.value());
+  throw ailoy::runtime_error("[OpenAI] No more deltas in the stream");
+}
+
+void openai_chat_completion_stream_t::cancel() {
+  {
+    // a finished stream is read to its end, typically just `[DONE]`, so
+    // that the connection goes back to the pool
+    std::lock_guard lock(mutex_);
+    if (!finished_)
+      cancelled_ = true;
+  }
+  // interrupts the request waiting for the server, after which the
+  // connection cannot be reused
+  bool interrupted = cancelled_ && !done_;
+  if (interrupted)
+    client_->stop();
+  if (thread_.joinable())
+    thread_.join();
+  if (interrupted || !reusable_)
+    client_.discard();
+}
+
+void openai_chat_completion_stream_t::receive(std::string_view data) {
+  // whatever follows the finish reason is only drained
+  if (finished_) {
+    buffer_.clear();
+    return;
+  }
+  buffer_.append(data);
+  size_t pos = 0;
+  while (!finished_) {
+    size_t line_end = buffer_.find('\n', pos);
+    if (line_end == std::string::npos)
+      break;
+    std::string_view line(buffer_.data() + pos, line_end - pos);
+    pos = line_end + 1;
+    if (line.ends_with('\r'))
+      line.remove_suffix(1);
+
+    // a blank line dispatches the event of the data lines before it, and
+    // fields other than data, and comments starting with ':', are ignored
+    if (line.empty()) {
+      if (!event_data_.empty())
+        handle_event(event_data_);
+      event_data_.clear();
+    } else if (line.starts_with("data:")) {
+      line.remove_prefix(5);
+      if (line.starts_with(' '))
+        line.remove_prefix(1);
+      if (!event_data_.empty())
+        event_data_.push_back('\n');
+      event_data_.append(line);
+    }
+  }
+  buffer_.erase(0, pos);
+}
+
+void openai_chat_completion_stream_t::handle_event(const std::string &data) {
+  if (data == "[DONE]")
+    return;
+  const nlohmann::json j = nlohmann::json::parse(data, nullptr, false);
+  if (j.is_discarded() || !j.is_object())
+    return fail("[OpenAI] Invalid event: " + data);
+  if (j.contains("error"))
+    return fail("[OpenAI] Request failed: " + j["error"].dump());
+  if (!j.contains("choices"))
+    return;
+  if (!j["choices"].is_array())
+    return fail("[OpenAI] Invalid event: " + data);
+  if (j["choices"].empty())
+    return;
+
+  const auto &choice = j["choices"][0];
+  if (!choice.is_object())
+    return fail("[OpenAI] Invalid event: " + data);
+  const auto &delta = choice.contains("delta") && choice["delta"].is_object()
+                          ? choice["delta"]
+                          : nlohmann::json::object();
+  if (delta.contains("content") && delta["content"].is_string() &&
+      !delta["content"].get<std::string>().empty()) {
+    openai_response_delta_t content_delta;
+    content_delta.message.role = "assistant";
+    content_delta.message.content = delta["content"];
+    push(std::move(content_delta));
   }
+  if (delta.contains("tool_calls") && delta["tool_calls"].is_array()) {
+    for (const auto &tool_call : delta["tool_calls"]) {
+      if (!tool_call.is_object())
+        return fail("[OpenAI] Invalid tool call: " + tool_call.dump());
+      size_t index = 0;
+      if (tool_call.contains("index")) {
+        const auto &index_val = tool_call["index"];
+        if (!index_val.is_number_unsigned() ||
+            index_val.get<uint64_t>() >= openai_max_tool_calls)
+          return fail("[OpenAI] Invalid tool call index: " + index_val.dump());
+        index = index_val.get<uint64_t>();
+      }
+      if (index >= tool_calls_.size())
+        tool_calls_.resize(index + 1);
+      auto &fragments = tool_calls_[index];
+      if (tool_call.contains("id") && tool_call["id"].is_string())
+        fragments.id += tool_call["id"].get<std::string>();
+      if (!tool_call.contains("function") ||
+          !tool_call["function"].is_object())
+        continue;
+      const auto &function = tool_call["function"];
+      if (function.contains("name") && function["name"].is_string())
+        fragments.name += function["name"].get<std::string>();
+      if (function.contains("arguments") && function["arguments"].is_string())
+        fragments.arguments += function["arguments"].get<std::string>();
+    }
+  }
+
+  if (!choice.contains("finish_reason") || choice["finish_reason"].is_null())
+    return;
+  if (!choice["finish_reason"].is_string())
+    return fail("[OpenAI] Invalid finish reason: " +
+                choice["finish_reason"].dump());
+  openai_response_delta_t last_delta;
+  last_delta.message.role = "assistant";
+  last_delta.finish_reason = choice["finish_reason"].get<std::string>();
+  if (tool_calls_.empty())
+    last_delta.message.content = "";
+  else {
+    last_delta.message.tool_calls = std::vector<openai_chat_tool_call_t>{};
+    for (const auto &fragments : tool_calls_) {
+      openai_chat_tool_call_t tool_call{.id = fragments.id};
+      tool_call.function.name = fragments.name;
+      auto arguments = nlohmann::json::parse(
+          fragments.arguments.empty() ? "{}" : fragments.arguments, nullptr,
+          false);
+      if (arguments.is_discarded())
+        return fail("[OpenAI] Invalid tool call arguments: " +
+                    fragments.arguments);
+      tool_call.function.arguments = std::move(arguments);
+      last_delta.message.tool_calls->push_back(std::move(tool_call));
+    }
+  }
+  push(std::move(last_delta));
+}
+
+void openai_chat_completion_stream_t::push(openai_response_delta_t delta) {
+  {
+    std::lock_guard lock(mutex_);
+    if (delta.finish_reason.has_value())
+      finished_ = true;
+    deltas_.push_back(std::move(delta));
+  }
+  cv_.notify_all();
+}
+
+bool openai_chat_completion_stream_t::failed() {
+  std::lock_guard lock(mutex_);
+  return error_.has_value();
+}
+
+void openai_chat_completion_stream_t::fail(const std::string &reason) {
+  {
+    std::lock_guard lock(mutex_);
+    if (finished_ || error_.has_value())
+      return;
+    error_ = reason;
+  }
+  cv_.notify_all();
+}
 
+openai_llm_engine_t::openai_llm_engine_t(const std::string &api_key,
+                                         const std::string &model,
+                                         const std::string &base_url)
+    : api_key_(api_key), model_(model), base_url_(base_url) {}
+
+std::unique_ptr<openai_chat_completion_stream_t> openai_llm_engine_t::infer(
+    std::unique_ptr<openai_chat_completion_request_t> request) {
   request->model = model_;
   // convert function call arguments as string if exists
   g_dump_function_call_arguments_as_string = true;
   nlohmann::json body = *request;
   g_dump_function_call_arguments_as_string = false;
+  body["stream"] = true;
 
-  httplib::Request http_req;
-  std::stringstream response_body;
-
-  http_req.method = "POST";
-  http_req.path = "/v1/chat/completions";
-  http_req.headers = httplib_headers;
-  http_req.body = body.dump();
+  return std::make_unique<openai_chat_completion_stream_t>(base_url_, api_key_,
+                                                           body.dump());
+}
 
-  auto result = client.send(http_req);
+/**
+ * Operator of `infer`, which yields deltas as they are streamed. The request
+ * is cancelled when the operator is initialized again or reset before the
+ * stream finishes.
+ */
+class openai_infer_operator_t : public method_operator_t {
+public:
+  std::optional<error_output_t>
+  initialize(std::shared_ptr<const value_t> in) override {
+    stream_.reset();
+    auto parent_rv = method_operator_t::initialize(in);
+    if (parent_rv.has_value())
+      return parent_rv;
+    auto engine = comp_.lock()->get_obj("engine")->as<openai_llm_engine_t>();
+    try {
+      stream_ = engine->infer(convert_request_input(in));
+    } catch (const std::exception &e) {
+      return error_output_t(e.what());
+    } catch (const ailoy::runtime_error &e) {
+      return error_output_t(e.what());
+    }
+    return std::nullopt;
+  }
 
-  if (!result)
-    throw ailoy::runtime_error("[OpenAI] Request failed: " +
-                               std::string(httplib::to_string(result.error())));
+  output_t step() override {
+    openai_response_delta_t delta;
+    try {
+      delta = stream_->next();
+    } catch (const ailoy::runtime_error &e) {
+      reset_input();
+      return error_output_t(e.what());
+    }
 
-  if (result->status != httplib::OK_200) {
-    std::cout << result->status << " " << result->body << std::endl;
-    throw ailoy::runtime_error(std::format("[OpenAI] Request failed: [{}] {}",
-                                           result->status, result->body));
+    auto out = create<map_t>();
+    out->insert_or_assign("message", from_nlohmann_json(delta.message));
+    if (delta.finish_reason.has_value())
+      out->insert_or_assign("finish_reason",
+                            create<string_t>(delta.finish_reason.value()));
+    else
+      out->insert_or_assign("finish_reason", create<null_t>());
+    bool finish = delta.finish_reason.has_value();
+    if (finish)
+      reset_input();
+    return ok_output_t(out, finish);
   }
 
-  auto j = nlohmann::json::parse(result->body);
-  openai_chat_completion_response_choice_t choice = j["choices"][0];
-  auto delta = openai_response_delta_t{.message = choice.message,
-                                       .finish_reason = choice.finish_reason};
-  return delta;
-}
+  void reset_input() override {
+    method_operator_t::reset_input();
+    stream_.reset();
+  }
 
-// TODO: enable iterative infer
-// void infer_stream(const openai_request_t &req) {
-//   httplib::Client client("https://api.openai.com");
-//   std::unordered_map<std::string, std::string> headers = {
-//       {"Authorization", "Bearer " + req.api_key},
-//       {"Content-Type", "application/json"},
-//       {"Accept", "text/event-stream"},
-//       {"Cache-Control", "no-cache"},
-//   };
-//   httplib::Headers httplib_headers;
-//   for (const auto &[key, value] : headers) {
-//     httplib_headers.emplace(key, value);
-//   }
-
-//   nlohmann::json body = {{"model", req.model},
-//                          {"messages", nlohmann::json::array()},
-//                          {"stream", true}};
-//   for (const auto &msg : req.messages) {
-//     body["messages"].push_back({{"role", msg.role}, {"content",
-//     msg.content}});
-//   }
-
-//   httplib::Request http_req;
-//   std::stringstream response_body;
-
-//   http_req.method = "POST";
-//   http_req.path = "/v1/chat/completions";
-//   http_req.headers = httplib_headers;
-//   http_req.body = body.dump();
-
-//   std::string buffer;
-//   http_req.content_receiver = [&](const char *data, size_t data_length,
-//                                   uint64_t, uint64_t) {
-//     std::string chunk(data, data_length);
-//     response_body << chunk;
-//     buffer += chunk;
-
-//     // Process SSE events
-//     size_t pos = 0;
-//     while (pos < buffer.length()) {
-//       size_t event_end = buffer.find("\n\n", pos);
-//       if (event_end == std::string::npos)
-//         break;
-
-//       std::string event_block = buffer.substr(pos, event_end - pos);
-//       pos = event_end + 2;
-
-//       if (event_block.rfind("data:", 0) != 0)
-//         continue;
-//       std::string event_data = event_block.substr(5);
-//       event_data.erase(0, event_data.find_first_not_of(" \t"));
-//       event_data.erase(event_data.find_last_not_of(" \t") + 1);
-
-//       if (event_data == "[DONE]") {
-//         break;
-//       }
-
-//       try {
-//         auto j = nlohmann::json::parse(event_data);
-//         if (j.contains("choices") && !j["choices"].empty()) {
-//           auto &_delta = j["choices"][0]["delta"];
-//           auto &_finish_reason = j["choices"][0]["finish_reason"];
-//           std::optional<std::string> content;
-//           std::optional<std::string> finish_reason;
-
-//           if (_delta.contains("content") && !_delta["content"].is_null()) {
-//             content = _delta["content"].get<std::string>();
-//           }
-//           if (!_finish_reason.is_null()) {
-//             finish_reason = _finish_reason.get<std::string>();
-//           }
-
-//           // callback
-//           std::cout << "content: " << content.value_or("") << std::endl;
-//         }
-//       } catch (const std::exception &e) {
-//         throw ailoy::runtime_error("[OpenAI] Error parsing SSE data: " +
-//                                    std::string(e.what()));
-//       }
-//     }
-//     buffer = buffer.substr(pos);
-//     return true;
-//   };
-
-//   httplib::Response res;
-//   httplib::Error err;
-//   bool request_succeeded = client.send(http_req, res, err);
-//   if (!request_succeeded) {
-//     throw ailoy::runtime_error("[OpenAI] Request failed: " +
-//                                std::string(httplib::to_string(err)));
-//   }
-// }
+private:
+  std::unique_ptr<openai_chat_completion_stream_t> stream_;
+};
 
 component_or_error_t
 create_openai_component(std::shared_ptr<const value_t> attrs) {
@@ -317,18 +503,11 @@ create_openai_component(std::shared_ptr<const value_t> attrs) {
   auto data = attrs->as<map_t>();
   std::string api_key = *data->at<string_t>("api_key");
   std::string model = *data->at<string_t>("model", "gpt-4o");
-  auto engine = ailoy::create<openai_llm_engine_t>(api_key, model);
-
-  auto infer = ailoy::create<instant_method_operator_t>(
-      [&](std::shared_ptr<component_t> component,
-          std::shared_ptr<const value_t> inputs) -> value_or_error_t {
-        auto request = convert_request_input(inputs);
-        auto delta =
-            component->get_obj("engine")->as<openai_llm_engine_t>()->infer(
-                std::move(request));
-        auto rv = ailoy::from_nlohmann_json(delta);
-        return rv;
-      });
+  std::string base_url =
+      *data->at<string_t>("base_url", "https://api.openai.com");
+  auto engine = ailoy::create<openai_llm_engine_t>(api_key, model, base_url);
+
+  auto infer = ailoy::create<openai_infer_operator_t>();
 
   auto ops = std::initializer_list<
       std::pair<const std::string, std::shared_ptr<method_operator_t>>>{
@@ -1,10 +1,18 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 #include <nlohmann/json.hpp>
 
+#include "http_client_pool.hpp"
 #include "module.hpp"
 #include "value.hpp"
 
@@ -66,19 +74,93 @@ struct openai_chat_completion_request_t {
 
 struct openai_response_delta_t {
   openai_chat_completion_message_t message;
-  std::string finish_reason;
+  std::optional<std::string> finish_reason = std::nullopt;
+};
+
+/**
+ * @brief Chat completion streamed as server-sent events
+ * @details The request runs on a background thread, which parses events as
+ * they arrive and queues their deltas to be taken by `next`. The connection
+ * is leased from the pool shared by the process. Arguments of
+ * tool calls come in fragments, so tool calls are gathered and returned
+ * with the last delta.
+ */
+class openai_chat_completion_stream_t {
+public:
+  openai_chat_completion_stream_t(const std::string &base_url,
+                                  const std::string &api_key,
+                                  const std::string &body);
+
+  ~openai_chat_completion_stream_t();
+
+  /**
+   * @brief Wait for the next delta, where the last one has `finish_reason`
+   * @throw ailoy::runtime_error if the request has failed
+   */
+  openai_response_delta_t next();
+
+  /**
+   * @brief Abort the request if it has not finished, and wait for the thread
+   * @details Once the last delta is pushed, the rest of the response is read
+   * instead, so that the connection may be reused.
+   */
+  void cancel();
+
+private:
+  struct tool_call_fragments_t {
+    std::string id;
+    std::string name;
+    std::string arguments;
+  };
+
+  /**
+   * Send the request and parse its events, on the thread
+   */
+  void run(const std::string &api_key, const std::string &body);
+
+  void receive(std::string_view data);
+
+  void handle_event(const std::string &data);
+
+  void push(openai_response_delta_t delta);
+
+  void fail(const std::string &reason);
+
+  bool failed();
+
+  http_client_lease_t client_;
+  std::thread thread_;
+  std::atomic<bool> cancelled_ = false;
+  // Set by the thread when the request returns, after which the connection
+  // may be reused if the response was read to the end
+  std::atomic<bool> done_ = false;
+  bool reusable_ = false;
+
+  // Owned by the thread
+  std::string buffer_;
+  std::string event_data_;
+  std::vector<tool_call_fragments_t> tool_calls_;
+
+  // Shared with `next`
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<openai_response_delta_t> deltas_;
+  std::optional<std::string> error_;
+  bool finished_ = false;
 };
 
 class openai_llm_engine_t : public object_t {
 public:
-  openai_llm_engine_t(const std::string &api_key, const std::string &model);
+  openai_llm_engine_t(const std::string &api_key, const std::string &model,
+                      const std::string &base_url = "https://api.openai.com");
 
-  openai_response_delta_t
+  std::unique_ptr<openai_chat_completion_stream_t>
   infer(std::unique_ptr<openai_chat_completion_request_t> request);
 
 private:
   std::string api_key_;
   std::string model_;
+  std::string base_url_;
 };
 
 component_or_error_t
@@ -0,0 +1,752 @@
+#include "rag.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "bm25_index.hpp"
+#include "exception.hpp"
+#include "split_text.hpp"
+#include "vector_store.hpp"
+
+namespace ailoy {
+
+/**
+ * Queue between two pipeline stages, which blocks the producer while full
+ */
+template <typename item_t> class bounded_queue_t {
+public:
+  bounded_queue_t(size_t capacity) : capacity_(capacity) {}
+
+  /**
+   * @return false if the queue is closed
+   */
+  bool push(item_t item) {
+    std::unique_lock lock(mutex_);
+    cv_.wait(lock, [&]() { return items_.size() < capacity_ || closed_; });
+    if (closed_)
+      return false;
+    items_.push_back(std::move(item));
+    lock.unlock();
+    cv_.notify_all();
+    return true;
+  }
+
+  /**
+   * @return nullopt once the queue is closed and drained
+   */
+  std::optional<item_t> pop() {
+    std::unique_lock lock(mutex_);
+    cv_.wait(lock, [&]() { return !items_.empty() || closed_; });
+    if (items_.empty())
+      return std::nullopt;
+    item_t item = std::move(items_.front());
+    items_.pop_front();
+    lock.unlock();
+    cv_.notify_all();
+    return item;
+  }
+
+  /**
+   * Stop accepting items, while the queued ones can still be popped
+   */
+  void close(bool drop_items = false) {
+    {
+      std::lock_guard lock(mutex_);
+      closed_ = true;
+      if (drop_items)
+        items_.clear();
+    }
+    cv_.notify_all();
+  }
+
+private:
+  size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<item_t> items_;
+  bool closed_ = false;
+};
+
+/**
+ * Reason of the exception being handled
+ */
+static std::string current_error_reason() {
+  try {
+    throw;
+  } catch (const ailoy::runtime_error &e) {
+    return e.what();
+  } catch (const std::exception &e) {
+    return e.what();
+  } catch (...) {
+    return "Unknown error";
+  }
+}
+
+// Batches of chunks that can wait between two stages
+constexpr size_t ingest_queue_capacity = 4;
+
+class ingest_documents_operator_t : public operator_t {
+public:
+  ~ingest_documents_operator_t() { stop(); }
+
+  std::optional<error_output_t>
+  initialize(std::shared_ptr<const value_t> in) override {
+    stop();
+    auto error = parse_inputs(in);
+    if (error.has_value())
+      return error;
+    operator_t::initialize(in);
+    start();
+    return std::nullopt;
+  }
+
+  output_t step() override {
+    auto batch = chunks_->pop();
+    if (!batch.has_value()) {
+      // every chunk is embedded, or a stage has failed
+      embedded_->close();
+      inserter_.join();
+      stop();
+      if (error_.has_value())
+        return error_output_t(error_.value());
+
+      auto outputs = progress();
+      auto ids = create<array_t>();
+      for (const auto &id : ids_)
+        ids->push_back(create<string_t>(id));
+      outputs->insert_or_assign("ids", ids);
+      reset_input();
+      return ok_output_t(outputs, true);
+    }
+
+    auto inputs = embed(batch.value());
+    if (std::holds_alternative<error_output_t>(inputs)) {
+      fail(std::get<error_output_t>(inputs).reason);
+      stop();
+      return std::get<error_output_t>(inputs);
+    }
+    size_t num_chunks = std::get<0>(inputs).size();
+    // fails only if the insertion has failed, which the next step reports
+    embedded_->push(std::move(std::get<0>(inputs)));
+    num_embedded_chunks_ += num_chunks;
+    return ok_output_t(progress(), false);
+  }
+
+  void reset_input() override {
+    operator_t::reset_input();
+    stop();
+  }
+
+private:
+  struct chunk_batch_t {
+    std::vector<std::string> texts;
+    // index of the source text of each chunk
+    std::vector<size_t> sources;
+  };
+
+  std::optional<error_output_t>
+  parse_inputs(std::shared_ptr<const value_t> inputs) {
+    const std::string context = "Ingest Documents";
+    if (!inputs || !inputs->is_type_of<map_t>())
+      return error_output_t(type_error(context, "inputs", "map_t",
+                                       inputs ? inputs->get_type() : "null"));
+    auto input_map = inputs->as<map_t>();
+
+    // Components
+    for (auto name : {"embedding_model", "vector_store"}) {
+      if (!input_map->contains(name))
+        return error_output_t(range_error(context, name));
+      if (!input_map->at(name)->is_type_of<string_t>())
+        return error_output_t(type_error(context, name, "string_t",
+                                         input_map->at(name)->get_type()));
+    }
+    const std::string &embedding_model_name =
+        *input_map->at<string_t>("embedding_model");
+    auto embedding_model = find_component(embedding_model_name);
+    infer_ = embedding_model ? embedding_model->get_operator("infer") : nullptr;
+    if (!infer_)
+      return error_output_t(value_error(context, "embedding_model",
+                                        "name of an embedding model component",
+                                        embedding_model_name));
+    const std::string &vector_store_name =
+        *input_map->at<string_t>("vector_store");
+    auto vector_store = find_component(vector_store_name);
+    vector_store_ =
+        vector_store ? vector_store->get_obj<vector_store_t>("vector_store")
+                     : nullptr;
+    if (!vector_store_)
+      return error_output_t(value_error(context, "vector_store",
+                                        "name of a vector store component",
+                                        vector_store_name));
+
+    // Texts and their metadata
+    if (!input_map->contains("texts"))
+      return error_output_t(range_error(context, "texts"));
+    if (!input_map->at("texts")->is_type_of<array_t>())
+      return error_output_t(type_error(context, "texts", "array_t",
+                                       input_map->at("texts")->get_type()));
+    texts_.clear();
+    for (const auto &text : *input_map->at<array_t>("texts")) {
+      if (!text->is_type_of<string_t>())
+        return error_output_t(
+            type_error(context, "texts.*", "string_t", text->get_type()));
+      texts_.push_back(*text->as<string_t>());
+    }
+    metadatas_.assign(texts_.size(), nlohmann::json({}));
+    if (input_map->contains("metadatas")) {
+      if (!input_map->at("metadatas")->is_type_of<array_t>())
+        return error_output_t(
+            type_error(context, "metadatas", "array_t",
+                       input_map->at("metadatas")->get_type()));
+      auto metadatas = input_map->at<array_t>("metadatas");
+      if (metadatas->size() != texts_.size())
+        return error_output_t(value_error(
+            context, "metadatas", "as many as texts",
+            std::to_string(metadatas->size())));
+      for (size_t i = 0; i < texts_.size(); i++) {
+        auto metadata = metadatas->at(i);
+        if (!metadata->is_type_of<map_t>() && !metadata->is_type_of<null_t>())
+          return error_output_t(type_error(context, "metadatas.*",
+                                           "map_t | null_t",
+                                           metadata->get_type()));
+        metadatas_[i] = *metadata;
+      }
+    }
+
+    // Splitting and batching
+    auto get_uint = [&](const std::string &name,
+                        size_t &value) -> std::optional<error_output_t> {
+      if (!input_map->contains(name))
+        return std::nullopt;
+      auto val = input_map->at(name);
+      if (val->is_type_of<uint_t>())
+        value = *val->as<uint_t>();
+      else if (val->is_type_of<int_t>() && *val->as<int_t>() >= 0)
+        value = *val->as<int_t>();
+      else
+        return error_output_t(
+            type_error(context, name, "uint_t | int_t", val->get_type()));
+      return std::nullopt;
+    };
+    chunk_size_ = 4000;
+    chunk_overlap_ = 200;
+    batch_size_ = 32;
+    for (auto [name, value] : {std::pair{"chunk_size", &chunk_size_},
+                               std::pair{"chunk_overlap", &chunk_overlap_},
+                               std::pair{"batch_size", &batch_size_}}) {
+      auto error = get_uint(name, *value);
+      if (error.has_value())
+        return error;
+    }
+    if (chunk_size_ < 1)
+      return error_output_t(value_error(context, "chunk_size", ">= 1",
+                                        std::to_string(chunk_size_)));
+    if (chunk_overlap_ > chunk_size_)
+      return error_output_t(
+          value_error(context, "chunk_overlap", "<= chunk_size",
+                      std::to_string(chunk_overlap_)));
+    if (batch_size_ < 1)
+      return error_output_t(value_error(context, "batch_size", ">= 1",
+                                        std::to_string(batch_size_)));
+
+    separators_ = {"\n\n", "\n", " ", ""};
+    if (input_map->contains("separators")) {
+      if (!input_map->at("separators")->is_type_of<array_t>())
+        return error_output_t(
+            type_error(context, "separators", "array_t",
+                       input_map->at("separators")->get_type()));
+      separators_.clear();
+      for (const auto &separator : *input_map->at<array_t>("separators")) {
+        if (!separator->is_type_of<string_t>())
+          return error_output_t(type_error(context, "separators.*",
+                                           "string_t", separator->get_type()));
+        separators_.push_back(*separator->as<string_t>());
+      }
+    }
+    return std::nullopt;
+  }
+
+  void start() {
+    chunks_ = std::make_unique<bounded_queue_t<chunk_batch_t>>(
+        ingest_queue_capacity);
+    embedded_ =
+        std::make_unique<bounded_queue_t<std::vector<vector_store_add_input_t>>>(
+            ingest_queue_capacity);
+    error_.reset();
+    ids_.clear();
+    num_split_texts_ = 0;
+    num_chunks_ = 0;
+    num_embedded_chunks_ = 0;
+    num_inserted_chunks_ = 0;
+
+    splitter_ = std::thread([this]() {
+      try {
+        chunk_batch_t batch;
+        for (size_t i = 0; i < texts_.size(); i++) {
+          auto chunks = split_text_by_separators_recursively(
+              texts_[i], chunk_size_, chunk_overlap_, separators_);
+          for (auto &chunk : chunks) {
+            batch.texts.push_back(std::move(chunk));
+            batch.sources.push_back(i);
+            if (batch.texts.size() < batch_size_)
+              continue;
+            if (!chunks_->push(std::move(batch)))
+              return;
+            batch = {};
+          }
+          num_chunks_ += chunks.size();
+          num_split_texts_++;
+        }
+        if (!batch.texts.empty())
+          chunks_->push(std::move(batch));
+      } catch (...) {
+        fail(current_error_reason());
+      }
+      chunks_->close();
+    });
+
+    inserter_ = std::thread([this]() {
+      while (auto inputs = embedded_->pop()) {
+        try {
+          auto ids = vector_store_->add_vectors(inputs.value());
+          ids_.insert(ids_.end(), ids.begin(), ids.end());
+          num_inserted_chunks_ += ids.size();
+        } catch (...) {
+          fail(current_error_reason());
+          return;
+        }
+      }
+    });
+  }
+
+  /**
+   * Cancel the pipeline and wait for its threads
+   */
+  void stop() {
+    if (chunks_)
+      chunks_->close(true);
+    if (embedded_)
+      embedded_->close(true);
+    if (splitter_.joinable())
+      splitter_.join();
+    if (inserter_.joinable())
+      inserter_.join();
+  }
+
+  /**
+   * Record the first error and cancel the other stages
+   */
+  void fail(const std::string &reason) {
+    {
+      std::lock_guard lock(error_mutex_);
+      if (!error_.has_value())
+        error_ = "[Ingest Documents] " + reason;
+    }
+    chunks_->close(true);
+    embedded_->close(true);
+  }
+
+  std::variant<std::vector<vector_store_add_input_t>, error_output_t>
+  embed(const chunk_batch_t &batch) {
+    auto prompts = create<array_t>();
+    for (const auto &text : batch.texts)
+      prompts->push_back(create<string_t>(text));
+    auto infer_inputs = create<map_t>();
+    infer_inputs->insert_or_assign("prompts", prompts);
+
+    auto init_error = infer_->initialize(infer_inputs);
+    if (init_error.has_value())
+      return init_error.value();
+    auto output = infer_->step();
+    if (std::holds_alternative<error_output_t>(output))
+      return std::get<error_output_t>(output);
+
+    auto output_val = std::get<ok_output_t>(output).val;
+    if (!output_val || !output_val->is_type_of<map_t>() ||
+        !output_val->as<map_t>()->contains("embeddings") ||
+        !output_val->as<map_t>()->at("embeddings")->is_type_of<ndarray_t>())
+      return error_output_t(range_error("Ingest Documents", "embeddings"));
+    auto embeddings = output_val->as<map_t>()->at<ndarray_t>("embeddings");
+    if (embeddings->shape.size() != 2 ||
+        embeddings->shape[0] != batch.texts.size())
+      return error_output_t(value_error(
+          "Ingest Documents", "embeddings",
+          std::format("shape of ({}, dimension)", batch.texts.size()),
+          embeddings->shape_str()));
+
+    size_t row_size = embeddings->data.size() / batch.texts.size();
+    std::vector<vector_store_add_input_t> inputs(batch.texts.size());
+    for (size_t i = 0; i < batch.texts.size(); i++) {
+      inputs[i].embedding = create<ndarray_t>(
+          std::vector<size_t>{embeddings->shape[1]}, embeddings->dtype,
+          embeddings->data.data() + i * row_size, row_size);
+      inputs[i].document = batch.texts[i];
+      inputs[i].metadata = metadatas_[batch.sources[i]];
+    }
+    return inputs;
+  }
+
+  std::shared_ptr<map_t> progress() const {
+    auto outputs = create<map_t>();
+    outputs->insert_or_assign("num_texts", create<uint_t>(texts_.size()));
+    outputs->insert_or_assign("num_split_texts",
+                              create<uint_t>(num_split_texts_.load()));
+    outputs->insert_or_assign("num_chunks", create<uint_t>(num_chunks_.load()));
+    outputs->insert_or_assign("num_embedded_chunks",
+                              create<uint_t>(num_embedded_chunks_.load()));
+    outputs->insert_or_assign("num_inserted_chunks",
+                              create<uint_t>(num_inserted_chunks_.load()));
+    return outputs;
+  }
+
+  std::shared_ptr<operator_t> infer_;
+  std::shared_ptr<vector_store_t> vector_store_;
+  std::vector<std::string> texts_;
+  std::vector<nlohmann::json> metadatas_;
+  size_t chunk_size_;
+  size_t chunk_overlap_;
+  std::vector<std::string> separators_;
+  size_t batch_size_;
+
+  std::unique_ptr<bounded_queue_t<chunk_batch_t>> chunks_;
+  std::unique_ptr<bounded_queue_t<std::vector<vector_store_add_input_t>>>
+      embedded_;
+  std::thread splitter_;
+  std::thread inserter_;
+  std::mutex error_mutex_;
+  std::optional<std::string> error_;
+  // Written by the inserter only, and read after it is joined
+  std::vector<std::string> ids_;
+
+  std::atomic<size_t> num_split_texts_ = 0;
+  std::atomic<size_t> num_chunks_ = 0;
+  std::atomic<size_t> num_embedded_chunks_ = 0;
+  std::atomic<size_t> num_inserted_chunks_ = 0;
+};
+
+std::shared_ptr<operator_t> create_ingest_documents_operator() {
+  return create<ingest_documents_operator_t>();
+}
+
+constexpr const char *default_rag_context_template =
+    "Based on the following contexts, answer to user's question.\n"
+    "Context: {context}\n"
+    "Question: {query}";
+
+/**
+ * Replace every occurrence of `placeholder` in `text`
+ */
+static void replace_all(std::string &text, const std::string &placeholder,
+                        const std::string &value) {
+  for (size_t pos = text.find(placeholder); pos != std::string::npos;
+       pos = text.find(placeholder, pos + value.size()))
+    text.replace(pos, placeholder.size(), value);
+}
+
+class rag_query_operator_t : public operator_t {
+public:
+  std::optional<error_output_t>
+  initialize(std::shared_ptr<const value_t> in) override {
+    reset_input();
+    auto error = parse_inputs(in);
+    if (error.has_value())
+      return error;
+    return operator_t::initialize(in);
+  }
+
+  output_t step() override {
+    if (!generating_) {
+      started_at_ = clock_t::now();
+      auto error = prepare_generation();
+      if (error.has_value()) {
+        reset_input();
+        return error.value();
+      }
+      generating_ = true;
+    }
+
+    auto output = infer_->step();
+    if (std::holds_alternative<error_output_t>(output)) {
+      reset_input();
+      return output;
+    }
+    if (!first_token_at_.has_value())
+      first_token_at_ = clock_t::now();
+
+    auto &ok_output = std::get<ok_output_t>(output);
+    auto outputs = create<map_t>();
+    if (ok_output.val && ok_output.val->is_type_of<map_t>())
+      outputs = ok_output.val->as<map_t>();
+    // The language model may leave its operator unfinished on other finish
+    // reasons than "stop", which also end the answer
+    bool finish = ok_output.finish || (outputs->contains("finish_reason") &&
+                                       !outputs->at("finish_reason")
+                                            ->is_type_of<null_t>());
+    if (!finish)
+      return ok_output_t(outputs, false);
+
+    auto finished_at = clock_t::now();
+    timings_->insert_or_assign(
+        "time_to_first_token",
+        create<double_t>(seconds(generation_started_at_, *first_token_at_)));
+    timings_->insert_or_assign(
+        "generate",
+        create<double_t>(seconds(generation_started_at_, finished_at)));
+    timings_->insert_or_assign(
+        "total", create<double_t>(seconds(started_at_, finished_at)));
+    outputs->insert_or_assign("results", retrieve_results_to_value(results_));
+    outputs->insert_or_assign("timings", timings_);
+    if (!ok_output.finish)
+      infer_->reset_input();
+    reset_input();
+    return ok_output_t(outputs, true);
+  }
+
+  void reset_input() override {
+    operator_t::reset_input();
+    generating_ = false;
+    first_token_at_.reset();
+    results_.clear();
+  }
+
+private:
+  using clock_t = std::chrono::steady_clock;
+
+  static double seconds(clock_t::time_point from, clock_t::time_point to) {
+    return std::chrono::duration<double>(to - from).count();
+  }
+
+  std::optional<error_output_t>
+  parse_inputs(std::shared_ptr<const value_t> inputs) {
+    const std::string context = "RAG Query";
+    if (!inputs || !inputs->is_type_of<map_t>())
+      return error_output_t(type_error(context, "inputs", "map_t",
+                                       inputs ? inputs->get_type() : "null"));
+    auto input_map = inputs->as<map_t>();
+
+    // Components
+    for (auto name : {"embedding_model", "vector_store", "language_model"}) {
+      if (!input_map->contains(name))
+        return error_output_t(range_error(context, name));
+      if (!input_map->at(name)->is_type_of<string_t>())
+        return error_output_t(type_error(context, name, "string_t",
+                                         input_map->at(name)->get_type()));
+    }
+    const std::string &embedding_model_name =
+        *input_map->at<string_t>("embedding_model");
+    auto embedding_model = find_component(embedding_model_name);
+    embed_ = embedding_model ? embedding_model->get_operator("infer") : nullptr;
+    if (!embed_)
+      return error_output_t(value_error(context, "embedding_model",
+                                        "name of an embedding model component",
+                                        embedding_model_name));
+    const std::string &vector_store_name =
+        *input_map->at<string_t>("vector_store");
+    auto vector_store = find_component(vector_store_name);
+    vector_store_ =
+        vector_store ? vector_store->get_obj<vector_store_t>("vector_store")
+                     : nullptr;
+    if (!vector_store_)
+      return error_output_t(value_error(context, "vector_store",
+                                        "name of a vector store component",
+                                        vector_store_name));
+    const std::string &language_model_name =
+        *input_map->at<string_t>("language_model");
+    auto language_model = find_component(language_model_name);
+    infer_ = language_model ? language_model->get_operator("infer") : nullptr;
+    if (!infer_)
+      return error_output_t(value_error(context, "language_model",
+                                        "name of a language model component",
+                                        language_model_name));
+
+    // Query and retrieval
+    if (!input_map->contains("query"))
+      return error_output_t(range_error(context, "query"));
+    if (!input_map->at("query")->is_type_of<string_t>())
+      return error_output_t(type_error(context, "query", "string_t",
+                                       input_map->at("query")->get_type()));
+    query_ = *input_map->at<string_t>("query");
+
+    params_ = {};
+    auto error = parse_retrieve_inputs(input_map, context, top_k_, params_);
+    if (error.has_value())
+      return error;
+
+    rerank_ = false;
+    if (input_map->contains("rerank")) {
+      if (!input_map->at("rerank")->is_type_of<bool_t>())
+        return error_output_t(type_error(context, "rerank", "bool_t",
+                                         input_map->at("rerank")->get_type()));
+      rerank_ = *input_map->at<bool_t>("rerank");
+    }
+    num_candidates_ = 4 * top_k_;
+    if (input_map->contains("num_candidates")) {
+      auto num_candidates = input_map->at("num_candidates");
+      if (num_candidates->is_type_of<uint_t>())
+        num_candidates_ = *num_candidates->as<uint_t>();
+      else if (num_candidates->is_type_of<int_t>())
+        num_candidates_ = *num_candidates->as<int_t>();
+      else
+        return error_output_t(type_error(context, "num_candidates",
+                                         "uint_t | int_t",
+                                         num_candidates->get_type()));
+    }
+
+    // Counts are checked on the inputs, as negative int_t values wrap around
+    for (auto name : {"top_k", "num_candidates"}) {
+      if (!input_map->contains(name))
+        continue;
+      auto val = input_map->at(name);
+      if (val->is_type_of<int_t>() ? *val->as<int_t>() < 1
+                                   : *val->as<uint_t>() < 1)
+        return error_output_t(value_error(context, name, ">= 1",
+                                          val->to_nlohmann_json().dump()));
+    }
+
+    // Prompt
+    for (auto name : {"context_template", "system_message"}) {
+      if (input_map->contains(name) &&
+          !input_map->at(name)->is_type_of<string_t>())
+        return error_output_t(type_error(context, name, "string_t",
+                                         input_map->at(name)->get_type()));
+    }
+    context_template_ = input_map->contains("context_template")
+                            ? *input_map->at<string_t>("context_template")
+                            : default_rag_context_template;
+    system_message_.reset();
+    if (input_map->contains("system_message"))
+      system_message_ = *input_map->at<string_t>("system_message");
+
+    // Options passed through to the language model
+    infer_options_.clear();
+    for (auto name : {"enable_reasoning", "ignore_reasoning_messages"}) {
+      if (input_map->contains(name))
+        infer_options_.emplace_back(
+            name, std::const_pointer_cast<value_t>(input_map->at(name)));
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * Embed the query, retrieve contexts and start generation, recording the
+   * time of each stage
+   */
+  std::optional<error_output_t> prepare_generation() {
+    timings_ = create<map_t>();
+    auto stage_started_at = clock_t::now();
+    auto record = [&](const std::string &stage) {
+      auto now = clock_t::now();
+      timings_->insert_or_assign(
+          stage, create<double_t>(seconds(stage_started_at, now)));
+      stage_started_at = now;
+    };
+
+    // Embed
+    auto embed_inputs = create<map_t>();
+    embed_inputs->insert_or_assign("prompt", create<string_t>(query_));
+    auto error = embed_->initialize(embed_inputs);
+    if (error.has_value())
+      return error;
+    auto embed_output = embed_->step();
+    if (std::holds_alternative<error_output_t>(embed_output))
+      return std::get<error_output_t>(embed_output);
+    auto embed_val = std::get<ok_output_t>(embed_output).val;
+    if (!embed_val || !embed_val->is_type_of<map_t>() ||
+        !embed_val->as<map_t>()->contains("embedding") ||
+        !embed_val->as<map_t>()->at("embedding")->is_type_of<ndarray_t>())
+      return error_output_t(range_error("RAG Query", "embedding"));
+    auto embedding = embed_val->as<map_t>()->at<ndarray_t>("embedding");
+    record("embed");
+
+    // Retrieve, and rerank candidates by fusing BM25 scores of the query
+    try {
+      results_ = vector_store_->retrieve(
+          embedding, rerank_ ? std::max(num_candidates_, top_k_) : top_k_,
+          params_);
+      record("retrieve");
+      if (rerank_) {
+        results_ = rerank(std::move(results_));
+        record("rerank");
+      }
+    } catch (const ailoy::runtime_error &e) {
+      return error_output_t(e.what());
+    } catch (const std::exception &e) {
+      return error_output_t(e.what());
+    }
+
+    // Fill the template and start generation
+    std::string contexts;
+    for (const auto &result : results_) {
+      if (!contexts.empty())
+        contexts += "\n\n";
+      contexts += result.document;
+    }
+    std::string prompt = context_template_;
+    replace_all(prompt, "{context}", contexts);
+    replace_all(prompt, "{query}", query_);
+
+    auto messages = create<array_t>();
+    auto add_message = [&](const std::string &role,
+                           const std::string &content) {
+      auto message = create<map_t>();
+      message->insert_or_assign("role", create<string_t>(role));
+      message->insert_or_assign("content", create<string_t>(content));
+      messages->push_back(message);
+    };
+    if (system_message_.has_value())
+      add_message("system", system_message_.value());
+    add_message("user", prompt);
+    auto infer_inputs = create<map_t>();
+    infer_inputs->insert_or_assign("messages", messages);
+    for (const auto &[name, value] : infer_options_)
+      infer_inputs->insert_or_assign(name, value);
+    error = infer_->initialize(infer_inputs);
+    if (error.has_value())
+      return error;
+    generation_started_at_ = clock_t::now();
+    return std::nullopt;
+  }
+
+  std::vector<vector_store_retrieve_result_t>
+  rerank(std::vector<vector_store_retrieve_result_t> candidates) {
+    bm25_index_t index;
+    for (size_t i = 0; i < candidates.size(); i++)
+      index.insert(i, bm25_index_t::analyze(candidates[i].document));
+    std::vector<vector_store_retrieve_result_t> lexical_results;
+    for (auto [i, score] : index.search(query_, candidates.size())) {
+      lexical_results.push_back(candidates[i]);
+      lexical_results.back().similarity = score;
+    }
+    return fuse_retrieve_results(std::move(candidates),
+                                 std::move(lexical_results), top_k_, {});
+  }
+
+  std::shared_ptr<operator_t> embed_;
+  std::shared_ptr<vector_store_t> vector_store_;
+  std::shared_ptr<operator_t> infer_;
+  std::string query_;
+  uint64_t top_k_;
+  vector_store_retrieve_params_t params_;
+  bool rerank_;
+  uint64_t num_candidates_;
+  std::string context_template_;
+  std::optional<std::string> system_message_;
+  std::vector<std::pair<std::string, std::shared_ptr<value_t>>> infer_options_;
+
+  bool generating_ = false;
+  std::vector<vector_store_retrieve_result_t> results_;
+  std::shared_ptr<map_t> timings_;
+  clock_t::time_point started_at_;
+  clock_t::time_point generation_started_at_;
+  std::optional<clock_t::time_point> first_token_at_;
+};
+
+std::shared_ptr<operator_t> create_rag_query_operator() {
+  return create<rag_query_operator_t>();
+}
+
+} // namespace ailoy
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "module.hpp"
+
+namespace ailoy {
+
+/**
+ * @brief Create the operator indexing texts into a vector store
+ * @details Texts are split into chunks, embedded by an embedding model
+ * component and inserted into a vector store component, without leaving the
+ * VM. The stages form a pipeline connected by bounded queues: splitting and
+ * insertion run on their own threads, while each `step()` embeds a batch of
+ * chunks and reports the progress.
+ */
+std::shared_ptr<operator_t> create_ingest_documents_operator();
+
+/**
+ * @brief Create the operator answering a query with retrieved contexts
+ * @details The query is embedded, similar documents are retrieved from a
+ * vector store (optionally reranked by BM25 scores of the query) and filled
+ * into a prompt template, then the answer of a language model component is
+ * streamed. The final output reports the retrieved documents and the time
+ * spent in each stage.
+ */
+std::shared_ptr<operator_t> create_rag_query_operator();
+
+} // namespace ailoy
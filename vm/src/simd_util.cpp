@@ -0,0 +1,319 @@
+#include "simd_util.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define AILOY_SIMD_X86
+#define AILOY_SIMD_TARGET(x) __attribute__((target(x)))
+#elif defined(_M_X64) && defined(_MSC_VER)
+// MSVC compiles intrinsics of any instruction set without a target
+#include <immintrin.h>
+#include <intrin.h>
+#define AILOY_SIMD_X86
+#define AILOY_SIMD_TARGET(x)
+#elif (defined(__aarch64__) && defined(__ARM_NEON)) ||                         \
+    (defined(_M_ARM64) && defined(_MSC_VER))
+#include <arm_neon.h>
+#define AILOY_SIMD_NEON
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define AILOY_SIMD_WASM
+#endif
+
+namespace ailoy {
+
+uint16_t float_to_half(float value) {
+  uint32_t x;
+  std::memcpy(&x, &value, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t biased_exponent = (x >> 23) & 0xff;
+  uint32_t mantissa = x & 0x7fffff;
+
+  // infinity or NaN
+  if (biased_exponent == 0xff)
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+  int32_t exponent = static_cast<int32_t>(biased_exponent) - 127 + 15;
+  if (exponent >= 0x1f)
+    return sign | 0x7c00;
+  if (exponent <= 0) {
+    // subnormal or zero
+    if (exponent < -10)
+      return sign;
+    mantissa |= 0x800000;
+    uint32_t shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1)))
+      half++;
+    return sign | half;
+  }
+
+  // round to nearest even, carrying into the exponent if needed
+  uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+    half++;
+  return half;
+}
+
+float half_to_float(uint16_t value) {
+  uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1f;
+  uint32_t mantissa = value & 0x3ff;
+
+  uint32_t x;
+  if (exponent == 0x1f)
+    x = sign | 0x7f800000 | (mantissa << 13);
+  else if (exponent == 0) {
+    if (mantissa == 0)
+      x = sign;
+    else {
+      float subnormal = std::ldexp(static_cast<float>(mantissa), -24);
+      return sign ? -subnormal : subnormal;
+    }
+  } else
+    x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+  float rv;
+  std::memcpy(&rv, &x, sizeof(rv));
+  return rv;
+}
+
+static float dot_f32_scalar(const float *query, const float *vec, size_t n) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; i++)
+    sum += query[i] * vec[i];
+  return sum;
+}
+
+static float dot_f16_scalar(const float *query, const uint16_t *vec,
+                            size_t n) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; i++)
+    sum += query[i] * half_to_float(vec[i]);
+  return sum;
+}
+
+static float dot_i8_scalar(const float *query, const int8_t *vec, size_t n) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; i++)
+    sum += query[i] * vec[i];
+  return sum;
+}
+
+#if defined(AILOY_SIMD_X86)
+
+struct x86_features_t {
+  bool avx2_fma = false;
+  bool avx512f = false;
+};
+
+static x86_features_t detect_x86_features() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  // MSVC has no `__builtin_cpu_supports`, so CPUID and XCR0 are read
+  // directly, counting features only if the OS saves their registers
+  x86_features_t rv;
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return rv;
+  __cpuid(info, 1);
+  bool fma = info[2] & (1 << 12);
+  bool osxsave = info[2] & (1 << 27);
+  if (!osxsave)
+    return rv;
+  unsigned long long xcr0 = _xgetbv(0);
+  __cpuidex(info, 7, 0);
+  rv.avx2_fma = (xcr0 & 0x6) == 0x6 && fma && (info[1] & (1 << 5));
+  rv.avx512f = (xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16));
+  return rv;
+#else
+  __builtin_cpu_init();
+  x86_features_t rv;
+  rv.avx2_fma = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  rv.avx512f = __builtin_cpu_supports("avx512f") != 0;
+  return rv;
+#endif
+}
+
+AILOY_SIMD_TARGET("avx2,fma")
+static float hsum_avx2(__m256 v) {
+  __m128 sum =
+      _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum = _mm_hadd_ps(sum, sum);
+  sum = _mm_hadd_ps(sum, sum);
+  return _mm_cvtss_f32(sum);
+}
+
+AILOY_SIMD_TARGET("avx2,fma")
+static float dot_f32_avx2(const float *query, const float *vec, size_t n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (size_t i = 0; i < n; i += 16) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i),
+                           _mm256_loadu_ps(vec + i), acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8),
+                           _mm256_loadu_ps(vec + i + 8), acc1);
+  }
+  return hsum_avx2(_mm256_add_ps(acc0, acc1));
+}
+
+AILOY_SIMD_TARGET("avx2,fma,f16c")
+static float dot_f16_avx2(const float *query, const uint16_t *vec, size_t n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (size_t i = 0; i < n; i += 16) {
+    __m256 v0 = _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(vec + i)));
+    __m256 v1 = _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(vec + i + 8)));
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), v0, acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8), v1, acc1);
+  }
+  return hsum_avx2(_mm256_add_ps(acc0, acc1));
+}
+
+AILOY_SIMD_TARGET("avx2,fma")
+static float dot_i8_avx2(const float *query, const int8_t *vec, size_t n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (size_t i = 0; i < n; i += 16) {
+    __m128i codes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(vec + i));
+    __m256 v0 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(codes));
+    __m256 v1 =
+        _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(codes, 8)));
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), v0, acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8), v1, acc1);
+  }
+  return hsum_avx2(_mm256_add_ps(acc0, acc1));
+}
+
+AILOY_SIMD_TARGET("avx512f")
+static float dot_f32_avx512(const float *query, const float *vec, size_t n) {
+  __m512 acc = _mm512_setzero_ps();
+  for (size_t i = 0; i < n; i += 16)
+    acc = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), _mm512_loadu_ps(vec + i),
+                          acc);
+  return _mm512_reduce_add_ps(acc);
+}
+
+AILOY_SIMD_TARGET("avx512f")
+static float dot_f16_avx512(const float *query, const uint16_t *vec,
+                            size_t n) {
+  __m512 acc = _mm512_setzero_ps();
+  for (size_t i = 0; i < n; i += 16) {
+    __m512 v = _mm512_cvtph_ps(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(vec + i)));
+    acc = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), v, acc);
+  }
+  return _mm512_reduce_add_ps(acc);
+}
+
+AILOY_SIMD_TARGET("avx512f")
+static float dot_i8_avx512(const float *query, const int8_t *vec, size_t n) {
+  __m512 acc = _mm512_setzero_ps();
+  for (size_t i = 0; i < n; i += 16) {
+    __m512 v = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(vec + i))));
+    acc = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), v, acc);
+  }
+  return _mm512_reduce_add_ps(acc);
+}
+
+#elif defined(AILOY_SIMD_NEON)
+
+static float dot_f32_neon(const float *query, const float *vec, size_t n) {
+  float32x4_t acc0 = vdupq_n_f32(0.0f);
+  float32x4_t acc1 = vdupq_n_f32(0.0f);
+  float32x4_t acc2 = vdupq_n_f32(0.0f);
+  float32x4_t acc3 = vdupq_n_f32(0.0f);
+  for (size_t i = 0; i < n; i += 16) {
+    acc0 = vfmaq_f32(acc0, vld1q_f32(query + i), vld1q_f32(vec + i));
+    acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4), vld1q_f32(vec + i + 4));
+    acc2 = vfmaq_f32(acc2, vld1q_f32(query + i + 8), vld1q_f32(vec + i + 8));
+    acc3 = vfmaq_f32(acc3, vld1q_f32(query + i + 12), vld1q_f32(vec + i + 12));
+  }
+  return vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+}
+
+// MSVC has no float16x8_t, so half floats take the scalar path there
+#if !defined(_MSC_VER) || defined(__clang__)
+#define AILOY_SIMD_NEON_F16
+static float dot_f16_neon(const float *query, const uint16_t *vec, size_t n) {
+  float32x4_t acc0 = vdupq_n_f32(0.0f);
+  float32x4_t acc1 = vdupq_n_f32(0.0f);
+  for (size_t i = 0; i < n; i += 8) {
+    float16x8_t v = vreinterpretq_f16_u16(vld1q_u16(vec + i));
+    acc0 = vfmaq_f32(acc0, vld1q_f32(query + i), vcvt_f32_f16(vget_low_f16(v)));
+    acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4), vcvt_high_f32_f16(v));
+  }
+  return vaddvq_f32(vaddq_f32(acc0, acc1));
+}
+#endif
+
+static float dot_i8_neon(const float *query, const int8_t *vec, size_t n) {
+  float32x4_t acc0 = vdupq_n_f32(0.0f);
+  float32x4_t acc1 = vdupq_n_f32(0.0f);
+  for (size_t i = 0; i < n; i += 16) {
+    int8x16_t codes = vld1q_s8(vec + i);
+    int16x8_t lo = vmovl_s8(vget_low_s8(codes));
+    int16x8_t hi = vmovl_high_s8(codes);
+    acc0 = vfmaq_f32(acc0, vld1q_f32(query + i),
+                     vcvtq_f32_s32(vmovl_s16(vget_low_s16(lo))));
+    acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4),
+                     vcvtq_f32_s32(vmovl_high_s16(lo)));
+    acc0 = vfmaq_f32(acc0, vld1q_f32(query + i + 8),
+                     vcvtq_f32_s32(vmovl_s16(vget_low_s16(hi))));
+    acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 12),
+                     vcvtq_f32_s32(vmovl_high_s16(hi)));
+  }
+  return vaddvq_f32(vaddq_f32(acc0, acc1));
+}
+
+#elif defined(AILOY_SIMD_WASM)
+
+static float dot_f32_wasm(const float *query, const float *vec, size_t n) {
+  v128_t acc0 = wasm_f32x4_splat(0.0f);
+  v128_t acc1 = wasm_f32x4_splat(0.0f);
+  for (size_t i = 0; i < n; i += 8) {
+    acc0 = wasm_f32x4_add(acc0, wasm_f32x4_mul(wasm_v128_load(query + i),
+                                               wasm_v128_load(vec + i)));
+    acc1 = wasm_f32x4_add(acc1, wasm_f32x4_mul(wasm_v128_load(query + i + 4),
+                                               wasm_v128_load(vec + i + 4)));
+  }
+  v128_t acc = wasm_f32x4_add(acc0, acc1);
+  return wasm_f32x4_extract_lane(acc, 0) + wasm_f32x4_extract_lane(acc, 1) +
+         wasm_f32x4_extract_lane(acc, 2) + wasm_f32x4_extract_lane(acc, 3);
+}
+
+#endif
+
+static simd_kernels_t select_simd_kernels() {
+#if defined(AILOY_SIMD_X86)
+  auto features = detect_x86_features();
+  if (features.avx512f)
+    return {dot_f32_avx512, dot_f16_avx512, dot_i8_avx512, "avx512"};
+  // every CPU with AVX2 also supports F16C
+  if (features.avx2_fma)
+    return {dot_f32_avx2, dot_f16_avx2, dot_i8_avx2, "avx2"};
+#elif defined(AILOY_SIMD_NEON_F16)
+  return {dot_f32_neon, dot_f16_neon, dot_i8_neon, "neon"};
+#elif defined(AILOY_SIMD_NEON)
+  return {dot_f32_neon, dot_f16_scalar, dot_i8_neon, "neon"};
+#elif defined(AILOY_SIMD_WASM)
+  return {dot_f32_wasm, dot_f16_scalar, dot_i8_scalar, "wasm_simd128"};
+#endif
+  return {dot_f32_scalar, dot_f16_scalar, dot_i8_scalar, "scalar"};
+}
+
+const simd_kernels_t &get_simd_kernels() {
+  static const simd_kernels_t kernels = select_simd_kernels();
+  return kernels;
+}
+
+} // namespace ailoy
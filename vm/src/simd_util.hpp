@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace ailoy {
+
+/**
+ * @brief Inner product kernels between a float32 query and a stored vector
+ * @details Every kernel requires `n` to be a multiple of 16, so vectors
+ * should be zero-padded to that length. The fastest kernels the CPU supports
+ * are selected at runtime. x86-64 (AVX2, AVX-512) and ARM64 (NEON) kernels
+ * are built under GCC, Clang and MSVC, WASM SIMD under Clang. MSVC on ARM64
+ * computes `dot_f16` with the scalar kernel as it lacks half-float vectors.
+ */
+struct simd_kernels_t {
+  float (*dot_f32)(const float *query, const float *vec, size_t n);
+  float (*dot_f16)(const float *query, const uint16_t *vec, size_t n);
+  float (*dot_i8)(const float *query, const int8_t *vec, size_t n);
+  // Name of the instruction set, e.g. "avx2"
+  const char *name;
+};
+
+const simd_kernels_t &get_simd_kernels();
+
+uint16_t float_to_half(float value);
+
+float half_to_float(uint16_t value);
+
+/**
+ * @brief Allocator aligning every allocation to `alignment` bytes
+ */
+template <typename T, size_t alignment> struct aligned_allocator_t {
+  using value_type = T;
+
+  template <typename U> struct rebind {
+    using other = aligned_allocator_t<U, alignment>;
+  };
+
+  aligned_allocator_t() = default;
+
+  template <typename U>
+  aligned_allocator_t(const aligned_allocator_t<U, alignment> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(
+        ::operator new(n * sizeof(T), std::align_val_t(alignment)));
+  }
+
+  void deallocate(T *p, size_t) {
+    ::operator delete(p, std::align_val_t(alignment));
+  }
+
+  template <typename U>
+  bool operator==(const aligned_allocator_t<U, alignment> &) const {
+    return true;
+  }
+};
+
+} // namespace ailoy
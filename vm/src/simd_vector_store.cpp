@@ -0,0 +1,538 @@
+#include "simd_vector_store.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#include "bm25_index.hpp"
+#include "simd_util.hpp"
+#include "thread.hpp"
+
+namespace ailoy {
+
+constexpr size_t simd_row_alignment = 64;
+
+/**
+ * Element type of stored vectors
+ */
+enum class simd_storage_t { float32, float16, int8 };
+
+/**
+ * Vectors encoded into rows of the matrix, built before taking the store
+ * lock so that bulk inserts block readers only while they are appended.
+ */
+struct simd_rows_t {
+  std::vector<uint8_t, aligned_allocator_t<uint8_t, simd_row_alignment>> data;
+  std::vector<float> scales;
+  std::vector<float> norms;
+};
+
+/**
+ * Rows are stored contiguously and removed by moving the last row into the
+ * hole, so the matrix never has gaps. Each row is zero-padded to a multiple
+ * of 16 elements and 64 bytes, which the kernels rely on.
+ */
+class simd_vector_store_impl_t {
+public:
+  simd_vector_store_impl_t(const simd_vector_store_config_t &config)
+      : dimension_(config.dimension), kernels_(get_simd_kernels()) {
+    if (dimension_ == 0)
+      throw ailoy::runtime_error("[SIMD] dimension should be positive");
+
+    if (config.metric == "inner_product")
+      cosine_ = false;
+    else if (config.metric == "cosine")
+      cosine_ = true;
+    else
+      throw ailoy::runtime_error("[SIMD] unknown metric \"" + config.metric +
+                                 "\"");
+
+    size_t element_size;
+    if (config.storage == "float32") {
+      storage_ = simd_storage_t::float32;
+      element_size = sizeof(float);
+    } else if (config.storage == "float16") {
+      storage_ = simd_storage_t::float16;
+      element_size = sizeof(uint16_t);
+    } else if (config.storage == "int8") {
+      storage_ = simd_storage_t::int8;
+      element_size = sizeof(int8_t);
+    } else
+      throw ailoy::runtime_error("[SIMD] unknown storage \"" + config.storage +
+                                 "\"");
+
+    padded_dimension_ = (dimension_ + 15) / 16 * 16;
+    row_size_ = (padded_dimension_ * element_size + simd_row_alignment - 1) /
+                simd_row_alignment * simd_row_alignment;
+  }
+
+  std::string add_vector(const vector_store_add_input_t &input) {
+    std::vector<vector_store_add_input_t> inputs = {input};
+    return add_vectors(inputs)[0];
+  }
+
+  std::vector<std::string>
+  add_vectors(const std::vector<vector_store_add_input_t> &inputs) {
+    for (const auto &input : inputs) {
+      if (!is_valid_embedding(input.embedding)) {
+        throw ailoy::runtime_error("[SIMD] invalid embedding shape: " +
+                                   input.embedding->shape_str());
+      }
+    }
+
+    // encode rows without the lock
+    int64_t first_id =
+        id_counter_.fetch_add(inputs.size(), std::memory_order_relaxed);
+    simd_rows_t rows;
+    rows.data.resize(inputs.size() * row_size_);
+    for (size_t i = 0; i < inputs.size(); i++) {
+      auto vec = inputs[i].embedding->operator std::vector<float>();
+      encode_row(vec.data(), rows.data.data() + i * row_size_, rows);
+    }
+
+    // publish the rows
+    wlock_t lk(mutex_);
+    matrix_.insert(matrix_.end(), rows.data.begin(), rows.data.end());
+    scales_.insert(scales_.end(), rows.scales.begin(), rows.scales.end());
+    norms_.insert(norms_.end(), rows.norms.begin(), rows.norms.end());
+    std::vector<std::string> ids(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+      int64_t id = first_id + i;
+      rows_[id] = ids_.size();
+      ids_.push_back(id);
+      documents_.push_back(inputs[i].document);
+      metadatas_.push_back(inputs[i].metadata);
+      if (metadata_index_.has_value())
+        metadata_index_->insert(id, inputs[i].metadata);
+      if (bm25_index_.has_value())
+        bm25_index_->insert(id, bm25_index_t::analyze(inputs[i].document));
+      ids[i] = std::to_string(id);
+    }
+    return ids;
+  }
+
+  std::optional<vector_store_get_result_t> get_by_id(const std::string &id) {
+    int64_t _id = std::strtoll(id.c_str(), nullptr, 10);
+    rlock_t lk(mutex_);
+    auto it = rows_.find(_id);
+    if (it == rows_.end())
+      return std::nullopt;
+    size_t row = it->second;
+
+    auto ndarray = ailoy::create<ailoy::ndarray_t>();
+    ndarray->shape.push_back(dimension_);
+    ndarray->dtype = {.code = kDLFloat, .bits = 32, .lanes = 1};
+    ndarray->data.resize(sizeof(float) * dimension_);
+    decode_row(row, reinterpret_cast<float *>(ndarray->data.data()));
+
+    return vector_store_get_result_t{
+        .id = id,
+        .document = documents_[row],
+        .metadata = metadatas_[row],
+        .embedding = std::move(ndarray),
+    };
+  }
+
+  std::vector<vector_store_retrieve_result_t>
+  retrieve(std::shared_ptr<const ailoy::ndarray_t> query_embedding,
+           uint64_t top_k, const vector_store_retrieve_params_t &params) {
+    if (!is_valid_embedding(query_embedding)) {
+      throw ailoy::runtime_error("[SIMD] invalid query embedding shape: " +
+                                 query_embedding->shape_str());
+    }
+    auto vec = query_embedding->operator std::vector<float>();
+    rlock_t lk(mutex_);
+    return std::move(search(1, vec.data(), top_k, params)[0]);
+  }
+
+  std::vector<std::vector<vector_store_retrieve_result_t>>
+  retrieve_many(std::shared_ptr<const ailoy::ndarray_t> query_embeddings,
+                uint64_t top_k, const vector_store_retrieve_params_t &params) {
+    // should be 2-D array of (number of queries, dimension)
+    if (query_embeddings->shape.size() != 2 ||
+        query_embeddings->shape[1] != dimension_) {
+      throw ailoy::runtime_error("[SIMD] invalid query embeddings shape: " +
+                                 query_embeddings->shape_str());
+    }
+    auto vecs = query_embeddings->operator std::vector<float>();
+    rlock_t lk(mutex_);
+    return search(query_embeddings->shape[0], vecs.data(), top_k, params);
+  }
+
+  std::vector<vector_store_retrieve_result_t>
+  hybrid_retrieve(std::shared_ptr<const ailoy::ndarray_t> query_embedding,
+                  const std::string &query_text, uint64_t top_k,
+                  const vector_store_retrieve_params_t &params,
+                  const vector_store_hybrid_params_t &hybrid_params) {
+    if (!is_valid_embedding(query_embedding)) {
+      throw ailoy::runtime_error("[SIMD] invalid query embedding shape: " +
+                                 query_embedding->shape_str());
+    }
+    auto vec = query_embedding->operator std::vector<float>();
+    uint64_t num_candidates = hybrid_params.num_candidates.value_or(4 * top_k);
+    rlock_t lk(mutex_);
+    auto vector_results =
+        std::move(search(1, vec.data(), num_candidates, params)[0]);
+
+    std::vector<int64_t> selected;
+    if (params.filter.has_value())
+      selected = get_metadata_index().select(params.filter.value());
+    std::vector<vector_store_retrieve_result_t> lexical_results;
+    for (auto [id, score] : get_bm25_index().search(
+             query_text, num_candidates,
+             params.filter.has_value() ? &selected : nullptr)) {
+      size_t row = rows_.at(id);
+      lexical_results.push_back({.id = std::to_string(id),
+                                 .document = documents_[row],
+                                 .metadata = metadatas_[row],
+                                 .similarity = score});
+    }
+    try {
+      return fuse_retrieve_results(std::move(vector_results),
+                                   std::move(lexical_results), top_k,
+                                   hybrid_params);
+    } catch (const ailoy::runtime_error &e) {
+      throw ailoy::runtime_error(std::string("[SIMD] ") + e.what());
+    }
+  }
+
+  void remove_vector(const std::string &id) {
+    int64_t _id = std::strtoll(id.c_str(), nullptr, 10);
+    wlock_t lk(mutex_);
+    auto it = rows_.find(_id);
+    if (it == rows_.end())
+      return;
+    size_t row = it->second;
+    if (metadata_index_.has_value())
+      metadata_index_->erase(_id, metadatas_[row]);
+    if (bm25_index_.has_value())
+      bm25_index_->erase(_id, bm25_index_t::analyze(documents_[row]));
+    rows_.erase(it);
+
+    // move the last row into the hole
+    size_t last = ids_.size() - 1;
+    if (row != last) {
+      std::memcpy(matrix_.data() + row * row_size_,
+                  matrix_.data() + last * row_size_, row_size_);
+      scales_[row] = scales_[last];
+      norms_[row] = norms_[last];
+      ids_[row] = ids_[last];
+      documents_[row] = std::move(documents_[last]);
+      metadatas_[row] = std::move(metadatas_[last]);
+      rows_[ids_[row]] = row;
+    }
+    matrix_.resize(last * row_size_);
+    scales_.pop_back();
+    norms_.pop_back();
+    ids_.pop_back();
+    documents_.pop_back();
+    metadatas_.pop_back();
+  }
+
+  void clear() {
+    wlock_t lk(mutex_);
+    matrix_.clear();
+    scales_.clear();
+    norms_.clear();
+    ids_.clear();
+    rows_.clear();
+    documents_.clear();
+    metadatas_.clear();
+    metadata_index_.reset();
+    bm25_index_.reset();
+  }
+
+private:
+  bool is_valid_embedding(std::shared_ptr<const ailoy::ndarray_t> embedding) {
+    // should be 1-D array with length same as dimension
+    return embedding->shape.size() == 1 && embedding->shape[0] == dimension_;
+  }
+
+  void encode_row(const float *vec, uint8_t *row, simd_rows_t &rows) const {
+    float norm = std::sqrt(std::inner_product(vec, vec + dimension_, vec, 0.0f));
+    float scale = 1.0f;
+    switch (storage_) {
+    case simd_storage_t::float32:
+      std::memcpy(row, vec, dimension_ * sizeof(float));
+      break;
+    case simd_storage_t::float16: {
+      auto dst = reinterpret_cast<uint16_t *>(row);
+      for (size_t i = 0; i < dimension_; i++)
+        dst[i] = float_to_half(vec[i]);
+      break;
+    }
+    case simd_storage_t::int8: {
+      // symmetric quantization with the largest magnitude mapped to 127
+      float max_abs = 0.0f;
+      for (size_t i = 0; i < dimension_; i++)
+        max_abs = std::max(max_abs, std::abs(vec[i]));
+      if (max_abs > 0.0f)
+        scale = max_abs / 127.0f;
+      auto dst = reinterpret_cast<int8_t *>(row);
+      for (size_t i = 0; i < dimension_; i++)
+        dst[i] = static_cast<int8_t>(std::lround(vec[i] / scale));
+      break;
+    }
+    }
+    rows.scales.push_back(scale);
+    rows.norms.push_back(norm);
+  }
+
+  void decode_row(size_t row, float *vec) const {
+    const uint8_t *data = matrix_.data() + row * row_size_;
+    switch (storage_) {
+    case simd_storage_t::float32:
+      std::memcpy(vec, data, dimension_ * sizeof(float));
+      break;
+    case simd_storage_t::float16:
+      for (size_t i = 0; i < dimension_; i++)
+        vec[i] = half_to_float(reinterpret_cast<const uint16_t *>(data)[i]);
+      break;
+    case simd_storage_t::int8:
+      for (size_t i = 0; i < dimension_; i++)
+        vec[i] = reinterpret_cast<const int8_t *>(data)[i] * scales_[row];
+      break;
+    }
+  }
+
+  float score(const float *query, size_t row) const {
+    const uint8_t *data = matrix_.data() + row * row_size_;
+    float rv;
+    switch (storage_) {
+    case simd_storage_t::float32:
+      rv = kernels_.dot_f32(query, reinterpret_cast<const float *>(data),
+                            padded_dimension_);
+      break;
+    case simd_storage_t::float16:
+      rv = kernels_.dot_f16(query, reinterpret_cast<const uint16_t *>(data),
+                            padded_dimension_);
+      break;
+    case simd_storage_t::int8:
+      rv = kernels_.dot_i8(query, reinterpret_cast<const int8_t *>(data),
+                           padded_dimension_) *
+           scales_[row];
+      break;
+    }
+    if (cosine_ && norms_[row] > 0.0f)
+      rv /= norms_[row];
+    return rv;
+  }
+
+  /**
+   * The metadata index is built on the first filtered query. Concurrent
+   * readers may race to build it, so building is serialized.
+   */
+  const metadata_index_t &get_metadata_index() {
+    wlock_t lk(metadata_index_mutex_);
+    if (!metadata_index_.has_value()) {
+      metadata_index_.emplace();
+      for (size_t row = 0; row < ids_.size(); row++)
+        metadata_index_->insert(ids_[row], metadatas_[row]);
+    }
+    return metadata_index_.value();
+  }
+
+  /**
+   * The BM25 index is built on the first hybrid query, in the same way as the
+   * metadata index.
+   */
+  const bm25_index_t &get_bm25_index() {
+    wlock_t lk(bm25_index_mutex_);
+    if (!bm25_index_.has_value()) {
+      bm25_index_.emplace();
+      for (size_t row = 0; row < ids_.size(); row++)
+        bm25_index_->insert(ids_[row], bm25_index_t::analyze(documents_[row]));
+    }
+    return bm25_index_.value();
+  }
+
+  /**
+   * Scan the rows once for all `n` queries, keeping a min-heap of the top-k
+   * per query. Called with the store lock held at least shared.
+   */
+  std::vector<std::vector<vector_store_retrieve_result_t>>
+  search(size_t n, const float *queries, uint64_t top_k,
+         const vector_store_retrieve_params_t &params) {
+    // zero-padded copy of queries, normalized for cosine similarity
+    std::vector<float, aligned_allocator_t<float, simd_row_alignment>>
+        padded_queries(n * padded_dimension_, 0.0f);
+    for (size_t q = 0; q < n; q++) {
+      const float *query = queries + q * dimension_;
+      float *padded = padded_queries.data() + q * padded_dimension_;
+      std::copy_n(query, dimension_, padded);
+      if (cosine_) {
+        float norm = std::sqrt(
+            std::inner_product(query, query + dimension_, query, 0.0f));
+        if (norm > 0.0f)
+          std::for_each(padded, padded + dimension_,
+                        [&](float &v) { v /= norm; });
+      }
+    }
+
+    // rows to scan, pre-filtered with metadata
+    std::vector<size_t> selected_rows;
+    bool filtered = params.filter.has_value();
+    if (filtered) {
+      for (int64_t id : get_metadata_index().select(params.filter.value()))
+        selected_rows.push_back(rows_.at(id));
+      std::sort(selected_rows.begin(), selected_rows.end());
+    }
+    size_t num_rows = filtered ? selected_rows.size() : ids_.size();
+
+    using candidate_t = std::pair<float, size_t>;
+    auto greater = [](const candidate_t &a, const candidate_t &b) {
+      return a.first > b.first;
+    };
+    std::vector<std::vector<candidate_t>> heaps(n);
+    size_t k = std::min<size_t>(top_k, num_rows);
+    for (auto &heap : heaps)
+      heap.reserve(k);
+    if (k > 0) {
+      for (size_t i = 0; i < num_rows; i++) {
+        size_t row = filtered ? selected_rows[i] : i;
+        for (size_t q = 0; q < n; q++) {
+          float similarity =
+              score(padded_queries.data() + q * padded_dimension_, row);
+          auto &heap = heaps[q];
+          if (heap.size() < k) {
+            heap.emplace_back(similarity, row);
+            std::push_heap(heap.begin(), heap.end(), greater);
+          } else if (similarity > heap.front().first) {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            heap.back() = {similarity, row};
+            std::push_heap(heap.begin(), heap.end(), greater);
+          }
+        }
+      }
+    }
+
+    std::vector<std::vector<vector_store_retrieve_result_t>> results(n);
+    for (size_t q = 0; q < n; q++) {
+      // sorting a min-heap leaves it in descending order
+      std::sort_heap(heaps[q].begin(), heaps[q].end(), greater);
+      for (auto [similarity, row] : heaps[q]) {
+        results[q].push_back({.id = std::to_string(ids_[row]),
+                              .document = documents_[row],
+                              .metadata = metadatas_[row],
+                              .similarity = similarity});
+      }
+    }
+    return results;
+  }
+
+  size_t dimension_;
+  size_t padded_dimension_;
+  // Size of a row in bytes
+  size_t row_size_;
+  simd_storage_t storage_;
+  bool cosine_;
+  const simd_kernels_t &kernels_;
+
+  std::vector<uint8_t, aligned_allocator_t<uint8_t, simd_row_alignment>>
+      matrix_;
+  // Quantization scale of each row (int8 only)
+  std::vector<float> scales_;
+  // Norm of each vector before encoding
+  std::vector<float> norms_;
+  std::vector<int64_t> ids_;
+  std::unordered_map<int64_t, size_t> rows_;
+  std::vector<std::string> documents_;
+  std::vector<metadata_t> metadatas_;
+  std::atomic<int64_t> id_counter_{0};
+
+  std::optional<metadata_index_t> metadata_index_;
+  mutex_t metadata_index_mutex_;
+  std::optional<bm25_index_t> bm25_index_;
+  mutex_t bm25_index_mutex_;
+  mutex_t mutex_;
+};
+
+simd_vector_store_t::simd_vector_store_t(const size_t dimension)
+    : simd_vector_store_t(simd_vector_store_config_t{.dimension = dimension}) {}
+
+simd_vector_store_t::simd_vector_store_t(
+    const simd_vector_store_config_t &config)
+    : impl_(std::make_unique<simd_vector_store_impl_t>(config)) {}
+
+static simd_vector_store_config_t
+get_simd_vector_store_config(std::shared_ptr<const value_t> attrs) {
+  if (!attrs->is_type_of<map_t>())
+    throw ailoy::runtime_error("[SIMD] component attrs should be map type");
+  auto attrs_map = attrs->as<map_t>();
+
+  simd_vector_store_config_t config;
+  if (!attrs_map->contains("dimension"))
+    throw ailoy::runtime_error("[SIMD] dimension should be specified");
+  auto dimension = attrs_map->at("dimension");
+  if (dimension->is_type_of<uint_t>())
+    config.dimension = *dimension->as<uint_t>();
+  else if (dimension->is_type_of<int_t>())
+    config.dimension = *dimension->as<int_t>();
+  else
+    throw ailoy::runtime_error(
+        "[SIMD] dimension should be a type of unsigned integer");
+
+  for (auto [key, field] : {std::pair{"metric", &config.metric},
+                            std::pair{"storage", &config.storage}}) {
+    if (!attrs_map->contains(key))
+      continue;
+    if (!attrs_map->at(key)->is_type_of<string_t>())
+      throw ailoy::runtime_error(std::string("[SIMD] ") + key +
+                                 " should be a type of string");
+    *field = *attrs_map->at<string_t>(key);
+  }
+  return config;
+}
+
+simd_vector_store_t::simd_vector_store_t(std::shared_ptr<const value_t> attrs)
+    : simd_vector_store_t(get_simd_vector_store_config(attrs)) {}
+
+simd_vector_store_t::~simd_vector_store_t() = default;
+
+std::string
+simd_vector_store_t::add_vector(const vector_store_add_input_t &input) {
+  return impl_->add_vector(input);
+}
+
+std::vector<std::string>
+simd_vector_store_t::add_vectors(std::vector<vector_store_add_input_t> &inputs) {
+  return impl_->add_vectors(inputs);
+}
+
+std::optional<vector_store_get_result_t>
+simd_vector_store_t::get_by_id(const std::string &id) {
+  return impl_->get_by_id(id);
+}
+
+std::vector<vector_store_retrieve_result_t> simd_vector_store_t::retrieve(
+    std::shared_ptr<const ailoy::ndarray_t> query_embedding, uint64_t k,
+    const vector_store_retrieve_params_t &params) {
+  return impl_->retrieve(query_embedding, k, params);
+}
+
+std::vector<std::vector<vector_store_retrieve_result_t>>
+simd_vector_store_t::retrieve_many(
+    std::shared_ptr<const ailoy::ndarray_t> query_embeddings, uint64_t k,
+    const vector_store_retrieve_params_t &params) {
+  return impl_->retrieve_many(query_embeddings, k, params);
+}
+
+std::vector<vector_store_retrieve_result_t>
+simd_vector_store_t::hybrid_retrieve(
+    std::shared_ptr<const ailoy::ndarray_t> query_embedding,
+    const std::string &query_text, uint64_t k,
+    const vector_store_retrieve_params_t &params,
+    const vector_store_hybrid_params_t &hybrid_params) {
+  return impl_->hybrid_retrieve(query_embedding, query_text, k, params,
+                                hybrid_params);
+}
+
+void simd_vector_store_t::remove_vector(const std::string &id) {
+  impl_->remove_vector(id);
+}
+
+void simd_vector_store_t::clear() { impl_->clear(); }
+
+} // namespace ailoy
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "vector_store.hpp"
+
+namespace ailoy {
+
+class simd_vector_store_impl_t;
+
+struct simd_vector_store_config_t {
+  size_t dimension;
+  // "inner_product" or "cosine"
+  std::string metric = "inner_product";
+  // Element type of stored vectors: "float32", "float16" or "int8". int8
+  // vectors are quantized with a scale per vector.
+  std::string storage = "float32";
+};
+
+/**
+ * @brief Exhaustive vector store without external dependencies
+ * @details Vectors are kept in a 64-byte aligned row-major matrix and scored
+ * with SIMD kernels. Every member function may be called from multiple
+ * threads, and retrievals run concurrently with each other.
+ */
+class simd_vector_store_t : public vector_store_t {
+public:
+  simd_vector_store_t(const size_t dimension);
+  simd_vector_store_t(const simd_vector_store_config_t &config);
+  simd_vector_store_t(std::shared_ptr<const value_t> attrs);
+  ~simd_vector_store_t();
+
+  std::string add_vector(const vector_store_add_input_t &input) override;
+
+  std::vector<std::string>
+  add_vectors(std::vector<vector_store_add_input_t> &inputs) override;
+
+  std::optional<vector_store_get_result_t>
+  get_by_id(const std::string &id) override;
+
+  std::vector<vector_store_retrieve_result_t>
+  retrieve(embedding_t query_embedding, uint64_t top_k,
+           const vector_store_retrieve_params_t &params = {}) override;
+
+  std::vector<std::vector<vector_store_retrieve_result_t>>
+  retrieve_many(embedding_t query_embeddings, uint64_t top_k,
+                const vector_store_retrieve_params_t &params = {}) override;
+
+  /**
+   * @brief Retrieve with both the query embedding and BM25 keyword search
+   * over documents, and fuse the two rankings.
+   * @details The BM25 index is built on the first call and maintained from
+   * then on.
+   */
+  std::vector<vector_store_retrieve_result_t>
+  hybrid_retrieve(embedding_t query_embedding, const std::string &query_text,
+                  uint64_t top_k,
+                  const vector_store_retrieve_params_t &params = {},
+                  const vector_store_hybrid_params_t &hybrid_params = {});
+
+  void remove_vector(const std::string &id) override;
+
+  void clear() override;
+
+private:
+  std::unique_ptr<simd_vector_store_impl_t> impl_;
+};
+
+} // namespace ailoy
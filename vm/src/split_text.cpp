@@ -1,21 +1,95 @@
 #include "split_text.hpp"
 
+#include <array>
+#include <atomic>
 #include <deque>
-#include <ranges>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <thread>
 
+#include "file_util.hpp"
+#include "mlc_llm/embedding_model.hpp"
 #include "string_util.hpp"
 
 namespace ailoy {
 #ifdef _WIN32
 using size_t = unsigned long long;
 #endif
-using length_function_t = std::function<size_t(const std::string)>;
+
+static std::vector<size_t>
+_byte_lengths(std::span<const std::string_view> texts) {
+  std::vector<size_t> lengths(texts.size());
+  for (size_t i = 0; i < texts.size(); i++)
+    lengths[i] = texts[i].size();
+  return lengths;
+}
 
 std::unordered_map<std::string, length_function_t> length_functions = {
-    {"default", [](std::string s) { return s.size(); }},
-    {"string", [](std::string s) { return s.size(); }},
+    {"default", _byte_lengths},
+    {"string", _byte_lengths},
 };
 
+// Token counts of splits up to this size are memoized, which covers words
+// and separators while leaving out paragraphs that rarely repeat
+constexpr size_t memoized_split_size = 64;
+
+length_function_t
+create_token_length_function(std::shared_ptr<tokenizer_t> tokenizer) {
+  struct string_hash_t {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const {
+      return std::hash<std::string_view>{}(s);
+    }
+  };
+  using memo_t =
+      std::unordered_map<std::string, size_t, string_hash_t, std::equal_to<>>;
+  auto memo = std::make_shared<memo_t>();
+  auto mutex = std::make_shared<std::shared_mutex>();
+
+  return [tokenizer, memo, mutex](std::span<const std::string_view> texts) {
+    std::vector<size_t> lengths(texts.size());
+    // texts to tokenize, where repeated short texts are tokenized once
+    std::vector<std::string_view> missing;
+    std::vector<size_t> missing_pos(texts.size(), SIZE_MAX);
+    std::unordered_map<std::string_view, size_t> short_missing_pos;
+    std::shared_lock read_lock(*mutex);
+    for (size_t i = 0; i < texts.size(); i++) {
+      if (texts[i].size() <= memoized_split_size) {
+        auto it = memo->find(texts[i]);
+        if (it != memo->end()) {
+          lengths[i] = it->second;
+          continue;
+        }
+        auto [pos, inserted] =
+            short_missing_pos.try_emplace(texts[i], missing.size());
+        if (!inserted) {
+          missing_pos[i] = pos->second;
+          continue;
+        }
+      }
+      missing_pos[i] = missing.size();
+      missing.push_back(texts[i]);
+    }
+    read_lock.unlock();
+    if (missing.empty())
+      return lengths;
+
+    auto encoding = tokenizer->encode_batch(missing, false);
+    auto num_tokens = [&](size_t pos) {
+      return encoding.offsets[pos + 1] - encoding.offsets[pos];
+    };
+    for (size_t i = 0; i < texts.size(); i++) {
+      if (missing_pos[i] != SIZE_MAX)
+        lengths[i] = num_tokens(missing_pos[i]);
+    }
+    std::unique_lock write_lock(*mutex);
+    for (const auto &[text, pos] : short_missing_pos)
+      memo->emplace(text, num_tokens(pos));
+    return lengths;
+  };
+}
+
 void _check_chunk_overlap(const size_t chunk_size, const size_t chunk_overlap) {
   if (chunk_overlap > chunk_size)
     throw ailoy::exception(
@@ -23,169 +97,295 @@ void _check_chunk_overlap(const size_t chunk_size, const size_t chunk_overlap) {
                     chunk_overlap, chunk_size));
 }
 
-size_t calculate_total_direct(std::deque<std::string> current,
-                              size_t separator_len, size_t new_len = 0) {
-  size_t res = 0;
-  if (current.empty())
-    return new_len;
-  for (auto e : current)
-    res += e.size();
-  res += (current.size() - 1) * separator_len;
-  res += new_len ? separator_len + new_len : 0;
-  return res;
+/**
+ * Split `text` by `separator` in the same way as `std::ranges::split_view`:
+ * an empty separator splits every character, and leading or trailing
+ * separators make empty splits.
+ */
+std::vector<std::string_view> _split(std::string_view text,
+                                     std::string_view separator) {
+  std::vector<std::string_view> splits;
+  if (text.empty())
+    return splits;
+  if (separator.empty()) {
+    for (size_t i = 0; i < text.size(); i++)
+      splits.push_back(text.substr(i, 1));
+    return splits;
+  }
+  size_t start = 0;
+  while (true) {
+    size_t pos = text.find(separator, start);
+    if (pos == std::string_view::npos) {
+      splits.push_back(text.substr(start));
+      return splits;
+    }
+    splits.push_back(text.substr(start, pos - start));
+    start = pos + separator.size();
+  }
 }
 
-std::vector<std::string> _merge_splits(const std::vector<std::string> splits,
-                                       const std::string &separator,
-                                       const size_t chunk_size,
-                                       const size_t chunk_overlap,
-                                       length_function_t flength) {
-  auto separator_len = flength(separator);
-  std::vector<std::string> docs;
-  std::deque<std::string> current;
-
-  auto complete_document = [&docs, separator](auto &current) {
-    std::string doc = utils::join(separator, current);
-    if (utils::trim(doc) != "")
-      docs.push_back(doc);
-  };
-
-  size_t total = 0;
-  for (auto s : splits) {
-    auto new_len = flength(s);
+/**
+ * Merges consecutive splits of a text into chunks of at most `chunk_size`,
+ * where a chunk repeats the last splits of the previous one up to
+ * `chunk_overlap`.
+ *
+ * The splits are adjacent in the text with `separator` between them, so
+ * joining a window of splits gives back a range of the text, and chunks are
+ * views of the text instead of joined copies.
+ */
+class _split_merger_t {
+public:
+  _split_merger_t(std::string_view separator, size_t chunk_size,
+                  size_t chunk_overlap, const length_function_t &flength,
+                  std::vector<std::string_view> &chunks)
+      : separator_len_(flength({&separator, 1})[0]), chunk_size_(chunk_size),
+        chunk_overlap_(chunk_overlap), chunks_(chunks) {}
+
+  /**
+   * @param new_len Length of the split
+   */
+  void push(std::string_view split, size_t new_len) {
     size_t total_if_merge =
-        total + new_len + ((!current.empty()) ? separator_len : 0);
-    if (total_if_merge > chunk_size) {
-      // if(total > chunk_size) // warn?
-      if (!current.empty()) {
-        complete_document(current);
-        /**
-         * after completing document, pop from the current candidates until
-         *  - overlap part length becomes small enough
-         *  - room for the new candidate becomes large enough
-         */
-        while (total > chunk_overlap or
-               (total_if_merge > chunk_size and total > 0)) {
-          auto first = current.at(0);
-          current.pop_front();
-          total -= flength(first) + ((!current.empty()) ? separator_len : 0);
-          total_if_merge =
-              total + new_len + ((!current.empty()) ? separator_len : 0);
-        }
+        total_ + new_len + (!current_.empty() ? separator_len_ : 0);
+    if (total_if_merge > chunk_size_ && !current_.empty()) {
+      complete_chunk();
+      /**
+       * after completing chunk, pop from the current candidates until
+       *  - overlap part length becomes small enough
+       *  - room for the new candidate becomes large enough
+       */
+      while (total_ > chunk_overlap_ ||
+             (total_if_merge > chunk_size_ && total_ > 0)) {
+        size_t first_len = current_.front().second;
+        current_.pop_front();
+        total_ -= first_len + (!current_.empty() ? separator_len_ : 0);
+        total_if_merge =
+            total_ + new_len + (!current_.empty() ? separator_len_ : 0);
       }
     }
-    current.push_back(s);
-    total = total_if_merge;
+    current_.emplace_back(split, new_len);
+    total_ = total_if_merge;
   }
 
-  complete_document(current);
+  /**
+   * Complete the last chunk, after which splits are not merged with the
+   * previous ones
+   */
+  void flush() {
+    complete_chunk();
+    current_.clear();
+    total_ = 0;
+  }
 
-  return docs;
-}
+private:
+  void complete_chunk() {
+    if (current_.empty())
+      return;
+    const char *begin = current_.front().first.data();
+    const char *end =
+        current_.back().first.data() + current_.back().first.size();
+    auto chunk = utils::trim_view(std::string_view(begin, end - begin));
+    if (!chunk.empty())
+      chunks_.push_back(chunk);
+  }
 
-std::vector<std::string>
-split_text_by_separator(const std::string text, const size_t chunk_size,
-                        const size_t chunk_overlap, const std::string separator,
-                        const std::string length_function) {
-  _check_chunk_overlap(chunk_size, chunk_overlap);
-  length_function_t flength = length_functions.at(length_function);
-  size_t len_sep = flength(separator);
-  auto splits = utils::split_text(text, separator);
-  return _merge_splits(splits, separator, chunk_size, chunk_overlap, flength);
+  size_t separator_len_;
+  size_t chunk_size_;
+  size_t chunk_overlap_;
+  std::vector<std::string_view> &chunks_;
+  // splits in the current chunk with their lengths
+  std::deque<std::pair<std::string_view, size_t>> current_;
+  size_t total_ = 0;
+};
+
+std::vector<std::string_view>
+_split_text_by_separator(std::string_view text, size_t chunk_size,
+                         size_t chunk_overlap, std::string_view separator,
+                         const length_function_t &flength) {
+  std::vector<std::string_view> chunks;
+  _split_merger_t merger(separator, chunk_size, chunk_overlap, flength, chunks);
+  auto splits = _split(text, separator);
+  auto lengths = flength(splits);
+  for (size_t i = 0; i < splits.size(); i++)
+    merger.push(splits[i], lengths[i]);
+  merger.flush();
+  return chunks;
 }
 
-const std::string
-_pick_best_separator(const std::string &text,
-                     const std::vector<std::string> &separators,
-                     std::vector<std::string> &new_separators) {
-  std::string rv_sep = separators.back();
-  bool push = false;
-  for (size_t i = 0; i < separators.size(); i++) {
-    auto sep = separators.at(i);
-    // push the remaining separators after setting rv_sep
-    if (push) {
-      new_separators.push_back(sep);
+/**
+ * Find the first separator that appears in `text`, scanning the text once
+ * for all separators
+ * @return Index of the separator, or `separators.size()` if none appears. An
+ * empty separator always appears.
+ */
+size_t _find_best_separator(std::string_view text,
+                            std::span<const std::string> separators) {
+  size_t best = 0;
+  while (best < separators.size() && !separators[best].empty())
+    best++;
+
+  // first bytes of the separators that are better than the best so far
+  std::array<bool, 256> first_bytes;
+  size_t num_first_bytes;
+  unsigned char last_first_byte;
+  auto update_first_bytes = [&]() {
+    first_bytes.fill(false);
+    num_first_bytes = 0;
+    for (size_t i = 0; i < best; i++) {
+      last_first_byte = separators[i][0];
+      if (!first_bytes[last_first_byte])
+        num_first_bytes++;
+      first_bytes[last_first_byte] = true;
+    }
+  };
+  update_first_bytes();
+
+  for (size_t pos = 0; pos < text.size() && best > 0; pos++) {
+    if (num_first_bytes == 1) {
+      // skip to the candidate with memchr
+      pos = text.find(static_cast<char>(last_first_byte), pos);
+      if (pos == std::string_view::npos)
+        break;
+    } else if (!first_bytes[static_cast<unsigned char>(text[pos])])
       continue;
+
+    auto rest = text.substr(pos);
+    for (size_t i = 0; i < best; i++) {
+      if (rest.starts_with(separators[i])) {
+        best = i;
+        update_first_bytes();
+        break;
+      }
     }
+  }
+  return best;
+}
 
-    if (sep == "") {
-      // treat empty separator especially
-      rv_sep = sep;
-      break;
-    } else if (text.find(sep) != std::string::npos) {
-      // pick the next sep if the text contains it
-      rv_sep = sep;
-      push = true;
+void _split_text_recursive(std::string_view text, size_t chunk_size,
+                           size_t chunk_overlap,
+                           std::span<const std::string> separators,
+                           const length_function_t &flength,
+                           std::vector<std::string_view> &chunks) {
+  // Splits of the picked separator contain none of the separators before
+  // it, so only the ones after it are tried on splits that are too big.
+  size_t best = _find_best_separator(text, separators);
+  std::string_view separator;
+  std::span<const std::string> next_separators;
+  if (best < separators.size()) {
+    separator = separators[best];
+    if (!separator.empty())
+      next_separators = separators.subspan(best + 1);
+  } else if (!separators.empty())
+    separator = separators.back();
+
+  // merges are only on the consecutive good splits of the same step
+  _split_merger_t merger(separator, chunk_size, chunk_overlap, flength, chunks);
+  auto splits = _split(text, separator);
+  auto lengths = flength(splits);
+  for (size_t i = 0; i < splits.size(); i++) {
+    if (lengths[i] < chunk_size) {
+      merger.push(splits[i], lengths[i]);
+      continue;
     }
+    // if a split is too big, complete the chunk of good splits before it
+    // and split it up with the next separators if there are any
+    merger.flush();
+    if (next_separators.empty())
+      chunks.push_back(splits[i]);
+    else
+      _split_text_recursive(splits[i], chunk_size, chunk_overlap,
+                            next_separators, flength, chunks);
   }
-  return rv_sep;
+  merger.flush();
 }
 
-void _merge_splits_and_put(std::vector<std::string> &chunks,
-                           const std::vector<std::string> &splits,
-                           const std::string &separator,
-                           const size_t chunk_size, const size_t chunk_overlap,
-                           length_function_t flength) {
-  auto merged_chunks =
-      _merge_splits(splits, separator, chunk_size, chunk_overlap, flength);
-  for (auto chunk : merged_chunks)
-    chunks.push_back(chunk);
+std::vector<std::string_view> _split_text_by_separators_recursively(
+    std::string_view text, size_t chunk_size, size_t chunk_overlap,
+    std::span<const std::string> separators,
+    const length_function_t &flength) {
+  std::vector<std::string_view> chunks;
+  _split_text_recursive(text, chunk_size, chunk_overlap, separators, flength,
+                        chunks);
+  return chunks;
 }
 
-std::vector<std::string> _split_text_recursive(
-    const std::string text, const size_t chunk_size, const size_t chunk_overlap,
-    const std::vector<std::string> &separators, length_function_t flength) {
-  std::vector<std::string> new_separators{};
-  const std::string separator =
-      _pick_best_separator(text, separators, new_separators);
-  auto splits = utils::split_text(text, separator);
-
-  std::vector<std::string> _good_splits{};
-  std::vector<std::string> final_chunks{};
-  for (const std::string s : splits) {
-    if (flength(s) < chunk_size) // gather 'good splits'
-      _good_splits.push_back(s);
-    else { // if a split it too big
-      // first, merge good splits into chunks and put them into final chunks.
-      // merges are only on the splits in the same step.
-      if (!_good_splits.empty()) {
-        _merge_splits_and_put(final_chunks, _good_splits, separator, chunk_size,
-                              chunk_overlap, flength);
-        _good_splits.clear();
-      }
+std::vector<std::string>
+split_text_by_separator(std::string_view text, const size_t chunk_size,
+                        const size_t chunk_overlap, std::string_view separator,
+                        const length_function_t &length_function) {
+  _check_chunk_overlap(chunk_size, chunk_overlap);
+  auto chunks = _split_text_by_separator(text, chunk_size, chunk_overlap,
+                                         separator, length_function);
+  return {chunks.begin(), chunks.end()};
+}
 
-      // split up the big split if there are more steps
-      if (new_separators.empty())
-        final_chunks.push_back(s);
-      else {
-        // put the chunks from next steps into final chunks.
-        auto chunks_from_next_steps = _split_text_recursive(
-            s, chunk_size, chunk_overlap, new_separators, flength);
-        for (auto chunk : chunks_from_next_steps)
-          final_chunks.push_back(chunk);
-      }
-    }
-  }
-  // process remaining good splits
-  if (!_good_splits.empty()) {
-    _merge_splits_and_put(final_chunks, _good_splits, separator, chunk_size,
-                          chunk_overlap, flength);
-  }
-  return final_chunks;
+std::vector<std::string>
+split_text_by_separator(std::string_view text, const size_t chunk_size,
+                        const size_t chunk_overlap, std::string_view separator,
+                        const std::string &length_function) {
+  return split_text_by_separator(text, chunk_size, chunk_overlap, separator,
+                                 length_functions.at(length_function));
 }
 
 std::vector<std::string> split_text_by_separators_recursively(
-    const std::string text, const size_t chunk_size, const size_t chunk_overlap,
-    const std::vector<std::string> separators,
-    const std::string length_function) {
+    std::string_view text, const size_t chunk_size, const size_t chunk_overlap,
+    const std::vector<std::string> &separators,
+    const length_function_t &length_function) {
   _check_chunk_overlap(chunk_size, chunk_overlap);
-  length_function_t flength = length_functions.at(length_function);
-  return _split_text_recursive(text, chunk_size, chunk_overlap, separators,
-                               flength);
+  auto chunks = _split_text_by_separators_recursively(
+      text, chunk_size, chunk_overlap, separators, length_function);
+  return {chunks.begin(), chunks.end()};
+}
+
+std::vector<std::string> split_text_by_separators_recursively(
+    std::string_view text, const size_t chunk_size, const size_t chunk_overlap,
+    const std::vector<std::string> &separators,
+    const std::string &length_function) {
+  return split_text_by_separators_recursively(
+      text, chunk_size, chunk_overlap, separators,
+      length_functions.at(length_function));
+}
+
+/**
+ * Parse `length_function`, and `tokenizer` for counting tokens
+ */
+static std::variant<length_function_t, error_output_t>
+_parse_length_function(std::shared_ptr<const map_t> input_map,
+                       const component_lookup_t &find_component) {
+  std::string length_function = "default";
+  if (input_map->contains("length_function")) {
+    if (!input_map->at("length_function")->is_type_of<string_t>())
+      return error_output_t(
+          type_error("Split Text", "length_function", "string_t",
+                     input_map->at("length_function")->get_type()));
+    length_function = *input_map->at<string_t>("length_function");
+  }
+  if (length_function == "default" || length_function == "string")
+    return length_functions.at(length_function);
+  if (length_function != "tokens")
+    return error_output_t(value_error("Split Text", "length_function",
+                                      "default | string | tokens",
+                                      length_function));
+
+  if (!input_map->contains("tokenizer"))
+    return error_output_t(range_error("Split Text", "tokenizer"));
+  if (!input_map->at("tokenizer")->is_type_of<string_t>())
+    return error_output_t(type_error("Split Text", "tokenizer", "string_t",
+                                     input_map->at("tokenizer")->get_type()));
+  const std::string &name = *input_map->at<string_t>("tokenizer");
+  auto component = find_component(name);
+  auto tokenizer =
+      component ? component->get_obj<tokenizer_t>("tokenizer") : nullptr;
+  if (!tokenizer)
+    return error_output_t(value_error("Split Text", "tokenizer",
+                                      "name of a component with a tokenizer",
+                                      name));
+  return create_token_length_function(tokenizer);
 }
 
-value_or_error_t
-split_text_by_separator_op(std::shared_ptr<const value_t> inputs) {
+static value_or_error_t
+split_text_by_separator_op(std::shared_ptr<const value_t> inputs,
+                           const component_lookup_t &find_component) {
   // Get input parameters
   if (!inputs->is_type_of<map_t>())
     return error_output_t(
@@ -242,32 +442,29 @@ split_text_by_separator_op(std::shared_ptr<const value_t> inputs) {
   }
 
   // Parse length_function
-  std::string length_function = "default";
-  if (input_map->contains("length_function")) {
-    if (!input_map->at("length_function")->is_type_of<string_t>())
-      return error_output_t(
-          type_error("Split Text", "length_function", "string_t",
-                     input_map->at("length_function")->get_type()));
-    length_function = *input_map->at<string_t>("length_function");
-    if (!(length_function == "default" || length_function == "string"))
-      return error_output_t(value_error("Split Text", "length_function",
-                                        "default | string", length_function));
-  }
+  auto length_function = _parse_length_function(input_map, find_component);
+  if (std::holds_alternative<error_output_t>(length_function))
+    return std::get<error_output_t>(length_function);
 
-  // Split text into chunks
-  auto chunks = split_text_by_separator(text, chunk_size, chunk_overlap,
-                                        separator, length_function);
+  // Split text into chunks, which are copied only into outputs
+  _check_chunk_overlap(chunk_size, chunk_overlap);
+  auto chunks =
+      _split_text_by_separator(text, chunk_size, chunk_overlap, separator,
+                               std::get<length_function_t>(length_function));
 
   // Return output
   auto outputs = create<map_t>();
   outputs->insert_or_assign("chunks", create<array_t>());
+  outputs->at<array_t>("chunks")->reserve(chunks.size());
   for (const auto &chunk : chunks)
     outputs->at<array_t>("chunks")->push_back(create<string_t>(chunk));
   return outputs;
 }
 
-value_or_error_t
-split_text_by_separators_recursively_op(std::shared_ptr<const value_t> inputs) {
+static value_or_error_t
+split_text_by_separators_recursively_op(
+    std::shared_ptr<const value_t> inputs,
+    const component_lookup_t &find_component) {
   // Get input parameters
   if (!inputs->is_type_of<map_t>())
     return error_output_t(
@@ -335,28 +532,404 @@ split_text_by_separators_recursively_op(std::shared_ptr<const value_t> inputs) {
   }
 
   // Parse length_function
-  std::string length_function = "default";
-  if (input_map->contains("length_function")) {
-    if (!input_map->at("length_function")->is_type_of<string_t>())
-      return error_output_t(
-          type_error("Split Text", "length_function", "string_t",
-                     input_map->at("length_function")->get_type()));
-    length_function = *input_map->at<string_t>("length_function");
-    if (!(length_function == "default" || length_function == "string"))
-      return error_output_t(value_error("Split Text", "length_function",
-                                        "default | string", length_function));
-  }
+  auto length_function = _parse_length_function(input_map, find_component);
+  if (std::holds_alternative<error_output_t>(length_function))
+    return std::get<error_output_t>(length_function);
 
-  // Split text into chunks
-  auto chunks = split_text_by_separators_recursively(
-      text, chunk_size, chunk_overlap, separators, length_function);
+  // Split text into chunks, which are copied only into outputs
+  _check_chunk_overlap(chunk_size, chunk_overlap);
+  auto chunks = _split_text_by_separators_recursively(
+      text, chunk_size, chunk_overlap, separators,
+      std::get<length_function_t>(length_function));
 
   // Return output
   auto outputs = create<map_t>();
   outputs->insert_or_assign("chunks", create<array_t>());
+  outputs->at<array_t>("chunks")->reserve(chunks.size());
   for (const auto &chunk : chunks)
     outputs->at<array_t>("chunks")->push_back(create<string_t>(chunk));
   return outputs;
 }
 
+/**
+ * Split many texts recursively in parallel, where the texts are given either
+ * as `texts`, or as a single `text` with the `offsets` where they begin
+ */
+static value_or_error_t
+split_texts_op(std::shared_ptr<const value_t> inputs,
+               const component_lookup_t &find_component) {
+  const std::string context = "Split Texts";
+  if (!inputs->is_type_of<map_t>())
+    return error_output_t(
+        type_error(context, "inputs", "map_t", inputs->get_type()));
+  auto input_map = inputs->as<map_t>();
+
+  // Parse texts, which are views of the inputs
+  std::vector<std::string_view> texts;
+  if (input_map->contains("texts")) {
+    if (!input_map->at("texts")->is_type_of<array_t>())
+      return error_output_t(type_error(context, "texts", "array_t",
+                                       input_map->at("texts")->get_type()));
+    for (const auto &text : *input_map->at<array_t>("texts")) {
+      if (!text->is_type_of<string_t>())
+        return error_output_t(
+            type_error(context, "texts.*", "string_t", text->get_type()));
+      texts.push_back(*text->as<string_t>());
+    }
+  } else if (input_map->contains("text")) {
+    if (!input_map->at("text")->is_type_of<string_t>())
+      return error_output_t(type_error(context, "text", "string_t",
+                                       input_map->at("text")->get_type()));
+    std::string_view text = *input_map->at<string_t>("text");
+    if (!input_map->contains("offsets"))
+      return error_output_t(range_error(context, "offsets"));
+    if (!input_map->at("offsets")->is_type_of<array_t>())
+      return error_output_t(type_error(context, "offsets", "array_t",
+                                       input_map->at("offsets")->get_type()));
+    std::vector<size_t> offsets;
+    for (const auto &offset : *input_map->at<array_t>("offsets")) {
+      if (!offset->is_type_of<uint_t>())
+        return error_output_t(
+            type_error(context, "offsets.*", "uint_t", offset->get_type()));
+      offsets.push_back(*offset->as<uint_t>());
+      if (offsets.back() > text.size() ||
+          (offsets.size() > 1 && offsets.back() < offsets.end()[-2]))
+        return error_output_t(value_error(
+            context, "offsets.*", "ascending and <= size of text",
+            std::to_string(offsets.back())));
+    }
+    for (size_t i = 0; i < offsets.size(); i++) {
+      size_t end = i + 1 < offsets.size() ? offsets[i + 1] : text.size();
+      texts.push_back(text.substr(offsets[i], end - offsets[i]));
+    }
+  } else
+    return error_output_t(range_error(context, "texts"));
+
+  // Parse sizes
+  auto get_uint = [&](const std::string &name,
+                      size_t &value) -> std::optional<error_output_t> {
+    if (!input_map->contains(name))
+      return std::nullopt;
+    auto val = input_map->at(name);
+    if (val->is_type_of<uint_t>())
+      value = *val->as<uint_t>();
+    else if (val->is_type_of<int_t>() && *val->as<int_t>() >= 0)
+      value = *val->as<int_t>();
+    else
+      return error_output_t(
+          type_error(context, name, "uint_t | int_t", val->get_type()));
+    return std::nullopt;
+  };
+  size_t chunk_size = 4000;
+  size_t chunk_overlap = 200;
+  size_t num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  for (auto [name, value] : {std::pair{"chunk_size", &chunk_size},
+                             std::pair{"chunk_overlap", &chunk_overlap},
+                             std::pair{"num_threads", &num_threads}}) {
+    auto error = get_uint(name, *value);
+    if (error.has_value())
+      return error.value();
+  }
+  if (chunk_size < 1)
+    return error_output_t(value_error(context, "chunk_size", ">= 1",
+                                      std::to_string(chunk_size)));
+  if (chunk_overlap > chunk_size)
+    return error_output_t(value_error(context, "chunk_overlap",
+                                      "<= chunk_size",
+                                      std::to_string(chunk_overlap)));
+  if (num_threads < 1)
+    return error_output_t(value_error(context, "num_threads", ">= 1",
+                                      std::to_string(num_threads)));
+
+  // Parse separators
+  std::vector<std::string> separators = {"\n\n", "\n", " ", ""};
+  if (input_map->contains("separators")) {
+    if (!input_map->at("separators")->is_type_of<array_t>())
+      return error_output_t(
+          type_error(context, "separators", "array_t",
+                     input_map->at("separators")->get_type()));
+    separators.clear();
+    for (const auto &sep : *input_map->at<array_t>("separators")) {
+      if (!sep->is_type_of<string_t>())
+        return error_output_t(
+            type_error(context, "separators.*", "string_t", sep->get_type()));
+      separators.push_back(*sep->as<string_t>());
+    }
+  }
+
+  // Parse length_function
+  auto length_function = _parse_length_function(input_map, find_component);
+  if (std::holds_alternative<error_output_t>(length_function))
+    return std::get<error_output_t>(length_function);
+  const auto &flength = std::get<length_function_t>(length_function);
+
+  // Split texts on workers, each taking the next text to split, where chunks
+  // are kept by text so that they are in order regardless of the workers
+  std::vector<std::vector<std::string_view>> chunks(texts.size());
+  std::atomic<size_t> next = 0;
+  auto worker = [&]() {
+    for (size_t i = next++; i < texts.size(); i = next++)
+      chunks[i] = _split_text_by_separators_recursively(
+          texts[i], chunk_size, chunk_overlap, separators, flength);
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(num_threads, texts.size()); i++)
+    workers.emplace_back(worker);
+  worker();
+  for (auto &w : workers)
+    w.join();
+
+  // Return output, with the source and the offset in it of each chunk
+  auto outputs = create<map_t>();
+  auto chunks_out = create<array_t>();
+  auto sources = create<array_t>();
+  auto offsets = create<array_t>();
+  for (size_t i = 0; i < texts.size(); i++) {
+    for (const auto &chunk : chunks[i]) {
+      chunks_out->push_back(create<string_t>(chunk));
+      sources->push_back(create<uint_t>(i));
+      offsets->push_back(create<uint_t>(chunk.data() - texts[i].data()));
+    }
+  }
+  outputs->insert_or_assign("chunks", chunks_out);
+  outputs->insert_or_assign("sources", sources);
+  outputs->insert_or_assign("offsets", offsets);
+  return outputs;
+}
+
+/**
+ * Operator of a split text function, which can look up components for their
+ * tokenizers
+ */
+class split_text_operator_t : public operator_t {
+public:
+  using function_t = value_or_error_t (*)(std::shared_ptr<const value_t>,
+                                          const component_lookup_t &);
+
+  split_text_operator_t(function_t f) : operator_t(), f_(f) {}
+
+  output_t step() override {
+    auto output = f_(get_input(), [this](const std::string &name) {
+      return find_component(name);
+    });
+    reset_input();
+    if (output.index() == 0)
+      return ok_output_t(std::get<0>(output));
+    else
+      return std::get<1>(output);
+  }
+
+private:
+  function_t f_;
+};
+
+// Bytes of a file split at once by split_file
+constexpr size_t split_file_window_size = 4 * 1024 * 1024;
+
+/**
+ * Operator splitting a file into chunks over steps, a window of the file at
+ * a time.
+ *
+ * The file is mapped rather than read, and chunks are views of the mapping
+ * until they are copied into the outputs of a step. The pages of a window are
+ * released once it is split, so only a window and its chunks are held in
+ * memory however large the file is. A window ends after
+ * the last occurrence of the first separator found in its latter half, and
+ * chunks never span two windows.
+ */
+class split_file_operator_t : public operator_t {
+public:
+  std::optional<error_output_t>
+  initialize(std::shared_ptr<const value_t> in) override {
+    auto error = parse_inputs(in);
+    if (error.has_value())
+      return error;
+    return operator_t::initialize(in);
+  }
+
+  output_t step() override {
+    auto chunks = create<array_t>();
+    auto offsets = create<array_t>();
+    std::string_view file(static_cast<const char *>(file_.data()),
+                          file_.size());
+    // windows without any chunk, e.g. of whitespaces, make no outputs
+    while (chunks->empty() && offset_ < file.size()) {
+      auto window = file.substr(offset_, window_size_);
+      if (offset_ + window.size() < file.size())
+        window = window.substr(0, find_window_end(window));
+      for (auto chunk : _split_text_by_separators_recursively(
+               window, chunk_size_, chunk_overlap_, separators_, flength_)) {
+        chunks->push_back(create<string_t>(chunk));
+        offsets->push_back(create<uint_t>(chunk.data() - file.data()));
+      }
+      // the chunks are copied, so the window is not needed in memory
+      file_.release(offset_, window.size());
+      offset_ += window.size();
+    }
+
+    auto outputs = create<map_t>();
+    outputs->insert_or_assign("chunks", chunks);
+    outputs->insert_or_assign("offsets", offsets);
+    outputs->insert_or_assign("offset", create<uint_t>(offset_));
+    outputs->insert_or_assign("size", create<uint_t>(file.size()));
+    bool finish = offset_ >= file.size();
+    if (finish)
+      reset_input();
+    return ok_output_t(outputs, finish);
+  }
+
+  void reset_input() override {
+    operator_t::reset_input();
+    file_ = utils::mapped_file_t();
+    flength_ = nullptr;
+  }
+
+private:
+  std::optional<error_output_t>
+  parse_inputs(std::shared_ptr<const value_t> inputs) {
+    const std::string context = "Split File";
+    if (!inputs || !inputs->is_type_of<map_t>())
+      return error_output_t(type_error(context, "inputs", "map_t",
+                                       inputs ? inputs->get_type() : "null"));
+    auto input_map = inputs->as<map_t>();
+
+    // Parse path
+    if (!input_map->contains("path"))
+      return error_output_t(range_error(context, "path"));
+    if (!input_map->at("path")->is_type_of<string_t>())
+      return error_output_t(type_error(context, "path", "string_t",
+                                       input_map->at("path")->get_type()));
+    const std::string &path = *input_map->at<string_t>("path");
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(path, ec))
+      return error_output_t(
+          value_error(context, "path", "path of a regular file", path));
+
+    // Parse sizes
+    auto get_uint = [&](const std::string &name,
+                        size_t &value) -> std::optional<error_output_t> {
+      if (!input_map->contains(name))
+        return std::nullopt;
+      auto val = input_map->at(name);
+      if (val->is_type_of<uint_t>())
+        value = *val->as<uint_t>();
+      else if (val->is_type_of<int_t>() && *val->as<int_t>() >= 0)
+        value = *val->as<int_t>();
+      else
+        return error_output_t(
+            type_error(context, name, "uint_t | int_t", val->get_type()));
+      return std::nullopt;
+    };
+    chunk_size_ = 4000;
+    chunk_overlap_ = 200;
+    window_size_ = split_file_window_size;
+    offset_ = 0;
+    for (auto [name, value] : {std::pair{"chunk_size", &chunk_size_},
+                               std::pair{"chunk_overlap", &chunk_overlap_},
+                               std::pair{"window_size", &window_size_},
+                               std::pair{"offset", &offset_}}) {
+      auto error = get_uint(name, *value);
+      if (error.has_value())
+        return error;
+    }
+    if (chunk_size_ < 1)
+      return error_output_t(value_error(context, "chunk_size", ">= 1",
+                                        std::to_string(chunk_size_)));
+    if (chunk_overlap_ > chunk_size_)
+      return error_output_t(
+          value_error(context, "chunk_overlap", "<= chunk_size",
+                      std::to_string(chunk_overlap_)));
+    if (window_size_ < 1)
+      return error_output_t(value_error(context, "window_size", ">= 1",
+                                        std::to_string(window_size_)));
+
+    // Parse separators
+    separators_ = {"\n\n", "\n", " ", ""};
+    if (input_map->contains("separators")) {
+      if (!input_map->at("separators")->is_type_of<array_t>())
+        return error_output_t(
+            type_error(context, "separators", "array_t",
+                       input_map->at("separators")->get_type()));
+      separators_.clear();
+      for (const auto &sep : *input_map->at<array_t>("separators")) {
+        if (!sep->is_type_of<string_t>())
+          return error_output_t(type_error(context, "separators.*",
+                                           "string_t", sep->get_type()));
+        separators_.push_back(*sep->as<string_t>());
+      }
+    }
+
+    // Parse length_function
+    auto length_function =
+        _parse_length_function(input_map, [this](const std::string &name) {
+          return find_component(name);
+        });
+    if (std::holds_alternative<error_output_t>(length_function))
+      return std::get<error_output_t>(length_function);
+    flength_ = std::get<length_function_t>(length_function);
+
+    // Map the file
+    try {
+      file_ = utils::mapped_file_t(path);
+    } catch (const ailoy::runtime_error &e) {
+      return error_output_t(e.what());
+    }
+    if (offset_ > file_.size())
+      return error_output_t(value_error(context, "offset",
+                                        "<= " + std::to_string(file_.size()),
+                                        std::to_string(offset_)));
+    return std::nullopt;
+  }
+
+  /**
+   * Find where a window not at the end of the file ends, which is after the
+   * last occurrence of the first separator found in the latter half of it,
+   * or else at the last character boundary
+   */
+  size_t find_window_end(std::string_view window) const {
+    size_t half = window.size() / 2;
+    for (const auto &separator : separators_) {
+      if (separator.empty())
+        break;
+      size_t pos = window.rfind(separator);
+      if (pos != std::string_view::npos && pos >= half)
+        return pos + separator.size();
+    }
+    // do not end the window inside a UTF-8 character, looking at the byte
+    // after the window, which is in the file as the window is not at the end
+    const char *data = window.data();
+    size_t end = window.size();
+    while (end > 1 && (static_cast<unsigned char>(data[end]) & 0xc0) == 0x80)
+      end--;
+    return end;
+  }
+
+  utils::mapped_file_t file_;
+  size_t chunk_size_;
+  size_t chunk_overlap_;
+  size_t window_size_;
+  // offset of the rest of the file to split
+  size_t offset_;
+  std::vector<std::string> separators_;
+  length_function_t flength_;
+};
+
+std::shared_ptr<operator_t> create_split_text_by_separator_operator() {
+  return create<split_text_operator_t>(split_text_by_separator_op);
+}
+
+std::shared_ptr<operator_t>
+create_split_text_by_separators_recursively_operator() {
+  return create<split_text_operator_t>(
+      split_text_by_separators_recursively_op);
+}
+
+std::shared_ptr<operator_t> create_split_texts_operator() {
+  return create<split_text_operator_t>(split_texts_op);
+}
+
+std::shared_ptr<operator_t> create_split_file_operator() {
+  return create<split_file_operator_t>();
+}
+
 } // namespace ailoy
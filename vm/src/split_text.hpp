@@ -1,25 +1,94 @@
+#include <functional>
+#include <span>
+#include <string_view>
 #include <vector>
 
 #include "module.hpp"
 
 namespace ailoy {
 
+class tokenizer_t;
+
+/**
+ * @brief Function measuring lengths of texts for splitting
+ * @details Lengths of many texts are measured at once, so that tokenizers
+ * can work in batch.
+ */
+using length_function_t = std::function<std::vector<size_t>(
+    std::span<const std::string_view> texts)>;
+
+/**
+ * @brief Length function counting tokens of a tokenizer
+ * @details Chunks are measured by the sum of the token counts of their
+ * splits and separators, so no merged chunk is tokenized again. Lengths of
+ * short splits, such as words and separators, are memoized, so a word is
+ * tokenized once however often it appears. The function can be called from
+ * many threads at once.
+ */
+length_function_t
+create_token_length_function(std::shared_ptr<tokenizer_t> tokenizer);
+
+/**
+ * @brief Split text into chunks by a separator
+ * @details Chunks are views of the text until they are returned, so the text
+ * is copied only once into the chunks.
+ */
 std::vector<std::string>
-split_text_by_separator(const std::string text, const size_t chunk_size = 4000,
+split_text_by_separator(std::string_view text, const size_t chunk_size = 4000,
                         const size_t chunk_overlap = 200,
-                        const std::string separator = "\n\n",
-                        const std::string length_function = "default");
+                        std::string_view separator = "\n\n",
+                        const std::string &length_function = "default");
+
+std::vector<std::string>
+split_text_by_separator(std::string_view text, const size_t chunk_size,
+                        const size_t chunk_overlap, std::string_view separator,
+                        const length_function_t &length_function);
 
+/**
+ * @brief Split text into chunks by the first separator found in it, and
+ * split the chunks too big again by the separators after it
+ */
 std::vector<std::string> split_text_by_separators_recursively(
-    const std::string text, const size_t chunk_size = 4000,
+    std::string_view text, const size_t chunk_size = 4000,
     const size_t chunk_overlap = 200,
-    const std::vector<std::string> separator = {"\n\n", "\n", " ", ""},
-    const std::string length_function = "default");
+    const std::vector<std::string> &separators = {"\n\n", "\n", " ", ""},
+    const std::string &length_function = "default");
+
+std::vector<std::string> split_text_by_separators_recursively(
+    std::string_view text, const size_t chunk_size, const size_t chunk_overlap,
+    const std::vector<std::string> &separators,
+    const length_function_t &length_function);
+
+/**
+ * @brief Create the operator splitting text by a separator
+ * @details With `length_function` of "tokens", chunks are measured with the
+ * tokenizer of the component named by `tokenizer`.
+ */
+std::shared_ptr<operator_t> create_split_text_by_separator_operator();
+
+/**
+ * @brief Create the operator splitting text by separators recursively
+ * @details With `length_function` of "tokens", chunks are measured with the
+ * tokenizer of the component named by `tokenizer`.
+ */
+std::shared_ptr<operator_t>
+create_split_text_by_separators_recursively_operator();
 
-value_or_error_t
-split_text_by_separator_op(std::shared_ptr<const value_t> inputs);
+/**
+ * @brief Create the operator splitting many texts by separators recursively
+ * in parallel
+ * @details Each chunk is returned with the index of its text and its byte
+ * offset in the text, so the texts need not be copied back to locate it.
+ */
+std::shared_ptr<operator_t> create_split_texts_operator();
 
-value_or_error_t
-split_text_by_separators_recursively_op(std::shared_ptr<const value_t> inputs);
+/**
+ * @brief Create the iterative operator splitting a local file by separators
+ * recursively
+ * @details The file is split a window at a time, each step yielding the
+ * chunks of a window with the offset to resume from, so that files larger
+ * than memory can be split.
+ */
+std::shared_ptr<operator_t> create_split_file_operator();
 
 } // namespace ailoy
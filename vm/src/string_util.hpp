@@ -1,7 +1,6 @@
 #include <algorithm>
 #include <concepts>
 #include <ranges>
-#include <sstream>
 #include <string_view>
 #include <vector>
 
@@ -31,11 +30,12 @@ std::string join(std::string_view delimiter, R &&chunks) {
   if (begin == end)
     return "";
 
-  std::ostringstream oss;
-  oss << std::string_view(*begin++);
-  for (; begin != end; ++begin)
-    oss << delimiter << std::string_view(*begin);
-  return oss.str();
+  std::string rv(std::string_view(*begin++));
+  for (; begin != end; ++begin) {
+    rv.append(delimiter);
+    rv.append(std::string_view(*begin));
+  }
+  return rv;
 }
 
 inline std::string &ltrim(std::string &s) {
@@ -55,5 +55,14 @@ inline std::string &rtrim(std::string &s) {
 
 inline std::string &trim(std::string &s) { return ltrim(rtrim(s)); }
 
+inline std::string_view trim_view(std::string_view s) {
+  auto is_space = [](unsigned char ch) { return std::isspace(ch); };
+  while (!s.empty() && is_space(s.front()))
+    s.remove_prefix(1);
+  while (!s.empty() && is_space(s.back()))
+    s.remove_suffix(1);
+  return s;
+}
+
 } // namespace utils
 } // namespace ailoy
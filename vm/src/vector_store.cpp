@@ -0,0 +1,59 @@
+#include "vector_store.hpp"
+
+#include <algorithm>
+
+namespace ailoy {
+
+// Rank constant of reciprocal rank fusion, which damps the weight of the
+// first few ranks
+constexpr float rrf_k = 60.0f;
+
+std::vector<vector_store_retrieve_result_t> fuse_retrieve_results(
+    std::vector<vector_store_retrieve_result_t> vector_results,
+    std::vector<vector_store_retrieve_result_t> lexical_results, uint64_t top_k,
+    const vector_store_hybrid_params_t &params) {
+  if (params.fusion != "rrf" && params.fusion != "weighted")
+    throw ailoy::runtime_error("unknown fusion \"" + params.fusion + "\"");
+
+  std::vector<vector_store_retrieve_result_t> fused;
+  std::unordered_map<std::string, size_t> positions;
+  auto accumulate = [&](std::vector<vector_store_retrieve_result_t> &results,
+                        float weight) {
+    float max_score = 0.0f, min_score = 0.0f;
+    if (!results.empty()) {
+      max_score = results.front().similarity;
+      min_score = results.back().similarity;
+    }
+    for (size_t rank = 0; rank < results.size(); rank++) {
+      float score;
+      if (params.fusion == "rrf")
+        score = 1.0f / (rrf_k + rank + 1);
+      else if (max_score > min_score)
+        score = weight * (results[rank].similarity - min_score) /
+                (max_score - min_score);
+      else
+        score = weight;
+
+      auto [it, inserted] =
+          positions.try_emplace(results[rank].id, fused.size());
+      if (inserted) {
+        fused.push_back(std::move(results[rank]));
+        fused.back().similarity = score;
+      } else
+        fused[it->second].similarity += score;
+    }
+  };
+  accumulate(vector_results, params.vector_weight);
+  accumulate(lexical_results, 1.0f - params.vector_weight);
+
+  // stable, so that ties keep the order of vector search
+  std::stable_sort(fused.begin(), fused.end(),
+                   [](const auto &a, const auto &b) {
+                     return a.similarity > b.similarity;
+                   });
+  if (fused.size() > top_k)
+    fused.resize(top_k);
+  return fused;
+}
+
+} // namespace ailoy
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <unordered_map>
+#include <variant>
 #include <vector>
 
 #include <nlohmann/json.hpp>
 
+#include "metadata_filter.hpp"
 #include "module.hpp"
 #include "value.hpp"
 
@@ -25,6 +28,20 @@ struct vector_store_get_result_t {
   embedding_t embedding;
 };
 
+/**
+ * @brief Search-time parameters of retrieval.
+ * @details Unset fields fall back to the defaults of the vector store, and
+ * fields that do not apply to the underlying index are ignored.
+ */
+struct vector_store_retrieve_params_t {
+  // Only items whose metadata matches this filter are retrieved
+  std::optional<metadata_filter_t> filter = std::nullopt;
+  // Size of the dynamic candidate list of HNSW indexes
+  std::optional<uint64_t> ef_search = std::nullopt;
+  // Number of inverted lists to visit in IVF indexes
+  std::optional<uint64_t> nprobe = std::nullopt;
+};
+
 struct vector_store_retrieve_result_t {
   std::string id;
   std::string document;
@@ -33,6 +50,34 @@ struct vector_store_retrieve_result_t {
   float similarity;
 };
 
+/**
+ * @brief Parameters of hybrid retrieval, which fuses vector search with BM25
+ * keyword search over documents.
+ */
+struct vector_store_hybrid_params_t {
+  // "rrf" (reciprocal rank fusion) or "weighted" (weighted sum of min-max
+  // normalized scores)
+  std::string fusion = "rrf";
+  // Weight of vector similarities in weighted fusion, where BM25 scores get
+  // the rest
+  float vector_weight = 0.5f;
+  // Number of candidates taken from each search before fusion. Defaults to
+  // 4 * top_k.
+  std::optional<uint64_t> num_candidates = std::nullopt;
+};
+
+/**
+ * @brief Fuse ranked results of vector search and keyword search
+ * @param vector_results Results of vector search, in descending order
+ * @param lexical_results Results of keyword search, in descending order
+ * @return Up to `top_k` results in descending order of fused score, which is
+ * stored in `similarity`
+ */
+std::vector<vector_store_retrieve_result_t> fuse_retrieve_results(
+    std::vector<vector_store_retrieve_result_t> vector_results,
+    std::vector<vector_store_retrieve_result_t> lexical_results, uint64_t top_k,
+    const vector_store_hybrid_params_t &params);
+
 class vector_store_t : public object_t {
 public:
   /**
@@ -66,10 +111,23 @@ public:
    * @brief Retrieve similar vectors with query embedding up to n vectors.
    * @param query_embedding Query embedding
    * @param n Number of results to retrieve.
+   * @param params Search-time parameters for approximate indexes
    * @return Retrieved results of text, metadata and similarity score.
    */
   virtual std::vector<vector_store_retrieve_result_t>
-  retrieve(embedding_t query_embedding, uint64_t k) = 0;
+  retrieve(embedding_t query_embedding, uint64_t k,
+           const vector_store_retrieve_params_t &params = {}) = 0;
+
+  /**
+   * @brief Retrieve similar vectors for multiple queries at once.
+   * @param query_embeddings 2-D array of query embeddings
+   * @param k Number of results to retrieve for each query.
+   * @param params Search-time parameters applied to every query
+   * @return Retrieved results of each query, in the order of queries.
+   */
+  virtual std::vector<std::vector<vector_store_retrieve_result_t>>
+  retrieve_many(embedding_t query_embeddings, uint64_t k,
+                const vector_store_retrieve_params_t &params = {}) = 0;
 
   /**
    * @brief Remove a vector from vector store.
@@ -83,6 +141,114 @@ public:
   virtual void clear() = 0;
 };
 
+/**
+ * @brief Parse an item of insert operators
+ * @param prefix Prefix of field names in error messages
+ */
+inline std::optional<error_output_t>
+parse_add_input(std::shared_ptr<const map_t> input_map,
+                const std::string &context, const std::string &prefix,
+                vector_store_add_input_t &add_input) {
+  if (!input_map->contains("embedding"))
+    return error_output_t(range_error(context, prefix + "embedding"));
+  if (!input_map->at("embedding")->is_type_of<ndarray_t>())
+    return error_output_t(type_error(context, prefix + "embedding",
+                                     "ndarray_t",
+                                     input_map->at("embedding")->get_type()));
+  add_input.embedding = input_map->at<ndarray_t>("embedding");
+
+  if (!input_map->contains("document"))
+    return error_output_t(range_error(context, prefix + "document"));
+  if (!input_map->at("document")->is_type_of<string_t>())
+    return error_output_t(type_error(context, prefix + "document", "string_t",
+                                     input_map->at("document")->get_type()));
+  add_input.document = *input_map->at<string_t>("document");
+
+  if (input_map->contains("metadata")) {
+    auto metadata_val = input_map->at("metadata");
+    if (metadata_val->is_type_of<map_t>() || metadata_val->is_type_of<null_t>())
+      add_input.metadata = *metadata_val;
+    else
+      return error_output_t(type_error(context, prefix + "metadata",
+                                       "map_t | null_t",
+                                       metadata_val->get_type()));
+  } else
+    add_input.metadata = nlohmann::json({});
+  return std::nullopt;
+}
+
+/**
+ * @brief Parse `top_k` and search parameters of retrieve operators
+ */
+inline std::optional<error_output_t>
+parse_retrieve_inputs(std::shared_ptr<const map_t> inputs_map,
+                      const std::string &context, uint64_t &top_k,
+                      vector_store_retrieve_params_t &params) {
+  if (!inputs_map->contains("top_k"))
+    return error_output_t(range_error(context, "top_k"));
+
+  // Counts are checked before the cast, as negative int_t values wrap around
+  uint64_t ef_search = 0, nprobe = 0;
+  for (auto [key, count] : {std::pair{"top_k", &top_k},
+                            std::pair{"ef_search", &ef_search},
+                            std::pair{"nprobe", &nprobe}}) {
+    if (!inputs_map->contains(key))
+      continue;
+    auto val = inputs_map->at(key);
+    if (!val->is_type_of<uint_t>() && !val->is_type_of<int_t>())
+      return error_output_t(
+          type_error(context, key, "uint_t | int_t", val->get_type()));
+    if (val->is_type_of<int_t>() ? *val->as<int_t>() < 1
+                                 : *val->as<uint_t>() < 1)
+      return error_output_t(
+          value_error(context, key, ">= 1", val->to_nlohmann_json().dump()));
+    if (val->is_type_of<uint_t>())
+      *count = *val->as<uint_t>();
+    else
+      *count = *val->as<int_t>();
+  }
+  // Search parameters are optional
+  if (inputs_map->contains("ef_search"))
+    params.ef_search = ef_search;
+  if (inputs_map->contains("nprobe"))
+    params.nprobe = nprobe;
+  if (inputs_map->contains("filter")) {
+    auto filter = inputs_map->at("filter");
+    if (!filter->is_type_of<map_t>())
+      return error_output_t(
+          type_error(context, "filter", "map_t", filter->get_type()));
+    params.filter = filter->to_nlohmann_json();
+    try {
+      validate_metadata_filter(params.filter.value());
+    } catch (const ailoy::runtime_error &e) {
+      return error_output_t(e.what());
+    } catch (const std::exception &e) {
+      return error_output_t(e.what());
+    }
+  }
+  return std::nullopt;
+}
+
+inline std::shared_ptr<array_t> retrieve_results_to_value(
+    const std::vector<vector_store_retrieve_result_t> &retrieve_results) {
+  auto results = create<array_t>();
+  for (const auto &result : retrieve_results) {
+    auto retrieve_result = create<map_t>();
+    retrieve_result->insert_or_assign("id", create<string_t>(result.id));
+    retrieve_result->insert_or_assign("document",
+                                      create<string_t>(result.document));
+    if (result.metadata.has_value())
+      retrieve_result->insert_or_assign(
+          "metadata", from_nlohmann_json(result.metadata.value()));
+    else
+      retrieve_result->insert_or_assign("metadata", create<null_t>());
+    retrieve_result->insert_or_assign("similarity",
+                                      create<float_t>(result.similarity));
+    results->push_back(retrieve_result);
+  }
+  return results;
+}
+
 template <typename derived_vector_store_t>
   requires std::is_base_of_v<vector_store_t, derived_vector_store_t>
 component_or_error_t
@@ -93,45 +259,24 @@ create_vector_store_component(std::shared_ptr<const value_t> attrs) {
         if (!inputs->is_type_of<map_t>())
           return error_output_t(type_error("vector_store.insert", "inputs",
                                            "map_t", inputs->get_type()));
-        auto input_map = inputs->as<map_t>();
-
-        if (!input_map->contains("embedding") ||
-            !input_map->at("embedding")->is_type_of<ndarray_t>())
-          return error_output_t(
-              type_error("vector_store.insert", "embedding", "ndarray_t",
-                         input_map->at("embedding")->get_type()));
-        auto embedding = input_map->at<ndarray_t>("embedding");
-
-        if (!input_map->contains("document") ||
-            !input_map->at("document")->is_type_of<string_t>())
-          return error_output_t(
-              type_error("vector_store.insert", "document", "string_t",
-                         input_map->at("embedding")->get_type()));
-        std::string document = *input_map->at<string_t>("document");
-
-        nlohmann::json metadata;
-        if (input_map->contains("metadata")) {
-          auto metadata_val = input_map->at("metadata");
-          if (metadata_val->is_type_of<map_t>() ||
-              metadata_val->is_type_of<null_t>())
-            metadata = *metadata_val;
-          else
-            return error_output_t(type_error("vector_store.insert", "metadata",
-                                             "map_t | null_t",
-                                             metadata_val->get_type()));
-        } else
-          metadata = nlohmann::json({});
-
-        auto add_input = vector_store_add_input_t{
-            .embedding = std::move(embedding),
-            .document = document,
-            .metadata = metadata,
-        };
+        vector_store_add_input_t add_input;
+        auto parse_error = parse_add_input(
+            inputs->as<map_t>(), "vector_store.insert", "", add_input);
+        if (parse_error.has_value())
+          return parse_error.value();
+
+        std::string id;
+        try {
+          id = component->get_obj("vector_store")
+                   ->as<vector_store_t>()
+                   ->add_vector(add_input);
+        } catch (const ailoy::runtime_error &e) {
+          return error_output_t(e.what());
+        } catch (const std::exception &e) {
+          return error_output_t(e.what());
+        }
 
         auto outputs = create<map_t>();
-        auto id = component->get_obj("vector_store")
-                      ->as<vector_store_t>()
-                      ->add_vector(add_input);
         outputs->insert_or_assign("id", create<string_t>(id));
         return outputs;
       });
@@ -153,45 +298,25 @@ create_vector_store_component(std::shared_ptr<const value_t> attrs) {
                                              "inputs.*", "map_t",
                                              input_item->get_type()));
           }
-          auto input_item_map = input_item->as<map_t>();
-
-          if (!input_item_map->contains("embedding") ||
-              !input_item_map->at("embedding")->is_type_of<ndarray_t>())
-            return error_output_t(type_error(
-                "vector_store.insert_many", "inputs.embedding", "ndarray_t",
-                input_item_map->at("embedding")->get_type()));
-          auto embedding = input_item_map->at<ndarray_t>("embedding");
-
-          if (!input_item_map->contains("document") ||
-              !input_item_map->at("document")->is_type_of<string_t>())
-            return error_output_t(type_error(
-                "vector_store.insert_many", "inputs.document", "string_t",
-                input_item_map->at("embedding")->get_type()));
-          std::string document = *input_item_map->at<string_t>("document");
-
-          nlohmann::json metadata;
-          if (input_item_map->contains("metadata")) {
-            auto metadata_val = input_item_map->at("metadata");
-            if (metadata_val->is_type_of<map_t>() ||
-                metadata_val->is_type_of<null_t>())
-              metadata = *metadata_val;
-            else
-              return error_output_t(
-                  type_error("vector_store.insert_many", "inputs.metadata",
-                             "map_t | null_t", metadata_val->get_type()));
-          } else
-            metadata = nlohmann::json({});
-
-          add_inputs.push_back({
-              .embedding = std::move(embedding),
-              .document = document,
-              .metadata = metadata,
-          });
+          vector_store_add_input_t add_input;
+          auto parse_error =
+              parse_add_input(input_item->as<map_t>(),
+                              "vector_store.insert_many", "inputs.", add_input);
+          if (parse_error.has_value())
+            return parse_error.value();
+          add_inputs.push_back(std::move(add_input));
         }
 
-        auto ids = component->get_obj("vector_store")
-                       ->as<vector_store_t>()
-                       ->add_vectors(add_inputs);
+        std::vector<std::string> ids;
+        try {
+          ids = component->get_obj("vector_store")
+                    ->as<vector_store_t>()
+                    ->add_vectors(add_inputs);
+        } catch (const ailoy::runtime_error &e) {
+          return error_output_t(e.what());
+        } catch (const std::exception &e) {
+          return error_output_t(e.what());
+        }
 
         auto outputs = create<map_t>();
         outputs->insert_or_assign("ids", create<array_t>());
@@ -218,9 +343,16 @@ create_vector_store_component(std::shared_ptr<const value_t> attrs) {
                                            inputs_map->at("id")->get_type()));
         std::string id = *inputs_map->at<string_t>("id");
 
-        auto get_result = component->get_obj("vector_store")
-                              ->as<vector_store_t>()
-                              ->get_by_id(id);
+        std::optional<vector_store_get_result_t> get_result;
+        try {
+          get_result = component->get_obj("vector_store")
+                           ->as<vector_store_t>()
+                           ->get_by_id(id);
+        } catch (const ailoy::runtime_error &e) {
+          return error_output_t(e.what());
+        } catch (const std::exception &e) {
+          return error_output_t(e.what());
+        }
 
         auto outputs = create<map_t>();
         if (get_result.has_value()) {
@@ -262,37 +394,71 @@ create_vector_store_component(std::shared_ptr<const value_t> attrs) {
         auto query_embedding = inputs_map->at<ndarray_t>("query_embedding");
 
         uint64_t top_k;
-        if (!inputs_map->contains("top_k"))
-          return error_output_t(
-              range_error("vector_store.retrieve", "query_embedding"));
-        if (inputs_map->at("top_k")->is_type_of<uint_t>())
-          top_k = *inputs_map->at<uint_t>("top_k");
-        else if (inputs_map->at("top_k")->is_type_of<int_t>())
-          top_k = *inputs_map->at<int_t>("top_k");
-        else
+        vector_store_retrieve_params_t params;
+        auto parse_error = parse_retrieve_inputs(
+            inputs_map, "vector_store.retrieve", top_k, params);
+        if (parse_error.has_value())
+          return parse_error.value();
+
+        std::vector<vector_store_retrieve_result_t> retrieve_results;
+        try {
+          retrieve_results = component->get_obj("vector_store")
+                                 ->as<vector_store_t>()
+                                 ->retrieve(query_embedding, top_k, params);
+        } catch (const ailoy::runtime_error &e) {
+          return error_output_t(e.what());
+        } catch (const std::exception &e) {
+          return error_output_t(e.what());
+        }
+
+        auto outputs = create<map_t>();
+        outputs->insert_or_assign("results",
+                                  retrieve_results_to_value(retrieve_results));
+        return outputs;
+      });
+
+  auto retrieve_many = create<instant_method_operator_t>(
+      [](std::shared_ptr<component_t> component,
+         std::shared_ptr<const value_t> inputs) -> value_or_error_t {
+        if (!inputs->is_type_of<map_t>()) {
+          return error_output_t(type_error("vector_store.retrieve_many",
+                                           "inputs", "map_t",
+                                           inputs->get_type()));
+        }
+        auto inputs_map = inputs->as<map_t>();
+
+        if (!inputs_map->contains("query_embeddings"))
           return error_output_t(
-              type_error("vector_store.retrieve", "top_k", "uint_t | int_t",
-                         inputs_map->at("top_k")->get_type()));
+              range_error("vector_store.retrieve_many", "query_embeddings"));
+        if (!inputs_map->at("query_embeddings")->is_type_of<ndarray_t>())
+          return error_output_t(type_error(
+              "vector_store.retrieve_many", "query_embeddings", "ndarray_t",
+              inputs_map->at("query_embeddings")->get_type()));
+        auto query_embeddings = inputs_map->at<ndarray_t>("query_embeddings");
 
-        auto retrieve_results = component->get_obj("vector_store")
-                                    ->as<vector_store_t>()
-                                    ->retrieve(query_embedding, top_k);
+        uint64_t top_k;
+        vector_store_retrieve_params_t params;
+        auto parse_error = parse_retrieve_inputs(
+            inputs_map, "vector_store.retrieve_many", top_k, params);
+        if (parse_error.has_value())
+          return parse_error.value();
+
+        std::vector<std::vector<vector_store_retrieve_result_t>>
+            retrieve_results;
+        try {
+          retrieve_results =
+              component->get_obj("vector_store")
+                  ->as<vector_store_t>()
+                  ->retrieve_many(query_embeddings, top_k, params);
+        } catch (const ailoy::runtime_error &e) {
+          return error_output_t(e.what());
+        } catch (const std::exception &e) {
+          return error_output_t(e.what());
+        }
 
         auto results = create<array_t>();
-        for (const auto &result : retrieve_results) {
-          auto retrieve_result = create<map_t>();
-          retrieve_result->insert_or_assign("id", create<string_t>(result.id));
-          retrieve_result->insert_or_assign("document",
-                                            create<string_t>(result.document));
-          if (result.metadata.has_value())
-            retrieve_result->insert_or_assign(
-                "metadata", from_nlohmann_json(result.metadata.value()));
-          else
-            retrieve_result->insert_or_assign("metadata", create<null_t>());
-          retrieve_result->insert_or_assign("similarity",
-                                            create<float_t>(result.similarity));
-          results->push_back(retrieve_result);
-        }
+        for (const auto &query_results : retrieve_results)
+          results->push_back(retrieve_results_to_value(query_results));
         auto outputs = create<map_t>();
         outputs->insert_or_assign("results", results);
         return outputs;
@@ -315,30 +481,292 @@ create_vector_store_component(std::shared_ptr<const value_t> attrs) {
                                            inputs_map->at("id")->get_type()));
         std::string id = *inputs_map->at<string_t>("id");
 
-        component->get_obj("vector_store")
-            ->as<vector_store_t>()
-            ->remove_vector(id);
+        try {
+          component->get_obj("vector_store")
+              ->as<vector_store_t>()
+              ->remove_vector(id);
+        } catch (const ailoy::runtime_error &e) {
+          return error_output_t(e.what());
+        } catch (const std::exception &e) {
+          return error_output_t(e.what());
+        }
         return create<bool_t>(true);
       });
 
   auto clear = create<instant_method_operator_t>(
       [](std::shared_ptr<component_t> component,
          std::shared_ptr<const value_t> inputs) -> value_or_error_t {
-        component->get_obj("vector_store")->as<vector_store_t>()->clear();
+        try {
+          component->get_obj("vector_store")->as<vector_store_t>()->clear();
+        } catch (const ailoy::runtime_error &e) {
+          return error_output_t(e.what());
+        } catch (const std::exception &e) {
+          return error_output_t(e.what());
+        }
         return create<bool_t>(true);
       });
 
-  auto vector_store = create<derived_vector_store_t>(attrs);
-  auto component = create<component_t>(
-      std::initializer_list<
-          std::pair<const std::string, std::shared_ptr<method_operator_t>>>{
-          {"insert", insert},
-          {"insert_many", insert_many},
-          {"get_by_id", get_by_id},
-          {"retrieve", retrieve},
-          {"remove", remove},
-          {"clear", clear},
-      });
+  std::shared_ptr<derived_vector_store_t> vector_store;
+  try {
+    vector_store = create<derived_vector_store_t>(attrs);
+  } catch (const ailoy::runtime_error &e) {
+    return error_output_t(e.what());
+  } catch (const std::exception &e) {
+    return error_output_t(e.what());
+  }
+  std::unordered_map<std::string, std::shared_ptr<method_operator_t>> ops{
+      {"insert", insert},
+      {"insert_many", insert_many},
+      {"get_by_id", get_by_id},
+      {"retrieve", retrieve},
+      {"retrieve_many", retrieve_many},
+      {"remove", remove},
+      {"clear", clear},
+  };
+
+  // Persistence ops for vector stores that are stored locally
+  if constexpr (requires(derived_vector_store_t vs, std::string path) {
+                  vs.save(path);
+                  vs.load(path);
+                }) {
+    auto get_path = [](std::shared_ptr<const value_t> inputs,
+                       const std::string &context)
+        -> std::variant<std::optional<std::string>, error_output_t> {
+      if (!inputs || !inputs->is_type_of<map_t>() ||
+          !inputs->as<map_t>()->contains("path"))
+        return std::nullopt;
+      auto path = inputs->as<map_t>()->at("path");
+      if (!path->is_type_of<string_t>())
+        return error_output_t(
+            type_error(context, "path", "string_t", path->get_type()));
+      return std::optional<std::string>(*path->as<string_t>());
+    };
+
+    ops["save"] = create<instant_method_operator_t>(
+        [get_path](std::shared_ptr<component_t> component,
+                   std::shared_ptr<const value_t> inputs) -> value_or_error_t {
+          auto path = get_path(inputs, "vector_store.save");
+          if (std::holds_alternative<error_output_t>(path))
+            return std::get<error_output_t>(path);
+          try {
+            component->get_obj("vector_store")
+                ->as<derived_vector_store_t>()
+                ->save(std::get<0>(path));
+          } catch (const ailoy::runtime_error &e) {
+            return error_output_t(e.what());
+          } catch (const std::exception &e) {
+            return error_output_t(e.what());
+          }
+          return create<bool_t>(true);
+        });
+
+    ops["load"] = create<instant_method_operator_t>(
+        [get_path](std::shared_ptr<component_t> component,
+                   std::shared_ptr<const value_t> inputs) -> value_or_error_t {
+          auto path = get_path(inputs, "vector_store.load");
+          if (std::holds_alternative<error_output_t>(path))
+            return std::get<error_output_t>(path);
+          if (!std::get<0>(path).has_value())
+            return error_output_t(range_error("vector_store.load", "path"));
+          try {
+            component->get_obj("vector_store")
+                ->as<derived_vector_store_t>()
+                ->load(std::get<0>(path).value());
+          } catch (const ailoy::runtime_error &e) {
+            return error_output_t(e.what());
+          } catch (const std::exception &e) {
+            return error_output_t(e.what());
+          }
+          return create<bool_t>(true);
+        });
+  }
+
+  // Upsert ops for vector stores that keep external keys
+  if constexpr (requires(derived_vector_store_t vs,
+                         std::vector<std::string> keys,
+                         std::vector<vector_store_add_input_t> inputs) {
+                  vs.upsert_vectors(keys, inputs);
+                }) {
+    auto parse_upsert_input =
+        [](std::shared_ptr<const value_t> input, const std::string &context,
+           const std::string &prefix, std::string &key,
+           vector_store_add_input_t &add_input)
+        -> std::optional<error_output_t> {
+      if (!input->is_type_of<map_t>())
+        return error_output_t(
+            type_error(context, "inputs", "map_t", input->get_type()));
+      auto input_map = input->as<map_t>();
+      if (!input_map->contains("key"))
+        return error_output_t(range_error(context, prefix + "key"));
+      if (!input_map->at("key")->is_type_of<string_t>())
+        return error_output_t(type_error(context, prefix + "key", "string_t",
+                                         input_map->at("key")->get_type()));
+      key = *input_map->at<string_t>("key");
+      return parse_add_input(input_map, context, prefix, add_input);
+    };
+
+    ops["upsert"] = create<instant_method_operator_t>(
+        [parse_upsert_input](
+            std::shared_ptr<component_t> component,
+            std::shared_ptr<const value_t> inputs) -> value_or_error_t {
+          std::vector<std::string> keys(1);
+          std::vector<vector_store_add_input_t> add_inputs(1);
+          auto parse_error = parse_upsert_input(
+              inputs, "vector_store.upsert", "", keys[0], add_inputs[0]);
+          if (parse_error.has_value())
+            return parse_error.value();
+
+          std::vector<std::string> ids;
+          try {
+            ids = component->get_obj("vector_store")
+                      ->as<derived_vector_store_t>()
+                      ->upsert_vectors(keys, add_inputs);
+          } catch (const ailoy::runtime_error &e) {
+            return error_output_t(e.what());
+          } catch (const std::exception &e) {
+            return error_output_t(e.what());
+          }
+          auto outputs = create<map_t>();
+          outputs->insert_or_assign("id", create<string_t>(ids[0]));
+          return outputs;
+        });
+
+    ops["upsert_many"] = create<instant_method_operator_t>(
+        [parse_upsert_input](
+            std::shared_ptr<component_t> component,
+            std::shared_ptr<const value_t> inputs) -> value_or_error_t {
+          if (!inputs->is_type_of<array_t>())
+            return error_output_t(type_error("vector_store.upsert_many",
+                                             "inputs", "array_t",
+                                             inputs->get_type()));
+          std::vector<std::string> keys;
+          std::vector<vector_store_add_input_t> add_inputs;
+          for (auto input_item : *inputs->as<array_t>()) {
+            std::string key;
+            vector_store_add_input_t add_input;
+            auto parse_error =
+                parse_upsert_input(input_item, "vector_store.upsert_many",
+                                   "inputs.", key, add_input);
+            if (parse_error.has_value())
+              return parse_error.value();
+            keys.push_back(std::move(key));
+            add_inputs.push_back(std::move(add_input));
+          }
+
+          std::vector<std::string> ids;
+          try {
+            ids = component->get_obj("vector_store")
+                      ->as<derived_vector_store_t>()
+                      ->upsert_vectors(keys, add_inputs);
+          } catch (const ailoy::runtime_error &e) {
+            return error_output_t(e.what());
+          } catch (const std::exception &e) {
+            return error_output_t(e.what());
+          }
+          auto outputs = create<map_t>();
+          outputs->insert_or_assign("ids", create<array_t>());
+          for (const auto &id : ids)
+            outputs->at<array_t>("ids")->push_back(create<string_t>(id));
+          return outputs;
+        });
+  }
+
+  // Hybrid retrieval for vector stores that keep documents in-process
+  if constexpr (requires(derived_vector_store_t vs, embedding_t embedding,
+                         std::string text) {
+                  vs.hybrid_retrieve(embedding, text, 0, {}, {});
+                }) {
+    ops["hybrid_retrieve"] = create<instant_method_operator_t>(
+        [](std::shared_ptr<component_t> component,
+           std::shared_ptr<const value_t> inputs) -> value_or_error_t {
+          const std::string context = "vector_store.hybrid_retrieve";
+          if (!inputs->is_type_of<map_t>())
+            return error_output_t(
+                type_error(context, "inputs", "map_t", inputs->get_type()));
+          auto inputs_map = inputs->as<map_t>();
+
+          if (!inputs_map->contains("query_embedding"))
+            return error_output_t(range_error(context, "query_embedding"));
+          if (!inputs_map->at("query_embedding")->is_type_of<ndarray_t>())
+            return error_output_t(
+                type_error(context, "query_embedding", "ndarray_t",
+                           inputs_map->at("query_embedding")->get_type()));
+          auto query_embedding = inputs_map->at<ndarray_t>("query_embedding");
+
+          if (!inputs_map->contains("query_text"))
+            return error_output_t(range_error(context, "query_text"));
+          if (!inputs_map->at("query_text")->is_type_of<string_t>())
+            return error_output_t(
+                type_error(context, "query_text", "string_t",
+                           inputs_map->at("query_text")->get_type()));
+          std::string query_text = *inputs_map->at<string_t>("query_text");
+
+          uint64_t top_k;
+          vector_store_retrieve_params_t params;
+          auto parse_error =
+              parse_retrieve_inputs(inputs_map, context, top_k, params);
+          if (parse_error.has_value())
+            return parse_error.value();
+
+          // Parse fusion parameters(optional)
+          vector_store_hybrid_params_t hybrid_params;
+          if (inputs_map->contains("fusion")) {
+            if (!inputs_map->at("fusion")->is_type_of<string_t>())
+              return error_output_t(
+                  type_error(context, "fusion", "string_t",
+                             inputs_map->at("fusion")->get_type()));
+            hybrid_params.fusion = *inputs_map->at<string_t>("fusion");
+          }
+          if (inputs_map->contains("vector_weight")) {
+            auto weight = inputs_map->at("vector_weight");
+            if (weight->is_type_of<float_t>())
+              hybrid_params.vector_weight = *weight->as<float_t>();
+            else if (weight->is_type_of<double_t>())
+              hybrid_params.vector_weight = *weight->as<double_t>();
+            else
+              return error_output_t(type_error(context, "vector_weight",
+                                               "float_t | double_t",
+                                               weight->get_type()));
+          }
+          if (inputs_map->contains("num_candidates")) {
+            auto num_candidates = inputs_map->at("num_candidates");
+            if (num_candidates->is_type_of<uint_t>())
+              hybrid_params.num_candidates = *num_candidates->as<uint_t>();
+            else if (num_candidates->is_type_of<int_t>())
+              hybrid_params.num_candidates = *num_candidates->as<int_t>();
+            else
+              return error_output_t(type_error(context, "num_candidates",
+                                               "uint_t | int_t",
+                                               num_candidates->get_type()));
+            if (num_candidates->is_type_of<int_t>()
+                    ? *num_candidates->as<int_t>() < 1
+                    : *num_candidates->as<uint_t>() < 1)
+              return error_output_t(
+                  value_error(context, "num_candidates", ">= 1",
+                              num_candidates->to_nlohmann_json().dump()));
+          }
+
+          std::vector<vector_store_retrieve_result_t> retrieve_results;
+          try {
+            retrieve_results = component->get_obj("vector_store")
+                                   ->as<derived_vector_store_t>()
+                                   ->hybrid_retrieve(query_embedding,
+                                                     query_text, top_k, params,
+                                                     hybrid_params);
+          } catch (const ailoy::runtime_error &e) {
+            return error_output_t(e.what());
+          } catch (const std::exception &e) {
+            return error_output_t(e.what());
+          }
+
+          auto outputs = create<map_t>();
+          outputs->insert_or_assign(
+              "results", retrieve_results_to_value(retrieve_results));
+          return outputs;
+        });
+  }
+
+  auto component = create<component_t>(ops);
   component->set_obj("vector_store", vector_store);
   return component;
 }
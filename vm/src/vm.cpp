@@ -291,6 +291,14 @@ void handle_call_function(std::shared_ptr<packet_t> pkt,
 
   // Run
   auto op = vm_state->operators.at(opname);
+  op->set_component_lookup(
+      [weak_state = std::weak_ptr<vm_state_t>(vm_state)](
+          const std::string &name) -> std::shared_ptr<component_t> {
+        auto vm_state = weak_state.lock();
+        if (!vm_state || !vm_state->components.contains(name))
+          return nullptr;
+        return vm_state->components.at(name);
+      });
   auto init_result = op->initialize(pkt->body->at("in"));
   if (init_result.has_value()) {
     client->send<packet_type::respond_execute, false>(
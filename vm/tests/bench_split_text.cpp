@@ -0,0 +1,75 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+
+#include "split_text.hpp"
+
+/**
+ * Benchmark of splitting text, compared against copying the same text.
+ * Since the splitter scans the text once and copies each chunk once, its
+ * throughput should stay within a small factor of copying the text into new
+ * memory.
+ *
+ * Usage: bench_split_text [size in MB (default 100)]
+ */
+
+std::string generate_text(size_t size) {
+  std::mt19937 rng(0);
+  std::string text;
+  text.reserve(size);
+  while (text.size() < size) {
+    // words of 1 to 12 letters, lines of 1 to 20 words and paragraphs of 1
+    // to 8 lines
+    size_t num_lines = 1 + rng() % 8;
+    for (size_t i = 0; i < num_lines; i++) {
+      size_t num_words = 1 + rng() % 20;
+      for (size_t j = 0; j < num_words; j++) {
+        size_t word_len = 1 + rng() % 12;
+        for (size_t k = 0; k < word_len; k++)
+          text.push_back('a' + rng() % 26);
+        text.push_back(j + 1 < num_words ? ' ' : '\n');
+      }
+    }
+    text.push_back('\n');
+  }
+  text.resize(size);
+  return text;
+}
+
+template <typename function_t> double measure_seconds(function_t &&f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+int main(int argc, char **argv) {
+  size_t size_mb = argc > 1 ? std::stoul(argv[1]) : 100;
+  auto text = generate_text(size_mb * 1024 * 1024);
+
+  // chunks are written to newly allocated memory, so the copy is too
+  std::unique_ptr<char[]> copied;
+  double copy_seconds = measure_seconds([&]() {
+    copied.reset(new char[text.size()]);
+    std::memcpy(copied.get(), text.data(), text.size());
+  });
+
+  size_t num_chunks = 0, num_bytes = 0;
+  double split_seconds = measure_seconds([&]() {
+    auto chunks = ailoy::split_text_by_separators_recursively(text);
+    num_chunks = chunks.size();
+    for (const auto &chunk : chunks)
+      num_bytes += chunk.size();
+  });
+
+  auto throughput = [&](double seconds) { return size_mb / seconds; };
+  std::cout << "text: " << size_mb << " MB, chunks: " << num_chunks
+            << ", bytes in chunks: " << num_bytes << std::endl;
+  std::cout << "memcpy: " << throughput(copy_seconds) << " MB/s" << std::endl;
+  std::cout << "split_text: " << throughput(split_seconds) << " MB/s ("
+            << split_seconds / copy_seconds << "x of memcpy)" << std::endl;
+  return 0;
+}
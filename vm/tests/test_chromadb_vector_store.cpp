@@ -1,5 +1,8 @@
 #include <format>
+#include <mutex>
 #include <random>
+#include <set>
+#include <thread>
 
 #include <gtest/gtest.h>
 #include <nlohmann/json.hpp>
@@ -92,6 +95,17 @@ TEST(VectorStoreTest, Chromadb_CreateAddRetrieve) {
   ASSERT_EQ(result.document, add_inputs[0].document);
   ASSERT_EQ(result.metadata.value(), add_inputs[0].metadata.value());
   ASSERT_FLOAT_EQ(result.similarity, 1.0f);
+
+  // test retrieve with filter
+  results = vs->retrieve(
+      add_inputs[0].embedding, num_vectors,
+      {.filter = nlohmann::json{{"value", {{"$gte", 3}}},
+                                {"$or", {{{"value", 4}}, {{"value", 7}}}}}});
+  ASSERT_EQ(results.size(), 2);
+  for (const auto &result : results) {
+    auto value = result.metadata.value()["value"].get<int>();
+    ASSERT_TRUE(value == 4 || value == 7);
+  }
 }
 
 TEST(VectorStoreTest, ChromadbComponent_CreateAddRetrieve) {
@@ -222,6 +236,349 @@ TEST(VectorStoreTest, ChromadbComponent_CreateAddRetrieve) {
   ASSERT_EQ(out5_opt.index(), 0);
 }
 
+/**
+ * In-process server implementing the part of the Chroma API the store uses,
+ * over a single collection
+ */
+class mock_chromadb_server_t {
+public:
+  struct item_t {
+    std::vector<float> embedding;
+    std::string document;
+    nlohmann::json metadata;
+  };
+
+  mock_chromadb_server_t() {
+    const std::string base = "/api/v2/tenants/default_tenant/databases/"
+                             "default_database/collections";
+    server_.Post(base, [this](const httplib::Request &req,
+                              httplib::Response &res) {
+      std::lock_guard lock(mutex_);
+      track(req);
+      auto name = nlohmann::json::parse(req.body)["name"].get<std::string>();
+      if (name_ == name) {
+        res.status = httplib::Conflict_409;
+        return;
+      }
+      name_ = name;
+      res.set_content(nlohmann::json{{"id", id_}, {"name", name}}.dump(),
+                      "application/json");
+    });
+    server_.Get(base + "/([^/]+)", [this](const httplib::Request &req,
+                                         httplib::Response &res) {
+      std::lock_guard lock(mutex_);
+      track(req);
+      if (req.matches[1] != name_) {
+        res.status = httplib::NotFound_404;
+        return;
+      }
+      res.set_content(nlohmann::json{{"id", id_}, {"name", name_}}.dump(),
+                      "application/json");
+    });
+    server_.Delete(base + "/([^/]+)", [this](const httplib::Request &req,
+                                            httplib::Response &res) {
+      std::lock_guard lock(mutex_);
+      track(req);
+      name_.clear();
+      items.clear();
+      res.set_content("{}", "application/json");
+    });
+    server_.Post(base + "/([^/]+)/(add|get|query|delete)",
+                 [this](const httplib::Request &req, httplib::Response &res) {
+                   std::lock_guard lock(mutex_);
+                   track(req);
+                   auto body = nlohmann::json::parse(req.body);
+                   if (req.matches[2] == "add")
+                     add(req, body, res);
+                   else if (req.matches[2] == "get")
+                     get(body, res);
+                   else if (req.matches[2] == "query")
+                     query(body, res);
+                   else {
+                     for (const auto &id : body["ids"])
+                       items.erase(id.get<std::string>());
+                     res.set_content("{}", "application/json");
+                   }
+                 });
+
+    port_ = server_.bind_to_any_port("127.0.0.1");
+    thread_ = std::thread([this]() { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+  }
+
+  ~mock_chromadb_server_t() {
+    server_.stop();
+    thread_.join();
+  }
+
+  std::string url() const { return std::format("http://127.0.0.1:{}", port_); }
+
+  std::mutex &mutex() { return mutex_; }
+
+  std::unordered_map<std::string, item_t> items;
+  // Sizes of the bodies of add requests
+  std::vector<size_t> add_body_sizes;
+  // Remote ports of all requests, one for each connection
+  std::set<int> remote_ports;
+  // If set, the add request of this index (in arrival order) fails
+  std::optional<size_t> failing_add;
+
+private:
+  void track(const httplib::Request &req) {
+    remote_ports.insert(req.remote_port);
+  }
+
+  void add(const httplib::Request &req, const nlohmann::json &body,
+           httplib::Response &res) {
+    size_t index = add_body_sizes.size();
+    add_body_sizes.push_back(req.body.size());
+    if (failing_add == index) {
+      res.status = httplib::InternalServerError_500;
+      return;
+    }
+    for (size_t i = 0; i < body["ids"].size(); i++) {
+      items[body["ids"][i]] = {
+          .embedding = body["embeddings"][i].get<std::vector<float>>(),
+          .document = body["documents"][i],
+          .metadata = body["metadatas"][i],
+      };
+    }
+    res.status = httplib::Created_201;
+    res.set_content("true", "application/json");
+  }
+
+  void get(const nlohmann::json &body, httplib::Response &res) {
+    nlohmann::json out = {{"ids", nlohmann::json::array()},
+                          {"embeddings", nlohmann::json::array()},
+                          {"documents", nlohmann::json::array()},
+                          {"metadatas", nlohmann::json::array()}};
+    for (const auto &id : body["ids"]) {
+      auto it = items.find(id);
+      if (it == items.end())
+        continue;
+      out["ids"].push_back(id);
+      out["embeddings"].push_back(it->second.embedding);
+      out["documents"].push_back(it->second.document);
+      out["metadatas"].push_back(it->second.metadata);
+    }
+    res.set_content(out.dump(), "application/json");
+  }
+
+  // Exhaustive cosine search, ignoring filters
+  void query(const nlohmann::json &body, httplib::Response &res) {
+    nlohmann::json out = {{"ids", nlohmann::json::array()},
+                          {"documents", nlohmann::json::array()},
+                          {"metadatas", nlohmann::json::array()},
+                          {"distances", nlohmann::json::array()}};
+    size_t n_results = body["n_results"];
+    for (const auto &q : body["query_embeddings"]) {
+      auto query = q.get<std::vector<float>>();
+      std::vector<std::pair<float, std::string>> distances;
+      for (const auto &[id, item] : items) {
+        float dot = 0, query_norm = 0, item_norm = 0;
+        for (size_t i = 0; i < query.size(); i++) {
+          dot += query[i] * item.embedding[i];
+          query_norm += query[i] * query[i];
+          item_norm += item.embedding[i] * item.embedding[i];
+        }
+        distances.emplace_back(
+            1 - dot / std::sqrt(query_norm * item_norm), id);
+      }
+      std::sort(distances.begin(), distances.end());
+      distances.resize(std::min(distances.size(), n_results));
+      nlohmann::json ids, documents, metadatas, dists;
+      for (const auto &[distance, id] : distances) {
+        ids.push_back(id);
+        documents.push_back(items[id].document);
+        metadatas.push_back(items[id].metadata);
+        dists.push_back(distance);
+      }
+      out["ids"].push_back(ids.is_null() ? nlohmann::json::array() : ids);
+      out["documents"].push_back(documents.is_null() ? nlohmann::json::array()
+                                                     : documents);
+      out["metadatas"].push_back(metadatas.is_null() ? nlohmann::json::array()
+                                                     : metadatas);
+      out["distances"].push_back(dists.is_null() ? nlohmann::json::array()
+                                                 : dists);
+    }
+    res.set_content(out.dump(), "application/json");
+  }
+
+  httplib::Server server_;
+  std::thread thread_;
+  int port_;
+  std::mutex mutex_;
+  std::string id_ = "mock-collection-id";
+  std::string name_;
+};
+
+TEST(VectorStoreTest, ChromadbMock_BatchedAdd) {
+  mock_chromadb_server_t server;
+  const size_t dimension = 16, num_vectors = 1000;
+  ailoy::chromadb_vector_store_t vs(ailoy::chromadb_vector_store_config_t{
+      .url = server.url(), .max_connections = 3, .max_batch_size = 64});
+
+  std::vector<ailoy::vector_store_add_input_t> add_inputs;
+  for (int i = 0; i < num_vectors; i++) {
+    add_inputs.push_back({
+        .embedding = get_random_normalized_vector(dimension),
+        .document = "document \"" + std::to_string(i) + "\"\n",
+        .metadata = nlohmann::json{{"value", i}},
+    });
+  }
+  auto ids = vs.add_vectors(add_inputs);
+  ASSERT_EQ(ids.size(), num_vectors);
+
+  {
+    std::lock_guard lock(server.mutex());
+    // ceil(1000 / 64) batches, sent over at most 3 connections
+    ASSERT_EQ(server.add_body_sizes.size(), 16);
+    ASSERT_EQ(server.items.size(), num_vectors);
+    ASSERT_LE(server.remote_ports.size(), 3);
+  }
+
+  for (size_t i = 0; i < num_vectors; i += 97) {
+    auto item = vs.get_by_id(ids[i]).value();
+    ASSERT_EQ(item.document, add_inputs[i].document);
+    ASSERT_EQ(item.metadata.value(), add_inputs[i].metadata.value());
+    auto expected = add_inputs[i].embedding->operator std::vector<float>();
+    auto embedding = item.embedding->operator std::vector<float>();
+    ASSERT_EQ(embedding.size(), dimension);
+    for (size_t d = 0; d < dimension; d++)
+      ASSERT_FLOAT_EQ(embedding[d], expected[d]);
+  }
+
+  auto results = vs.retrieve(add_inputs[42].embedding, 1);
+  ASSERT_EQ(results.size(), 1);
+  ASSERT_EQ(results[0].id, ids[42]);
+  ASSERT_NEAR(results[0].similarity, 1.0f, 1e-5);
+}
+
+TEST(VectorStoreTest, ChromadbMock_BatchBytes) {
+  mock_chromadb_server_t server;
+  const size_t max_batch_bytes = 4096;
+  auto attrs = ailoy::create<ailoy::map_t>();
+  attrs->insert_or_assign("url", ailoy::create<ailoy::string_t>(server.url()));
+  attrs->insert_or_assign("max_batch_bytes",
+                          ailoy::create<ailoy::uint_t>(max_batch_bytes));
+  ailoy::chromadb_vector_store_t vs(attrs);
+
+  std::vector<ailoy::vector_store_add_input_t> add_inputs;
+  for (int i = 0; i < 100; i++) {
+    add_inputs.push_back({
+        .embedding = get_random_normalized_vector(8),
+        .document = std::string(i == 50 ? 8192 : 100, 'a'),
+    });
+  }
+  vs.add_vectors(add_inputs);
+
+  std::lock_guard lock(server.mutex());
+  ASSERT_EQ(server.items.size(), 100);
+  ASSERT_GT(server.add_body_sizes.size(), 1);
+  // only the batch of the oversized item may exceed the limit
+  size_t num_oversized = 0;
+  for (size_t size : server.add_body_sizes) {
+    if (size > max_batch_bytes)
+      num_oversized++;
+  }
+  ASSERT_EQ(num_oversized, 1);
+}
+
+TEST(VectorStoreTest, ChromadbMock_AddRollback) {
+  mock_chromadb_server_t server;
+  ailoy::chromadb_vector_store_t vs(ailoy::chromadb_vector_store_config_t{
+      .url = server.url(), .max_connections = 2, .max_batch_size = 10});
+  vs.add_vector({.embedding = get_random_normalized_vector(8),
+                 .document = "kept"});
+
+  std::vector<ailoy::vector_store_add_input_t> add_inputs;
+  for (int i = 0; i < 100; i++) {
+    add_inputs.push_back({
+        .embedding = get_random_normalized_vector(8),
+        .document = "document" + std::to_string(i),
+    });
+  }
+  {
+    std::lock_guard lock(server.mutex());
+    server.failing_add = 4;
+  }
+  ASSERT_THROW(vs.add_vectors(add_inputs), ailoy::runtime_error);
+
+  // the batches added before the failure are deleted again
+  std::lock_guard lock(server.mutex());
+  ASSERT_EQ(server.items.size(), 1);
+  ASSERT_EQ(server.items.begin()->second.document, "kept");
+}
+
+TEST(VectorStoreTest, ChromadbMock_ConcurrentClear) {
+  mock_chromadb_server_t server;
+  ailoy::chromadb_vector_store_t vs(
+      ailoy::chromadb_vector_store_config_t{.url = server.url()});
+
+  // clear replaces the collection id, while the others build paths with it
+  std::vector<std::thread> threads;
+  threads.emplace_back([&]() {
+    for (int i = 0; i < 20; i++)
+      vs.clear();
+  });
+  for (int t = 0; t < 3; t++) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < 20; i++) {
+        vs.add_vector({.embedding = get_random_normalized_vector(8),
+                       .document = "document"});
+        vs.retrieve(get_random_normalized_vector(8), 1);
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+}
+
+TEST(VectorStoreTest, ChromadbMockComponent_AddFailure) {
+  mock_chromadb_server_t server;
+  auto attrs = ailoy::create<ailoy::map_t>();
+  attrs->insert_or_assign("url", ailoy::create<ailoy::string_t>(server.url()));
+  attrs->insert_or_assign("max_connections", ailoy::create<ailoy::uint_t>(2));
+  attrs->insert_or_assign("max_batch_size", ailoy::create<ailoy::uint_t>(10));
+  auto vectorstore_opt =
+      ailoy::create_vector_store_component<ailoy::chromadb_vector_store_t>(
+          attrs);
+  ASSERT_EQ(vectorstore_opt.index(), 0);
+  auto vectorstore = std::get<0>(vectorstore_opt);
+  auto insert_op = vectorstore->get_operator("insert");
+  auto insert_many_op = vectorstore->get_operator("insert_many");
+
+  // a failed batch becomes an error of the operator, not an exception
+  auto items = ailoy::create<ailoy::array_t>();
+  for (int i = 0; i < 100; i++) {
+    auto in = ailoy::create<ailoy::map_t>();
+    in->insert_or_assign("embedding", get_random_normalized_vector(8));
+    in->insert_or_assign("document", ailoy::create<ailoy::string_t>(
+                                         "document" + std::to_string(i)));
+    items->push_back(in);
+  }
+  {
+    std::lock_guard lock(server.mutex());
+    server.failing_add = 3;
+  }
+  insert_many_op->initialize(items);
+  auto out = insert_many_op->step();
+  ASSERT_EQ(out.index(), 1);
+  ASSERT_NE(std::get<1>(out).reason.find("Failed to add vectors"),
+            std::string::npos);
+  {
+    std::lock_guard lock(server.mutex());
+    ASSERT_TRUE(server.items.empty());
+    server.failing_add = server.add_body_sizes.size();
+  }
+
+  auto in = ailoy::create<ailoy::map_t>();
+  in->insert_or_assign("embedding", get_random_normalized_vector(8));
+  in->insert_or_assign("document", ailoy::create<ailoy::string_t>("document"));
+  insert_op->initialize(in);
+  ASSERT_EQ(insert_op->step().index(), 1);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
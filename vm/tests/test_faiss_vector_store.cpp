@@ -1,9 +1,10 @@
-#include <random>
+#include <filesystem>
 
 #include <gtest/gtest.h>
 
+#include "faiss/faiss_document_store.hpp"
 #include "faiss/faiss_vector_store.hpp"
-#include "language.hpp"
+#include "vector_store_test_suite.hpp"
 
 std::string dump_vector(std::vector<float> &vec) {
   std::stringstream ss;
@@ -18,190 +19,506 @@ std::string dump_vector(std::vector<float> &vec) {
   return ss.str();
 }
 
-std::shared_ptr<ailoy::ndarray_t> get_random_normalized_vector(size_t dim) {
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+template <> struct vector_store_test_traits_t<ailoy::faiss_vector_store_t> {
+  static constexpr const char *component = "faiss_vector_store";
+};
 
-  std::vector<float> vec(dim);
-  for (int i = 0; i < dim; i++) {
-    vec[i] = dist(gen);
-  }
+INSTANTIATE_TYPED_TEST_SUITE_P(FAISS, VectorStoreSuite,
+                               ailoy::faiss_vector_store_t);
 
-  // normalize
-  float magnitude = 0.0f;
-  for (float value : vec) {
-    magnitude += value * value;
-  }
-  magnitude = std::sqrt(magnitude);
-  for (float &value : vec) {
-    value /= magnitude;
-  }
+TEST(VectorStoreTest, FAISS_HNSW) {
+  size_t dimension = 16;
+  ailoy::faiss_vector_store_t vs(ailoy::faiss_vector_store_config_t{
+      .dimension = dimension, .index = "HNSW16", .ef_search = 32});
 
-  auto ndarray = ailoy::create<ailoy::ndarray_t>();
-  ndarray->shape.push_back(dim);
-  ndarray->dtype = {
-      .code = kDLFloat,
-      .bits = 32,
-      .lanes = 1,
-  };
-  ndarray->data.resize(sizeof(float) * dim);
-  memcpy(ndarray->data.data(), vec.data(), sizeof(float) * dim);
+  size_t num_vectors = 100;
+  std::vector<ailoy::vector_store_add_input_t> add_inputs;
+  for (int i = 0; i < num_vectors; i++) {
+    add_inputs.push_back(ailoy::vector_store_add_input_t{
+        .embedding = get_random_normalized_vector(dimension),
+        .document = "document" + std::to_string(i),
+    });
+  }
+  auto vec_ids = vs.add_vectors(add_inputs);
 
-  return ndarray;
+  auto results = vs.retrieve(add_inputs[0].embedding, 1, {.ef_search = 64});
+  ASSERT_EQ(results.size(), 1);
+  ASSERT_EQ(results[0].id, vec_ids[0]);
+  ASSERT_FLOAT_EQ(results[0].similarity, 1.0f);
 }
 
-TEST(VectorStoreTest, FAISS_CreateAddRetrieve) {
-  size_t dimension = 10;
-  ailoy::faiss_vector_store_t vs(dimension);
+TEST(VectorStoreTest, FAISS_IVFTraining) {
+  size_t dimension = 16;
+  ailoy::faiss_vector_store_t vs(ailoy::faiss_vector_store_config_t{
+      .dimension = dimension, .index = "IVF4,Flat", .train_size = 100});
 
-  size_t num_vectors = 10;
+  size_t num_vectors = 200;
   std::vector<ailoy::vector_store_add_input_t> add_inputs;
+  std::vector<std::string> vec_ids;
   for (int i = 0; i < num_vectors; i++) {
-    auto vec = get_random_normalized_vector(dimension);
     auto item = ailoy::vector_store_add_input_t{
-        .embedding = vec,
+        .embedding = get_random_normalized_vector(dimension),
         .document = "document" + std::to_string(i),
-        .metadata = nlohmann::json{{"value", i}},
     };
     add_inputs.push_back(item);
+    vec_ids.push_back(vs.add_vector(item));
+
+    // vectors added before training are still retrievable
+    if (i == 10) {
+      auto results = vs.retrieve(add_inputs[0].embedding, 1);
+      ASSERT_EQ(results.size(), 1);
+      ASSERT_EQ(results[0].id, vec_ids[0]);
+    }
   }
-  auto vec_ids = vs.add_vectors(add_inputs);
 
-  std::string test_id = vec_ids[0];
+  // search every inverted list to get the exact result
+  auto results = vs.retrieve(add_inputs[0].embedding, 1, {.nprobe = 4});
+  ASSERT_EQ(results.size(), 1);
+  ASSERT_EQ(results[0].id, vec_ids[0]);
+  ASSERT_FLOAT_EQ(results[0].similarity, 1.0f);
 
-  // test get_by_id
-  auto item = vs.get_by_id(test_id).value();
-  ASSERT_EQ(item.document, add_inputs[0].document);
-  ASSERT_EQ(item.metadata.value(), add_inputs[0].metadata.value());
+  auto item = vs.get_by_id(vec_ids[150]).value();
+  ASSERT_EQ(item.document, add_inputs[150].document);
 
-  // test retrieve
-  auto results = vs.retrieve(add_inputs[0].embedding, 1);
+  vs.remove_vector(vec_ids[0]);
+  ASSERT_FALSE(vs.get_by_id(vec_ids[0]).has_value());
+  results = vs.retrieve(add_inputs[0].embedding, 1, {.nprobe = 4});
+  ASSERT_NE(results[0].id, vec_ids[0]);
+}
+
+TEST(VectorStoreTest, FAISS_TrainingFailure) {
+  size_t dimension = 16;
+  // too few points to train 1024 inverted lists
+  ailoy::faiss_vector_store_t vs(ailoy::faiss_vector_store_config_t{
+      .dimension = dimension, .index = "IVF1024,Flat", .train_size = 100});
+
+  std::vector<ailoy::vector_store_add_input_t> add_inputs;
+  for (int i = 0; i < 100; i++) {
+    add_inputs.push_back(ailoy::vector_store_add_input_t{
+        .embedding = get_random_normalized_vector(dimension),
+        .document = "document" + std::to_string(i),
+    });
+  }
+  ASSERT_THROW(vs.add_vectors(add_inputs), ailoy::runtime_error);
+
+  // the store is left as it was
+  auto id = vs.add_vector(add_inputs[0]);
+  auto results = vs.retrieve(add_inputs[0].embedding, 10);
   ASSERT_EQ(results.size(), 1);
-  auto result = results[0];
-  ASSERT_EQ(result.id, test_id);
-  ASSERT_EQ(result.document, add_inputs[0].document);
-  ASSERT_EQ(result.metadata.value(), add_inputs[0].metadata.value());
-  ASSERT_FLOAT_EQ(result.similarity, 1.0f);
+  ASSERT_EQ(results[0].id, id);
 }
 
-TEST(VectorStoreTest, FAISSComponent_CreateAddRetrieve) {
-  size_t dimension = 10;
-  auto create_vectorstore =
-      ailoy::get_language_module()->factories.at("faiss_vector_store");
-  auto attrs = ailoy::create<ailoy::map_t>();
-  attrs->insert_or_assign("dimension", ailoy::create<ailoy::uint_t>(dimension));
-  auto vectorstore_opt = create_vectorstore(attrs);
-  ASSERT_EQ(vectorstore_opt.index(), 0);
-  auto vectorstore = std::get<0>(vectorstore_opt);
-  auto insert_op = vectorstore->get_operator("insert");
-  auto insert_many_op = vectorstore->get_operator("insert_many");
-  auto get_by_id_op = vectorstore->get_operator("get_by_id");
-  auto retrieve_op = vectorstore->get_operator("retrieve");
-  auto remove_op = vectorstore->get_operator("remove");
-  auto clear_op = vectorstore->get_operator("clear");
+TEST(VectorStoreTest, FAISS_InvalidIndex) {
+  ASSERT_THROW(ailoy::faiss_vector_store_t(ailoy::faiss_vector_store_config_t{
+                   .dimension = 16, .index = "NotAnIndex"}),
+               ailoy::runtime_error);
+}
 
-  size_t num_vectors = 10;
-  std::vector<ailoy::vector_store_add_input_t> insert_inputs;
-  std::vector<std::string> vec_ids;
+TEST(VectorStoreTest, FAISS_QuantizedStorage) {
+  size_t dimension = 16;
+  size_t num_vectors = 400;
+  std::vector<ailoy::vector_store_add_input_t> add_inputs;
   for (int i = 0; i < num_vectors; i++) {
-    auto vec = get_random_normalized_vector(dimension);
-    auto insert_input = ailoy::vector_store_add_input_t{
-        .embedding = vec,
+    add_inputs.push_back(ailoy::vector_store_add_input_t{
+        .embedding = get_random_normalized_vector(dimension),
         .document = "document" + std::to_string(i),
-        .metadata = nlohmann::json{{"value", i}},
-    };
-    insert_inputs.push_back(insert_input);
+    });
   }
 
-  // test insert
-  {
-    auto item0 = insert_inputs[0];
-    auto in1 = ailoy::create<ailoy::map_t>();
-    in1->insert_or_assign("embedding",
-                          ailoy::create<ailoy::ndarray_t>(*item0.embedding));
-    in1->insert_or_assign("document",
-                          ailoy::create<ailoy::string_t>(item0.document));
-    in1->insert_or_assign("metadata",
-                          ailoy::from_nlohmann_json(item0.metadata));
-    insert_op->initialize(in1);
-    auto insert_outputs_opt = insert_op->step();
-    ASSERT_EQ(insert_outputs_opt.index(), 0);
-    auto insert_outputs = std::get<0>(insert_outputs_opt);
-    auto vec_id =
-        insert_outputs.val->as<ailoy::map_t>()->at<ailoy::string_t>("id");
-    vec_ids.push_back(*vec_id);
+  for (std::string storage : {"float16", "int8", "pq4"}) {
+    ailoy::faiss_vector_store_t vs(ailoy::faiss_vector_store_config_t{
+        .dimension = dimension,
+        .train_size = 300,
+        .storage = storage,
+        .rerank = 10,
+    });
+    auto vec_ids = vs.add_vectors(add_inputs);
+
+    // re-ranking with full-precision vectors gives exact similarities
+    auto results = vs.retrieve(add_inputs[7].embedding, 1);
+    ASSERT_EQ(results[0].id, vec_ids[7]) << storage;
+    ASSERT_FLOAT_EQ(results[0].similarity, 1.0f) << storage;
+    ASSERT_EQ(vs.get_by_id(vec_ids[7])->embedding->data,
+              add_inputs[7].embedding->data)
+        << storage;
   }
 
-  // test insert_many
+  // full-precision vectors are saved and mapped back
+  auto path = std::filesystem::temp_directory_path() / "ailoy_test_faiss_pq";
+  std::filesystem::remove_all(path);
   {
-    auto items = ailoy::create<ailoy::array_t>();
-    for (int i = 1; i < num_vectors; i++) {
-      auto in = ailoy::create<ailoy::map_t>();
-      in->insert_or_assign("embedding", ailoy::create<ailoy::ndarray_t>(
-                                            *insert_inputs[i].embedding));
-      in->insert_or_assign("document", ailoy::create<ailoy::string_t>(
-                                           insert_inputs[i].document));
-      in->insert_or_assign(
-          "metadata", ailoy::from_nlohmann_json(insert_inputs[i].metadata));
-      items->push_back(in);
+    ailoy::faiss_vector_store_t vs(ailoy::faiss_vector_store_config_t{
+        .dimension = dimension,
+        .train_size = 300,
+        .storage = "pq4",
+        .rerank = 10,
+        .path = path.string(),
+    });
+    auto vec_ids = vs.add_vectors(add_inputs);
+    vs.save();
+    vs.remove_vector(vec_ids[0]);
+    auto new_id = vs.add_vector(add_inputs[0]);
+    vs.save();
+
+    ailoy::faiss_vector_store_t reloaded(ailoy::faiss_vector_store_config_t{
+        .dimension = dimension, .path = path.string()});
+    auto results = reloaded.retrieve(add_inputs[0].embedding, 1);
+    ASSERT_EQ(results[0].id, new_id);
+    ASSERT_FLOAT_EQ(results[0].similarity, 1.0f);
+    ASSERT_EQ(reloaded.get_by_id(vec_ids[42])->embedding->data,
+              add_inputs[42].embedding->data);
+  }
+  std::filesystem::remove_all(path);
+
+  // storage replaces only the "Flat" encoding
+  ASSERT_THROW(ailoy::faiss_vector_store_t(ailoy::faiss_vector_store_config_t{
+                   .dimension = dimension,
+                   .index = "IVF4,PQ4",
+                   .storage = "int8"}),
+               ailoy::runtime_error);
+  ASSERT_THROW(ailoy::faiss_vector_store_t(ailoy::faiss_vector_store_config_t{
+                   .dimension = dimension, .storage = "int4"}),
+               ailoy::runtime_error);
+}
+
+TEST(VectorStoreTest, FAISS_HybridRetrieveSaveLoad) {
+  size_t dimension = 16;
+  auto path =
+      std::filesystem::temp_directory_path() / "ailoy_test_faiss_hybrid";
+  std::filesystem::remove_all(path);
+  ailoy::faiss_vector_store_t vs(ailoy::faiss_vector_store_config_t{
+      .dimension = dimension, .path = path.string()});
+
+  auto add_inputs = get_random_inputs(dimension, 100);
+  auto vec_ids = vs.add_vectors(add_inputs);
+
+  // the BM25 index is rebuilt from the saved documents after loading
+  auto query_embedding = add_inputs[7].embedding;
+  vs.remove_vector(vec_ids[42]);
+  vs.save();
+  vs.load(path.string());
+  auto results =
+      vs.hybrid_retrieve(query_embedding, "document11", 1, {},
+                         {.fusion = "weighted", .vector_weight = 0.0f});
+  ASSERT_EQ(results[0].id, vec_ids[11]);
+  results = vs.hybrid_retrieve(query_embedding, "document42", 100);
+  for (const auto &result : results)
+    ASSERT_NE(result.id, vec_ids[42]);
+
+  std::filesystem::remove_all(path);
+}
+
+TEST(VectorStoreTest, FAISS_Compaction) {
+  size_t dimension = 16;
+  for (std::string index : {"Flat", "HNSW16", "IVF4,Flat"}) {
+    // compacted only when requested
+    ailoy::faiss_vector_store_t vs(
+        ailoy::faiss_vector_store_config_t{.dimension = dimension,
+                                           .index = index,
+                                           .train_size = 100,
+                                           .compaction_threshold = 2.0});
+
+    size_t num_vectors = 200;
+    std::vector<ailoy::vector_store_add_input_t> add_inputs;
+    for (int i = 0; i < num_vectors; i++) {
+      add_inputs.push_back(ailoy::vector_store_add_input_t{
+          .embedding = get_random_normalized_vector(dimension),
+          .document = "document" + std::to_string(i),
+      });
     }
+    auto vec_ids = vs.add_vectors(add_inputs);
+
+    std::set<std::string> expected;
+    for (int i = 0; i < num_vectors; i++) {
+      if (i % 2 == 0)
+        vs.remove_vector(vec_ids[i]);
+      else
+        expected.insert(vec_ids[i]);
+    }
+
+    auto check = [&]() {
+      std::set<std::string> ids;
+      for (const auto &result :
+           vs.retrieve(add_inputs[0].embedding, num_vectors,
+                       {.ef_search = 256, .nprobe = 4}))
+        ids.insert(result.id);
+      ASSERT_EQ(ids, expected) << index;
+      auto results = vs.retrieve(add_inputs[1].embedding, 1,
+                                 {.ef_search = 256, .nprobe = 4});
+      ASSERT_EQ(results[0].id, vec_ids[1]) << index;
+    };
+
+    // removed vectors are skipped before compaction
+    check();
+    vs.compact();
+    check();
+
+    // removing again after compaction
+    vs.remove_vector(vec_ids[1]);
+    expected.erase(vec_ids[1]);
+    vs.compact();
+    auto results = vs.retrieve(add_inputs[1].embedding, 1,
+                               {.ef_search = 256, .nprobe = 4});
+    ASSERT_NE(results[0].id, vec_ids[1]) << index;
+  }
+}
+
+TEST(VectorStoreTest, FAISS_BackgroundCompaction) {
+  size_t dimension = 16;
+  auto path = std::filesystem::temp_directory_path() / "ailoy_test_faiss_tomb";
+  std::filesystem::remove_all(path);
+  ailoy::faiss_vector_store_t vs(
+      ailoy::faiss_vector_store_config_t{.dimension = dimension,
+                                         .compaction_threshold = 0.1,
+                                         .path = path.string()});
+
+  std::vector<ailoy::vector_store_add_input_t> add_inputs;
+  for (int i = 0; i < 1000; i++) {
+    add_inputs.push_back(ailoy::vector_store_add_input_t{
+        .embedding = get_random_normalized_vector(dimension),
+        .document = "document" + std::to_string(i),
+    });
+  }
+  auto vec_ids = vs.add_vectors(add_inputs);
+
+  // vectors are removed and added while compactions run in the background
+  std::vector<std::string> new_ids;
+  for (int i = 0; i < 500; i++) {
+    vs.remove_vector(vec_ids[i]);
+    new_ids.push_back(vs.add_vector(ailoy::vector_store_add_input_t{
+        .embedding = add_inputs[i].embedding,
+        .document = "new document" + std::to_string(i),
+    }));
+  }
+  vs.compact();
+
+  for (int i = 0; i < 500; i += 50) {
+    auto results = vs.retrieve(add_inputs[i].embedding, 1);
+    ASSERT_EQ(results.size(), 1);
+    ASSERT_EQ(results[0].id, new_ids[i]);
+    ASSERT_EQ(results[0].document, "new document" + std::to_string(i));
+  }
+  ASSERT_EQ(vs.retrieve(add_inputs[0].embedding, 2000).size(), 1000);
+
+  // removed vectors stay removed after loading, even before compaction
+  vs.remove_vector(vec_ids[999]);
+  vs.save();
+  vs.load(path.string());
+  auto results = vs.retrieve(add_inputs[999].embedding, 1);
+  ASSERT_NE(results[0].id, vec_ids[999]);
+  ASSERT_EQ(vs.retrieve(add_inputs[0].embedding, 2000).size(), 999);
+
+  std::filesystem::remove_all(path);
+}
+
+TEST(VectorStoreTest, FAISS_Upsert) {
+  size_t dimension = 16;
+  auto path =
+      std::filesystem::temp_directory_path() / "ailoy_test_faiss_upsert";
+  std::filesystem::remove_all(path);
+  ailoy::faiss_vector_store_t vs(ailoy::faiss_vector_store_config_t{
+      .dimension = dimension, .path = path.string()});
+
+  auto make_input = [&](const std::string &document) {
+    return ailoy::vector_store_add_input_t{
+        .embedding = get_random_normalized_vector(dimension),
+        .document = document,
+    };
+  };
+  std::vector<std::string> keys = {"a.txt", "b.txt"};
+  std::vector<ailoy::vector_store_add_input_t> inputs = {make_input("a1"),
+                                                         make_input("b1")};
+  auto ids = vs.upsert_vectors(keys, inputs);
+
+  // replacing the document under a key removes the previous one
+  keys = {"a.txt", "a.txt"};
+  inputs = {make_input("a2"), make_input("a3")};
+  auto new_ids = vs.upsert_vectors(keys, inputs);
+  ASSERT_FALSE(vs.get_by_id(ids[0]).has_value());
+  ASSERT_FALSE(vs.get_by_id(new_ids[0]).has_value());
+  ASSERT_EQ(vs.get_by_id(new_ids[1])->document, "a3");
+  ASSERT_EQ(vs.get_by_id(ids[1])->document, "b1");
+  auto results = vs.retrieve(inputs[1].embedding, 10);
+  ASSERT_EQ(results.size(), 2);
+  ASSERT_EQ(results[0].id, new_ids[1]);
+
+  // keys are saved with the store
+  vs.save();
+  vs.load(path.string());
+  keys = {"b.txt"};
+  inputs = {make_input("b2")};
+  auto b_ids = vs.upsert_vectors(keys, inputs);
+  ASSERT_FALSE(vs.get_by_id(ids[1]).has_value());
+  ASSERT_EQ(vs.get_by_id(b_ids[0])->document, "b2");
+
+  // removing by id forgets the key
+  vs.remove_vector(b_ids[0]);
+  inputs = {make_input("b3")};
+  b_ids = vs.upsert_vectors(keys, inputs);
+  ASSERT_EQ(vs.retrieve(inputs[0].embedding, 10).size(), 2);
+
+  keys = {"c.txt", "d.txt"};
+  ASSERT_THROW(vs.upsert_vectors(keys, inputs), ailoy::runtime_error);
+
+  std::filesystem::remove_all(path);
+}
+
+TEST(VectorStoreTest, FAISS_DocumentStore) {
+  ailoy::faiss_document_store_t store;
+  for (int i = 0; i < 100; i++) {
+    store.insert(i, "document" + std::to_string(i),
+                 i % 10 == 0 ? ailoy::metadata_t(std::nullopt)
+                             : nlohmann::json{{"value", i}});
+  }
+  ASSERT_EQ(store.get_document(42), "document42");
+  ASSERT_EQ(store.get_metadata(42).value(), nlohmann::json({{"value", 42}}));
+  ASSERT_FALSE(store.get_metadata(40).has_value());
+  ASSERT_FALSE(store.contains(100));
+
+  // erasing most of the entries compacts the arenas
+  for (int i = 0; i < 90; i++)
+    store.erase(i);
+  ASSERT_FALSE(store.contains(0));
+  ASSERT_EQ(store.get_document(95), "document95");
+  ASSERT_EQ(store.get_metadata(95).value(), nlohmann::json({{"value", 95}}));
+
+  // overwriting an entry
+  store.insert(95, "overwritten", std::nullopt);
+  ASSERT_EQ(store.get_document(95), "overwritten");
+  ASSERT_FALSE(store.get_metadata(95).has_value());
+
+  size_t count = 0;
+  store.for_each_id([&](int64_t) { count++; });
+  ASSERT_EQ(count, 10);
+}
+
+TEST(VectorStoreTest, FAISS_DocumentStoreRewrite) {
+  auto path =
+      std::filesystem::temp_directory_path() / "ailoy_test_faiss_documents";
+  std::filesystem::remove_all(path);
+  std::filesystem::create_directories(path);
+  auto file_size = [&]() {
+    return std::filesystem::file_size(path / "documents.bin");
+  };
 
-    insert_many_op->initialize(items);
-    auto insert_many_outputs_opt = insert_many_op->step();
-    ASSERT_EQ(insert_many_outputs_opt.index(), 0);
-    auto insert_many_outputs = std::get<0>(insert_many_outputs_opt);
-    auto ids =
-        insert_many_outputs.val->as<ailoy::map_t>()->at<ailoy::array_t>("ids");
-    for (auto vec_id : *ids) {
-      vec_ids.push_back(*vec_id->as<ailoy::string_t>());
+  ailoy::faiss_document_store_t store;
+  for (int i = 0; i < 100; i++)
+    store.insert(i, "document" + std::to_string(i), std::nullopt);
+  store.save(path, false);
+  auto full_size = file_size();
+
+  // a few erased records are left in the file
+  for (int i = 0; i < 10; i++)
+    store.erase(i);
+  store.save(path, true);
+  ASSERT_EQ(file_size(), full_size);
+  ASSERT_GT(store.file_garbage_size(), 0);
+
+  // and the file is rewritten once they take up a quarter of it
+  ailoy::faiss_document_store_t loaded;
+  loaded.load(path, store.file_garbage_size());
+  for (int i = 10; i < 30; i++)
+    loaded.erase(i);
+  loaded.save(path, true);
+  ASSERT_LT(file_size(), full_size * 3 / 4);
+  ASSERT_EQ(loaded.file_garbage_size(), 0);
+  ASSERT_FALSE(loaded.contains(29));
+  ASSERT_EQ(loaded.get_document(30), "document30");
+  ASSERT_EQ(loaded.get_document(99), "document99");
+
+  std::filesystem::remove_all(path);
+}
+
+TEST(VectorStoreTest, FAISS_SaveLoad) {
+  size_t dimension = 16;
+  auto path = std::filesystem::temp_directory_path() / "ailoy_test_faiss_store";
+  std::filesystem::remove_all(path);
+
+  size_t num_vectors = 200;
+  std::vector<ailoy::vector_store_add_input_t> add_inputs;
+  std::vector<std::string> vec_ids;
+  {
+    ailoy::faiss_vector_store_t vs(ailoy::faiss_vector_store_config_t{
+        .dimension = dimension,
+        .index = "IVF4,Flat",
+        .train_size = 100,
+        .path = path.string()});
+    for (int i = 0; i < num_vectors; i++) {
+      add_inputs.push_back(ailoy::vector_store_add_input_t{
+          .embedding = get_random_normalized_vector(dimension),
+          .document = "document" + std::to_string(i),
+          .metadata = nlohmann::json{{"value", i}},
+      });
     }
+    vec_ids = vs.add_vectors(add_inputs);
+    vs.save();
   }
 
-  std::string test_id = vec_ids[0];
-
-  // test get_by_id
-  auto in2 = ailoy::create<ailoy::map_t>();
-  in2->insert_or_assign("id", ailoy::create<ailoy::string_t>(test_id));
-  auto init_result = get_by_id_op->initialize(in2);
-  ASSERT_FALSE(init_result.has_value());
-  auto out2_opt = get_by_id_op->step();
-  ASSERT_EQ(out2_opt.index(), 0);
-  auto out2 = std::get<0>(out2_opt).val->as<ailoy::map_t>();
-  ASSERT_EQ(*out2->at<ailoy::string_t>("document"), insert_inputs[0].document);
-  ASSERT_EQ(out2->at<ailoy::value_t>("metadata")->to_nlohmann_json(),
-            insert_inputs[0].metadata.value());
-
-  // test retrieve
-  auto in3 = ailoy::create<ailoy::map_t>();
-  in3->insert_or_assign("query_embedding", ailoy::create<ailoy::ndarray_t>(
-                                               *insert_inputs[0].embedding));
-  in3->insert_or_assign("top_k", ailoy::create<ailoy::uint_t>(1));
-  retrieve_op->initialize(in3);
-  auto out3_opt = retrieve_op->step();
-  ASSERT_EQ(out3_opt.index(), 0);
-  auto out3 = std::get<0>(out3_opt).val->as<ailoy::map_t>()->at<ailoy::array_t>(
-      "results");
-  ASSERT_EQ(out3->size(), 1);
-  auto result = out3->at<ailoy::map_t>(0);
-  ASSERT_EQ(*result->at<ailoy::string_t>("id"), test_id);
-  ASSERT_EQ(*result->at<ailoy::string_t>("document"),
-            insert_inputs[0].document);
-  ASSERT_EQ(result->at<ailoy::value_t>("metadata")->to_nlohmann_json(),
-            insert_inputs[0].metadata.value());
-  ASSERT_FLOAT_EQ(*result->at<ailoy::float_t>("similarity"), 1.0f);
-
-  // test remove
-  auto in4 = ailoy::create<ailoy::map_t>();
-  in4->insert_or_assign("id", ailoy::create<ailoy::string_t>(vec_ids[0]));
-  remove_op->initialize(in4);
-  auto out4_opt = remove_op->step();
-  ASSERT_EQ(out4_opt.index(), 0);
-
-  // test clear
-  clear_op->initialize();
-  auto out5_opt = clear_op->step();
-  ASSERT_EQ(out5_opt.index(), 0);
+  // reopen, modify and save into the same directory
+  {
+    ailoy::faiss_vector_store_t vs(ailoy::faiss_vector_store_config_t{
+        .dimension = dimension, .path = path.string()});
+    auto item = vs.get_by_id(vec_ids[10]).value();
+    ASSERT_EQ(item.document, add_inputs[10].document);
+    ASSERT_EQ(item.metadata.value(), add_inputs[10].metadata.value());
+
+    auto results = vs.retrieve(add_inputs[10].embedding, 1, {.nprobe = 4});
+    ASSERT_EQ(results.size(), 1);
+    ASSERT_EQ(results[0].id, vec_ids[10]);
+    ASSERT_EQ(results[0].document, add_inputs[10].document);
+
+    vs.remove_vector(vec_ids[0]);
+    auto new_item = ailoy::vector_store_add_input_t{
+        .embedding = get_random_normalized_vector(dimension),
+        .document = "new document",
+    };
+    auto new_id = vs.add_vector(new_item);
+    ASSERT_EQ(new_id, std::to_string(num_vectors));
+    vs.save();
+
+    ailoy::faiss_vector_store_t reloaded(ailoy::faiss_vector_store_config_t{
+        .dimension = dimension, .path = path.string()});
+    ASSERT_FALSE(reloaded.get_by_id(vec_ids[0]).has_value());
+    ASSERT_EQ(reloaded.get_by_id(new_id)->document, "new document");
+    ASSERT_EQ(reloaded.get_by_id(vec_ids[199])->document,
+              add_inputs[199].document);
+  }
+
+  // dimension mismatch
+  ASSERT_THROW(ailoy::faiss_vector_store_t(ailoy::faiss_vector_store_config_t{
+                   .dimension = dimension + 1, .path = path.string()}),
+               ailoy::runtime_error);
+
+  std::filesystem::remove_all(path);
+}
+
+TEST(VectorStoreTest, FAISSComponent_TrainingFailure) {
+  size_t dimension = 16;
+  auto create_vectorstore =
+      ailoy::get_language_module()->factories.at("faiss_vector_store");
+  auto attrs = ailoy::create<ailoy::map_t>();
+  attrs->insert_or_assign("dimension", ailoy::create<ailoy::uint_t>(dimension));
+  attrs->insert_or_assign("index",
+                          ailoy::create<ailoy::string_t>("IVF1024,Flat"));
+  attrs->insert_or_assign("train_size", ailoy::create<ailoy::uint_t>(100));
+  auto vectorstore_opt = create_vectorstore(attrs);
+  ASSERT_EQ(vectorstore_opt.index(), 0);
+  auto vectorstore = std::get<0>(vectorstore_opt);
+  auto insert_many_op = vectorstore->get_operator("insert_many");
+
+  auto items = ailoy::create<ailoy::array_t>();
+  for (int i = 0; i < 100; i++) {
+    auto in = ailoy::create<ailoy::map_t>();
+    in->insert_or_assign("embedding", get_random_normalized_vector(dimension));
+    in->insert_or_assign("document", ailoy::create<ailoy::string_t>(
+                                         "document" + std::to_string(i)));
+    items->push_back(in);
+  }
+  insert_many_op->initialize(items);
+  auto out = insert_many_op->step();
+  ASSERT_EQ(out.index(), 1);
+  ASSERT_NE(std::get<1>(out).reason.find("failed to train index"),
+            std::string::npos);
 }
 
 int main(int argc, char **argv) {
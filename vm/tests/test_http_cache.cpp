@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+#include <httplib.h>
+
+#include <atomic>
+#include <filesystem>
+#include <format>
+#include <thread>
+
+#include "http_cache.hpp"
+
+class HttpCacheTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    server_.Get("/max-age", [this](const httplib::Request &req,
+                                   httplib::Response &res) {
+      num_requests_++;
+      res.set_header("Cache-Control", "max-age=60");
+      res.set_content("fresh", "text/plain");
+    });
+    server_.Get("/etag", [this](const httplib::Request &req,
+                                httplib::Response &res) {
+      num_requests_++;
+      auto etag = std::format("\"v{}\"", version_.load());
+      res.set_header("Cache-Control", "no-cache");
+      res.set_header("ETag", etag);
+      if (req.get_header_value("If-None-Match") == etag) {
+        res.status = 304;
+        return;
+      }
+      res.set_content(std::format("version {}", version_.load()),
+                      "text/plain");
+    });
+    server_.Get("/no-store", [this](const httplib::Request &req,
+                                    httplib::Response &res) {
+      num_requests_++;
+      res.set_header("Cache-Control", "no-store");
+      res.set_content("secret", "text/plain");
+    });
+    server_.Get("/vary", [this](const httplib::Request &req,
+                                httplib::Response &res) {
+      num_requests_++;
+      res.set_header("Cache-Control", "max-age=60");
+      res.set_header("Vary", "Accept-Language");
+      res.set_content(req.get_header_value("Accept-Language"), "text/plain");
+    });
+    server_.Get("/auth", [this](const httplib::Request &req,
+                                httplib::Response &res) {
+      num_requests_++;
+      res.set_header("Cache-Control", req.get_header_value("X-Cache-Control"));
+      res.set_content(req.get_header_value("Authorization"), "text/plain");
+    });
+    server_.Get(R"(/large/(\d+))", [this](const httplib::Request &req,
+                                          httplib::Response &res) {
+      num_requests_++;
+      res.set_header("Cache-Control", "max-age=60");
+      res.set_content(std::string(1000, 'a'), "text/plain");
+    });
+    port_ = server_.bind_to_any_port("127.0.0.1");
+    thread_ = std::thread([this]() { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+  }
+
+  void TearDown() override {
+    server_.stop();
+    thread_.join();
+  }
+
+  ailoy::http_request_t request(
+      const std::string &path,
+      ailoy::http_cache_mode_t cache = ailoy::http_cache_mode_t::memory) {
+    return ailoy::http_request_t{
+        .url = std::format("http://127.0.0.1:{}{}", port_, path),
+        .method = "GET",
+        .cache = cache,
+    };
+  }
+
+  // sent past any cache
+  static ailoy::http_response_t send(const ailoy::http_request_t &req) {
+    auto uncached = req;
+    uncached.cache = ailoy::http_cache_mode_t::off;
+    return ailoy::run_http_request(uncached);
+  }
+
+  httplib::Server server_;
+  std::thread thread_;
+  int port_;
+  std::atomic<int> num_requests_ = 0;
+  std::atomic<int> version_ = 1;
+};
+
+TEST_F(HttpCacheTest, MaxAge) {
+  ailoy::http_cache_t cache;
+  for (int i = 0; i < 3; i++) {
+    auto resp = cache.fetch(request("/max-age"), send);
+    ASSERT_EQ(resp.status_code, 200);
+    ASSERT_EQ(resp.body, "fresh");
+  }
+  ASSERT_EQ(num_requests_, 1);
+  auto stats = cache.stats();
+  ASSERT_EQ(stats.hits, 2);
+  ASSERT_EQ(stats.misses, 1);
+  ASSERT_EQ(stats.memory_entries, 1);
+}
+
+TEST_F(HttpCacheTest, ETagRevalidation) {
+  ailoy::http_cache_t cache;
+  ASSERT_EQ(cache.fetch(request("/etag"), send).body, "version 1");
+
+  // answered by 304 Not Modified, with the cached body
+  auto resp = cache.fetch(request("/etag"), send);
+  ASSERT_EQ(resp.status_code, 200);
+  ASSERT_EQ(resp.body, "version 1");
+  ASSERT_EQ(cache.stats().revalidations, 1);
+
+  version_ = 2;
+  ASSERT_EQ(cache.fetch(request("/etag"), send).body, "version 2");
+  ASSERT_EQ(num_requests_, 3);
+  ASSERT_EQ(cache.stats().misses, 2);
+}
+
+TEST_F(HttpCacheTest, NoStore) {
+  ailoy::http_cache_t cache;
+  cache.fetch(request("/no-store"), send);
+  cache.fetch(request("/no-store"), send);
+  ASSERT_EQ(num_requests_, 2);
+  ASSERT_EQ(cache.stats().memory_entries, 0);
+
+  // so does the request
+  auto req = request("/max-age");
+  req.headers["Cache-Control"] = "no-store";
+  cache.fetch(req, send);
+  cache.fetch(req, send);
+  ASSERT_EQ(num_requests_, 4);
+}
+
+TEST_F(HttpCacheTest, Vary) {
+  ailoy::http_cache_t cache;
+  auto en = request("/vary");
+  en.headers["Accept-Language"] = "en";
+  auto ko = request("/vary");
+  ko.headers["Accept-Language"] = "ko";
+
+  ASSERT_EQ(cache.fetch(en, send).body, "en");
+  ASSERT_EQ(cache.fetch(en, send).body, "en");
+  ASSERT_EQ(cache.fetch(ko, send).body, "ko");
+  ASSERT_EQ(num_requests_, 2);
+}
+
+TEST_F(HttpCacheTest, Credentials) {
+  ailoy::http_cache_t cache;
+  auto alice = request("/auth");
+  alice.headers["Authorization"] = "Bearer alice";
+  alice.headers["X-Cache-Control"] = "max-age=60";
+  auto bob = request("/auth");
+  bob.headers["Authorization"] = "Bearer bob";
+  bob.headers["X-Cache-Control"] = "max-age=60";
+
+  // each sees the response to their own token
+  ASSERT_EQ(cache.fetch(alice, send).body, "Bearer alice");
+  ASSERT_EQ(cache.fetch(bob, send).body, "Bearer bob");
+  ASSERT_EQ(cache.fetch(alice, send).body, "Bearer alice");
+  ASSERT_EQ(num_requests_, 3);
+  ASSERT_EQ(cache.stats().memory_entries, 0);
+
+  // unless the server says it is for everyone
+  alice.headers["X-Cache-Control"] = "public, max-age=60";
+  cache.fetch(alice, send);
+  ASSERT_EQ(cache.fetch(alice, send).body, "Bearer alice");
+  ASSERT_EQ(num_requests_, 4);
+
+  // and never if it is private, even without credentials
+  cache.clear();
+  auto anonymous = request("/auth");
+  anonymous.headers["X-Cache-Control"] = "private, max-age=60";
+  cache.fetch(anonymous, send);
+  cache.fetch(anonymous, send);
+  ASSERT_EQ(num_requests_, 6);
+  ASSERT_EQ(cache.stats().memory_entries, 0);
+}
+
+TEST_F(HttpCacheTest, MemoryCapacity) {
+  ailoy::http_cache_t cache({.memory_capacity = 2500});
+  for (int i = 0; i < 4; i++)
+    cache.fetch(request(std::format("/large/{}", i)), send);
+  auto stats = cache.stats();
+  ASSERT_EQ(stats.memory_entries, 2);
+  ASSERT_LE(stats.memory_bytes, 2500);
+
+  // the least recently used ones are evicted
+  cache.fetch(request("/large/3"), send);
+  ASSERT_EQ(num_requests_, 4);
+  cache.fetch(request("/large/0"), send);
+  ASSERT_EQ(num_requests_, 5);
+}
+
+TEST_F(HttpCacheTest, Disk) {
+  auto disk_path = std::filesystem::temp_directory_path() /
+                   std::format("ailoy_http_cache_test_{}", port_);
+  std::filesystem::remove_all(disk_path);
+  {
+    ailoy::http_cache_t cache({.disk_path = disk_path});
+    cache.fetch(request("/max-age", ailoy::http_cache_mode_t::disk), send);
+  }
+  {
+    // a new cache, like that of another process, reads it from disk
+    ailoy::http_cache_t cache({.disk_path = disk_path});
+    auto resp =
+        cache.fetch(request("/max-age", ailoy::http_cache_mode_t::disk), send);
+    ASSERT_EQ(resp.body, "fresh");
+    ASSERT_EQ(num_requests_, 1);
+    ASSERT_EQ(cache.stats().hits, 1);
+    cache.clear();
+  }
+  ASSERT_FALSE(std::filesystem::exists(disk_path));
+}
+
+TEST_F(HttpCacheTest, DiskCapacity) {
+  auto disk_path = std::filesystem::temp_directory_path() /
+                   std::format("ailoy_http_cache_test_{}", port_);
+  std::filesystem::remove_all(disk_path);
+  auto disk_size = [&]() {
+    size_t size = 0;
+    for (const auto &file : std::filesystem::directory_iterator(disk_path))
+      size += file.file_size();
+    return size;
+  };
+
+  // each entry takes a bit more than its 1000 byte body
+  ailoy::http_cache_t cache(
+      {.memory_capacity = 0, .disk_capacity = 5000, .disk_path = disk_path});
+  for (int i = 0; i < 10; i++) {
+    cache.fetch(
+        request(std::format("/large/{}", i), ailoy::http_cache_mode_t::disk),
+        send);
+    ASSERT_LE(disk_size(), 5000);
+  }
+
+  // the most recently written ones are kept
+  cache.fetch(request("/large/9", ailoy::http_cache_mode_t::disk), send);
+  ASSERT_EQ(num_requests_, 10);
+  cache.fetch(request("/large/0", ailoy::http_cache_mode_t::disk), send);
+  ASSERT_EQ(num_requests_, 11);
+  cache.clear();
+}
+
+TEST_F(HttpCacheTest, HttpRequestOp) {
+  auto inputs = ailoy::create<ailoy::map_t>();
+  inputs->insert_or_assign(
+      "url", ailoy::create<ailoy::string_t>(
+                 std::format("http://127.0.0.1:{}/max-age", port_)));
+  inputs->insert_or_assign("method", ailoy::create<ailoy::string_t>("GET"));
+  inputs->insert_or_assign("cache", ailoy::create<ailoy::bool_t>(true));
+
+  auto before = ailoy::http_cache_t::global().stats();
+  for (int i = 0; i < 2; i++) {
+    auto out = ailoy::http_request_op(inputs);
+    ASSERT_EQ(out.index(), 0);
+  }
+  ASSERT_EQ(num_requests_, 1);
+
+  auto stats = ailoy::http_cache_stats_op(nullptr);
+  ASSERT_EQ(stats.index(), 0);
+  auto stats_map = std::get<0>(stats)->as<ailoy::map_t>();
+  ASSERT_EQ(*stats_map->at<ailoy::uint_t>("hits"), before.hits + 1);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <httplib.h>
+
+#include <atomic>
+#include <format>
+#include <thread>
+
+#include "exception.hpp"
+#include "http_client_pool.hpp"
+
+class HttpClientPoolTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    // answers the port of the client, which tells connections apart
+    server_.Get("/port", [](const httplib::Request &req,
+                            httplib::Response &res) {
+      res.set_content(std::to_string(req.remote_port), "text/plain");
+    });
+    port_ = server_.bind_to_any_port("127.0.0.1");
+    thread_ = std::thread([this]() { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+  }
+
+  void TearDown() override {
+    server_.stop();
+    thread_.join();
+  }
+
+  std::string origin() const {
+    return std::format("http://127.0.0.1:{}", port_);
+  }
+
+  static std::string get_port(ailoy::http_client_lease_t &client) {
+    auto res = client->Get("/port");
+    EXPECT_TRUE(res);
+    return res ? res->body : "";
+  }
+
+  httplib::Server server_;
+  std::thread thread_;
+  int port_;
+};
+
+TEST_F(HttpClientPoolTest, ReuseConnection) {
+  ailoy::http_client_pool_t pool;
+  std::string port;
+  {
+    auto client = pool.acquire(origin());
+    port = get_port(client);
+  }
+  {
+    auto client = pool.acquire(origin());
+    ASSERT_EQ(get_port(client), port);
+  }
+  ASSERT_EQ(pool.num_connections(origin()), 1);
+}
+
+TEST_F(HttpClientPoolTest, MaxConnectionsPerOrigin) {
+  ailoy::http_client_pool_t pool({.max_connections_per_origin = 2});
+  auto client1 = pool.acquire(origin());
+  auto client2 = pool.acquire(origin());
+  ASSERT_NE(get_port(client1), get_port(client2));
+
+  std::atomic<bool> acquired = false;
+  std::thread waiter([&]() {
+    auto client3 = pool.acquire(origin());
+    acquired = true;
+    get_port(client3);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  ASSERT_FALSE(acquired);
+
+  // the third one takes over the released connection
+  client1 = {};
+  waiter.join();
+  ASSERT_TRUE(acquired);
+  ASSERT_EQ(pool.num_connections(origin()), 2);
+}
+
+TEST_F(HttpClientPoolTest, IdleTimeout) {
+  ailoy::http_client_pool_t pool(
+      {.idle_timeout = std::chrono::milliseconds(50)});
+  {
+    auto client = pool.acquire(origin());
+    get_port(client);
+  }
+  ASSERT_EQ(pool.num_connections(origin()), 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  ASSERT_EQ(pool.num_connections(origin()), 0);
+}
+
+TEST_F(HttpClientPoolTest, Discard) {
+  ailoy::http_client_pool_t pool;
+  std::string port;
+  {
+    auto client = pool.acquire(origin());
+    port = get_port(client);
+    client.discard();
+  }
+  ASSERT_EQ(pool.num_connections(origin()), 0);
+  auto client = pool.acquire(origin());
+  ASSERT_NE(get_port(client), port);
+}
+
+TEST(HttpClientPoolInvalidTest, InvalidOrigin) {
+  ailoy::http_client_pool_t pool;
+  ASSERT_THROW(pool.acquire("ftp://localhost"), ailoy::runtime_error);
+  ASSERT_EQ(pool.num_connections("ftp://localhost"), 0);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
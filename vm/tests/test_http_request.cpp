@@ -1,6 +1,14 @@
 #include <gtest/gtest.h>
+#include <httplib.h>
 #include <nlohmann/json.hpp>
 
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
 #include "http_request.hpp"
 
 TEST(HttpRequestTest, Get_Frankfurter) {
@@ -19,6 +27,278 @@ TEST(HttpRequestTest, Get_Frankfurter) {
   ASSERT_EQ(j["rates"].contains("KRW"), true);
 }
 
+class HttpRequestManyTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    // answers after the given milliseconds
+    server_.Get(R"(/delay/(\d+))", [](const httplib::Request &req,
+                                       httplib::Response &res) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(std::stoi(req.matches[1])));
+      res.set_content(req.matches[1], "text/plain");
+    });
+    port_ = server_.bind_to_any_port("127.0.0.1");
+    thread_ = std::thread([this]() { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+  }
+
+  void TearDown() override {
+    server_.stop();
+    thread_.join();
+  }
+
+  std::shared_ptr<ailoy::map_t> request(int delay_ms) {
+    auto req = ailoy::create<ailoy::map_t>();
+    auto url = std::format("http://127.0.0.1:{}/delay/{}", port_, delay_ms);
+    req->insert_or_assign("url", ailoy::create<ailoy::string_t>(url));
+    req->insert_or_assign("method", ailoy::create<ailoy::string_t>("GET"));
+    return req;
+  }
+
+  httplib::Server server_;
+  std::thread thread_;
+  int port_;
+};
+
+TEST_F(HttpRequestManyTest, Concurrent) {
+  auto requests = ailoy::create<ailoy::array_t>();
+  for (int delay_ms : {300, 100, 200})
+    requests->push_back(request(delay_ms));
+  auto inputs = ailoy::create<ailoy::map_t>();
+  inputs->insert_or_assign("requests", requests);
+
+  auto op = ailoy::create_http_request_many_operator();
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_FALSE(op->initialize(inputs).has_value());
+
+  // responses come as they complete
+  std::vector<size_t> indices;
+  while (true) {
+    auto out = op->step();
+    ASSERT_EQ(out.index(), 0);
+    auto output = std::get<0>(out);
+    auto out_map = output.val->as<ailoy::map_t>();
+    ASSERT_EQ(*out_map->at<ailoy::uint_t>("status_code"), 200);
+    indices.push_back(*out_map->at<ailoy::uint_t>("index"));
+    if (output.finish)
+      break;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  ASSERT_EQ(indices, (std::vector<size_t>{1, 2, 0}));
+  // close to the slowest request rather than the sum of them
+  ASSERT_LT(elapsed, std::chrono::milliseconds(550));
+}
+
+TEST_F(HttpRequestManyTest, Timeout) {
+  auto slow = request(1000);
+  slow->insert_or_assign("timeout", ailoy::create<ailoy::double_t>(0.1));
+  auto requests = ailoy::create<ailoy::array_t>();
+  requests->push_back(slow);
+  requests->push_back(request(0));
+  auto inputs = ailoy::create<ailoy::map_t>();
+  inputs->insert_or_assign("requests", requests);
+
+  auto op = ailoy::create_http_request_many_operator();
+  ASSERT_FALSE(op->initialize(inputs).has_value());
+  std::map<size_t, unsigned long long> status_codes;
+  for (int i = 0; i < 2; i++) {
+    auto out = op->step();
+    ASSERT_EQ(out.index(), 0);
+    auto out_map = std::get<0>(out).val->as<ailoy::map_t>();
+    status_codes[*out_map->at<ailoy::uint_t>("index")] =
+        *out_map->at<ailoy::uint_t>("status_code");
+    ASSERT_EQ(std::get<0>(out).finish, i == 1);
+  }
+  ASSERT_EQ(status_codes[0], 500);
+  ASSERT_EQ(status_codes[1], 200);
+}
+
+TEST_F(HttpRequestManyTest, InvalidRequest) {
+  auto invalid = request(0);
+  invalid->insert_or_assign("method", ailoy::create<ailoy::string_t>("HEAD"));
+  auto requests = ailoy::create<ailoy::array_t>();
+  requests->push_back(request(0));
+  requests->push_back(invalid);
+  auto inputs = ailoy::create<ailoy::map_t>();
+  inputs->insert_or_assign("requests", requests);
+
+  auto op = ailoy::create_http_request_many_operator();
+  auto error = op->initialize(inputs);
+  ASSERT_TRUE(error.has_value());
+  EXPECT_NE(error->reason.find("requests[1].method"), std::string::npos);
+}
+
+class HttpRequestStreamTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    // answers the given number of bytes
+    server_.Get(R"(/bytes/(\d+))", [](const httplib::Request &req,
+                                       httplib::Response &res) {
+      res.set_content(body(std::stoul(req.matches[1])),
+                      "application/octet-stream");
+    });
+    server_.Get("/missing",
+                [](const httplib::Request &req, httplib::Response &res) {
+                  res.status = httplib::NotFound_404;
+                  res.set_content("not found", "text/plain");
+                });
+    port_ = server_.bind_to_any_port("127.0.0.1");
+    thread_ = std::thread([this]() { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+  }
+
+  void TearDown() override {
+    server_.stop();
+    thread_.join();
+  }
+
+  static std::string body(size_t size) {
+    std::string body(size, '\0');
+    for (size_t i = 0; i < size; i++)
+      body[i] = 'a' + i % 26;
+    return body;
+  }
+
+  std::shared_ptr<ailoy::map_t> request(size_t size) {
+    auto req = ailoy::create<ailoy::map_t>();
+    auto url = std::format("http://127.0.0.1:{}/bytes/{}", port_, size);
+    req->insert_or_assign("url", ailoy::create<ailoy::string_t>(url));
+    req->insert_or_assign("method", ailoy::create<ailoy::string_t>("GET"));
+    return req;
+  }
+
+  httplib::Server server_;
+  std::thread thread_;
+  int port_;
+};
+
+TEST_F(HttpRequestStreamTest, Chunks) {
+  auto inputs = request(10000);
+  inputs->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(4096));
+
+  auto op = ailoy::create_http_request_operator();
+  ASSERT_FALSE(op->initialize(inputs).has_value());
+  std::string received;
+  std::vector<size_t> sizes;
+  while (true) {
+    auto out = op->step();
+    ASSERT_EQ(out.index(), 0);
+    auto output = std::get<0>(out);
+    auto out_map = output.val->as<ailoy::map_t>();
+    // the status and the headers come with the first chunk only
+    ASSERT_EQ(out_map->contains("status_code"), received.empty());
+    if (received.empty())
+      ASSERT_EQ(*out_map->at<ailoy::uint_t>("status_code"), 200);
+    ASSERT_EQ(*out_map->at<ailoy::uint_t>("offset"), received.size());
+    auto chunk = out_map->at<ailoy::bytes_t>("body");
+    received.append(chunk->begin(), chunk->end());
+    sizes.push_back(chunk->size());
+    if (output.finish)
+      break;
+  }
+  ASSERT_EQ(sizes, (std::vector<size_t>{4096, 4096, 1808}));
+  ASSERT_EQ(received, body(10000));
+}
+
+TEST_F(HttpRequestStreamTest, EmptyBody) {
+  auto inputs = request(0);
+  inputs->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(4096));
+
+  auto op = ailoy::create_http_request_operator();
+  ASSERT_FALSE(op->initialize(inputs).has_value());
+  auto out = op->step();
+  ASSERT_EQ(out.index(), 0);
+  ASSERT_TRUE(std::get<0>(out).finish);
+  auto out_map = std::get<0>(out).val->as<ailoy::map_t>();
+  ASSERT_EQ(*out_map->at<ailoy::uint_t>("status_code"), 200);
+  ASSERT_EQ(out_map->at<ailoy::bytes_t>("body")->size(), 0);
+}
+
+TEST_F(HttpRequestStreamTest, Reset) {
+  auto inputs = request(1 << 20);
+  inputs->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(1024));
+
+  // stopped after the first chunk, while the rest are held back
+  auto op = ailoy::create_http_request_operator();
+  ASSERT_FALSE(op->initialize(inputs).has_value());
+  auto out = op->step();
+  ASSERT_EQ(out.index(), 0);
+  ASSERT_FALSE(std::get<0>(out).finish);
+  op->reset_input();
+
+  // and the operator can be used again
+  ASSERT_FALSE(op->initialize(request(3)).has_value());
+  out = op->step();
+  ASSERT_EQ(out.index(), 0);
+  auto out_map = std::get<0>(out).val->as<ailoy::map_t>();
+  ASSERT_EQ(out_map->at<ailoy::bytes_t>("body")->size(), 3);
+}
+
+TEST_F(HttpRequestStreamTest, OutputPath) {
+  auto path = std::filesystem::temp_directory_path() /
+              std::format("ailoy_http_request_test_{}", port_);
+  auto inputs = request(100000);
+  inputs->insert_or_assign("output_path",
+                           ailoy::create<ailoy::string_t>(path.string()));
+
+  auto op = ailoy::create_http_request_operator();
+  ASSERT_FALSE(op->initialize(inputs).has_value());
+  auto out = op->step();
+  ASSERT_EQ(out.index(), 0);
+  auto out_map = std::get<0>(out).val->as<ailoy::map_t>();
+  ASSERT_EQ(*out_map->at<ailoy::uint_t>("status_code"), 200);
+  ASSERT_EQ(*out_map->at<ailoy::uint_t>("size"), 100000);
+  ASSERT_FALSE(out_map->contains("body"));
+
+  std::ifstream ifs(path, std::ios::binary);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  ASSERT_EQ(ss.str(), body(100000));
+  std::filesystem::remove(path);
+}
+
+TEST_F(HttpRequestStreamTest, OutputPathErrorStatus) {
+  auto path = std::filesystem::temp_directory_path() /
+              std::format("ailoy_http_request_test_{}", port_);
+  std::ofstream(path) << "original";
+  auto inputs = request(0);
+  inputs->insert_or_assign(
+      "url", ailoy::create<ailoy::string_t>(
+                 std::format("http://127.0.0.1:{}/missing", port_)));
+  inputs->insert_or_assign("output_path",
+                           ailoy::create<ailoy::string_t>(path.string()));
+
+  // the error page is output, instead of replacing the file
+  auto op = ailoy::create_http_request_operator();
+  ASSERT_FALSE(op->initialize(inputs).has_value());
+  auto out = op->step();
+  ASSERT_EQ(out.index(), 0);
+  auto out_map = std::get<0>(out).val->as<ailoy::map_t>();
+  ASSERT_EQ(*out_map->at<ailoy::uint_t>("status_code"), 404);
+  ASSERT_FALSE(out_map->contains("path"));
+  auto error_body = out_map->at<ailoy::bytes_t>("body");
+  ASSERT_EQ(std::string(error_body->begin(), error_body->end()), "not found");
+
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  ASSERT_EQ(ss.str(), "original");
+  ASSERT_FALSE(std::filesystem::exists(path.string() + ".part"));
+  std::filesystem::remove(path);
+}
+
+TEST_F(HttpRequestStreamTest, Failure) {
+  auto inputs = request(10);
+  inputs->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(4096));
+  server_.stop();
+
+  auto op = ailoy::create_http_request_operator();
+  ASSERT_FALSE(op->initialize(inputs).has_value());
+  auto out = op->step();
+  ASSERT_EQ(out.index(), 1);
+  EXPECT_EQ(std::get<1>(out).reason, "[HTTP] Request Failed");
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -1,7 +1,11 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <httplib.h>
 #include <nlohmann/json.hpp>
 
+#include <thread>
+
+#include "http_client_pool.hpp"
 #include "language.hpp"
 #include "openai.hpp"
 
@@ -29,14 +33,36 @@ protected:
 
   static void TestDownTestSuite() {}
 
+  /**
+   * Run `infer` until it finishes, merging the contents of its deltas
+   */
+  static nlohmann::json infer_all(std::shared_ptr<ailoy::map_t> input) {
+    auto infer = comp_->get_operator("infer");
+    EXPECT_FALSE(infer->initialize(input).has_value());
+    nlohmann::json rv;
+    std::string content;
+    while (true) {
+      auto res = infer->step();
+      EXPECT_EQ(res.index(), 0);
+      if (res.index() != 0)
+        return rv;
+      rv = std::get<0>(res).val->to_nlohmann_json();
+      if (rv["message"]["content"].is_string())
+        content += rv["message"]["content"].get<std::string>();
+      if (std::get<0>(res).finish)
+        break;
+    }
+    if (!rv["message"]["content"].is_null())
+      rv["message"]["content"] = content;
+    return rv;
+  }
+
   static std::shared_ptr<ailoy::component_t> comp_;
 };
 
 std::shared_ptr<ailoy::component_t> OpenAITest::comp_ = nullptr;
 
 TEST_F(OpenAITest, SimpleChat) {
-  auto infer = comp_->get_operator("infer");
-
   auto input = ailoy::create<ailoy::map_t>();
   auto messages = nlohmann::json::array();
   messages.push_back(
@@ -45,35 +71,24 @@ TEST_F(OpenAITest, SimpleChat) {
         "Who is the president of US in 2021? Just answer in two words."}});
   input->insert_or_assign("messages", ailoy::from_nlohmann_json(messages));
 
-  infer->initialize(input);
-  auto res = infer->step();
-  ASSERT_EQ(res.index(), 0);
-  auto out = std::get<0>(res).val;
-  ASSERT_EQ(out->is_type_of<ailoy::map_t>(), true);
-  auto out_map = out->as<ailoy::map_t>();
+  auto out_map = infer_all(input);
 
-  /* Expected out:
+  /* Expected out, with the contents of the deltas merged:
      {
        "finish_reason": "stop",
        "message": {
-         "annotations": [],
          "content": "Joe Biden",
-         "refusal": null,
          "role": "assistant"
        }
      }
   */
-  ASSERT_EQ(*out_map->at<ailoy::string_t>("finish_reason"), "stop");
-  ASSERT_EQ(*out_map->at<ailoy::map_t>("message")->at<ailoy::string_t>("role"),
-            "assistant");
-  EXPECT_THAT(
-      *out_map->at<ailoy::map_t>("message")->at<ailoy::string_t>("content"),
-      ::testing::HasSubstr("Joe Biden"));
+  ASSERT_EQ(out_map["finish_reason"], "stop");
+  ASSERT_EQ(out_map["message"]["role"], "assistant");
+  EXPECT_THAT(out_map["message"]["content"].get<std::string>(),
+              ::testing::HasSubstr("Joe Biden"));
 }
 
 TEST_F(OpenAITest, ToolCall) {
-  auto infer = comp_->get_operator("infer");
-
   auto input = ailoy::create<ailoy::map_t>();
   auto messages = nlohmann::json::array();
   messages.push_back({{"role", "user"},
@@ -103,12 +118,7 @@ TEST_F(OpenAITest, ToolCall) {
   )");
   input->insert_or_assign("tools", ailoy::from_nlohmann_json(tools));
 
-  infer->initialize(input);
-  auto res = infer->step();
-  ASSERT_EQ(res.index(), 0);
-  auto out = std::get<0>(res).val;
-  ASSERT_EQ(out->is_type_of<ailoy::map_t>(), true);
-  auto out_map = out->as<ailoy::map_t>()->to_nlohmann_json();
+  auto out_map = infer_all(input);
 
   /* Expected out:
      {
@@ -149,12 +159,7 @@ TEST_F(OpenAITest, ToolCall) {
   input2->insert_or_assign("messages", ailoy::from_nlohmann_json(messages));
   input2->insert_or_assign("tools", ailoy::from_nlohmann_json(tools));
 
-  infer->initialize(input2);
-  auto res2 = infer->step();
-  ASSERT_EQ(res2.index(), 0);
-  auto out2 = std::get<0>(res2).val;
-  ASSERT_EQ(out2->is_type_of<ailoy::map_t>(), true);
-  auto out2_map = out2->as<ailoy::map_t>()->to_nlohmann_json();
+  auto out2_map = infer_all(input2);
 
   /* Expected out:
     {
@@ -167,7 +172,220 @@ TEST_F(OpenAITest, ToolCall) {
   */
   ASSERT_EQ(out2_map["finish_reason"], "stop");
   ASSERT_EQ(out2_map["message"]["role"], "assistant");
-  EXPECT_THAT(out2_map["message"]["content"], ::testing::HasSubstr("14°C"));
+  EXPECT_THAT(out2_map["message"]["content"].get<std::string>(),
+              ::testing::HasSubstr("14°C"));
+}
+
+/**
+ * Tests of streaming against a local server standing in for the OpenAI API,
+ * which writes the given server-sent events one at a time
+ */
+class OpenAIStreamTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    server_.Post("/v1/chat/completions", [this](const httplib::Request &req,
+                                                httplib::Response &res) {
+      request_body_ = nlohmann::json::parse(req.body);
+      if (status_ != httplib::OK_200) {
+        res.status = status_;
+        res.set_content(R"({"error": {"message": "Invalid API key"}})",
+                        "application/json");
+        return;
+      }
+      res.set_chunked_content_provider(
+          "text/event-stream", [this](size_t, httplib::DataSink &sink) {
+            for (const auto &write : writes_) {
+              if (!sink.is_writable() ||
+                  !sink.write(write.data(), write.size()))
+                return false;
+              std::this_thread::sleep_for(write_interval_);
+            }
+            sink.done();
+            return true;
+          });
+    });
+    port_ = server_.bind_to_any_port("127.0.0.1");
+    thread_ = std::thread([this]() { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+
+    auto attrs = ailoy::create<ailoy::map_t>();
+    attrs->insert_or_assign("api_key", ailoy::create<ailoy::string_t>("key"));
+    attrs->insert_or_assign("base_url",
+                            ailoy::create<ailoy::string_t>(std::format(
+                                "http://127.0.0.1:{}", port_)));
+    comp_ = std::get<0>(
+        ailoy::get_language_module()->factories.at("openai")(attrs));
+  }
+
+  void TearDown() override {
+    comp_.reset();
+    server_.stop();
+    thread_.join();
+  }
+
+  static std::string event(const nlohmann::json &delta,
+                           const nlohmann::json &finish_reason = nullptr) {
+    nlohmann::json chunk = {
+        {"object", "chat.completion.chunk"},
+        {"choices",
+         {{{"index", 0}, {"delta", delta}, {"finish_reason", finish_reason}}}}};
+    return "data: " + chunk.dump() + "\n\n";
+  }
+
+  /**
+   * Run `infer` until it finishes
+   */
+  std::vector<nlohmann::json> infer() {
+    auto infer = comp_->get_operator("infer");
+    auto input = ailoy::create<ailoy::map_t>();
+    input->insert_or_assign(
+        "messages", ailoy::from_nlohmann_json(nlohmann::json::array(
+                        {{{"role", "user"}, {"content", "Hello"}}})));
+    EXPECT_FALSE(infer->initialize(input).has_value());
+    std::vector<nlohmann::json> outputs;
+    while (true) {
+      auto res = infer->step();
+      if (res.index() != 0) {
+        outputs.push_back({{"error", std::get<1>(res).reason}});
+        break;
+      }
+      outputs.push_back(std::get<0>(res).val->to_nlohmann_json());
+      if (std::get<0>(res).finish)
+        break;
+    }
+    return outputs;
+  }
+
+  httplib::Server server_;
+  int port_;
+  std::thread thread_;
+  std::shared_ptr<ailoy::component_t> comp_;
+  int status_ = httplib::OK_200;
+  std::vector<std::string> writes_;
+  std::chrono::milliseconds write_interval_{0};
+  nlohmann::json request_body_;
+};
+
+TEST_F(OpenAIStreamTest, StreamContent) {
+  auto joe = event({{"content", "Joe"}});
+  writes_ = {event({{"role", "assistant"}, {"content", ""}}),
+             // an event split over writes, with CRLF line endings
+             joe.substr(0, 10), joe.substr(10, joe.size() - 12) + "\r\n\r\n",
+             ": comment\n\n", event({{"content", " Biden"}}),
+             event(nlohmann::json::object(), "stop"), "data: [DONE]\n\n"};
+  auto outputs = infer();
+  ASSERT_EQ(request_body_["stream"], true);
+  ASSERT_EQ(request_body_["model"], "gpt-4o");
+
+  ASSERT_EQ(outputs.size(), 3);
+  ASSERT_EQ(outputs[0]["message"]["content"], "Joe");
+  ASSERT_EQ(outputs[0]["message"]["role"], "assistant");
+  ASSERT_TRUE(outputs[0]["finish_reason"].is_null());
+  ASSERT_EQ(outputs[1]["message"]["content"], " Biden");
+  ASSERT_EQ(outputs[2]["message"]["content"], "");
+  ASSERT_EQ(outputs[2]["finish_reason"], "stop");
+}
+
+TEST_F(OpenAIStreamTest, StreamToolCall) {
+  auto tool_call = [](const nlohmann::json &fields,
+                      const std::string &arguments) {
+    nlohmann::json rv = fields;
+    rv["index"] = 0;
+    rv["function"]["arguments"] = arguments;
+    return event({{"tool_calls", {rv}}});
+  };
+  writes_ = {event({{"role", "assistant"}, {"content", nullptr}}),
+             tool_call({{"id", "call_1"},
+                        {"type", "function"},
+                        {"function", {{"name", "get_weather"}}}},
+                       ""),
+             tool_call({}, R"({"locat)"), tool_call({}, R"(ion": "Paris"})"),
+             event(nlohmann::json::object(), "tool_calls"),
+             "data: [DONE]\n\n"};
+  auto outputs = infer();
+
+  // tool calls are returned with the last delta, as a whole
+  ASSERT_EQ(outputs.size(), 1);
+  ASSERT_EQ(outputs[0]["finish_reason"], "tool_calls");
+  ASSERT_TRUE(outputs[0]["message"]["content"].is_null());
+  auto tool_calls = outputs[0]["message"]["tool_calls"];
+  ASSERT_EQ(tool_calls.size(), 1);
+  ASSERT_EQ(tool_calls[0]["id"], "call_1");
+  ASSERT_EQ(tool_calls[0]["function"]["name"], "get_weather");
+  ASSERT_EQ(tool_calls[0]["function"]["arguments"],
+            nlohmann::json({{"location", "Paris"}}));
+}
+
+TEST_F(OpenAIStreamTest, RequestFailed) {
+  status_ = httplib::Unauthorized_401;
+  auto outputs = infer();
+  ASSERT_EQ(outputs.size(), 1);
+  EXPECT_THAT(outputs[0]["error"].get<std::string>(),
+              ::testing::HasSubstr("Invalid API key"));
+}
+
+TEST_F(OpenAIStreamTest, MalformedEvents) {
+  auto chunk = [](const nlohmann::json &choice) {
+    return "data: " +
+           nlohmann::json{{"choices", nlohmann::json::array({choice})}}.dump() +
+           "\n\n";
+  };
+  auto tool_call = [&](const nlohmann::json &call) {
+    return chunk({{"delta", {{"tool_calls", nlohmann::json::array({call})}}}});
+  };
+  // each of them fails the stream instead of terminating the process
+  std::vector<std::string> malformed = {
+      R"(data: {"choices": {"index": 0}})"
+      "\n\n",
+      "data: 42\n\n",
+      tool_call({{"index", "0"}}),
+      tool_call({{"index", 1ull << 40}}),
+      tool_call(1),
+      chunk({{"delta", nlohmann::json::object()}, {"finish_reason", 1}}),
+      chunk(1),
+  };
+  for (const auto &write : malformed) {
+    writes_ = {event({{"content", "a"}}), write};
+    auto outputs = infer();
+    ASSERT_EQ(outputs.size(), 2) << write;
+    ASSERT_EQ(outputs[0]["message"]["content"], "a");
+    ASSERT_TRUE(outputs[1].contains("error")) << write;
+  }
+}
+
+TEST_F(OpenAIStreamTest, ReuseConnection) {
+  // `[DONE]` is sent late, after the finish reason is handed out
+  writes_ = {event({{"content", "a"}}), event(nlohmann::json::object(), "stop"),
+             "data: [DONE]\n\n"};
+  write_interval_ = std::chrono::milliseconds(20);
+  auto base_url = std::format("http://127.0.0.1:{}", port_);
+  for (int i = 0; i < 2; i++) {
+    auto outputs = infer();
+    ASSERT_EQ(outputs.size(), 2);
+    ASSERT_EQ(outputs[1]["finish_reason"], "stop");
+    ASSERT_EQ(ailoy::http_client_pool_t::global().num_connections(base_url),
+              1);
+  }
+}
+
+TEST_F(OpenAIStreamTest, Cancel) {
+  // a stream that would take 50 seconds to finish
+  writes_.assign(1000, event({{"content", "a"}}));
+  write_interval_ = std::chrono::milliseconds(50);
+
+  auto infer = comp_->get_operator("infer");
+  auto input = ailoy::create<ailoy::map_t>();
+  input->insert_or_assign(
+      "messages", ailoy::from_nlohmann_json(nlohmann::json::array(
+                      {{{"role", "user"}, {"content", "Hello"}}})));
+  ASSERT_FALSE(infer->initialize(input).has_value());
+  auto res = infer->step();
+  ASSERT_EQ(res.index(), 0);
+  ASSERT_FALSE(std::get<0>(res).finish);
+
+  auto start = std::chrono::steady_clock::now();
+  infer->reset_input();
+  ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
 }
 
 int main(int argc, char **argv) {
@@ -0,0 +1,314 @@
+#include <cmath>
+#include <format>
+#include <map>
+
+#include <gtest/gtest.h>
+
+#include "language.hpp"
+#include "vector_store.hpp"
+
+constexpr size_t dimension = 8;
+
+/**
+ * Embedding model component embedding texts into their normalized letter
+ * counts, modulo the dimension
+ */
+std::shared_ptr<ailoy::component_t>
+create_letter_embedding_component(std::vector<size_t> &batch_sizes,
+                                  bool fail = false) {
+  auto infer = [&batch_sizes, fail](std::shared_ptr<ailoy::component_t>,
+                                    std::shared_ptr<const ailoy::value_t>
+                                        inputs) -> ailoy::value_or_error_t {
+    if (fail)
+      return ailoy::error_output_t("embedding failed");
+    auto input_map = inputs->as<ailoy::map_t>();
+    bool batched = input_map->contains("prompts");
+    auto prompts = ailoy::create<ailoy::array_t>();
+    if (batched) {
+      for (const auto &prompt : *input_map->at<ailoy::array_t>("prompts"))
+        prompts->push_back(prompt);
+    } else
+      prompts->push_back(
+          std::const_pointer_cast<ailoy::value_t>(input_map->at("prompt")));
+    batch_sizes.push_back(prompts->size());
+    std::vector<float> embeddings;
+    for (const auto &prompt : *prompts) {
+      std::vector<float> embedding(dimension, 0.0f);
+      for (unsigned char c : *prompt->as<ailoy::string_t>())
+        embedding[c % dimension] += 1.0f;
+      float norm = 0.0f;
+      for (float v : embedding)
+        norm += v * v;
+      for (float v : embedding)
+        embeddings.push_back(norm > 0 ? v / std::sqrt(norm) : 0.0f);
+    }
+    std::vector<size_t> shape{prompts->size(), dimension};
+    if (!batched)
+      shape.erase(shape.begin());
+    auto outputs = ailoy::create<ailoy::map_t>();
+    outputs->insert_or_assign(
+        batched ? "embeddings" : "embedding",
+        ailoy::create<ailoy::ndarray_t>(
+            shape, DLDataType{.code = kDLFloat, .bits = 32, .lanes = 1},
+            reinterpret_cast<const uint8_t *>(embeddings.data()),
+            embeddings.size() * sizeof(float)));
+    return outputs;
+  };
+  return ailoy::create<ailoy::component_t>(
+      std::initializer_list<std::pair<
+          const std::string, std::shared_ptr<ailoy::method_operator_t>>>{
+          {"infer", ailoy::create<ailoy::instant_method_operator_t>(infer)},
+      });
+}
+
+/**
+ * Language model component answering with two deltas, and keeping the prompt
+ * of the last inference
+ */
+std::shared_ptr<ailoy::component_t>
+create_echo_language_model_component(std::string &prompt) {
+  auto init = [&prompt](std::shared_ptr<ailoy::component_t>,
+                        std::shared_ptr<const ailoy::value_t> inputs)
+      -> ailoy::value_or_error_t {
+    auto messages = inputs->as<ailoy::map_t>()->at<ailoy::array_t>("messages");
+    prompt = *messages->back()->as<ailoy::map_t>()->at<ailoy::string_t>(
+        "content");
+    return ailoy::create<ailoy::bool_t>(false);
+  };
+  auto step = [](std::shared_ptr<ailoy::component_t>,
+                 std::shared_ptr<ailoy::value_t> state) -> ailoy::output_t {
+    // finishes on the second step
+    auto stepped = state->as<ailoy::bool_t>();
+    bool finish = *stepped;
+    *stepped = true;
+    auto outputs = ailoy::create<ailoy::map_t>();
+    outputs->insert_or_assign(
+        "message", ailoy::from_nlohmann_json(nlohmann::json{
+                       {"role", "assistant"},
+                       {"content", finish ? "answer" : "the "}}));
+    if (finish)
+      outputs->insert_or_assign("finish_reason",
+                                ailoy::create<ailoy::string_t>("stop"));
+    else
+      outputs->insert_or_assign("finish_reason",
+                                ailoy::create<ailoy::null_t>());
+    return ailoy::ok_output_t(outputs, finish);
+  };
+  return ailoy::create<ailoy::component_t>(
+      std::initializer_list<std::pair<
+          const std::string, std::shared_ptr<ailoy::method_operator_t>>>{
+          {"infer",
+           ailoy::create<ailoy::iterative_method_operator_t>(init, step)},
+      });
+}
+
+std::shared_ptr<ailoy::component_t> create_simd_vector_store_component() {
+  auto attrs = ailoy::create<ailoy::map_t>();
+  attrs->insert_or_assign("dimension", ailoy::create<ailoy::uint_t>(dimension));
+  return std::get<0>(ailoy::get_language_module()->factories.at(
+      "simd_vector_store")(attrs));
+}
+
+std::shared_ptr<ailoy::operator_t> get_ingest_documents_operator(
+    std::map<std::string, std::shared_ptr<ailoy::component_t>> components) {
+  auto op = ailoy::get_language_module()->ops.at("ingest_documents");
+  op->set_component_lookup([components](const std::string &name) {
+    return components.contains(name) ? components.at(name) : nullptr;
+  });
+  return op;
+}
+
+std::shared_ptr<ailoy::operator_t> get_rag_query_operator(
+    std::map<std::string, std::shared_ptr<ailoy::component_t>> components) {
+  auto op = ailoy::get_language_module()->ops.at("rag_query");
+  op->set_component_lookup([components](const std::string &name) {
+    return components.contains(name) ? components.at(name) : nullptr;
+  });
+  return op;
+}
+
+std::shared_ptr<ailoy::map_t>
+get_ingest_inputs(const std::vector<std::string> &texts) {
+  auto inputs = ailoy::create<ailoy::map_t>();
+  inputs->insert_or_assign("embedding_model",
+                           ailoy::create<ailoy::string_t>("embedding"));
+  inputs->insert_or_assign("vector_store",
+                           ailoy::create<ailoy::string_t>("vector_store"));
+  auto texts_val = ailoy::create<ailoy::array_t>();
+  auto metadatas = ailoy::create<ailoy::array_t>();
+  for (size_t i = 0; i < texts.size(); i++) {
+    texts_val->push_back(ailoy::create<ailoy::string_t>(texts[i]));
+    metadatas->push_back(
+        ailoy::from_nlohmann_json(nlohmann::json{{"source", i}}));
+  }
+  inputs->insert_or_assign("texts", texts_val);
+  inputs->insert_or_assign("metadatas", metadatas);
+  inputs->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(40));
+  inputs->insert_or_assign("chunk_overlap", ailoy::create<ailoy::uint_t>(0));
+  inputs->insert_or_assign("batch_size", ailoy::create<ailoy::uint_t>(4));
+  return inputs;
+}
+
+TEST(RAGTest, IngestDocuments) {
+  std::vector<size_t> batch_sizes;
+  auto vector_store = create_simd_vector_store_component();
+  auto op = get_ingest_documents_operator(
+      {{"embedding", create_letter_embedding_component(batch_sizes)},
+       {"vector_store", vector_store}});
+
+  std::vector<std::string> texts;
+  for (int i = 0; i < 10; i++) {
+    std::string text;
+    for (int j = 0; j < 20; j++)
+      text += std::format("word{}{} ", i, j);
+    texts.push_back(text);
+  }
+  ASSERT_FALSE(op->initialize(get_ingest_inputs(texts)).has_value());
+
+  size_t num_steps = 0, last_num_embedded = 0;
+  std::shared_ptr<ailoy::map_t> outputs;
+  while (true) {
+    auto output = op->step();
+    ASSERT_EQ(output.index(), 0);
+    outputs = std::get<0>(output).val->as<ailoy::map_t>();
+    num_steps++;
+    if (std::get<0>(output).finish)
+      break;
+    // progress is reported after each embedded batch
+    size_t num_embedded = *outputs->at<ailoy::uint_t>("num_embedded_chunks");
+    ASSERT_GT(num_embedded, last_num_embedded);
+    last_num_embedded = num_embedded;
+  }
+
+  size_t num_chunks = *outputs->at<ailoy::uint_t>("num_chunks");
+  ASSERT_EQ(*outputs->at<ailoy::uint_t>("num_texts"), texts.size());
+  ASSERT_EQ(*outputs->at<ailoy::uint_t>("num_split_texts"), texts.size());
+  ASSERT_GT(num_chunks, texts.size());
+  ASSERT_EQ(*outputs->at<ailoy::uint_t>("num_embedded_chunks"), num_chunks);
+  ASSERT_EQ(*outputs->at<ailoy::uint_t>("num_inserted_chunks"), num_chunks);
+  ASSERT_EQ(outputs->at<ailoy::array_t>("ids")->size(), num_chunks);
+  ASSERT_EQ(num_steps, batch_sizes.size() + 1);
+  for (size_t i = 0; i + 1 < batch_sizes.size(); i++)
+    ASSERT_EQ(batch_sizes[i], 4);
+
+  // every chunk is stored with the metadata of its text
+  auto store = vector_store->get_obj<ailoy::vector_store_t>("vector_store");
+  for (const auto &id_val : *outputs->at<ailoy::array_t>("ids")) {
+    auto item = store->get_by_id(*id_val->as<ailoy::string_t>()).value();
+    size_t source = item.metadata.value()["source"];
+    ASSERT_NE(texts[source].find(item.document), std::string::npos);
+  }
+}
+
+TEST(RAGTest, IngestDocumentsErrors) {
+  std::vector<size_t> batch_sizes;
+  auto vector_store = create_simd_vector_store_component();
+
+  // unknown components
+  auto op = get_ingest_documents_operator({{"vector_store", vector_store}});
+  ASSERT_TRUE(op->initialize(get_ingest_inputs({"text"})).has_value());
+
+  // a failing stage stops the pipeline
+  op = get_ingest_documents_operator(
+      {{"embedding", create_letter_embedding_component(batch_sizes, true)},
+       {"vector_store", vector_store}});
+  std::vector<std::string> texts(100, std::string(400, 'a'));
+  ASSERT_FALSE(op->initialize(get_ingest_inputs(texts)).has_value());
+  ASSERT_EQ(op->step().index(), 1);
+  std::vector<float> query(dimension, 1.0f);
+  auto results =
+      vector_store->get_obj<ailoy::vector_store_t>("vector_store")
+          ->retrieve(ailoy::create<ailoy::ndarray_t>(
+                         std::vector<size_t>{dimension},
+                         DLDataType{.code = kDLFloat, .bits = 32, .lanes = 1},
+                         reinterpret_cast<const uint8_t *>(query.data()),
+                         dimension * sizeof(float)),
+                     10);
+  ASSERT_TRUE(results.empty());
+}
+
+TEST(RAGTest, RAGQuery) {
+  std::vector<size_t> batch_sizes;
+  std::string prompt;
+  auto embedding = create_letter_embedding_component(batch_sizes);
+  auto vector_store = create_simd_vector_store_component();
+  auto ingest = get_ingest_documents_operator(
+      {{"embedding", embedding}, {"vector_store", vector_store}});
+  // "aberz" is the closest to the query by letters, while only the second
+  // text contains the query term
+  ASSERT_FALSE(ingest
+                   ->initialize(get_ingest_inputs(
+                       {"aberz", "zebra stripes", "qqqq", "mmmm"}))
+                   .has_value());
+  while (!std::get<0>(ingest->step()).finish)
+    ;
+
+  auto op = get_rag_query_operator(
+      {{"embedding", embedding},
+       {"vector_store", vector_store},
+       {"llm", create_echo_language_model_component(prompt)}});
+  auto get_inputs = [](bool rerank) {
+    auto inputs = ailoy::create<ailoy::map_t>();
+    inputs->insert_or_assign("embedding_model",
+                             ailoy::create<ailoy::string_t>("embedding"));
+    inputs->insert_or_assign("vector_store",
+                             ailoy::create<ailoy::string_t>("vector_store"));
+    inputs->insert_or_assign("language_model",
+                             ailoy::create<ailoy::string_t>("llm"));
+    inputs->insert_or_assign("query", ailoy::create<ailoy::string_t>("zebra"));
+    inputs->insert_or_assign("top_k", ailoy::create<ailoy::uint_t>(1));
+    inputs->insert_or_assign("rerank", ailoy::create<ailoy::bool_t>(rerank));
+    inputs->insert_or_assign(
+        "context_template",
+        ailoy::create<ailoy::string_t>("[{context}] {query}?"));
+    return inputs;
+  };
+
+  for (bool rerank : {false, true}) {
+    ASSERT_FALSE(op->initialize(get_inputs(rerank)).has_value());
+    auto output = op->step();
+    ASSERT_EQ(output.index(), 0);
+    ASSERT_FALSE(std::get<0>(output).finish);
+    auto outputs = std::get<0>(output).val->as<ailoy::map_t>();
+    ASSERT_EQ(*outputs->at<ailoy::map_t>("message")->at<ailoy::string_t>(
+                  "content"),
+              "the ");
+
+    output = op->step();
+    ASSERT_EQ(output.index(), 0);
+    ASSERT_TRUE(std::get<0>(output).finish);
+    outputs = std::get<0>(output).val->as<ailoy::map_t>();
+    ASSERT_EQ(*outputs->at<ailoy::string_t>("finish_reason"), "stop");
+    auto results = outputs->at<ailoy::array_t>("results");
+    ASSERT_EQ(results->size(), 1);
+    std::string document = rerank ? "zebra stripes" : "aberz";
+    ASSERT_EQ(*results->at<ailoy::map_t>(0)->at<ailoy::string_t>("document"),
+              document);
+    ASSERT_EQ(prompt, "[" + document + "] zebra?");
+
+    auto timings = outputs->at<ailoy::map_t>("timings");
+    for (auto stage : {"embed", "retrieve", "time_to_first_token", "generate",
+                       "total"})
+      ASSERT_GE(*timings->at<ailoy::double_t>(stage), 0.0);
+    ASSERT_EQ(timings->contains("rerank"), rerank);
+  }
+
+  // unknown language model
+  auto inputs = get_inputs(false);
+  inputs->insert_or_assign("language_model",
+                           ailoy::create<ailoy::string_t>("unknown"));
+  ASSERT_TRUE(op->initialize(inputs).has_value());
+
+  // counts below 1
+  inputs = get_inputs(true);
+  inputs->insert_or_assign("num_candidates", ailoy::create<ailoy::int_t>(-1));
+  ASSERT_TRUE(op->initialize(inputs).has_value());
+  inputs = get_inputs(true);
+  inputs->insert_or_assign("top_k", ailoy::create<ailoy::uint_t>(0));
+  ASSERT_TRUE(op->initialize(inputs).has_value());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
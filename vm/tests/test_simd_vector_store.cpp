@@ -0,0 +1,228 @@
+#include <map>
+
+#include <gtest/gtest.h>
+
+#include "bm25_index.hpp"
+#include "simd_util.hpp"
+#include "simd_vector_store.hpp"
+#include "vector_store_test_suite.hpp"
+
+template <> struct vector_store_test_traits_t<ailoy::simd_vector_store_t> {
+  static constexpr const char *component = "simd_vector_store";
+};
+
+INSTANTIATE_TYPED_TEST_SUITE_P(SIMD, VectorStoreSuite,
+                               ailoy::simd_vector_store_t);
+
+TEST(VectorStoreTest, SIMD_Kernels) {
+  // every kernel reads a multiple of 16 elements
+  size_t n = 48;
+  std::vector<float> query(n), vec(n);
+  std::vector<uint16_t> halves(n);
+  std::vector<int8_t> codes(n);
+  float expected_f32 = 0.0f, expected_i8 = 0.0f;
+  for (size_t i = 0; i < n; i++) {
+    query[i] = std::sin(i * 0.1f);
+    vec[i] = std::cos(i * 0.3f);
+    halves[i] = ailoy::float_to_half(vec[i]);
+    codes[i] = static_cast<int8_t>(i) - 24;
+    expected_f32 += query[i] * vec[i];
+    expected_i8 += query[i] * codes[i];
+  }
+
+  const auto &kernels = ailoy::get_simd_kernels();
+  ASSERT_NEAR(kernels.dot_f32(query.data(), vec.data(), n), expected_f32,
+              1e-4);
+  ASSERT_NEAR(kernels.dot_f16(query.data(), halves.data(), n), expected_f32,
+              1e-2);
+  ASSERT_NEAR(kernels.dot_i8(query.data(), codes.data(), n), expected_i8,
+              1e-3);
+
+  for (float value : {0.0f, 1.0f, -2.5f, 65504.0f, 0.333251953125f})
+    ASSERT_EQ(ailoy::half_to_float(ailoy::float_to_half(value)), value);
+  ASSERT_TRUE(std::isinf(ailoy::half_to_float(ailoy::float_to_half(1e9f))));
+}
+
+TEST(VectorStoreTest, SIMD_Storage) {
+  size_t dimension = 40;
+  auto add_inputs = get_random_inputs(dimension, 100);
+  for (std::string storage : {"float32", "float16", "int8"}) {
+    ailoy::simd_vector_store_t vs(ailoy::simd_vector_store_config_t{
+        .dimension = dimension, .storage = storage});
+    auto vec_ids = vs.add_vectors(add_inputs);
+
+    for (size_t i : {0, 42, 99}) {
+      auto results = vs.retrieve(add_inputs[i].embedding, 1);
+      ASSERT_EQ(results[0].id, vec_ids[i]) << storage;
+      ASSERT_NEAR(results[0].similarity, 1.0f, 1e-2) << storage;
+
+      // decoded embeddings are close to the original
+      auto embedding = vs.get_by_id(vec_ids[i])->embedding;
+      auto original = add_inputs[i].embedding->operator std::vector<float>();
+      auto decoded = embedding->operator std::vector<float>();
+      for (size_t d = 0; d < dimension; d++)
+        ASSERT_NEAR(decoded[d], original[d], 1e-2) << storage;
+    }
+  }
+
+  ASSERT_THROW(ailoy::simd_vector_store_t(ailoy::simd_vector_store_config_t{
+                   .dimension = dimension, .storage = "int4"}),
+               ailoy::runtime_error);
+}
+
+TEST(VectorStoreTest, SIMD_Cosine) {
+  size_t dimension = 16;
+  ailoy::simd_vector_store_t vs(ailoy::simd_vector_store_config_t{
+      .dimension = dimension, .metric = "cosine"});
+
+  // scaled vectors are still identical in cosine similarity
+  auto embedding = get_random_normalized_vector(dimension);
+  auto scaled = ailoy::create<ailoy::ndarray_t>(*embedding);
+  for (size_t i = 0; i < dimension; i++)
+    reinterpret_cast<float *>(scaled->data.data())[i] *= 3.0f;
+  auto id = vs.add_vector({.embedding = scaled, .document = "scaled"});
+  auto other_inputs = get_random_inputs(dimension, 20);
+  vs.add_vectors(other_inputs);
+
+  auto results = vs.retrieve(embedding, 1);
+  ASSERT_EQ(results[0].id, id);
+  ASSERT_NEAR(results[0].similarity, 1.0f, 1e-5);
+
+  ASSERT_THROW(ailoy::simd_vector_store_t(ailoy::simd_vector_store_config_t{
+                   .dimension = dimension, .metric = "l2"}),
+               ailoy::runtime_error);
+}
+
+TEST(VectorStoreTest, BM25_Search) {
+  // words of skewed frequencies, so that MaxScore skips some of them
+  std::vector<std::string> vocabulary;
+  for (int i = 0; i < 50; i++)
+    vocabulary.push_back("word" + std::to_string(i));
+  std::mt19937 gen(42);
+  std::vector<double> weights;
+  for (size_t i = 0; i < vocabulary.size(); i++)
+    weights.push_back(1.0 / (i + 1));
+  std::discrete_distribution<size_t> dist(weights.begin(), weights.end());
+  std::uniform_int_distribution<size_t> length_dist(1, 30);
+
+  ailoy::bm25_index_t index;
+  std::map<int64_t, ailoy::bm25_index_t::document_t> documents;
+  for (int64_t id = 0; id < 1000; id++) {
+    std::string text;
+    for (size_t i = length_dist(gen); i > 0; i--)
+      text += vocabulary[dist(gen)] + " ";
+    documents[id] = ailoy::bm25_index_t::analyze(text);
+    index.insert(id, documents[id]);
+  }
+  // erased and re-inserted ids go into the middle of postings
+  for (int64_t id = 0; id < 1000; id += 7) {
+    index.erase(id, documents[id]);
+    if (id % 2 == 0)
+      documents.erase(id);
+    else
+      index.insert(id, documents[id]);
+  }
+  ASSERT_EQ(index.size(), documents.size());
+
+  // exhaustive BM25 scores
+  auto exhaustive = [&](const std::string &query,
+                        const std::vector<int64_t> *selected) {
+    double total_length = 0;
+    for (const auto &[_, document] : documents)
+      total_length += document.length;
+    double avg_length = total_length / documents.size();
+    auto terms = ailoy::bm25_index_t::analyze(query).terms;
+    std::map<std::string, size_t> dfs;
+    for (const auto &[term, _] : terms) {
+      for (const auto &[_, document] : documents)
+        dfs[term] += document.terms.contains(term);
+    }
+    std::vector<std::pair<float, int64_t>> scores;
+    for (const auto &[id, document] : documents) {
+      if (selected &&
+          !std::binary_search(selected->begin(), selected->end(), id))
+        continue;
+      double score = 0;
+      for (const auto &[term, df] : dfs) {
+        auto tf = document.terms.find(term);
+        if (tf == document.terms.end())
+          continue;
+        double idf =
+            std::log(1.0 + (documents.size() - df + 0.5) / (df + 0.5));
+        score += idf * tf->second * 2.2 /
+                 (tf->second + 1.2 * (0.25 + 0.75 * document.length /
+                                                 avg_length));
+      }
+      if (score > 0)
+        scores.emplace_back(score, id);
+    }
+    std::sort(scores.begin(), scores.end(), std::greater<>());
+    return scores;
+  };
+
+  std::vector<int64_t> selected;
+  for (const auto &[id, _] : documents) {
+    if (id % 3 == 0)
+      selected.push_back(id);
+  }
+  for (std::string query :
+       {"word0", "word1 word49", "word0 word1 word2 word3 word20 word40",
+        "Word5, WORD30!", "missing word7"}) {
+    for (auto filter : {(const std::vector<int64_t> *)nullptr,
+                        (const std::vector<int64_t> *)&selected}) {
+      size_t top_k = 10;
+      auto expected = exhaustive(query, filter);
+      auto results = index.search(query, top_k, filter);
+      ASSERT_EQ(results.size(), std::min(top_k, expected.size()));
+      for (size_t i = 0; i < results.size(); i++)
+        ASSERT_NEAR(results[i].second, expected[i].first, 1e-4);
+    }
+  }
+  ASSERT_TRUE(index.search("unknown", 10).empty());
+}
+
+TEST(VectorStoreTest, SIMDComponent_Attrs) {
+  size_t dimension = 10;
+  auto create_vectorstore =
+      ailoy::get_language_module()->factories.at("simd_vector_store");
+  auto attrs = ailoy::create<ailoy::map_t>();
+  attrs->insert_or_assign("dimension", ailoy::create<ailoy::uint_t>(dimension));
+  attrs->insert_or_assign("storage", ailoy::create<ailoy::string_t>("float16"));
+  auto vectorstore_opt = create_vectorstore(attrs);
+  ASSERT_EQ(vectorstore_opt.index(), 0);
+  auto vectorstore = std::get<0>(vectorstore_opt);
+  auto insert_op = vectorstore->get_operator("insert");
+  auto retrieve_op = vectorstore->get_operator("retrieve");
+
+  // operators work on a store created with non-default attrs
+  auto embedding = get_random_normalized_vector(dimension);
+  auto in1 = ailoy::create<ailoy::map_t>();
+  in1->insert_or_assign("embedding", embedding);
+  in1->insert_or_assign("document", ailoy::create<ailoy::string_t>("document"));
+  insert_op->initialize(in1);
+  auto out1_opt = insert_op->step();
+  ASSERT_EQ(out1_opt.index(), 0);
+  auto vec_id =
+      *std::get<0>(out1_opt).val->as<ailoy::map_t>()->at<ailoy::string_t>(
+          "id");
+
+  auto in2 = ailoy::create<ailoy::map_t>();
+  in2->insert_or_assign("query_embedding", embedding);
+  in2->insert_or_assign("top_k", ailoy::create<ailoy::uint_t>(1));
+  retrieve_op->initialize(in2);
+  auto out2_opt = retrieve_op->step();
+  ASSERT_EQ(out2_opt.index(), 0);
+  auto out2 = std::get<0>(out2_opt).val->as<ailoy::map_t>()->at<ailoy::array_t>(
+      "results");
+  ASSERT_EQ(out2->size(), 1);
+  ASSERT_EQ(*out2->at<ailoy::map_t>(0)->at<ailoy::string_t>("id"), vec_id);
+
+  // invalid attrs
+  attrs->insert_or_assign("metric", ailoy::create<ailoy::string_t>("l2"));
+  ASSERT_EQ(create_vectorstore(attrs).index(), 1);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
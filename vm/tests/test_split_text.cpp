@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 #include <httplib.h>
 
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 
 #include "language.hpp"
@@ -82,6 +84,200 @@ TEST(TextSplitterTest, TestSplitBySeparatorRecursively) {
   }
 }
 
+TEST(TextSplitterTest, TestChunksWithOverlap) {
+  auto language_module = ailoy::get_language_module();
+  auto get_chunks = [&](const std::string &op_name,
+                        std::shared_ptr<ailoy::map_t> in) {
+    auto op = language_module->ops.at(op_name);
+    EXPECT_FALSE(op->initialize(in).has_value());
+    // the output owns the chunks, so it is kept while they are read
+    auto output = std::get<0>(op->step());
+    std::vector<std::string> chunks;
+    for (auto c : *output.val->as<ailoy::map_t>()->at<ailoy::array_t>("chunks"))
+      chunks.push_back(*c->as<ailoy::string_t>());
+    return chunks;
+  };
+
+  auto in = ailoy::create<ailoy::map_t>();
+  in->insert_or_assign("text", ailoy::create<ailoy::string_t>(
+                                   "one two three\n\nfour five six seven "
+                                   "eight\n\n\n  nine"));
+  in->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(12));
+  in->insert_or_assign("chunk_overlap", ailoy::create<ailoy::uint_t>(4));
+  ASSERT_EQ(get_chunks("split_text", in),
+            std::vector<std::string>({"one two", "two three", "four five",
+                                      "five six", "six seven", "eight",
+                                      "nine"}));
+
+  in->insert_or_assign("text", ailoy::create<ailoy::string_t>("a b c d e f g"));
+  in->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(5));
+  in->insert_or_assign("chunk_overlap", ailoy::create<ailoy::uint_t>(2));
+  in->insert_or_assign("separator", ailoy::create<ailoy::string_t>(" "));
+  ASSERT_EQ(get_chunks("split_text_by_separator", in),
+            std::vector<std::string>({"a b c", "c d e", "e f g"}));
+}
+
+TEST(TextSplitterTest, TestSplitFile) {
+  // paragraphs of distinct words, so that a chunk is found once in the file
+  std::string text;
+  for (int i = 0; i < 200; i++) {
+    for (int j = 0; j < 10; j++)
+      text += std::format("w{}-{}{}", i, j, j < 9 ? " " : "\n");
+    text += "\n";
+  }
+  auto path =
+      std::filesystem::temp_directory_path() / "ailoy_test_split_file.txt";
+  std::ofstream(path, std::ios::binary) << text;
+
+  auto language_module = ailoy::get_language_module();
+  struct step_t {
+    std::vector<std::string> chunks;
+    std::vector<size_t> offsets;
+    size_t offset;
+  };
+  auto split_file = [&](size_t window_size, size_t offset) {
+    auto op = language_module->ops.at("split_file");
+    auto in = ailoy::create<ailoy::map_t>();
+    in->insert_or_assign("path", ailoy::create<ailoy::string_t>(path.string()));
+    in->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(100));
+    in->insert_or_assign("chunk_overlap", ailoy::create<ailoy::uint_t>(30));
+    in->insert_or_assign("window_size",
+                         ailoy::create<ailoy::uint_t>(window_size));
+    in->insert_or_assign("offset", ailoy::create<ailoy::uint_t>(offset));
+    EXPECT_FALSE(op->initialize(in).has_value());
+    std::vector<step_t> steps;
+    while (true) {
+      auto output = std::get<0>(op->step());
+      auto out = output.val->as<ailoy::map_t>();
+      step_t step;
+      for (auto c : *out->at<ailoy::array_t>("chunks"))
+        step.chunks.push_back(*c->as<ailoy::string_t>());
+      for (auto o : *out->at<ailoy::array_t>("offsets"))
+        step.offsets.push_back(*o->as<ailoy::uint_t>());
+      step.offset = *out->at<ailoy::uint_t>("offset");
+      steps.push_back(step);
+      if (output.finish)
+        break;
+    }
+    return steps;
+  };
+
+  // a window covering the file splits it the same as split_text
+  auto split_text = language_module->ops.at("split_text");
+  auto in = ailoy::create<ailoy::map_t>();
+  in->insert_or_assign("text", ailoy::create<ailoy::string_t>(text));
+  in->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(100));
+  in->insert_or_assign("chunk_overlap", ailoy::create<ailoy::uint_t>(30));
+  ASSERT_FALSE(split_text->initialize(in).has_value());
+  auto output = std::get<0>(split_text->step());
+  std::vector<std::string> chunks;
+  for (auto c : *output.val->as<ailoy::map_t>()->at<ailoy::array_t>("chunks"))
+    chunks.push_back(*c->as<ailoy::string_t>());
+  auto steps = split_file(1 << 20, 0);
+  ASSERT_EQ(steps.size(), 1);
+  ASSERT_EQ(steps[0].chunks, chunks);
+  ASSERT_EQ(steps[0].offset, text.size());
+
+  // chunks of small windows are located at their offsets in the file
+  steps = split_file(1000, 0);
+  ASSERT_GT(steps.size(), 3);
+  for (const auto &step : steps) {
+    ASSERT_EQ(step.chunks.size(), step.offsets.size());
+    for (size_t i = 0; i < step.chunks.size(); i++) {
+      ASSERT_GE(100, step.chunks[i].size());
+      ASSERT_EQ(text.substr(step.offsets[i], step.chunks[i].size()),
+                step.chunks[i]);
+    }
+  }
+  ASSERT_EQ(steps.back().offset, text.size());
+
+  // splitting resumed from the offset of a step yields the steps after it
+  auto resumed = split_file(1000, steps[1].offset);
+  ASSERT_EQ(resumed.size(), steps.size() - 2);
+  for (size_t i = 0; i < resumed.size(); i++)
+    ASSERT_EQ(resumed[i].chunks, steps[i + 2].chunks);
+
+  // offsets beyond the file are rejected
+  auto op = language_module->ops.at("split_file");
+  in = ailoy::create<ailoy::map_t>();
+  in->insert_or_assign("path", ailoy::create<ailoy::string_t>(path.string()));
+  in->insert_or_assign("offset", ailoy::create<ailoy::uint_t>(text.size() + 1));
+  ASSERT_TRUE(op->initialize(in).has_value());
+
+  std::filesystem::remove(path);
+}
+
+TEST(TextSplitterTest, TestSplitTexts) {
+  auto language_module = ailoy::get_language_module();
+  std::vector<std::string> texts;
+  std::string slab;
+  auto offsets = ailoy::create<ailoy::array_t>();
+  for (int i = 0; i < 50; i++) {
+    std::string text;
+    for (int j = 0; j < i * 7 % 40; j++)
+      text += std::format("t{}-w{}{}", i, j, j % 9 == 8 ? "\n\n" : " ");
+    offsets->push_back(ailoy::create<ailoy::uint_t>(slab.size()));
+    slab += text;
+    texts.push_back(text);
+  }
+  auto create_input = [&]() {
+    auto in = ailoy::create<ailoy::map_t>();
+    in->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(60));
+    in->insert_or_assign("chunk_overlap", ailoy::create<ailoy::uint_t>(20));
+    return in;
+  };
+  auto get_chunks = [](std::shared_ptr<ailoy::operator_t> op,
+                       std::shared_ptr<ailoy::map_t> in) {
+    EXPECT_FALSE(op->initialize(in).has_value());
+    auto output = std::get<0>(op->step());
+    return output.val->as<ailoy::map_t>();
+  };
+
+  // chunks of each text in order, as split_text splits them
+  std::vector<std::string> expected_chunks;
+  std::vector<uint64_t> expected_sources;
+  for (size_t i = 0; i < texts.size(); i++) {
+    auto in = create_input();
+    in->insert_or_assign("text", ailoy::create<ailoy::string_t>(texts[i]));
+    auto out = get_chunks(language_module->ops.at("split_text"), in);
+    for (auto c : *out->at<ailoy::array_t>("chunks")) {
+      expected_chunks.push_back(*c->as<ailoy::string_t>());
+      expected_sources.push_back(i);
+    }
+  }
+
+  auto texts_in = create_input();
+  texts_in->insert_or_assign("texts", ailoy::create<ailoy::array_t>());
+  for (const auto &text : texts)
+    texts_in->at<ailoy::array_t>("texts")->push_back(
+        ailoy::create<ailoy::string_t>(text));
+  auto slab_in = create_input();
+  slab_in->insert_or_assign("text", ailoy::create<ailoy::string_t>(slab));
+  slab_in->insert_or_assign("offsets", offsets);
+  auto single_thread_in = create_input();
+  single_thread_in->insert_or_assign("texts", texts_in->at("texts"));
+  single_thread_in->insert_or_assign("num_threads",
+                                     ailoy::create<ailoy::uint_t>(1));
+
+  for (auto in : {texts_in, slab_in, single_thread_in}) {
+    auto out = get_chunks(language_module->ops.at("split_texts"), in);
+    auto chunks = out->at<ailoy::array_t>("chunks");
+    auto sources = out->at<ailoy::array_t>("sources");
+    auto chunk_offsets = out->at<ailoy::array_t>("offsets");
+    ASSERT_EQ(chunks->size(), expected_chunks.size());
+    ASSERT_EQ(sources->size(), expected_chunks.size());
+    ASSERT_EQ(chunk_offsets->size(), expected_chunks.size());
+    for (size_t i = 0; i < expected_chunks.size(); i++) {
+      const std::string &chunk = *chunks->at(i)->as<ailoy::string_t>();
+      uint64_t source = *sources->at(i)->as<ailoy::uint_t>();
+      uint64_t offset = *chunk_offsets->at(i)->as<ailoy::uint_t>();
+      ASSERT_EQ(chunk, expected_chunks[i]);
+      ASSERT_EQ(source, expected_sources[i]);
+      ASSERT_EQ(texts[source].substr(offset, chunk.size()), chunk);
+    }
+  }
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -24,13 +24,75 @@ TEST(EmbeddingModelTest, TestTokenize) {
     in->insert_or_assign("prompt",
                          ailoy::create<ailoy::string_t>("What is BGE M3?"));
     tokenize_op->initialize(in);
-    auto tokens = std::get<0>(tokenize_op->step())
-                      .val->as<ailoy::map_t>()
-                      ->at<ailoy::array_t>("tokens");
-    ASSERT_EQ(tokens->size(), 9);
-    ASSERT_EQ(*tokens->at<ailoy::int_t>(0), 0); // cls token
-    ASSERT_EQ(*tokens->at<ailoy::int_t>(8), 2); // eos token
+    auto tokens_arr = std::get<0>(tokenize_op->step())
+                          .val->as<ailoy::map_t>()
+                          ->at<ailoy::ndarray_t>("tokens");
+    std::vector<int32_t> tokens = *tokens_arr;
+    ASSERT_EQ(tokens_arr->dtype.code, kDLInt);
+    ASSERT_EQ(tokens_arr->dtype.bits, 32);
+    ASSERT_EQ(tokens.size(), 9);
+    ASSERT_EQ(tokens[0], 0); // cls token
+    ASSERT_EQ(tokens[8], 2); // eos token
   }
+  {
+    auto in = ailoy::create<ailoy::map_t>();
+    auto prompts = ailoy::create<ailoy::array_t>();
+    prompts->push_back(ailoy::create<ailoy::string_t>("What is BGE M3?"));
+    prompts->push_back(ailoy::create<ailoy::string_t>("Defination of BM25"));
+    in->insert_or_assign("prompts", prompts);
+    tokenize_op->initialize(in);
+    auto out = std::get<0>(tokenize_op->step()).val->as<ailoy::map_t>();
+    std::vector<int32_t> tokens = *out->at<ailoy::ndarray_t>("tokens");
+    std::vector<int64_t> offsets = *out->at<ailoy::ndarray_t>("offsets");
+    ASSERT_EQ(offsets.size(), 3);
+    ASSERT_EQ(offsets[0], 0);
+    ASSERT_EQ(offsets[1], 9);
+    ASSERT_EQ(offsets[2], tokens.size());
+    ASSERT_EQ(tokens[0], 0);  // cls token of the first prompt
+    ASSERT_EQ(tokens[9], 0);  // cls token of the second prompt
+    ASSERT_EQ(tokens[8], 2);  // eos token of the first prompt
+  }
+}
+
+TEST(EmbeddingModelTest, TestSplitTextByTokens) {
+  auto create_tvm_embedding_model =
+      ailoy::get_language_module()->factories.at("tvm_embedding_model");
+  auto attrs = ailoy::create<ailoy::map_t>();
+  auto embedding_model = std::get<0>(create_tvm_embedding_model(attrs));
+  auto tokenizer = embedding_model->get_obj<ailoy::tokenizer_t>("tokenizer");
+
+  auto split_text = ailoy::get_language_module()->ops.at("split_text");
+  split_text->set_component_lookup([&](const std::string &name) {
+    return name == "embedding" ? embedding_model : nullptr;
+  });
+  std::string text;
+  for (int i = 0; i < 50; i++)
+    text += "BGE M3 is an embedding model supporting dense retrieval, "
+            "lexical matching and multi-vector interaction.\n\n";
+  auto in = ailoy::create<ailoy::map_t>();
+  in->insert_or_assign("text", ailoy::create<ailoy::string_t>(text));
+  in->insert_or_assign("chunk_size", ailoy::create<ailoy::uint_t>(64));
+  in->insert_or_assign("chunk_overlap", ailoy::create<ailoy::uint_t>(16));
+  in->insert_or_assign("length_function",
+                       ailoy::create<ailoy::string_t>("tokens"));
+  in->insert_or_assign("tokenizer",
+                       ailoy::create<ailoy::string_t>("embedding"));
+  ASSERT_FALSE(split_text->initialize(in).has_value());
+  auto chunks = std::get<0>(split_text->step())
+                    .val->as<ailoy::map_t>()
+                    ->at<ailoy::array_t>("chunks");
+  ASSERT_GT(chunks->size(), 1);
+  for (auto c : *chunks) {
+    auto tokens = tokenizer->encode(*c->as<ailoy::string_t>(), false);
+    ASSERT_LE(tokens.size(), 64);
+    // chunks are filled up to the token window, not to 64 bytes
+    ASSERT_GT(c->as<ailoy::string_t>()->size(), 64);
+  }
+
+  // the tokenizer must be of a component
+  in->insert_or_assign("tokenizer", ailoy::create<ailoy::string_t>("unknown"));
+  split_text->initialize(in);
+  ASSERT_EQ(split_text->step().index(), 1);
 }
 
 TEST(EmbeddingModelTest, TestInfer) {
@@ -0,0 +1,467 @@
+#pragma once
+
+#include <atomic>
+#include <random>
+#include <set>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "language.hpp"
+#include "vector_store.hpp"
+
+/**
+ * Cases shared by every vector store. A test file specializes
+ * `vector_store_test_traits_t` for its store and instantiates the suite with
+ * `INSTANTIATE_TYPED_TEST_SUITE_P`.
+ */
+template <typename T> struct vector_store_test_traits_t;
+
+inline std::shared_ptr<ailoy::ndarray_t>
+get_random_normalized_vector(size_t dim) {
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+  std::vector<float> vec(dim);
+  for (int i = 0; i < dim; i++) {
+    vec[i] = dist(gen);
+  }
+
+  // normalize
+  float magnitude = 0.0f;
+  for (float value : vec) {
+    magnitude += value * value;
+  }
+  magnitude = std::sqrt(magnitude);
+  for (float &value : vec) {
+    value /= magnitude;
+  }
+
+  auto ndarray = ailoy::create<ailoy::ndarray_t>();
+  ndarray->shape.push_back(dim);
+  ndarray->dtype = {
+      .code = kDLFloat,
+      .bits = 32,
+      .lanes = 1,
+  };
+  ndarray->data.resize(sizeof(float) * dim);
+  memcpy(ndarray->data.data(), vec.data(), sizeof(float) * dim);
+
+  return ndarray;
+}
+
+inline std::vector<ailoy::vector_store_add_input_t>
+get_random_inputs(size_t dimension, size_t num_vectors) {
+  std::vector<ailoy::vector_store_add_input_t> add_inputs;
+  for (int i = 0; i < num_vectors; i++) {
+    add_inputs.push_back(ailoy::vector_store_add_input_t{
+        .embedding = get_random_normalized_vector(dimension),
+        .document = "document" + std::to_string(i),
+        .metadata = nlohmann::json{{"value", i},
+                                   {"parity", i % 2 == 0 ? "even" : "odd"}},
+    });
+  }
+  return add_inputs;
+}
+
+template <typename T> class VectorStoreSuite : public ::testing::Test {};
+
+TYPED_TEST_SUITE_P(VectorStoreSuite);
+
+TYPED_TEST_P(VectorStoreSuite, CreateAddRetrieve) {
+  size_t dimension = 10;
+  TypeParam vs(dimension);
+
+  auto add_inputs = get_random_inputs(dimension, 10);
+  auto vec_ids = vs.add_vectors(add_inputs);
+
+  std::string test_id = vec_ids[0];
+
+  // test get_by_id
+  auto item = vs.get_by_id(test_id).value();
+  ASSERT_EQ(item.document, add_inputs[0].document);
+  ASSERT_EQ(item.metadata.value(), add_inputs[0].metadata.value());
+  ASSERT_EQ(item.embedding->data, add_inputs[0].embedding->data);
+
+  // test retrieve
+  auto results = vs.retrieve(add_inputs[0].embedding, 1);
+  ASSERT_EQ(results.size(), 1);
+  auto result = results[0];
+  ASSERT_EQ(result.id, test_id);
+  ASSERT_EQ(result.document, add_inputs[0].document);
+  ASSERT_EQ(result.metadata.value(), add_inputs[0].metadata.value());
+  ASSERT_FLOAT_EQ(result.similarity, 1.0f);
+
+  // results are sorted by similarity
+  results = vs.retrieve(add_inputs[0].embedding, 100);
+  ASSERT_EQ(results.size(), 10);
+  for (size_t i = 1; i < results.size(); i++)
+    ASSERT_GE(results[i - 1].similarity, results[i].similarity);
+}
+
+TYPED_TEST_P(VectorStoreSuite, Filter) {
+  size_t dimension = 16;
+  TypeParam vs(dimension);
+
+  size_t num_vectors = 100;
+  auto add_inputs = get_random_inputs(dimension, num_vectors);
+  auto vec_ids = vs.add_vectors(add_inputs);
+
+  auto retrieve_values = [&](const nlohmann::json &filter) {
+    std::set<int> values;
+    std::vector<ailoy::vector_store_retrieve_result_t> results =
+        vs.retrieve(add_inputs[0].embedding, num_vectors, {.filter = filter});
+    for (const auto &result : results)
+      values.insert(result.metadata.value()["value"].get<int>());
+    return values;
+  };
+
+  ASSERT_EQ(retrieve_values({{"value", 3}}), std::set<int>({3}));
+  ASSERT_EQ(retrieve_values({{"value", {{"$in", {1, 2, 1000}}}}}),
+            std::set<int>({1, 2}));
+  ASSERT_EQ(retrieve_values({{"value", {{"$gte", 10}, {"$lt", 14}}}}),
+            std::set<int>({10, 11, 12, 13}));
+  ASSERT_EQ(retrieve_values({{"parity", "odd"}, {"value", {{"$lte", 5}}}}),
+            std::set<int>({1, 3, 5}));
+  ASSERT_EQ(retrieve_values({{"$or",
+                              {{{"value", 0}}, {{"value", {{"$gt", 97}}}}}}}),
+            std::set<int>({0, 98, 99}));
+  ASSERT_EQ(retrieve_values({{"$and",
+                              {{{"value", {{"$nin", {0, 1}}}}},
+                               {{"value", {{"$lt", 4}}}}}}}),
+            std::set<int>({2, 3}));
+  ASSERT_TRUE(retrieve_values({{"parity", "none"}}).empty());
+
+  // the metadata index follows removals and insertions
+  vs.remove_vector(vec_ids[3]);
+  ASSERT_TRUE(retrieve_values({{"value", 3}}).empty());
+  vs.add_vector(ailoy::vector_store_add_input_t{
+      .embedding = get_random_normalized_vector(dimension),
+      .document = "new document",
+      .metadata = nlohmann::json{{"value", 3}},
+  });
+  ASSERT_EQ(retrieve_values({{"value", 3}}), std::set<int>({3}));
+
+  // top-k is applied after filtering
+  auto results = vs.retrieve(add_inputs[0].embedding, 1,
+                             {.filter = nlohmann::json{{"parity", "even"}}});
+  ASSERT_EQ(results.size(), 1);
+  ASSERT_EQ(results[0].id, vec_ids[0]);
+
+  ASSERT_THROW(ailoy::validate_metadata_filter({{"value", {{"$regex", "."}}}}),
+               ailoy::runtime_error);
+  ASSERT_THROW(ailoy::validate_metadata_filter({{"$and", 1}}),
+               ailoy::runtime_error);
+}
+
+TYPED_TEST_P(VectorStoreSuite, RetrieveMany) {
+  size_t dimension = 16;
+  TypeParam vs(dimension);
+
+  auto add_inputs = get_random_inputs(dimension, 50);
+  auto vec_ids = vs.add_vectors(add_inputs);
+
+  // stack some embeddings into a 2-D array of queries
+  std::vector<size_t> query_indices = {3, 14, 15, 9};
+  auto queries = ailoy::create<ailoy::ndarray_t>();
+  queries->shape = {query_indices.size(), dimension};
+  queries->dtype = {.code = kDLFloat, .bits = 32, .lanes = 1};
+  for (size_t i : query_indices)
+    queries->data.insert(queries->data.end(),
+                         add_inputs[i].embedding->data.begin(),
+                         add_inputs[i].embedding->data.end());
+
+  size_t top_k = 5;
+  auto results = vs.retrieve_many(queries, top_k);
+  ASSERT_EQ(results.size(), query_indices.size());
+  for (size_t q = 0; q < query_indices.size(); q++) {
+    auto expected = vs.retrieve(add_inputs[query_indices[q]].embedding, top_k);
+    ASSERT_EQ(results[q].size(), top_k);
+    ASSERT_EQ(results[q][0].id, vec_ids[query_indices[q]]);
+    for (size_t i = 0; i < top_k; i++) {
+      ASSERT_EQ(results[q][i].id, expected[i].id);
+      ASSERT_FLOAT_EQ(results[q][i].similarity, expected[i].similarity);
+    }
+  }
+
+  // filters apply to every query
+  results = vs.retrieve_many(
+      queries, top_k,
+      {.filter = nlohmann::json{{"value", {{"$in", {3, 9}}}}}});
+  for (const auto &query_results : results) {
+    ASSERT_EQ(query_results.size(), 2);
+  }
+
+  // 1-D query is not allowed
+  ASSERT_THROW(vs.retrieve_many(add_inputs[0].embedding, top_k),
+               ailoy::runtime_error);
+}
+
+TYPED_TEST_P(VectorStoreSuite, Remove) {
+  size_t dimension = 16;
+  TypeParam vs(dimension);
+
+  auto add_inputs = get_random_inputs(dimension, 20);
+  auto vec_ids = vs.add_vectors(add_inputs);
+
+  // the other entries are still found after a removal
+  vs.remove_vector(vec_ids[5]);
+  ASSERT_FALSE(vs.get_by_id(vec_ids[5]).has_value());
+  ASSERT_EQ(vs.get_by_id(vec_ids[19])->document, add_inputs[19].document);
+  auto results = vs.retrieve(add_inputs[19].embedding, 1);
+  ASSERT_EQ(results[0].id, vec_ids[19]);
+  ASSERT_EQ(vs.retrieve(add_inputs[0].embedding, 100).size(), 19);
+
+  vs.clear();
+  ASSERT_TRUE(vs.retrieve(add_inputs[0].embedding, 100).empty());
+}
+
+TYPED_TEST_P(VectorStoreSuite, HybridRetrieve) {
+  size_t dimension = 16;
+  TypeParam vs(dimension);
+
+  auto add_inputs = get_random_inputs(dimension, 100);
+  auto vec_ids = vs.add_vectors(add_inputs);
+
+  // the embedding matches document 7, and the text matches document 42
+  auto query_embedding = add_inputs[7].embedding;
+  auto ids_of = [](const std::vector<ailoy::vector_store_retrieve_result_t>
+                       &results) {
+    std::vector<std::string> ids;
+    for (const auto &result : results)
+      ids.push_back(result.id);
+    return ids;
+  };
+
+  // with a single candidate from each search, both come first in a tie
+  auto results = vs.hybrid_retrieve(query_embedding, "Document42", 2, {},
+                                    {.num_candidates = 1});
+  ASSERT_EQ(ids_of(results), std::vector({vec_ids[7], vec_ids[42]}));
+  ASSERT_EQ(results[1].document, "document42");
+
+  results = vs.hybrid_retrieve(query_embedding, "document42", 1, {},
+                               {.fusion = "weighted", .vector_weight = 0.0f});
+  ASSERT_EQ(results[0].id, vec_ids[42]);
+  results = vs.hybrid_retrieve(query_embedding, "document42", 1, {},
+                               {.fusion = "weighted", .vector_weight = 1.0f});
+  ASSERT_EQ(results[0].id, vec_ids[7]);
+
+  // filters apply to both searches
+  results = vs.hybrid_retrieve(query_embedding, "document42", 100,
+                               {.filter = nlohmann::json{{"parity", "odd"}}});
+  ASSERT_EQ(results.size(), 50);
+  for (const auto &result : results)
+    ASSERT_EQ(result.metadata.value()["parity"], "odd");
+
+  // the BM25 index follows removals and insertions
+  vs.remove_vector(vec_ids[42]);
+  results = vs.hybrid_retrieve(query_embedding, "document42", 100);
+  auto ids = ids_of(results);
+  ASSERT_EQ(std::count(ids.begin(), ids.end(), vec_ids[42]), 0);
+  auto id = vs.add_vector({.embedding = get_random_normalized_vector(dimension),
+                           .document = "another document42"});
+  results = vs.hybrid_retrieve(query_embedding, "document42", 2, {},
+                               {.num_candidates = 1});
+  ASSERT_EQ(ids_of(results), std::vector({vec_ids[7], id}));
+
+  ASSERT_THROW(vs.hybrid_retrieve(query_embedding, "document42", 1, {},
+                                  {.fusion = "unknown"}),
+               ailoy::runtime_error);
+}
+
+TYPED_TEST_P(VectorStoreSuite, ConcurrentRetrieve) {
+  size_t dimension = 16;
+  TypeParam vs(dimension);
+
+  auto make_inputs = [&](size_t n, int value) {
+    std::vector<ailoy::vector_store_add_input_t> inputs;
+    for (size_t i = 0; i < n; i++) {
+      inputs.push_back(ailoy::vector_store_add_input_t{
+          .embedding = get_random_normalized_vector(dimension),
+          .document = "document",
+          .metadata = nlohmann::json{{"value", value}},
+      });
+    }
+    return inputs;
+  };
+  auto initial = make_inputs(100, 0);
+  vs.add_vectors(initial);
+
+  // readers run while a writer keeps inserting and removing
+  std::atomic<bool> failed = false;
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&]() {
+      for (int i = 0; i < 50; i++) {
+        auto query = get_random_normalized_vector(dimension);
+        auto results = vs.retrieve(query, 5);
+        auto filtered = vs.retrieve(
+            query, 5, {.filter = nlohmann::json{{"value", {{"$gte", 1}}}}});
+        if (results.size() != 5 ||
+            std::any_of(filtered.begin(), filtered.end(), [](const auto &r) {
+              return r.metadata.value()["value"] < 1;
+            }))
+          failed = true;
+      }
+    });
+  }
+  for (int i = 1; i <= 20; i++) {
+    auto inputs = make_inputs(10, i);
+    auto ids = vs.add_vectors(inputs);
+    vs.remove_vector(ids[0]);
+  }
+  for (auto &reader : readers)
+    reader.join();
+  ASSERT_FALSE(failed);
+
+  auto results = vs.retrieve(get_random_normalized_vector(dimension), 1000);
+  ASSERT_EQ(results.size(), 100 + 20 * 9);
+}
+
+TYPED_TEST_P(VectorStoreSuite, ComponentOperators) {
+  size_t dimension = 10;
+  std::string component = vector_store_test_traits_t<TypeParam>::component;
+  auto create_vectorstore =
+      ailoy::get_language_module()->factories.at(component);
+  auto attrs = ailoy::create<ailoy::map_t>();
+  attrs->insert_or_assign("dimension", ailoy::create<ailoy::uint_t>(dimension));
+  auto vectorstore_opt = create_vectorstore(attrs);
+  ASSERT_EQ(vectorstore_opt.index(), 0);
+  auto vectorstore = std::get<0>(vectorstore_opt);
+  auto insert_op = vectorstore->get_operator("insert");
+  auto insert_many_op = vectorstore->get_operator("insert_many");
+  auto get_by_id_op = vectorstore->get_operator("get_by_id");
+  auto retrieve_op = vectorstore->get_operator("retrieve");
+  auto retrieve_many_op = vectorstore->get_operator("retrieve_many");
+  auto remove_op = vectorstore->get_operator("remove");
+  auto clear_op = vectorstore->get_operator("clear");
+
+  size_t num_vectors = 10;
+  auto insert_inputs = get_random_inputs(dimension, num_vectors);
+  std::vector<std::string> vec_ids;
+
+  // test insert
+  {
+    auto item0 = insert_inputs[0];
+    auto in1 = ailoy::create<ailoy::map_t>();
+    in1->insert_or_assign("embedding",
+                          ailoy::create<ailoy::ndarray_t>(*item0.embedding));
+    in1->insert_or_assign("document",
+                          ailoy::create<ailoy::string_t>(item0.document));
+    in1->insert_or_assign("metadata",
+                          ailoy::from_nlohmann_json(item0.metadata));
+    insert_op->initialize(in1);
+    auto insert_outputs_opt = insert_op->step();
+    ASSERT_EQ(insert_outputs_opt.index(), 0);
+    auto insert_outputs = std::get<0>(insert_outputs_opt);
+    auto vec_id =
+        insert_outputs.val->as<ailoy::map_t>()->at<ailoy::string_t>("id");
+    vec_ids.push_back(*vec_id);
+  }
+
+  // test insert_many
+  {
+    auto items = ailoy::create<ailoy::array_t>();
+    for (int i = 1; i < num_vectors; i++) {
+      auto in = ailoy::create<ailoy::map_t>();
+      in->insert_or_assign("embedding", ailoy::create<ailoy::ndarray_t>(
+                                            *insert_inputs[i].embedding));
+      in->insert_or_assign("document", ailoy::create<ailoy::string_t>(
+                                           insert_inputs[i].document));
+      in->insert_or_assign(
+          "metadata", ailoy::from_nlohmann_json(insert_inputs[i].metadata));
+      items->push_back(in);
+    }
+
+    insert_many_op->initialize(items);
+    auto insert_many_outputs_opt = insert_many_op->step();
+    ASSERT_EQ(insert_many_outputs_opt.index(), 0);
+    auto insert_many_outputs = std::get<0>(insert_many_outputs_opt);
+    auto ids =
+        insert_many_outputs.val->as<ailoy::map_t>()->at<ailoy::array_t>("ids");
+    for (auto vec_id : *ids) {
+      vec_ids.push_back(*vec_id->as<ailoy::string_t>());
+    }
+  }
+
+  std::string test_id = vec_ids[0];
+
+  // test get_by_id
+  auto in2 = ailoy::create<ailoy::map_t>();
+  in2->insert_or_assign("id", ailoy::create<ailoy::string_t>(test_id));
+  auto init_result = get_by_id_op->initialize(in2);
+  ASSERT_FALSE(init_result.has_value());
+  auto out2_opt = get_by_id_op->step();
+  ASSERT_EQ(out2_opt.index(), 0);
+  auto out2 = std::get<0>(out2_opt).val->as<ailoy::map_t>();
+  ASSERT_EQ(*out2->at<ailoy::string_t>("document"), insert_inputs[0].document);
+  ASSERT_EQ(out2->at<ailoy::value_t>("metadata")->to_nlohmann_json(),
+            insert_inputs[0].metadata.value());
+
+  // test retrieve
+  auto in3 = ailoy::create<ailoy::map_t>();
+  in3->insert_or_assign("query_embedding", ailoy::create<ailoy::ndarray_t>(
+                                               *insert_inputs[0].embedding));
+  in3->insert_or_assign("top_k", ailoy::create<ailoy::uint_t>(1));
+  retrieve_op->initialize(in3);
+  auto out3_opt = retrieve_op->step();
+  ASSERT_EQ(out3_opt.index(), 0);
+  auto out3 = std::get<0>(out3_opt).val->as<ailoy::map_t>()->at<ailoy::array_t>(
+      "results");
+  ASSERT_EQ(out3->size(), 1);
+  auto result = out3->at<ailoy::map_t>(0);
+  ASSERT_EQ(*result->at<ailoy::string_t>("id"), test_id);
+  ASSERT_EQ(*result->at<ailoy::string_t>("document"),
+            insert_inputs[0].document);
+  ASSERT_EQ(result->at<ailoy::value_t>("metadata")->to_nlohmann_json(),
+            insert_inputs[0].metadata.value());
+  ASSERT_FLOAT_EQ(*result->at<ailoy::float_t>("similarity"), 1.0f);
+
+  // test retrieve_many
+  auto queries = ailoy::create<ailoy::ndarray_t>(*insert_inputs[0].embedding);
+  queries->shape = {1, dimension};
+  auto in_many = ailoy::create<ailoy::map_t>();
+  in_many->insert_or_assign("query_embeddings", queries);
+  in_many->insert_or_assign("top_k", ailoy::create<ailoy::uint_t>(1));
+  retrieve_many_op->initialize(in_many);
+  auto out_many_opt = retrieve_many_op->step();
+  ASSERT_EQ(out_many_opt.index(), 0);
+  auto out_many =
+      std::get<0>(out_many_opt).val->as<ailoy::map_t>()->at<ailoy::array_t>(
+          "results");
+  ASSERT_EQ(out_many->size(), 1);
+  ASSERT_EQ(out_many->at<ailoy::array_t>(0)->size(), 1);
+  ASSERT_EQ(*out_many->at<ailoy::array_t>(0)
+                 ->at<ailoy::map_t>(0)
+                 ->at<ailoy::string_t>("id"),
+            test_id);
+
+  // invalid counts are errors, not exceptions thrown by the index
+  for (auto [key, value] : {std::pair{"nprobe", 0}, std::pair{"ef_search", 0},
+                            std::pair{"top_k", 0}, std::pair{"top_k", -1}}) {
+    auto in = ailoy::create<ailoy::map_t>();
+    in->insert_or_assign("query_embedding", ailoy::create<ailoy::ndarray_t>(
+                                                *insert_inputs[0].embedding));
+    in->insert_or_assign("top_k", ailoy::create<ailoy::uint_t>(1));
+    in->insert_or_assign(key, ailoy::create<ailoy::int_t>(value));
+    retrieve_op->initialize(in);
+    ASSERT_EQ(retrieve_op->step().index(), 1) << key << " " << value;
+  }
+
+  // test remove
+  auto in4 = ailoy::create<ailoy::map_t>();
+  in4->insert_or_assign("id", ailoy::create<ailoy::string_t>(vec_ids[0]));
+  remove_op->initialize(in4);
+  auto out4_opt = remove_op->step();
+  ASSERT_EQ(out4_opt.index(), 0);
+
+  // test clear
+  clear_op->initialize();
+  auto out5_opt = clear_op->step();
+  ASSERT_EQ(out5_opt.index(), 0);
+}
+
+REGISTER_TYPED_TEST_SUITE_P(VectorStoreSuite, CreateAddRetrieve, Filter,
+                            RetrieveMany, Remove, HybridRetrieve,
+                            ConcurrentRetrieve, ComponentOperators);